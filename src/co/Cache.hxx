@@ -36,25 +36,84 @@
 #include "util/Cache.hxx"
 #include "util/IntrusiveList.hxx"
 
+#include <chrono>
 #include <memory>
 #include <optional>
 
 namespace Co {
 
+/**
+ * Counters describing the pending requests of a #Co::Cache (in
+ * addition to #CacheStats).
+ */
+struct CacheRequestStats {
+	/**
+	 * The number of factory invocations.
+	 */
+	std::size_t requests = 0;
+
+	/**
+	 * The number of Get() calls which have joined a pending
+	 * request for the same key instead of starting a new one.
+	 */
+	std::size_t coalesced = 0;
+
+	/**
+	 * The number of factory invocations which have failed.
+	 */
+	std::size_t errors = 0;
+
+	/**
+	 * The number of Get() calls which were served with a stale
+	 * item.
+	 */
+	std::size_t stale = 0;
+
+	/**
+	 * The number of background refreshes of stale items.
+	 */
+	std::size_t revalidations = 0;
+
+	/**
+	 * The number of Get() calls which were served with a cached
+	 * error.
+	 */
+	std::size_t negative_hits = 0;
+
+	template<typename V>
+	void Visit(V &&v) const {
+		v("requests", requests);
+		v("coalesced", coalesced);
+		v("errors", errors);
+		v("stale", stale);
+		v("revalidations", revalidations);
+		v("negative_hits", negative_hits);
+	}
+};
+
 /**
  * A cache which handles multiple concurrent requests on the same key
  * and provides a coroutine interface for both the factory and the
  * getter method.
  *
  * @param Factory a factory class whose operator() returns a Coroutine
- * promise; it may optionally have a method `bool IsCacheable(const
- * Data&) const`
+ * promise; it may optionally have the methods `bool IsCacheable(const
+ * Data&) const`, `Expiry GetExpiry(const Data&) const` and
+ * `std::size_t GetWeight(const Data&) const`
+ *
+ * Optionally, expired items may still be served for a while
+ * ("stale-while-revalidate", see SetStaleDuration()) while the
+ * factory refreshes them in the background, and factory errors may
+ * be cached ("negative caching", see SetNegativeDuration()).
+ *
+ * @param Policy the eviction policy of the underlying #::Cache
  */
 template<typename Factory, typename Key, typename Data,
 	 std::size_t max_size,
 	 std::size_t table_size,
 	 typename Hash=std::hash<Key>,
-	 typename Equal=std::equal_to<Key>>
+	 typename Equal=std::equal_to<Key>,
+	 typename Policy=LRUCachePolicy>
 class Cache : Factory {
 	template<typename F, typename=void>
 	struct IsCacheable {
@@ -70,7 +129,78 @@ class Cache : Factory {
 		}
 	};
 
-	using Cache_ = ::Cache<Key, Data, max_size, table_size, Hash, Equal>;
+	template<typename F, typename=void>
+	struct ItemExpiry {
+		constexpr Expiry operator()(const F &, const Data &) noexcept {
+			return Expiry::Never();
+		}
+	};
+
+	template<typename F>
+	struct ItemExpiry<F, std::void_t<decltype(std::declval<F>().GetExpiry(std::declval<Data>()))>> {
+		Expiry operator()(const F &factory, const Data &data) noexcept {
+			return factory.GetExpiry(data);
+		}
+	};
+
+	template<typename F, typename=void>
+	struct ItemWeight {
+		constexpr std::size_t operator()(const F &, const Data &) noexcept {
+			return 1;
+		}
+	};
+
+	template<typename F>
+	struct ItemWeight<F, std::void_t<decltype(std::declval<F>().GetWeight(std::declval<Data>()))>> {
+		std::size_t operator()(const F &factory, const Data &data) noexcept {
+			return factory.GetWeight(data);
+		}
+	};
+
+	/**
+	 * The value type of the underlying #::Cache.
+	 */
+	struct Entry {
+		/**
+		 * The value returned by the factory; std::nullopt if
+		 * this is a negative entry.
+		 */
+		std::optional<Data> data;
+
+		/**
+		 * The error thrown by the factory (only if this is a
+		 * negative entry).
+		 */
+		std::exception_ptr error;
+
+		/**
+		 * After this time, the item is stale: it may still be
+		 * used, but it gets refreshed.  (The underlying
+		 * #::Cache deletes it after the stale duration has
+		 * passed.)
+		 */
+		Expiry fresh_until;
+
+		template<typename U>
+		Entry(U &&_data, Expiry _fresh_until) noexcept
+			:data(std::forward<U>(_data)),
+			 fresh_until(_fresh_until) {}
+
+		Entry(std::exception_ptr _error, Expiry _fresh_until) noexcept
+			:error(std::move(_error)),
+			 fresh_until(_fresh_until) {}
+
+		bool IsStale() const noexcept {
+			/* don't bother to read the clock for items
+			   which never expire */
+			return fresh_until != Expiry::Never() &&
+				fresh_until.IsExpired();
+		}
+	};
+
+	using Duration = std::chrono::steady_clock::duration;
+
+	using Cache_ = ::Cache<Key, Entry, max_size, table_size, Hash, Equal, Policy>;
 	Cache_ cache;
 
 	struct Request;
@@ -196,16 +326,24 @@ class Cache : Factory {
 
 		bool store = true;
 
+		/**
+		 * Is this a background refresh of a stale item?  Such
+		 * a request is owned by the #Cache, not by its
+		 * handlers.
+		 */
+		bool background;
+
 		template<typename K>
-		Request(Cache &_cache, K &&_key) noexcept
-			:cache(_cache), key(std::forward<K>(_key)) {}
+		Request(Cache &_cache, K &&_key, bool _background) noexcept
+			:cache(_cache), key(std::forward<K>(_key)),
+			 background(_background) {}
 
 		bool IsDone() const noexcept {
 			return done;
 		}
 
 		bool IsAbandoned() const noexcept {
-			return handlers.empty();
+			return handlers.empty() && !background;
 		}
 
 		void Resume() noexcept {
@@ -229,14 +367,22 @@ class Cache : Factory {
 			if (store && !IsCacheable<Factory>{}(factory, value))
 				store = false;
 
-			if (store)
-				cache.cache.Put(std::move(key),
-						std::move(value));
+			if (store) {
+				const Expiry expires = ItemExpiry<Factory>{}(factory, value);
+				const std::size_t weight = ItemWeight<Factory>{}(factory, value);
+
+				/* this may replace a stale item */
+				cache.cache.PutOrReplace(std::move(key),
+							 Entry(std::move(value),
+							       expires),
+							 cache.StaleExpiry(expires),
+							 weight);
+			}
 		}
 
 		void Start(Factory &factory) noexcept {
 			assert(!done);
-			assert(!handlers.empty());
+			assert(background || !handlers.empty());
 
 			task = Run(factory);
 			task.Start(BIND_THIS_METHOD(OnCompletion));
@@ -245,10 +391,26 @@ class Cache : Factory {
 		void OnCompletion(std::exception_ptr error) noexcept {
 			assert(!done);
 
-			if (error)
+			if (error) {
+				++cache.request_stats.errors;
+
 				for (auto &i : handlers)
 					i.error = error;
 
+				/* a failed revalidation keeps the stale
+				   item ("stale-if-error"); only misses
+				   (i.e. somebody is waiting for this
+				   request) are cached as negative
+				   entries */
+				if (store && (!background || !handlers.empty()) &&
+				    cache.negative_duration > Duration::zero()) {
+					const auto expires = Expiry::Touched(cache.negative_duration);
+					cache.cache.PutOrReplace(std::move(key),
+								 Entry(error, expires),
+								 expires);
+				}
+			}
+
 			done = true;
 
 			Resume();
@@ -258,6 +420,42 @@ class Cache : Factory {
 
 	IntrusiveList<Request> requests;
 
+	CacheRequestStats request_stats;
+
+	/**
+	 * How long may an expired item be served while it is being
+	 * refreshed?
+	 */
+	Duration stale_duration = Duration::zero();
+
+	/**
+	 * How long are factory errors cached?
+	 */
+	Duration negative_duration = Duration::zero();
+
+	Expiry StaleExpiry(Expiry fresh_until) const noexcept {
+		return fresh_until == Expiry::Never()
+			? fresh_until
+			: Expiry::Touched(fresh_until, stale_duration);
+	}
+
+	/**
+	 * Start refreshing a stale item in the background, unless
+	 * there is already a pending request for it.
+	 */
+	template<typename K>
+	void Revalidate(K &&key) noexcept {
+		for (auto &i : requests)
+			if (i.store && !i.IsDone() && key_eq()(i.key, key))
+				return;
+
+		++request_stats.requests;
+		++request_stats.revalidations;
+		auto *request = new Request(*this, std::forward<K>(key), true);
+		requests.push_back(*request);
+		request->Start(*this);
+	}
+
 public:
 	using hasher = typename Cache_::hasher;
 	using key_equal = typename Cache_::key_equal;
@@ -266,6 +464,41 @@ public:
 	explicit Cache(P&&... _params) noexcept
 		:Factory(std::forward<P>(_params)...) {}
 
+	~Cache() noexcept {
+		/* cancel all background refreshes; those which
+		   somebody is waiting for will be deleted by the
+		   last handler */
+		requests.remove_and_dispose_if([](Request &request){
+			request.background = false;
+			return request.handlers.empty();
+		}, [](Request *request){
+			delete request;
+		});
+	}
+
+	Cache(const Cache &) = delete;
+	Cache &operator=(const Cache &) = delete;
+
+	/**
+	 * Enable "stale-while-revalidate": after an item has
+	 * expired, it is still served for the given duration, while
+	 * it gets refreshed in the background.
+	 */
+	void SetStaleDuration(Duration duration) noexcept {
+		stale_duration = duration;
+	}
+
+	/**
+	 * Enable "negative caching": if the factory throws, the error
+	 * is cached for the given duration and is rethrown to
+	 * subsequent callers without invoking the factory again.
+	 * This applies only to misses; if the background refresh of
+	 * a stale item fails, the stale item is kept.
+	 */
+	void SetNegativeDuration(Duration duration) noexcept {
+		negative_duration = duration;
+	}
+
 	decltype(auto) hash_function() const noexcept {
 		return cache.hash_function();
 	}
@@ -274,23 +507,87 @@ public:
 		return cache.key_eq();
 	}
 
+	/**
+	 * Look up an item without invoking the factory.  This
+	 * returns stale items, but not cached errors.
+	 */
 	template<typename K>
-	[[gnu::pure]]
-	decltype(auto) GetIfCached(K &&key) noexcept {
-		return cache.Get(std::forward<K>(key));
+	Data *GetIfCached(K &&key) noexcept {
+		Entry *entry = cache.Get(std::forward<K>(key));
+		return entry != nullptr && entry->data
+			? &*entry->data
+			: nullptr;
+	}
+
+	std::size_t GetWeight() const noexcept {
+		return cache.GetWeight();
+	}
+
+	/**
+	 * Limit the sum of the weights (as returned by the factory's
+	 * GetWeight() method) of all cached items.
+	 */
+	void SetMaxWeight(std::size_t max_weight) noexcept {
+		cache.SetMaxWeight(max_weight);
+	}
+
+	/**
+	 * Delete all items which have expired (according to the
+	 * factory's GetExpiry() method).  This may be called
+	 * periodically, e.g. by a #CoarseTimerEvent.
+	 *
+	 * @return the number of items which were deleted
+	 */
+	std::size_t PurgeExpired(Expiry now=Expiry::Now()) noexcept {
+		return cache.PurgeExpired(now);
+	}
+
+	const CacheStats &GetStats() const noexcept {
+		return cache.GetStats();
+	}
+
+	const CacheRequestStats &GetRequestStats() const noexcept {
+		return request_stats;
+	}
+
+	/**
+	 * @see ::Cache::VisitStats()
+	 */
+	template<typename V>
+	void VisitStats(V &&v) const {
+		cache.VisitStats(v);
+		request_stats.Visit(v);
 	}
 
 	template<typename K>
 	Task Get(K &&key) {
-		auto *cached = GetIfCached(key);
-		if (cached != nullptr)
-			return Task(*cached);
+		if (Entry *entry = cache.Get(key)) {
+			if (!entry->data) {
+				++request_stats.negative_hits;
+				return Task(entry->error);
+			}
 
-		for (auto &i : requests)
-			if (i.store && !i.IsDone() && key_eq()(i.key, key))
+			Task task(*entry->data);
+
+			if (entry->IsStale()) {
+				/* serve the stale item now and refresh
+				   it in the background */
+				++request_stats.stale;
+				Revalidate(std::forward<K>(key));
+			}
+
+			return task;
+		}
+
+		for (auto &i : requests) {
+			if (i.store && !i.IsDone() && key_eq()(i.key, key)) {
+				++request_stats.coalesced;
 				return Task(i);
+			}
+		}
 
-		auto *request = new Request(*this, std::forward<K>(key));
+		++request_stats.requests;
+		auto *request = new Request(*this, std::forward<K>(key), false);
 		requests.push_back(*request);
 		Task task(*request);
 		request->Start(*this);
@@ -323,7 +620,9 @@ public:
 		   requests, so unfortunately, pending requests may
 		   result in stale cache items */
 
-		cache.RemoveIf(std::forward<P>(p));
+		cache.RemoveIf([&p](const Key &key, const Entry &entry){
+			return entry.data && p(key, *entry.data);
+		});
 	}
 };
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Call.hxx"
+#include "Loop.hxx"
+#include "InjectEvent.hxx"
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+class BlockingCallMonitor final
+{
+	InjectEvent event;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	bool done = false;
+
+	std::exception_ptr exception;
+
+	const std::function<void()> f;
+
+public:
+	BlockingCallMonitor(EventLoop &_loop,
+			    std::function<void()> &&_f) noexcept
+		:event(_loop, BIND_THIS_METHOD(RunDeferred)),
+		 f(std::move(_f)) {}
+
+	void Run() {
+		event.Schedule();
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this]{ return done; });
+		}
+
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+
+private:
+	void RunDeferred() noexcept {
+		try {
+			f();
+		} catch (...) {
+			exception = std::current_exception();
+		}
+
+		const std::lock_guard<std::mutex> lock(mutex);
+		done = true;
+		cond.notify_one();
+	}
+};
+
+void
+BlockingCall(EventLoop &loop, std::function<void()> &&f)
+{
+	if (loop.IsInside()) {
+		/* we're already inside the loop - we can simply call
+		   the function */
+		f();
+	} else {
+		/* delegate the call to the EventLoop thread */
+		BlockingCallMonitor m(loop, std::move(f));
+		m.Run();
+	}
+}
@@ -33,14 +33,8 @@
 #pragma once
 
 #include "Chrono.hxx"
-#include "event/Features.h"
 #include "util/BindMethod.hxx"
-
-#ifdef NO_BOOST
 #include "util/IntrusiveList.hxx"
-#else
-#include <boost/intrusive/set_hook.hpp>
-#endif
 
 class EventLoop;
 
@@ -48,24 +42,17 @@ class EventLoop;
  * This class invokes a callback function after a certain amount of
  * time.  Use Schedule() to start the timer or Cancel() to cancel it.
  *
- * Unlike #CoarseTimerEvent, this class uses a high-resolution timer,
- * but at the cost of more expensive insertion and deletion.
+ * Unlike #CoarseTimerEvent, this class uses a high-resolution timer
+ * with a granularity of 1 millisecond.
  *
  * This class is not thread-safe, all methods must be called from the
  * thread that runs the #EventLoop, except where explicitly documented
  * as thread-safe.
  */
-class FineTimerEvent final :
-#ifdef NO_BOOST
-	AutoUnlinkIntrusiveListHook
-#else
-	public boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>
-#endif
+class FineTimerEvent final : AutoUnlinkIntrusiveListHook
 {
-	friend class TimerList;
-#ifdef NO_BOOST
+	friend class FineTimerWheel;
 	friend class IntrusiveList<FineTimerEvent>;
-#endif
 
 	EventLoop &loop;
 
@@ -103,9 +90,7 @@ public:
 	void ScheduleEarlier(Event::Duration d) noexcept;
 
 	void Cancel() noexcept {
-#ifdef NO_BOOST
 		if (IsPending())
-#endif
 			unlink();
 	}
 
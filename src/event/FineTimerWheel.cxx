@@ -0,0 +1,216 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FineTimerWheel.hxx"
+#include "FineTimerEvent.hxx"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <limits>
+
+void
+FineTimerWheel::Level::Purge() const noexcept
+{
+	for (auto m = mask; m != 0; m &= m - 1) {
+		const unsigned i = std::countr_zero(m);
+		if (buckets[i].empty())
+			mask &= ~(uint_least64_t(1) << i);
+	}
+}
+
+FineTimerWheel::FineTimerWheel() noexcept
+	:current(ToTick(Event::Clock::now()))
+{
+}
+
+FineTimerWheel::~FineTimerWheel() noexcept
+{
+	assert(IsEmpty());
+}
+
+bool
+FineTimerWheel::IsEmpty() const noexcept
+{
+	return ready.empty() &&
+		std::all_of(levels.begin(), levels.end(), [](const auto &level){
+			level.Purge();
+			return level.mask == 0;
+		});
+}
+
+inline FineTimerWheel::Tick
+FineTimerWheel::GetExpiryTick(const FineTimerEvent &t) noexcept
+{
+	return Tick((t.GetDue().time_since_epoch() + RESOLUTION - Event::Duration(1))
+		    / RESOLUTION);
+}
+
+void
+FineTimerWheel::Insert(FineTimerEvent &t, Tick expires) noexcept
+{
+	if (expires < current) {
+		/* this timer is already due: insert it into the
+		   "ready" list to be invoked without delay */
+		ready.push_back(t);
+		return;
+	}
+
+	const Tick delta = expires - current;
+	unsigned level = (std::bit_width(delta | 1) - 1) / BITS_PER_LEVEL;
+	if (level >= N_LEVELS) {
+		/* too far in the future: park it in the last bucket
+		   of the last level; it will be re-inserted when
+		   that bucket gets cascaded */
+		level = N_LEVELS - 1;
+		expires = current + (Tick(1) << LevelShift(N_LEVELS)) - 1;
+	}
+
+	auto &l = levels[level];
+	const std::size_t i = (expires >> LevelShift(level)) & BUCKET_MASK;
+	l.buckets[i].push_back(t);
+	l.mask |= uint_least64_t(1) << i;
+}
+
+void
+FineTimerWheel::Insert(FineTimerEvent &t) noexcept
+{
+	Insert(t, GetExpiryTick(t));
+}
+
+void
+FineTimerWheel::Cascade(unsigned level) noexcept
+{
+	assert(level > 0);
+	assert(level < N_LEVELS);
+	assert(current % (Tick(1) << LevelShift(level)) == 0);
+
+	auto &l = levels[level];
+	const std::size_t i = (current >> LevelShift(level)) & BUCKET_MASK;
+	if (l.buckets[i].empty())
+		return;
+
+	auto tmp = std::move(l.buckets[i]);
+	l.mask &= ~(uint_least64_t(1) << i);
+
+	tmp.clear_and_dispose([this](auto *t){
+		Insert(*t);
+	});
+}
+
+FineTimerWheel::Tick
+FineTimerWheel::GetNextTick() const noexcept
+{
+	Tick result = std::numeric_limits<Tick>::max();
+
+	for (unsigned level = 0; level < N_LEVELS; ++level) {
+		const auto &l = levels[level];
+		const unsigned shift = LevelShift(level);
+
+		/* the first bucket which has not yet been cascaded
+		   (or, in level 0, which has not yet been run); if
+		   #current is aligned to this level, then its bucket
+		   will be cascaded when #current gets processed */
+		const Tick first = (current + (Tick(1) << shift) - 1) >> shift;
+		const unsigned rotate = first & BUCKET_MASK;
+
+		while (l.mask != 0) {
+			const unsigned distance =
+				std::countr_zero(std::rotr(l.mask, rotate));
+			const std::size_t i = (first + distance) & BUCKET_MASK;
+			if (l.buckets[i].empty()) {
+				/* all timers in this bucket have been
+				   canceled */
+				l.mask &= ~(uint_least64_t(1) << i);
+				continue;
+			}
+
+			result = std::min(result, (first + distance) << shift);
+			break;
+		}
+	}
+
+	return result;
+}
+
+Event::Duration
+FineTimerWheel::Run(const Event::TimePoint now, bool &invoked) noexcept
+{
+	/* invoke the "ready" list; timers added to it by these
+	   callbacks will be invoked by the next call */
+	auto tmp = std::move(ready);
+	tmp.clear_and_dispose([&](auto *t){
+		invoked = true;
+		t->Run();
+	});
+
+	const Tick target = ToTick(now);
+
+	while (current <= target) {
+		for (unsigned level = 1; level < N_LEVELS &&
+			     current % (Tick(1) << LevelShift(level)) == 0;
+		     ++level)
+			Cascade(level);
+
+		auto &l = levels[0];
+		const std::size_t i = current & BUCKET_MASK;
+
+		/* advance before invoking the timers, so timers
+		   scheduled by these callbacks will not be inserted
+		   into this bucket */
+		++current;
+
+		if (!l.buckets[i].empty()) {
+			swap(tmp, l.buckets[i]);
+			l.mask &= ~(uint_least64_t(1) << i);
+
+			tmp.clear_and_dispose([&](auto *t){
+				assert(t->GetDue() <= now);
+
+				invoked = true;
+				t->Run();
+			});
+		}
+
+		/* skip all empty buckets */
+		current = std::min(GetNextTick(), target + 1);
+	}
+
+	if (!ready.empty())
+		return Event::Duration::zero();
+
+	const Tick next = GetNextTick();
+	if (next == std::numeric_limits<Tick>::max())
+		return Event::Duration(-1);
+
+	return FromTick(next) - now;
+}
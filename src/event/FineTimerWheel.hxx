@@ -0,0 +1,170 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Chrono.hxx"
+#include "util/IntrusiveList.hxx"
+
+#include <array>
+#include <cstdint>
+
+class FineTimerEvent;
+
+/**
+ * A hierarchical timer wheel for #FineTimerEvent instances with
+ * millisecond resolution.  Insertion and cancellation are O(1);
+ * timers far in the future are kept in coarser levels and get
+ * "cascaded" into finer levels only when their time approaches.
+ *
+ * Each level has 64 buckets, and a bit mask of buckets which may be
+ * non-empty, which allows skipping large ranges of empty buckets
+ * quickly.  Since canceled timers unlink themselves, the bit masks
+ * may contain stale bits which get cleared lazily.
+ */
+class FineTimerWheel final {
+	using Tick = uint_least64_t;
+
+	static constexpr Event::Duration RESOLUTION = std::chrono::milliseconds(1);
+
+	static constexpr unsigned BITS_PER_LEVEL = 6;
+	static constexpr std::size_t N_BUCKETS = 1 << BITS_PER_LEVEL;
+	static constexpr Tick BUCKET_MASK = N_BUCKETS - 1;
+
+	/**
+	 * The number of levels; the last level covers 2^36
+	 * milliseconds (about 795 days).  Timers beyond that are
+	 * stored in the last bucket and get re-inserted when it gets
+	 * cascaded.
+	 */
+	static constexpr unsigned N_LEVELS = 6;
+
+	using List = IntrusiveList<FineTimerEvent>;
+
+	struct Level {
+		std::array<List, N_BUCKETS> buckets;
+
+		/**
+		 * A bit mask of buckets which may be non-empty.  A
+		 * set bit for an empty bucket is possible if the
+		 * timers have been canceled.
+		 */
+		mutable uint_least64_t mask = 0;
+
+		/**
+		 * Clear bits for empty buckets.
+		 */
+		void Purge() const noexcept;
+	};
+
+	/**
+	 * Level 0 contains one bucket per tick, level 1 one bucket
+	 * per 64 ticks and so on.
+	 */
+	std::array<Level, N_LEVELS> levels;
+
+	/**
+	 * A list of timers which are already due.  This can happen
+	 * if they are scheduled with a zero duration or scheduled in
+	 * the past.
+	 */
+	List ready;
+
+	/**
+	 * The next tick which has not yet been processed by Run().
+	 * Timer positions are relative to this value.
+	 */
+	Tick current;
+
+public:
+	FineTimerWheel() noexcept;
+	~FineTimerWheel() noexcept;
+
+	FineTimerWheel(const FineTimerWheel &other) = delete;
+	FineTimerWheel &operator=(const FineTimerWheel &other) = delete;
+
+	/**
+	 * Are there no pending timers?  This is not "pure" because
+	 * it clears stale bucket mask bits.
+	 */
+	bool IsEmpty() const noexcept;
+
+	void Insert(FineTimerEvent &t) noexcept;
+
+	/**
+	 * Invoke all expired #FineTimerEvent instances and return the
+	 * duration until the next timer expires.  Returns a negative
+	 * duration if there is no timeout.
+	 */
+	Event::Duration Run(Event::TimePoint now,
+			    bool &invoked) noexcept;
+
+private:
+	/**
+	 * Convert a time point to a tick, rounding down.
+	 */
+	static constexpr Tick ToTick(Event::TimePoint t) noexcept {
+		return Tick(t.time_since_epoch() / RESOLUTION);
+	}
+
+	static constexpr Event::TimePoint FromTick(Tick tick) noexcept {
+		return Event::TimePoint(tick * RESOLUTION);
+	}
+
+	/**
+	 * Determine the tick in which the given timer expires,
+	 * rounding up.
+	 */
+	[[gnu::pure]]
+	static Tick GetExpiryTick(const FineTimerEvent &t) noexcept;
+
+	static constexpr unsigned LevelShift(unsigned level) noexcept {
+		return level * BITS_PER_LEVEL;
+	}
+
+	void Insert(FineTimerEvent &t, Tick expires) noexcept;
+
+	/**
+	 * Move all timers of the bucket of the given level which is
+	 * due at #current to finer levels.
+	 */
+	void Cascade(unsigned level) noexcept;
+
+	/**
+	 * Determine the next tick at which something needs to be
+	 * done: either a level 0 bucket expires or a bucket of a
+	 * higher level needs to be cascaded.
+	 *
+	 * @return the tick or max() if the wheel is empty
+	 */
+	Tick GetNextTick() const noexcept;
+};
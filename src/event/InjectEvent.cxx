@@ -0,0 +1,91 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "InjectEvent.hxx"
+#include "Loop.hxx"
+
+InjectEvent::InjectEvent(EventLoop &_loop, Callback _callback) noexcept
+	:loop(_loop), callback(_callback)
+{
+	loop.inject_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+InjectEvent::~InjectEvent() noexcept
+{
+	if (state.load(std::memory_order_acquire) != State::IDLE)
+		/* still linked in the inject queue (maybe canceled,
+		   but not yet skipped by the EventLoop) - remove it
+		   now */
+		loop.RemoveInject(*this);
+
+	loop.inject_count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void
+InjectEvent::Schedule() noexcept
+{
+	auto s = state.load(std::memory_order_relaxed);
+
+	while (true) {
+		switch (s) {
+		case State::QUEUED:
+			/* already scheduled */
+			return;
+
+		case State::CANCELED:
+			/* still in the queue; just revive it */
+			if (state.compare_exchange_weak(s, State::QUEUED,
+							std::memory_order_release,
+							std::memory_order_relaxed))
+				return;
+			break;
+
+		case State::IDLE:
+			if (state.compare_exchange_weak(s, State::QUEUED,
+							std::memory_order_release,
+							std::memory_order_relaxed)) {
+				loop.AddInject(*this);
+				return;
+			}
+			break;
+		}
+	}
+}
+
+void
+InjectEvent::Cancel() noexcept
+{
+	auto s = State::QUEUED;
+	state.compare_exchange_strong(s, State::CANCELED,
+				      std::memory_order_relaxed);
+}
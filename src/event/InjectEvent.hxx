@@ -0,0 +1,131 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "util/BindMethod.hxx"
+
+#include <atomic>
+#include <cstdint>
+
+class EventLoop;
+
+/**
+ * Invoke a method call in the #EventLoop, triggered by another
+ * thread.  This is the only event class which may be scheduled from
+ * any thread; the callback will be invoked in the thread which runs
+ * the #EventLoop.
+ *
+ * Scheduling does not need a lock: the event is pushed onto a
+ * lock-free (multi-producer, single-consumer) stack owned by the
+ * #EventLoop, and the #EventLoop gets woken up (via eventfd) only if
+ * the stack was empty.  All events which have been scheduled until
+ * the #EventLoop wakes up are then invoked in one batch.
+ *
+ * The constructor may be called from any thread.  All other methods
+ * (including the destructor) must be called from the thread that
+ * runs the #EventLoop, except where explicitly documented as
+ * thread-safe.  The destructor may be called from another thread
+ * only if this event is not pending.
+ */
+class InjectEvent final
+{
+	friend class EventLoop;
+
+	EventLoop &loop;
+
+	using Callback = BoundMethod<void() noexcept>;
+	const Callback callback;
+
+	enum class State : uint_least8_t {
+		/**
+		 * Not scheduled.
+		 */
+		IDLE,
+
+		/**
+		 * Scheduled; this object is linked in the
+		 * #EventLoop's inject queue.
+		 */
+		QUEUED,
+
+		/**
+		 * Canceled, but this object is still linked in the
+		 * #EventLoop's inject queue; it will be skipped
+		 * (unless it gets scheduled again meanwhile).
+		 */
+		CANCELED,
+	};
+
+	std::atomic<State> state{State::IDLE};
+
+	/**
+	 * The next item in the #EventLoop's inject queue.  Only valid
+	 * while #state is not #State::IDLE.
+	 */
+	InjectEvent *next_injected;
+
+public:
+	InjectEvent(EventLoop &_loop, Callback _callback) noexcept;
+	~InjectEvent() noexcept;
+
+	InjectEvent(const InjectEvent &) = delete;
+	InjectEvent &operator=(const InjectEvent &) = delete;
+
+	auto &GetEventLoop() const noexcept {
+		return loop;
+	}
+
+	bool IsPending() const noexcept {
+		return state.load(std::memory_order_relaxed) == State::QUEUED;
+	}
+
+	/**
+	 * Schedule the callback to be invoked in the #EventLoop's
+	 * thread.  This method is thread-safe and lock-free.  If the
+	 * event is already pending, this is a no-op.
+	 */
+	void Schedule() noexcept;
+
+	/**
+	 * Cancel a pending event.  Note that this is racy if another
+	 * thread calls Schedule() at the same time; the caller is
+	 * responsible for synchronizing this.
+	 */
+	void Cancel() noexcept;
+
+private:
+	void Run() noexcept {
+		callback();
+	}
+};
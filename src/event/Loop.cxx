@@ -32,11 +32,23 @@
 
 #include "Loop.hxx"
 #include "DeferEvent.hxx"
+#include "InjectEvent.hxx"
 #include "SocketEvent.hxx"
+#include "system/LinuxFD.hxx"
+
+#ifdef HAVE_URING
+#include "UringBackend.hxx"
+#endif
 
 #include <array>
 
-EventLoop::EventLoop() = default;
+#include <stdint.h>
+
+EventLoop::EventLoop()
+	:wake_fd(CreateEventFD())
+{
+	epoll.Add(wake_fd.Get(), EPOLLIN, &wake_fd);
+}
 
 EventLoop::~EventLoop() noexcept
 {
@@ -44,6 +56,11 @@ EventLoop::~EventLoop() noexcept
 	assert(idle.empty());
 	assert(sockets.empty());
 	assert(ready_sockets.empty());
+#ifdef HAVE_URING
+	assert(unarmed_sockets.empty());
+#endif
+	assert(inject_head.load() == nullptr);
+	assert(inject_count.load() == 0);
 }
 
 void
@@ -54,6 +71,45 @@ EventLoop::Reinit() noexcept
 
 	epoll = {};
 
+	/* the old eventfd is shared with the parent process */
+	wake_fd = CreateEventFD();
+	epoll.Add(wake_fd.Get(), EPOLLIN, &wake_fd);
+
+#ifdef HAVE_URING
+	if (uring) {
+		/* the old io_uring is shared with the parent process;
+		   forget all pending poll operations (without
+		   canceling them, because that would affect the
+		   parent) and replace the ring with a new one;
+		   destroying the old UringBackend unmaps the old ring
+		   and closes its file descriptor in this process
+		   only; other pending io_uring operations are not
+		   allowed here */
+		while (!sockets.empty()) {
+			auto &i = sockets.front();
+			i.CancelUring();
+			i.unlink();
+			unarmed_sockets.push_back(i);
+		}
+
+		try {
+			uring = std::make_unique<UringBackend>(uring_entries,
+							       uring_flags,
+							       wake_fd);
+			return;
+		} catch (...) {
+			/* fall back to epoll */
+			uring.reset();
+
+			while (!unarmed_sockets.empty()) {
+				auto &i = unarmed_sockets.front();
+				i.unlink();
+				sockets.push_back(i);
+			}
+		}
+	}
+#endif
+
 	for (auto &i : sockets) {
 		assert(i.GetScheduledFlags() != 0);
 
@@ -61,11 +117,79 @@ EventLoop::Reinit() noexcept
 	}
 }
 
+#ifdef HAVE_URING
+
+void
+EventLoop::EnableUring(unsigned entries, unsigned flags)
+{
+	assert(!uring);
+	assert(sockets.empty());
+	assert(ready_sockets.empty());
+
+	uring = std::make_unique<UringBackend>(entries, flags, wake_fd);
+	uring_entries = entries;
+	uring_flags = flags;
+
+	/* the eventfd is now polled by the UringBackend */
+	epoll.Remove(wake_fd.Get());
+}
+
+Uring::Queue *
+EventLoop::GetUring() noexcept
+{
+	return uring.get();
+}
+
+bool
+EventLoop::IsUringIdle() const noexcept
+{
+	return !uring || uring->IsIdle();
+}
+
+void
+EventLoop::ArmSockets() noexcept
+{
+	while (!unarmed_sockets.empty()) {
+		auto &event = unarmed_sockets.front();
+		assert(event.GetScheduledFlags() != 0);
+		assert(!event.IsUringPending());
+
+		if (!uring->AddPoll(event, event.GetSocket().ToFileDescriptor(),
+				    event.GetScheduledFlags()))
+			/* the submit queue is full and cannot be
+			   flushed; try again in the next iteration */
+			break;
+
+		event.unlink();
+		sockets.push_back(event);
+	}
+}
+
+void
+EventLoop::OnUringPoll(SocketEvent &event, int res) noexcept
+{
+	/* a negative value is an error code, e.g. -EBADF if the
+	   socket was closed without cancelling the SocketEvent */
+	SetSocketReady(event, res >= 0 ? unsigned(res) : SocketEvent::ERROR);
+}
+
+#endif
+
 bool
 EventLoop::AddFD(int fd, unsigned events, SocketEvent &event) noexcept
 {
 	assert(events != 0);
 
+#ifdef HAVE_URING
+	if (uring) {
+		/* the IORING_OP_POLL_ADD will be submitted by
+		   ArmSockets() right before the next
+		   io_uring_enter() call */
+		unarmed_sockets.push_back(event);
+		return true;
+	}
+#endif
+
 	if (!epoll.Add(fd, events, &event))
 		return false;
 
@@ -78,6 +202,23 @@ EventLoop::ModifyFD(int fd, unsigned events, SocketEvent &event) noexcept
 {
 	assert(events != 0);
 
+#ifdef HAVE_URING
+	if (uring) {
+		if (event.IsUringPending()) {
+			/* replace the pending poll with a new one
+			   with the new event mask */
+			uring->CancelOperation(event);
+			event.unlink();
+			unarmed_sockets.push_back(event);
+		}
+
+		/* else: the event is either "ready" or "unarmed"
+		   already, and the new mask will be applied by
+		   ArmSockets() */
+		return true;
+	}
+#endif
+
 	return epoll.Modify(fd, events, &event);
 }
 
@@ -85,6 +226,14 @@ bool
 EventLoop::RemoveFD(int fd, SocketEvent &event) noexcept
 {
 	event.unlink();
+
+#ifdef HAVE_URING
+	if (uring) {
+		uring->CancelOperation(event);
+		return true;
+	}
+#endif
+
 	return epoll.Remove(fd);
 }
 
@@ -92,6 +241,42 @@ void
 EventLoop::AbandonFD(SocketEvent &event) noexcept
 {
 	event.unlink();
+
+#ifdef HAVE_URING
+	if (uring)
+		/* unlike epoll, io_uring holds a reference to the
+		   file, so we need to cancel the poll even though
+		   the file descriptor has been closed already */
+		uring->CancelOperation(event);
+#endif
+}
+
+inline void
+EventLoop::SetSocketReady(SocketEvent &event, unsigned flags) noexcept
+{
+	event.SetReadyFlags(flags);
+
+	/* move from "sockets" to "ready_sockets" */
+	event.unlink();
+	ready_sockets.push_back(event);
+}
+
+inline void
+EventLoop::UnreadySocket(SocketEvent &event) noexcept
+{
+	event.unlink();
+
+#ifdef HAVE_URING
+	if (uring) {
+		/* the one-shot poll has completed; a new one will be
+		   submitted by ArmSockets() after the callback
+		   returns (unless it gets canceled) */
+		unarmed_sockets.push_back(event);
+		return;
+	}
+#endif
+
+	sockets.push_back(event);
 }
 
 void
@@ -147,6 +332,123 @@ EventLoop::RunDeferred() noexcept
 	return true;
 }
 
+void
+EventLoop::AddInject(InjectEvent &e) noexcept
+{
+	e.next_injected = nullptr;
+	PushInject(e, e);
+}
+
+void
+EventLoop::PushInject(InjectEvent &first, InjectEvent &last) noexcept
+{
+	auto *head = inject_head.load(std::memory_order_relaxed);
+	do {
+		last.next_injected = head;
+	} while (!inject_head.compare_exchange_weak(head, &first,
+						    std::memory_order_release,
+						    std::memory_order_relaxed));
+
+	if (head == nullptr)
+		/* the stack was empty; if it was not, then somebody
+		   else has already woken up the EventLoop, and it
+		   will pick up this event in the same batch */
+		Wake();
+}
+
+/**
+ * Remove an item from a singly linked #InjectEvent chain.
+ *
+ * @return true if the item was found
+ */
+static bool
+UnlinkInject(InjectEvent *&head, InjectEvent &e,
+	     InjectEvent *InjectEvent::*next) noexcept
+{
+	for (auto **p = &head; *p != nullptr; p = &((*p)->*next)) {
+		if (*p == &e) {
+			*p = e.*next;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void
+EventLoop::RemoveInject(InjectEvent &e) noexcept
+{
+	assert(IsInside() || thread.load() == std::thread::id{});
+
+	if (UnlinkInject(inject_running, e, &InjectEvent::next_injected))
+		return;
+
+	/* take the whole stack, remove the item and push the rest
+	   back; this is expensive, but it happens only if a pending
+	   InjectEvent gets destroyed, which is rare */
+
+	auto *head = inject_head.exchange(nullptr, std::memory_order_acquire);
+	[[maybe_unused]] const bool found =
+		UnlinkInject(head, e, &InjectEvent::next_injected);
+	assert(found);
+
+	if (head != nullptr) {
+		auto *last = head;
+		while (last->next_injected != nullptr)
+			last = last->next_injected;
+
+		PushInject(*head, *last);
+	}
+}
+
+void
+EventLoop::Wake() noexcept
+{
+	static constexpr uint64_t value = 1;
+	[[maybe_unused]] ssize_t nbytes =
+		wake_fd.Write(&value, sizeof(value));
+}
+
+bool
+EventLoop::RunInject() noexcept
+{
+	if (inject_head.load(std::memory_order_relaxed) == nullptr)
+		/* fast path without an atomic read-modify-write */
+		return false;
+
+	auto *head = inject_head.exchange(nullptr, std::memory_order_acquire);
+	if (head == nullptr)
+		return false;
+
+	/* the stack is in reverse order; reverse it to invoke the
+	   events in FIFO order */
+	assert(inject_running == nullptr);
+	do {
+		auto *next = head->next_injected;
+		head->next_injected = inject_running;
+		inject_running = head;
+		head = next;
+	} while (head != nullptr);
+
+	while (inject_running != nullptr) {
+		auto &e = *inject_running;
+
+		/* read the "next" pointer before resetting the
+		   state, because after that, another thread may
+		   schedule it again */
+		inject_running = e.next_injected;
+
+		if (e.state.exchange(InjectEvent::State::IDLE,
+				     std::memory_order_acquire) == InjectEvent::State::QUEUED) {
+			invoked = true;
+			++stats.inject_count;
+			e.Run();
+		}
+	}
+
+	return true;
+}
+
 bool
 EventLoop::RunOneIdle() noexcept
 {
@@ -189,18 +491,36 @@ ExportTimeoutMS(Event::Duration timeout) noexcept
 inline bool
 EventLoop::Wait(Event::Duration timeout) noexcept
 {
+#ifdef HAVE_URING
+	if (uring) {
+		ArmSockets();
+
+		++stats.wait_count;
+		uring->Wait(timeout);
+		return !ready_sockets.empty();
+	}
+#endif
+
 	std::array<struct epoll_event, 256> received_events;
+	++stats.wait_count;
 	int ret = epoll.Wait(received_events.data(),
 			     received_events.size(),
 			     ExportTimeoutMS(timeout));
 	for (int i = 0; i < ret; ++i) {
 		const auto &e = received_events[i];
-		auto &socket_event = *(SocketEvent *)e.data.ptr;
-		socket_event.SetReadyFlags(e.events);
 
-		/* move from "sockets" to "ready_sockets" */
-		socket_event.unlink();
-		ready_sockets.push_back(socket_event);
+		if (e.data.ptr == &wake_fd) {
+			/* woken up by another thread; reset the
+			   eventfd counter; the InjectEvents will be
+			   invoked by the next RunInject() call */
+			uint64_t value;
+			[[maybe_unused]] ssize_t nbytes =
+				wake_fd.Read(&value, sizeof(value));
+			continue;
+		}
+
+		auto &socket_event = *(SocketEvent *)e.data.ptr;
+		SetSocketReady(socket_event, e.events);
 	}
 
 	return ret > 0;
@@ -212,6 +532,8 @@ EventLoop::Loop(int flags) noexcept
 	steady_clock_cache.flush();
 	system_clock_cache.flush();
 
+	thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
 	quit = false;
 
 	const bool once = flags & EVLOOP_ONCE;
@@ -227,6 +549,9 @@ EventLoop::Loop(int flags) noexcept
 		if (quit)
 			break;
 
+		if (RunInject() && quit)
+			break;
+
 		RunDeferred();
 		if (quit)
 			break;
@@ -266,12 +591,16 @@ EventLoop::Loop(int flags) noexcept
 			auto &socket_event = ready_sockets.front();
 
 			/* move from "ready_sockets" back to "sockets" */
-			socket_event.unlink();
-			sockets.push_back(socket_event);
+			UnreadySocket(socket_event);
 
+			++stats.socket_count;
 			socket_event.Dispatch();
 		}
 
+		/* invoke the InjectEvents which have woken us up */
+		if (!quit)
+			RunInject();
+
 		RunPost();
 	} while (!quit && !once);
 
@@ -35,27 +35,83 @@
 
 #include "Chrono.hxx"
 #include "TimerWheel.hxx"
-#include "TimerList.hxx"
+#include "FineTimerWheel.hxx"
 #include "system/EpollFD.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "io/uring/config.h"
 #include "time/ClockCache.hxx"
 #include "util/IntrusiveList.hxx"
 
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#ifdef HAVE_URING
+#include <memory>
+#endif
+
 #ifndef NDEBUG
 #include "util/BindMethod.hxx"
 #endif
 
 class DeferEvent;
+class InjectEvent;
 class SocketEvent;
 
+#ifdef HAVE_URING
+namespace Uring { class Queue; }
+class UringBackend;
+#endif
+
 /**
  * A non-blocking I/O event loop.
+ *
+ * This class is not thread-safe; other threads may only use
+ * #InjectEvent (and BlockingCall()) to hand work to it.
  */
 class EventLoop final
 {
+	friend class InjectEvent;
+	friend class SocketEvent;
+
+public:
+	/**
+	 * Statistics about what this #EventLoop has done.  These are
+	 * plain integers which are only updated and read by the
+	 * thread which runs the #EventLoop; other threads can obtain
+	 * a copy via BlockingCall().
+	 */
+	struct Stats {
+		/**
+		 * The number of epoll_wait() (or io_uring_enter())
+		 * calls.
+		 */
+		uint_least64_t wait_count = 0;
+
+		/**
+		 * The number of #SocketEvent callbacks.
+		 */
+		uint_least64_t socket_count = 0;
+
+		/**
+		 * The number of #InjectEvent callbacks.
+		 */
+		uint_least64_t inject_count = 0;
+	};
+
+private:
+
 	EpollFD epoll;
 
+	/**
+	 * An eventfd which is used by other threads to wake up
+	 * epoll_wait().  It is registered in #epoll with a pointer to
+	 * this field (instead of a #SocketEvent pointer).
+	 */
+	UniqueFileDescriptor wake_fd;
+
 	TimerWheel coarse_timers;
-	TimerList timers;
+	FineTimerWheel timers;
 
 	using DeferList = IntrusiveList<DeferEvent>;
 
@@ -80,6 +136,59 @@ class EventLoop final
 	 */
 	SocketList ready_sockets;
 
+#ifdef HAVE_URING
+	/**
+	 * If set, then this #EventLoop uses io_uring instead of
+	 * epoll.  See EnableUring().
+	 */
+	std::unique_ptr<UringBackend> uring;
+
+	/**
+	 * A list of scheduled #SocketEvent instances which do not
+	 * have a pending `IORING_OP_POLL_ADD` operation (yet); this
+	 * will be submitted by ArmSockets().  Only used in io_uring
+	 * mode.
+	 */
+	SocketList unarmed_sockets;
+
+	/**
+	 * The EnableUring() parameters, needed by Reinit().
+	 */
+	unsigned uring_entries, uring_flags;
+#endif
+
+	/**
+	 * A lock-free stack of #InjectEvent instances which were
+	 * scheduled by other threads (in reverse order).  New items
+	 * are pushed by InjectEvent::Schedule(); the #EventLoop
+	 * thread takes all of them at once.
+	 */
+	std::atomic<InjectEvent *> inject_head{nullptr};
+
+	/**
+	 * The #InjectEvent instances which were taken from
+	 * #inject_head and are currently being invoked by
+	 * RunInject() (in FIFO order).  Only accessed by the
+	 * #EventLoop thread.
+	 */
+	InjectEvent *inject_running = nullptr;
+
+	/**
+	 * The number of #InjectEvent instances referring to this
+	 * #EventLoop.  As long as there are any, another thread may
+	 * inject work at any time, and the #EventLoop is not
+	 * considered empty.
+	 */
+	std::atomic_uint inject_count{0};
+
+	/**
+	 * The thread which runs this #EventLoop; it gets assigned
+	 * each time Loop() is entered.
+	 */
+	std::atomic<std::thread::id> thread{};
+
+	Stats stats;
+
 #ifndef NDEBUG
 	using PostCallback = BoundMethod<void() noexcept>;
 	PostCallback post_callback = nullptr;
@@ -94,8 +203,8 @@ class EventLoop final
 	bool again;
 
 	/**
-	 * This flag keeps track whether a TimerEvent or a DeferEvent
-	 * has been invoked.  This is used to implement #EVLOOP_ONCE,
+	 * This flag keeps track whether a TimerEvent, a DeferEvent or
+	 * an InjectEvent has been invoked.  This is used to implement #EVLOOP_ONCE,
 	 * to avoid calling epoll_wait() after something has been done
 	 * already.
 	 */
@@ -116,6 +225,36 @@ public:
 
 	void Reinit() noexcept;
 
+#ifdef HAVE_URING
+	/**
+	 * Switch this #EventLoop from epoll to io_uring.  Socket
+	 * events are then implemented with `IORING_OP_POLL_ADD`, and
+	 * each iteration costs only one io_uring_enter() system
+	 * call.
+	 *
+	 * This must be called before any #SocketEvent gets
+	 * scheduled.
+	 *
+	 * Throws on error (e.g. if the kernel does not support
+	 * io_uring); in that case, the #EventLoop keeps using epoll.
+	 *
+	 * @param entries the size of the submission queue
+	 * @param flags flags for io_uring_queue_init()
+	 */
+	void EnableUring(unsigned entries, unsigned flags);
+
+	/**
+	 * Returns the io_uring queue used by this #EventLoop, or
+	 * nullptr if EnableUring() was not called.  Operations pushed
+	 * into this queue are submitted along with the next
+	 * io_uring_enter() call of the #EventLoop, which makes
+	 * #Uring::Manager unnecessary.  Pending operations prevent
+	 * the #EventLoop from becoming "empty".
+	 */
+	[[gnu::pure]]
+	Uring::Queue *GetUring() noexcept;
+#endif
+
 #ifndef NDEBUG
 	/**
 	 * Set a callback function which will be invoked each time an even
@@ -150,7 +289,21 @@ public:
 	bool IsEmpty() const noexcept {
 		return coarse_timers.IsEmpty() && timers.IsEmpty() &&
 			defer.empty() && idle.empty() &&
-			sockets.empty() && ready_sockets.empty();
+			sockets.empty() && ready_sockets.empty() &&
+#ifdef HAVE_URING
+			unarmed_sockets.empty() && IsUringIdle() &&
+#endif
+			inject_count.load(std::memory_order_relaxed) == 0;
+	}
+
+	/**
+	 * Is the current thread the one which runs this #EventLoop?
+	 * This method is thread-safe.
+	 */
+	[[gnu::pure]]
+	bool IsInside() const noexcept {
+		return thread.load(std::memory_order_relaxed) ==
+			std::this_thread::get_id();
 	}
 
 	bool AddFD(int fd, unsigned events, SocketEvent &event) noexcept;
@@ -170,6 +323,10 @@ public:
 	void AddDefer(DeferEvent &e) noexcept;
 	void AddIdle(DeferEvent &e) noexcept;
 
+	const Stats &GetStats() const noexcept {
+		return stats;
+	}
+
 	const auto &GetSteadyClockCache() const noexcept {
 		return steady_clock_cache;
 	}
@@ -201,6 +358,67 @@ public:
 	}
 
 private:
+#ifdef HAVE_URING
+	[[gnu::pure]]
+	bool IsUringIdle() const noexcept;
+
+	/**
+	 * Submit `IORING_OP_POLL_ADD` for all #unarmed_sockets.
+	 */
+	void ArmSockets() noexcept;
+
+	/**
+	 * Called by SocketEvent::OnUringCompletion().
+	 */
+	void OnUringPoll(SocketEvent &event, int res) noexcept;
+#endif
+
+	/**
+	 * Move a #SocketEvent (which was reported "ready" by the
+	 * backend) to #ready_sockets.
+	 */
+	void SetSocketReady(SocketEvent &event, unsigned flags) noexcept;
+
+	/**
+	 * Move a #SocketEvent which was just taken from
+	 * #ready_sockets back to the list of scheduled sockets.
+	 */
+	void UnreadySocket(SocketEvent &event) noexcept;
+
+	/**
+	 * Push the given #InjectEvent onto #inject_head and wake up
+	 * the #EventLoop thread if necessary.  This method is
+	 * thread-safe.
+	 */
+	void AddInject(InjectEvent &e) noexcept;
+
+	/**
+	 * Push a chain of #InjectEvent instances (linked by
+	 * InjectEvent::next_injected) onto #inject_head.  This method
+	 * is thread-safe.
+	 */
+	void PushInject(InjectEvent &first, InjectEvent &last) noexcept;
+
+	/**
+	 * Remove the given (queued or canceled) #InjectEvent from the
+	 * inject queue.  This is called by ~InjectEvent() in the
+	 * #EventLoop thread.
+	 */
+	void RemoveInject(InjectEvent &e) noexcept;
+
+	/**
+	 * Wake up epoll_wait() via #wake_fd.  This method is
+	 * thread-safe.
+	 */
+	void Wake() noexcept;
+
+	/**
+	 * Invoke all pending #InjectEvent instances.
+	 *
+	 * @return false if there was no such event
+	 */
+	bool RunInject() noexcept;
+
 	/**
 	 * @return false if there are no registered events
 	 */
@@ -223,8 +441,8 @@ private:
 	Event::Duration HandleTimers() noexcept;
 
 	/**
-	 * Call epoll_wait() and pass all returned events to
-	 * SocketEvent::SetReadyFlags().
+	 * Call epoll_wait() (or io_uring_enter()) and pass all
+	 * returned events to SocketEvent::SetReadyFlags().
 	 *
 	 * @return true if one or more sockets have become ready
 	 */
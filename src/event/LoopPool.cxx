@@ -0,0 +1,121 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "LoopPool.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm>
+#include <latch>
+
+#include <sched.h>
+
+/**
+ * Determine the CPUs this process is allowed to run on.
+ */
+static std::vector<int>
+GetAllowedCpus()
+{
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) < 0)
+		throw MakeErrno("sched_getaffinity() failed");
+
+	std::vector<int> result;
+	for (int i = 0; i < CPU_SETSIZE; ++i)
+		if (CPU_ISSET(i, &set))
+			result.push_back(i);
+
+	return result;
+}
+
+EventLoopPool::EventLoopPool(unsigned n)
+{
+	if (n == 0)
+		n = std::max<std::size_t>(GetAllowedCpus().size(), 1);
+
+	threads.reserve(n);
+	for (unsigned i = 0; i < n; ++i)
+		threads.emplace_back(std::make_unique<EventThread>());
+}
+
+EventLoopPool::~EventLoopPool() noexcept
+{
+	Stop();
+}
+
+void
+EventLoopPool::Start(bool pin_cpus)
+{
+	std::vector<int> cpus;
+	if (pin_cpus)
+		cpus = GetAllowedCpus();
+
+	try {
+		for (std::size_t i = 0; i < threads.size(); ++i)
+			threads[i]->Start(cpus.empty()
+					? -1
+					: cpus[i % cpus.size()]);
+	} catch (...) {
+		Stop();
+		throw;
+	}
+}
+
+void
+EventLoopPool::Shutdown(const std::function<void(EventLoop &)> &handler) noexcept
+{
+	std::latch latch(threads.size());
+
+	for (auto &i : threads)
+		i->Shutdown(handler, latch);
+
+	latch.wait();
+}
+
+void
+EventLoopPool::Stop() noexcept
+{
+	for (auto &i : threads)
+		i->Stop();
+}
+
+std::vector<EventLoop::Stats>
+EventLoopPool::GetStats()
+{
+	std::vector<EventLoop::Stats> result;
+	result.reserve(threads.size());
+
+	for (auto &i : threads)
+		result.push_back(i->GetStats());
+
+	return result;
+}
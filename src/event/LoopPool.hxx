@@ -0,0 +1,104 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "Thread.hxx"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * A pool of #EventThread instances, usually one per CPU.  Each thread
+ * can be pinned to one CPU.
+ *
+ * All methods must be called from the thread which owns this object.
+ */
+class EventLoopPool final {
+	std::vector<std::unique_ptr<EventThread>> threads;
+
+public:
+	/**
+	 * @param n the number of threads; 0 means one for each CPU
+	 * this process is allowed to run on
+	 */
+	explicit EventLoopPool(unsigned n=0);
+
+	~EventLoopPool() noexcept;
+
+	EventLoopPool(const EventLoopPool &) = delete;
+	EventLoopPool &operator=(const EventLoopPool &) = delete;
+
+	std::size_t size() const noexcept {
+		return threads.size();
+	}
+
+	EventThread &operator[](std::size_t i) noexcept {
+		return *threads[i];
+	}
+
+	EventLoop &GetEventLoop(std::size_t i) noexcept {
+		return threads[i]->GetEventLoop();
+	}
+
+	/**
+	 * Launch all threads.
+	 *
+	 * Throws on error.
+	 *
+	 * @param pin_cpus pin each thread to one of the CPUs this
+	 * process is allowed to run on (round-robin)
+	 */
+	void Start(bool pin_cpus=true);
+
+	/**
+	 * Invoke the given handler in all #EventLoop threads (in
+	 * parallel) and wait until all of them have returned.  This
+	 * is a barrier which can be used for graceful shutdown: e.g.
+	 * close all listeners in all threads, and after this method
+	 * returns, no thread will accept new connections.
+	 */
+	void Shutdown(const std::function<void(EventLoop &)> &handler) noexcept;
+
+	/**
+	 * Stop all threads (see EventThread::Stop()).
+	 */
+	void Stop() noexcept;
+
+	/**
+	 * Obtain a copy of the statistics of all #EventLoop
+	 * instances.
+	 */
+	std::vector<EventLoop::Stats> GetStats();
+};
@@ -142,3 +142,13 @@ SocketEvent::Dispatch() noexcept
 	if (flags != 0)
 		callback(flags);
 }
+
+#ifdef HAVE_URING
+
+void
+SocketEvent::OnUringCompletion(int res) noexcept
+{
+	loop.OnUringPoll(*this, res);
+}
+
+#endif
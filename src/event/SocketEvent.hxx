@@ -33,10 +33,15 @@
 #pragma once
 
 #include "BackendEvents.hxx"
+#include "io/uring/config.h"
 #include "net/SocketDescriptor.hxx"
 #include "util/BindMethod.hxx"
 #include "util/IntrusiveList.hxx"
 
+#ifdef HAVE_URING
+#include "io/uring/Operation.hxx"
+#endif
+
 class EventLoop;
 
 /**
@@ -53,6 +58,11 @@ class EventLoop;
  * as thread-safe.
  */
 class SocketEvent final : IntrusiveListHook, public EventPollBackendEvents
+#ifdef HAVE_URING
+	/* the IORING_OP_POLL_ADD operation in io_uring mode (see
+	   EventLoop::EnableUring()) */
+	, Uring::Operation
+#endif
 {
 	friend class EventLoop;
 	friend class IntrusiveList<SocketEvent>;
@@ -72,7 +82,7 @@ class SocketEvent final : IntrusiveListHook, public EventPollBackendEvents
 
 	/**
 	 * A bit mask of events which have been reported as "ready" by
-	 * epoll_wait().  If non-zero, then the #EventLoop will call
+	 * epoll_wait() (or io_uring).  If non-zero, then the #EventLoop will call
 	 * Dispatch() soon.
 	 */
 	unsigned ready_flags = 0;
@@ -187,4 +197,9 @@ private:
 	 * Dispatch the events that were passed to SetReadyFlags().
 	 */
 	void Dispatch() noexcept;
+
+#ifdef HAVE_URING
+	/* virtual methods from class Uring::Operation */
+	void OnUringCompletion(int res) noexcept override;
+#endif
 };
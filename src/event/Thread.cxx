@@ -0,0 +1,136 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Thread.hxx"
+#include "Call.hxx"
+#include "system/Error.hxx"
+
+#include <cassert>
+#include <utility>
+
+#include <pthread.h>
+#include <sched.h>
+
+EventThread::EventThread() noexcept
+	:stop_event(event_loop, BIND_THIS_METHOD(OnStop)),
+	 shutdown_event(event_loop, BIND_THIS_METHOD(OnShutdown)) {}
+
+EventThread::~EventThread() noexcept
+{
+	Stop();
+}
+
+void
+EventThread::Start(int _cpu)
+{
+	assert(!IsRunning());
+
+	thread = std::thread(&EventThread::Run, this);
+
+	if (_cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(_cpu, &set);
+
+		int error = pthread_setaffinity_np(thread.native_handle(),
+						   sizeof(set), &set);
+		if (error != 0) {
+			Stop();
+			throw FormatErrno(error,
+					  "Failed to pin thread to CPU %d",
+					  _cpu);
+		}
+	}
+
+	cpu = _cpu;
+}
+
+void
+EventThread::Stop() noexcept
+{
+	if (!IsRunning())
+		return;
+
+	stop_event.Schedule();
+	thread.join();
+}
+
+void
+EventThread::Call(std::function<void()> &&f)
+{
+	if (IsRunning())
+		BlockingCall(event_loop, std::move(f));
+	else
+		f();
+}
+
+void
+EventThread::Shutdown(const std::function<void(EventLoop &)> &handler,
+		      std::latch &latch) noexcept
+{
+	assert(shutdown_latch == nullptr);
+
+	if (!IsRunning()) {
+		handler(event_loop);
+		latch.count_down();
+		return;
+	}
+
+	shutdown_handler = &handler;
+	shutdown_latch = &latch;
+	shutdown_event.Schedule();
+}
+
+EventLoop::Stats
+EventThread::GetStats()
+{
+	EventLoop::Stats stats;
+	Call([this, &stats]{ stats = event_loop.GetStats(); });
+	return stats;
+}
+
+inline void
+EventThread::Run() noexcept
+{
+	event_loop.Dispatch();
+}
+
+inline void
+EventThread::OnShutdown() noexcept
+{
+	assert(shutdown_latch != nullptr);
+
+	(*std::exchange(shutdown_handler, nullptr))(event_loop);
+
+	std::exchange(shutdown_latch, nullptr)->count_down();
+}
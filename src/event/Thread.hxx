@@ -0,0 +1,153 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "Loop.hxx"
+#include "InjectEvent.hxx"
+
+#include <functional>
+#include <latch>
+#include <thread>
+
+/**
+ * A thread which runs an #EventLoop.  Optionally, the thread can be
+ * pinned to one CPU.
+ *
+ * Unless documented otherwise, all methods must be called from the
+ * thread which owns this object (not the #EventLoop thread).
+ */
+class EventThread final {
+	EventLoop event_loop;
+
+	/**
+	 * Scheduled by Stop() to make the #EventLoop exit.  As long
+	 * as this object exists, the #EventLoop will not exit
+	 * because it is empty.
+	 */
+	InjectEvent stop_event;
+
+	/**
+	 * Scheduled by Shutdown() to invoke the #shutdown_handler
+	 * inside the #EventLoop thread.
+	 */
+	InjectEvent shutdown_event;
+
+	/**
+	 * The handler passed to Shutdown().  It is not copied,
+	 * because copying a std::function may throw.
+	 */
+	const std::function<void(EventLoop &)> *shutdown_handler = nullptr;
+
+	/**
+	 * The barrier passed to Shutdown(); it gets decremented
+	 * after #shutdown_handler has returned.
+	 */
+	std::latch *shutdown_latch = nullptr;
+
+	std::thread thread;
+
+	/**
+	 * The CPU this thread is pinned to or -1 if it is not
+	 * pinned.
+	 */
+	int cpu = -1;
+
+public:
+	EventThread() noexcept;
+	~EventThread() noexcept;
+
+	EventThread(const EventThread &) = delete;
+	EventThread &operator=(const EventThread &) = delete;
+
+	EventLoop &GetEventLoop() noexcept {
+		return event_loop;
+	}
+
+	bool IsRunning() const noexcept {
+		return thread.joinable();
+	}
+
+	int GetCpu() const noexcept {
+		return cpu;
+	}
+
+	/**
+	 * Launch the thread.
+	 *
+	 * Throws on error.
+	 *
+	 * @param _cpu pin the thread to this CPU; -1 means no pinning
+	 */
+	void Start(int _cpu=-1);
+
+	/**
+	 * Make the #EventLoop exit (after the current iteration) and
+	 * wait for the thread to finish.  No-op if the thread is not
+	 * running.
+	 */
+	void Stop() noexcept;
+
+	/**
+	 * Invoke the given function inside the #EventLoop thread and
+	 * wait for it to complete.  If the thread is not running, the
+	 * function is invoked directly.
+	 */
+	void Call(std::function<void()> &&f);
+
+	/**
+	 * Invoke the given handler inside the #EventLoop thread
+	 * (asynchronously); after it returns, count down the given
+	 * latch.  This allows waiting for several threads at the
+	 * same time (see EventLoopPool::Shutdown()).
+	 *
+	 * The handler is not copied; it must remain valid until the
+	 * latch has been counted down.
+	 */
+	void Shutdown(const std::function<void(EventLoop &)> &handler,
+		      std::latch &latch) noexcept;
+
+	/**
+	 * Obtain a copy of the #EventLoop statistics.
+	 */
+	EventLoop::Stats GetStats();
+
+private:
+	void Run() noexcept;
+
+	void OnStop() noexcept {
+		event_loop.Break();
+	}
+
+	void OnShutdown() noexcept;
+};
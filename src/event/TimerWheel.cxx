@@ -33,6 +33,7 @@
 #include "TimerWheel.hxx"
 #include "CoarseTimerEvent.hxx"
 
+#include <algorithm>
 #include <cassert>
 
 TimerWheel::TimerWheel() noexcept
@@ -45,21 +46,51 @@ TimerWheel::TimerWheel() noexcept
 
 TimerWheel::~TimerWheel() noexcept = default;
 
+template<std::size_t N>
+std::size_t
+TimerWheel::FindNextBucket(const std::array<List, N> &lists,
+			   BucketMask<N> &mask, std::size_t i) noexcept
+{
+	while (true) {
+		const std::size_t j = mask.FindNext(i);
+		if (j == N || !lists[j].empty())
+			return j;
+
+		/* all timers in this bucket have been canceled */
+		mask.Clear(j);
+	}
+}
+
+bool
+TimerWheel::IsEmpty() const noexcept
+{
+	return ready.empty() &&
+		FindNextBucket(buckets, bucket_mask, 0) == N_BUCKETS &&
+		FindNextBucket(far_buckets, far_bucket_mask, 0) == N_FAR_BUCKETS;
+}
+
 void
 TimerWheel::Insert(CoarseTimerEvent &t,
 		   Event::TimePoint now) noexcept
 {
 	assert(now >= last_time);
 
-	auto &list = t.GetDue() > now
-		? buckets[BucketIndexAt(t.GetDue())]
+	if (t.GetDue() <= now) {
 		/* if this timer is already due, insert it into the
 		   "ready" list to be invoked without delay */
-		: ready;
-
-	list.push_back(t);
-
-	empty = false;
+		ready.push_back(t);
+	} else if (t.GetDue() - now < SPAN) {
+		const std::size_t i = BucketIndexAt(t.GetDue());
+		buckets[i].push_back(t);
+		bucket_mask.Set(i);
+	} else {
+		/* too far in the future for the seconds level; this
+		   bucket will be cascaded at least one
+		   FAR_RESOLUTION before the timer is due */
+		const std::size_t i = FarBucketIndexAt(t.GetDue());
+		far_buckets[i].push_back(t);
+		far_bucket_mask.Set(i);
+	}
 }
 
 void
@@ -83,25 +114,75 @@ TimerWheel::Run(List &list, Event::TimePoint now,
 	});
 }
 
+void
+TimerWheel::Cascade(std::size_t i, Event::TimePoint now) noexcept
+{
+	if (far_buckets[i].empty())
+		return;
+
+	auto tmp = std::move(far_buckets[i]);
+	far_bucket_mask.Clear(i);
+
+	tmp.clear_and_dispose([&](auto *t){
+		Insert(*t, now);
+	});
+}
+
+inline void
+TimerWheel::CascadeRange(Event::TimePoint now) noexcept
+{
+	const auto last_start = GetFarBucketStartTime(last_time);
+	const auto now_start = GetFarBucketStartTime(now);
+	if (now_start <= last_start)
+		/* still in the same overflow bucket; nothing to do */
+		return;
+
+	if (now_start - last_start >= FAR_SPAN) {
+		/* too much time has passed: cascade all buckets */
+		for (std::size_t i = 0; i < N_FAR_BUCKETS; ++i)
+			Cascade(i, now);
+		return;
+	}
+
+	/* when entering a new FAR_RESOLUTION, cascade the bucket
+	   after it, which guarantees that its timers fit into the
+	   seconds level */
+	for (auto t = last_start + FAR_RESOLUTION; t <= now_start;
+	     t += FAR_RESOLUTION)
+		Cascade(FarBucketIndexAt(t + FAR_RESOLUTION), now);
+}
+
 inline Event::TimePoint
 TimerWheel::GetNextDue(const std::size_t bucket_index,
 		       const Event::TimePoint bucket_start_time) const noexcept
 {
-	Event::TimePoint t = bucket_start_time;
+	const std::size_t i = FindNextBucket(buckets, bucket_mask,
+					     bucket_index);
+	if (i == N_BUCKETS)
+		/* no timer scheduled - no wakeup */
+		return Event::TimePoint::max();
+
+	/* found a non-empty bucket; return this bucket's end
+	   time */
+	const std::size_t distance = (i + N_BUCKETS - bucket_index) % N_BUCKETS;
+	return bucket_start_time + int(distance + 1) * RESOLUTION;
+}
 
-	for (std::size_t i = bucket_index;;) {
-		t += RESOLUTION;
+inline Event::TimePoint
+TimerWheel::GetNextCascade(Event::TimePoint now) const noexcept
+{
+	/* the bucket after the current one has already been
+	   cascaded; the next one to be cascaded is the one after
+	   that */
+	const std::size_t start = (FarBucketIndexAt(now) + 2) % N_FAR_BUCKETS;
 
-		if (!buckets[i].empty())
-			/* found a non-empty bucket; return this
-			   bucket's end time */
-			return t;
+	const std::size_t i = FindNextBucket(far_buckets, far_bucket_mask,
+					     start);
+	if (i == N_FAR_BUCKETS)
+		return Event::TimePoint::max();
 
-		i = NextBucketIndex(i);
-		if (i == bucket_index)
-			/* no timer scheduled - no wakeup */
-			return Event::TimePoint::max();
-	}
+	const std::size_t distance = (i + N_FAR_BUCKETS - start) % N_FAR_BUCKETS;
+	return GetFarBucketStartTime(now) + int(distance + 1) * FAR_RESOLUTION;
 }
 
 inline Event::Duration
@@ -111,22 +192,24 @@ TimerWheel::GetSleep(Event::TimePoint now) const noexcept
 	   method gets called only from Run() after the "ready" list
 	   has been processed already */
 
-	if (empty)
+	const auto t = std::min(GetNextDue(BucketIndexAt(now),
+					   GetBucketStartTime(now)),
+				GetNextCascade(now));
+	if (t == Event::TimePoint::max())
 		return Event::Duration(-1);
 
-	auto t = GetNextDue(BucketIndexAt(now), GetBucketStartTime(now));
 	assert(t > now);
-	if (t == Event::TimePoint::max()) {
-		empty = true;
-		return Event::Duration(-1);
-	}
-
 	return t - now;
 }
 
 Event::Duration
 TimerWheel::Run(const Event::TimePoint now, bool &invoked) noexcept
 {
+	/* move timers from the overflow level which will be due
+	   soon to the seconds level (or to the "ready" list) */
+	if (now > last_time)
+		CascadeRange(now);
+
 	/* invoke the "ready" list unconditionally */
 	ready.clear_and_dispose([&](auto *t){
 		invoked = true;
@@ -165,6 +248,8 @@ TimerWheel::Run(const Event::TimePoint now, bool &invoked) noexcept
 
 	for (std::size_t i = start_bucket;;) {
 		Run(buckets[i], now, invoked);
+		if (buckets[i].empty())
+			bucket_mask.Clear(i);
 
 		i = NextBucketIndex(i);
 		if (i == end_bucket)
@@ -36,13 +36,20 @@
 #include "util/IntrusiveList.hxx"
 
 #include <array>
-#include <algorithm>
+#include <bit>
+#include <cstdint>
 
 class CoarseTimerEvent;
 
 /**
  * A list of #CoarseTimerEvent instances managed in a circular timer
  * wheel.
+ *
+ * Timers which are due within #SPAN are kept in buckets with a
+ * resolution of one second.  Timers further in the future are kept
+ * in an "overflow" level with a resolution of one minute, and get
+ * moved ("cascaded") to the seconds level shortly before they are
+ * due.
  */
 class TimerWheel final {
 	static constexpr Event::Duration RESOLUTION = std::chrono::seconds(1);
@@ -52,18 +59,111 @@ class TimerWheel final {
 
 	static constexpr std::size_t N_BUCKETS = SPAN / RESOLUTION;
 
+	static constexpr Event::Duration FAR_RESOLUTION = std::chrono::minutes(1);
+	static constexpr Event::Duration FAR_SPAN = std::chrono::hours(24);
+
+	static_assert(FAR_SPAN % FAR_RESOLUTION == Event::Duration::zero());
+
+	/* an overflow bucket gets cascaded one FAR_RESOLUTION before
+	   it begins, so all of its timers fit into the seconds
+	   level */
+	static_assert(SPAN >= 2 * FAR_RESOLUTION);
+
+	static constexpr std::size_t N_FAR_BUCKETS = FAR_SPAN / FAR_RESOLUTION;
+
 	using List = IntrusiveList<CoarseTimerEvent>;
 
+	/**
+	 * A bit mask of buckets which may be non-empty.  Canceled
+	 * timers unlink themselves without notifying the
+	 * #TimerWheel, therefore a set bit may refer to an empty
+	 * bucket; these bits get cleared lazily.
+	 */
+	template<std::size_t N>
+	class BucketMask {
+		static constexpr std::size_t WORD_BITS = 64;
+		static constexpr std::size_t N_WORDS = (N + WORD_BITS - 1) / WORD_BITS;
+
+		std::array<uint_least64_t, N_WORDS> words{};
+
+		static constexpr uint_least64_t Bit(std::size_t i) noexcept {
+			return uint_least64_t(1) << (i % WORD_BITS);
+		}
+
+	public:
+		void Set(std::size_t i) noexcept {
+			words[i / WORD_BITS] |= Bit(i);
+		}
+
+		void Clear(std::size_t i) noexcept {
+			words[i / WORD_BITS] &= ~Bit(i);
+		}
+
+		/**
+		 * Find the first set bit at or after the given
+		 * index, wrapping around at the end.
+		 *
+		 * @return the bit index or N if no bit is set
+		 */
+		[[gnu::pure]]
+		std::size_t FindNext(std::size_t i) const noexcept {
+			std::size_t w = i / WORD_BITS;
+			uint_least64_t m = words[w] & ~(Bit(i) - 1);
+
+			/* search from i to the end */
+			while (true) {
+				if (m != 0)
+					return w * WORD_BITS + std::countr_zero(m);
+
+				if (++w == N_WORDS)
+					break;
+
+				m = words[w];
+			}
+
+			/* wrap around and search from the beginning
+			   to i */
+			for (w = 0; w <= i / WORD_BITS; ++w) {
+				m = words[w];
+				if (w == i / WORD_BITS)
+					m &= Bit(i) - 1;
+
+				if (m != 0)
+					return w * WORD_BITS + std::countr_zero(m);
+			}
+
+			return N;
+		}
+	};
+
 	/**
 	 * Each bucket contains a doubly linked list of
 	 * #CoarseTimerEvent instances scheduled for one #RESOLUTION.
 	 *
-	 * Timers scheduled far into the future (more than #SPAN) may
-	 * also sit in between, so anybody walking those lists should
-	 * check the due time.
+	 * Since Insert() may be called with a time point later than
+	 * the last Run() call, a bucket may contain timers which are
+	 * due only in the next round, so anybody walking those lists
+	 * should check the due time.
 	 */
 	std::array<List, N_BUCKETS> buckets;
 
+	/**
+	 * The overflow level: each bucket contains timers scheduled
+	 * for one #FAR_RESOLUTION.  Timers scheduled more than
+	 * #FAR_SPAN into the future sit in between and get put back
+	 * when their bucket is cascaded too early.
+	 */
+	std::array<List, N_FAR_BUCKETS> far_buckets;
+
+	/**
+	 * These fields are "mutable" so the "const" methods
+	 * IsEmpty() and GetSleep() can clear stale bits.  For the
+	 * same reason, those methods must not be declared
+	 * [[gnu::pure]].
+	 */
+	mutable BucketMask<N_BUCKETS> bucket_mask;
+	mutable BucketMask<N_FAR_BUCKETS> far_bucket_mask;
+
 	/**
 	 * A list of timers which are already ready.  This can happen
 	 * if they are scheduled with a zero duration or scheduled in
@@ -79,27 +179,15 @@ class TimerWheel final {
 	 */
 	Event::TimePoint last_time{};
 
-	/**
-	 * If this flag is true, then all buckets are guaranteed to be
-	 * empty.  If it is false, the buckets may or may not be
-	 * empty; if so, the next full scan will set it back to true.
-	 *
-	 * This field is "mutable" so the "const" method GetSleep()
-	 * can update it.
-	 */
-	mutable bool empty = true;
-
 public:
 	TimerWheel() noexcept;
 	~TimerWheel() noexcept;
 
-	bool IsEmpty() const noexcept {
-		return ready.empty() &&
-			std::all_of(buckets.begin(), buckets.end(),
-				    [](const auto &list){
-					    return list.empty();
-				    });
-	}
+	/**
+	 * Are there no pending timers?  This is not "pure" because
+	 * it clears stale bucket mask bits.
+	 */
+	bool IsEmpty() const noexcept;
 
 	void Insert(CoarseTimerEvent &t,
 		    Event::TimePoint now) noexcept;
@@ -126,19 +214,60 @@ private:
 		return t - t.time_since_epoch() % RESOLUTION;
 	}
 
+	static constexpr std::size_t FarBucketIndexAt(Event::TimePoint t) noexcept {
+		return std::size_t(t.time_since_epoch() / FAR_RESOLUTION)
+			% N_FAR_BUCKETS;
+	}
+
+	static constexpr Event::TimePoint GetFarBucketStartTime(Event::TimePoint t) noexcept {
+		return t - t.time_since_epoch() % FAR_RESOLUTION;
+	}
+
+	/**
+	 * Find the next non-empty bucket, starting at the given
+	 * index, and clear stale bits along the way.
+	 *
+	 * @return the bucket index or N if all buckets are empty
+	 */
+	template<std::size_t N>
+	static std::size_t FindNextBucket(const std::array<List, N> &lists,
+					  BucketMask<N> &mask,
+					  std::size_t i) noexcept;
+
 	/**
 	 * What is the end time of the next non-empty bucket?
 	 *
 	 * @param bucket_index start searching at this bucket index
 	 * @return the bucket end time or max() if the wheel is empty
 	 */
-	[[gnu::pure]]
 	Event::TimePoint GetNextDue(std::size_t bucket_index,
 				    Event::TimePoint bucket_start_time) const noexcept;
 
-	[[gnu::pure]]
+	/**
+	 * When does the next non-empty overflow bucket need to be
+	 * cascaded?
+	 *
+	 * @return the time point or max() if the overflow level is
+	 * empty
+	 */
+	Event::TimePoint GetNextCascade(Event::TimePoint now) const noexcept;
+
 	Event::Duration GetSleep(Event::TimePoint now) const noexcept;
 
+	/**
+	 * Move all timers from the given overflow bucket to the
+	 * seconds level (or back to the overflow level if they are
+	 * still too far in the future).
+	 */
+	void Cascade(std::size_t far_bucket_index,
+		     Event::TimePoint now) noexcept;
+
+	/**
+	 * Cascade all overflow buckets which have become due between
+	 * #last_time and the given time point.
+	 */
+	void CascadeRange(Event::TimePoint now) noexcept;
+
 	/**
 	 * Run all due timers in this bucket.
 	 */
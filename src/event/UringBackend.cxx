@@ -0,0 +1,115 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "UringBackend.hxx"
+
+#include <cstdint>
+
+#include <poll.h>
+
+void
+UringBackend::WakeOperation::Start() noexcept
+{
+	/* if the submission queue is full, try again in the next
+	   Wait() call; else EventLoop::Wake() calls would be lost */
+	start_failed = !backend.AddPoll(*this, fd, POLLIN);
+}
+
+void
+UringBackend::WakeOperation::OnUringCompletion(int res) noexcept
+{
+	if (res < 0)
+		/* should not happen; give up instead of busy-looping
+		   on a broken eventfd */
+		return;
+
+	/* reset the eventfd counter; the InjectEvents will be
+	   invoked by the next EventLoop::RunInject() call */
+	uint64_t value;
+	[[maybe_unused]] ssize_t nbytes = fd.Read(&value, sizeof(value));
+
+	Start();
+}
+
+UringBackend::UringBackend(unsigned entries, unsigned flags,
+			   FileDescriptor wake_fd)
+	:Queue(entries, flags),
+	 wake(*this, wake_fd)
+{
+	wake.Start();
+}
+
+UringBackend::~UringBackend() noexcept
+{
+	wake.CancelUring();
+}
+
+bool
+UringBackend::AddPoll(Uring::Operation &operation, FileDescriptor fd,
+		      unsigned events) noexcept
+{
+	auto *sqe = GetSubmitEntry();
+	if (sqe == nullptr)
+		return false;
+
+	/* this is a one-shot poll; IORING_POLL_ADD_MULTI would be
+	   edge-triggered, but SocketEvent is level-triggered */
+	io_uring_prep_poll_add(sqe, fd.Get(), events);
+	AddPending(*sqe, operation);
+	return true;
+}
+
+void
+UringBackend::Wait(Event::Duration timeout) noexcept
+{
+	struct __kernel_timespec ts, *tsp = nullptr;
+	if (timeout >= timeout.zero()) {
+		const auto s = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+		ts.tv_sec = s.count();
+		ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - s).count();
+		tsp = &ts;
+	}
+
+	wake.RetryStart();
+
+	try {
+		/* liburing implements the timeout with
+		   IORING_ENTER_EXT_ARG if the kernel supports it, or
+		   else with an IORING_OP_TIMEOUT entry */
+		SubmitAndWaitCompletion(tsp);
+	} catch (...) {
+		/* errors are ignored, just like epoll_wait() errors
+		   in the epoll backend */
+	}
+
+	DispatchCompletions();
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Chrono.hxx"
+#include "io/uring/Queue.hxx"
+#include "io/uring/Operation.hxx"
+#include "io/FileDescriptor.hxx"
+
+/**
+ * The io_uring backend for #EventLoop.  Instead of epoll, socket
+ * events are implemented with `IORING_OP_POLL_ADD`, and all
+ * submissions are flushed and all completions are waited for with
+ * just one io_uring_enter() system call per #EventLoop iteration.
+ *
+ * This is a #Uring::Queue, therefore other io_uring operations can
+ * be pushed into it as well; they are submitted along with the next
+ * Wait() call.
+ */
+class UringBackend final : public Uring::Queue {
+	/**
+	 * Listens for #EventLoop::Wake() calls by polling the
+	 * eventfd.
+	 */
+	class WakeOperation final : public Uring::Operation {
+		UringBackend &backend;
+		FileDescriptor fd;
+
+		/**
+		 * Did the last Start() call fail to obtain a
+		 * submission queue entry?
+		 */
+		bool start_failed = false;
+
+	public:
+		WakeOperation(UringBackend &_backend,
+			      FileDescriptor _fd) noexcept
+			:backend(_backend), fd(_fd) {}
+
+		void Start() noexcept;
+
+		/**
+		 * Call Start() again if the last call has failed.
+		 */
+		void RetryStart() noexcept {
+			if (start_failed)
+				Start();
+		}
+
+	private:
+		/* virtual methods from class Uring::Operation */
+		void OnUringCompletion(int res) noexcept override;
+	};
+
+	WakeOperation wake;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param wake_fd the eventfd which is written by
+	 * EventLoop::Wake()
+	 */
+	UringBackend(unsigned entries, unsigned flags,
+		     FileDescriptor wake_fd);
+
+	~UringBackend() noexcept;
+
+	/**
+	 * Are there no pending operations other than the internal
+	 * "wake" operation?
+	 */
+	bool IsIdle() const noexcept {
+		return GetPendingCount() <= 1;
+	}
+
+	/**
+	 * Submit a one-shot `IORING_OP_POLL_ADD` operation.
+	 *
+	 * @param events a bit mask of poll flags
+	 * @return false on error
+	 */
+	bool AddPoll(Uring::Operation &operation, FileDescriptor fd,
+		     unsigned events) noexcept;
+
+	/**
+	 * Submit all pending entries, wait for at least one
+	 * completion (or until the timeout expires) and dispatch all
+	 * completions.
+	 *
+	 * @param timeout a negative value means wait forever
+	 */
+	void Wait(Event::Duration timeout) noexcept;
+
+protected:
+	/* virtual methods from class Uring::Queue */
+	void ScheduleSubmit() noexcept override {
+		/* submitted by the next Wait() call */
+	}
+};
@@ -105,6 +105,13 @@ BufferedSocket::AsFD() noexcept
 		   buffer is empty */
 		return -1;
 
+#ifdef HAVE_URING
+	if (base.IsUring())
+		/* the kernel may have received more data into
+		   io_uring buffers already */
+		return -1;
+#endif
+
 	return base.AsFD();
 }
 
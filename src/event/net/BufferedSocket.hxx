@@ -35,6 +35,7 @@
 #include "DefaultFifoBuffer.hxx"
 #include "SocketWrapper.hxx"
 #include "event/DeferEvent.hxx"
+#include "io/uring/config.h"
 #include "util/Compiler.h"
 #include "util/DestructObserver.hxx"
 #include "util/LeakDetector.hxx"
@@ -468,11 +469,36 @@ public:
 
 	void SetDirect(bool _direct) noexcept {
 		direct = _direct;
+
+#ifdef HAVE_URING
+		if (base.IsUring())
+			/* not supported in io_uring mode */
+			direct = false;
+#endif
+	}
+
+#ifdef HAVE_URING
+	/**
+	 * Switch to io_uring mode; see SocketWrapper::EnableUring().
+	 * The #BufferedSocketHandler methods are invoked just like
+	 * in the default mode, but "direct" transfers are disabled,
+	 * because the kernel may have already received data into
+	 * io_uring buffers.
+	 */
+	void EnableUring(Uring::Queue &queue, Uring::BufferRing &buffers,
+			 bool zerocopy=false) noexcept {
+		assert(!ended);
+		assert(!destroyed);
+
+		base.EnableUring(queue, buffers, zerocopy);
+		direct = false;
 	}
+#endif
 
 	/**
 	 * Returns the socket descriptor and calls Abandon().
-	 * Returns -1 if the input buffer is not empty.
+	 * Returns -1 if the input buffer is not empty (or in io_uring
+	 * mode).
 	 */
 	int AsFD() noexcept;
 
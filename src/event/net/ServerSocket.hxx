@@ -55,7 +55,7 @@ public:
 		Listen(std::move(_fd));
 	}
 
-	~ServerSocket() noexcept;
+	virtual ~ServerSocket() noexcept;
 
 	auto &GetEventLoop() const noexcept {
 		return event.GetEventLoop();
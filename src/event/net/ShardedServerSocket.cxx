@@ -0,0 +1,136 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ShardedServerSocket.hxx"
+#include "ServerSocket.hxx"
+#include "event/LoopPool.hxx"
+#include "net/ReusePort.hxx"
+#include "net/SocketConfig.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <cassert>
+#include <stdexcept>
+
+ShardedServerSocket::ShardedServerSocket(EventLoopPool &_pool,
+					 const Factory &factory)
+	:pool(_pool)
+{
+	sockets.reserve(pool.size());
+
+	try {
+		for (std::size_t i = 0; i < pool.size(); ++i) {
+			auto &thread = pool[i];
+			thread.Call([this, &factory, &thread]{
+				sockets.emplace_back(factory(thread.GetEventLoop()));
+			});
+		}
+	} catch (...) {
+		/* the destructor won't be called: destroy the
+		   sockets which have been created already, each
+		   inside its own thread */
+		Close();
+		throw;
+	}
+}
+
+ShardedServerSocket::~ShardedServerSocket() noexcept
+{
+	Close();
+}
+
+void
+ShardedServerSocket::Listen(const SocketConfig &_config, bool cpu_steering)
+{
+	assert(!sockets.empty());
+
+	if (_config.listen == 0)
+		throw std::invalid_argument("No listen backlog");
+
+	SocketConfig config(_config);
+	config.reuse_port = true;
+
+	std::vector<int> cpus;
+
+	/* create all sockets in the same order as the #sockets
+	   array, because the socket index in the SO_REUSEPORT group
+	   is determined by the order in which they are created */
+	std::vector<UniqueSocketDescriptor> fds;
+	fds.reserve(sockets.size());
+	for (std::size_t i = 0; i < sockets.size(); ++i) {
+		fds.emplace_back(config.Create(SOCK_STREAM));
+
+		if (cpu_steering) {
+			const int cpu = pool[i].GetCpu();
+			if (cpu < 0)
+				throw std::runtime_error("CPU steering requires pinned threads");
+			cpus.push_back(cpu);
+		}
+	}
+
+	if (cpu_steering)
+		AttachReusePortCpuSteering(fds.front(),
+					   {cpus.data(), cpus.size()});
+
+	for (std::size_t i = 0; i < sockets.size(); ++i) {
+		auto &socket = *sockets[i];
+		pool[i].Call([&socket, &fd = fds[i]]{
+			socket.Listen(std::move(fd));
+		});
+	}
+}
+
+void
+ShardedServerSocket::Close(EventLoop &event_loop) noexcept
+{
+	assert(event_loop.IsInside());
+
+	/* look up the index in the (immutable) pool, not in the
+	   #sockets array, because other threads may be modifying
+	   their #sockets elements concurrently */
+	for (std::size_t i = 0; i < pool.size(); ++i)
+		if (&pool.GetEventLoop(i) == &event_loop)
+			sockets[i].reset();
+}
+
+void
+ShardedServerSocket::Close() noexcept
+{
+	for (std::size_t i = 0; i < sockets.size(); ++i) {
+		if (!sockets[i])
+			continue;
+
+		pool[i].Call([&s = sockets[i]]{
+			s.reset();
+		});
+	}
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct SocketConfig;
+class EventLoop;
+class EventLoopPool;
+class ServerSocket;
+
+/**
+ * Accept connections on one address in all threads of an
+ * #EventLoopPool: each #EventLoop gets its own #ServerSocket, all
+ * bound to the same address with `SO_REUSEPORT`, so the kernel
+ * distributes incoming connections among them and each connection
+ * is handled by the thread which accepted it.
+ *
+ * The #EventLoopPool must be running while Listen() and Close() are
+ * called, and it must outlive this object.
+ */
+class ShardedServerSocket final {
+	EventLoopPool &pool;
+
+	/**
+	 * One #ServerSocket per #EventLoopPool thread (same
+	 * indexes).
+	 */
+	std::vector<std::unique_ptr<ServerSocket>> sockets;
+
+public:
+	/**
+	 * A function which creates a (not yet listening)
+	 * #ServerSocket for the given #EventLoop.  It is invoked
+	 * inside the #EventLoop's thread.
+	 */
+	using Factory = std::function<std::unique_ptr<ServerSocket>(EventLoop &event_loop)>;
+
+	/**
+	 * Create one #ServerSocket per #EventLoopPool thread.
+	 *
+	 * Throws on error (e.g. if the factory throws); sockets
+	 * which have been created already are destroyed.
+	 */
+	ShardedServerSocket(EventLoopPool &_pool, const Factory &factory);
+
+	~ShardedServerSocket() noexcept;
+
+	ShardedServerSocket(const ShardedServerSocket &) = delete;
+	ShardedServerSocket &operator=(const ShardedServerSocket &) = delete;
+
+	/**
+	 * Create one listener socket per thread and register them.
+	 *
+	 * Throws on error.
+	 *
+	 * @param config the socket configuration; #reuse_port is
+	 * implied, and #listen must be non-zero (else
+	 * std::invalid_argument is thrown)
+	 * @param cpu_steering attach a BPF program which lets each
+	 * CPU accept connections only on the socket of the thread
+	 * pinned to it (requires that all threads are pinned)
+	 */
+	void Listen(const SocketConfig &config, bool cpu_steering=false);
+
+	/**
+	 * Close the #ServerSocket which belongs to the given
+	 * #EventLoop.  This must be called inside the #EventLoop's
+	 * thread, e.g. from an EventLoopPool::Shutdown() handler.
+	 */
+	void Close(EventLoop &event_loop) noexcept;
+
+	/**
+	 * Close all #ServerSocket instances (each inside its
+	 * #EventLoop thread).
+	 */
+	void Close() noexcept;
+};
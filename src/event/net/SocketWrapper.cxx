@@ -35,6 +35,10 @@
 #include "net/Buffered.hxx"
 #include "net/MsgHdr.hxx"
 
+#include <utility>
+
+#include <errno.h>
+
 void
 SocketWrapper::SocketEventCallback(unsigned events) noexcept
 {
@@ -69,6 +73,48 @@ SocketWrapper::TimeoutCallback() noexcept
 	handler.OnSocketTimeout();
 }
 
+#ifdef HAVE_URING
+
+void
+SocketWrapper::OnUringSocketReceive() noexcept
+{
+	assert(IsValid());
+
+	if (!uring_read_scheduled)
+		return;
+
+	read_timeout_event.Cancel();
+	handler.OnSocketRead();
+}
+
+void
+SocketWrapper::OnUringSocketReady() noexcept
+{
+	assert(IsValid());
+
+	if (!uring_write_scheduled)
+		return;
+
+	/* the write stays scheduled until UnscheduleWrite() is
+	   called, but unlike a level-triggered EPOLLOUT, this is
+	   invoked only once per completed send (or ScheduleWrite()
+	   call); the same goes for OnUringSocketReceive(), which is
+	   invoked once per completion of the multishot receive, not
+	   again and again while unconsumed data is pending */
+	write_timeout_event.Cancel();
+	handler.OnSocketWrite();
+}
+
+void
+SocketWrapper::OnUringSocketError(int error) noexcept
+{
+	assert(IsValid());
+
+	handler.OnSocketError(error);
+}
+
+#endif
+
 void
 SocketWrapper::Init(SocketDescriptor fd, FdType _fd_type) noexcept
 {
@@ -79,6 +125,43 @@ SocketWrapper::Init(SocketDescriptor fd, FdType _fd_type) noexcept
 	socket_event.Open(fd);
 }
 
+#ifdef HAVE_URING
+
+void
+SocketWrapper::EnableUring(Uring::Queue &queue, Uring::BufferRing &buffers,
+			   bool zerocopy) noexcept
+{
+	assert(IsValid());
+	assert(uring == nullptr);
+
+	const bool read_scheduled = socket_event.IsReadPending();
+	const bool write_scheduled = socket_event.IsWritePending();
+	socket_event.Cancel();
+
+	uring = new UringSocket(GetEventLoop(), queue, buffers,
+				GetSocket(), *this, 16384, zerocopy);
+	uring_read_scheduled = uring_write_scheduled = false;
+
+	if (read_scheduled) {
+		uring_read_scheduled = true;
+		uring->StartReceive();
+	}
+
+	if (write_scheduled) {
+		uring_write_scheduled = true;
+		uring->ScheduleReady();
+	}
+}
+
+inline void
+SocketWrapper::CloseUring() noexcept
+{
+	if (uring != nullptr)
+		std::exchange(uring, nullptr)->Close();
+}
+
+#endif
+
 void
 SocketWrapper::Shutdown() noexcept
 {
@@ -94,6 +177,10 @@ SocketWrapper::Close() noexcept
 	if (!IsValid())
 		return;
 
+#ifdef HAVE_URING
+	CloseUring();
+#endif
+
 	socket_event.Close();
 	read_timeout_event.Cancel();
 	write_timeout_event.Cancel();
@@ -104,6 +191,10 @@ SocketWrapper::Abandon() noexcept
 {
 	assert(IsValid());
 
+#ifdef HAVE_URING
+	CloseUring();
+#endif
+
 	socket_event.Cancel();
 	read_timeout_event.Cancel();
 	write_timeout_event.Cancel();
@@ -126,6 +217,11 @@ SocketWrapper::ReadToBuffer(ForeignFifoBuffer<uint8_t> &buffer) noexcept
 {
 	assert(IsValid());
 
+#ifdef HAVE_URING
+	if (uring != nullptr)
+		return uring->ReadToBuffer(buffer);
+#endif
+
 	return ReceiveToBuffer(GetSocket().Get(), buffer);
 }
 
@@ -134,6 +230,11 @@ SocketWrapper::IsReadyForWriting() const noexcept
 {
 	assert(IsValid());
 
+#ifdef HAVE_URING
+	if (uring != nullptr)
+		return uring->IsReadyForWriting();
+#endif
+
 	return GetSocket().IsReadyForWriting();
 }
 
@@ -142,6 +243,11 @@ SocketWrapper::Write(const void *data, std::size_t length) noexcept
 {
 	assert(IsValid());
 
+#ifdef HAVE_URING
+	if (uring != nullptr)
+		return uring->Send(data, length);
+#endif
+
 	return send(GetSocket().Get(), data, length, MSG_DONTWAIT|MSG_NOSIGNAL);
 }
 
@@ -150,6 +256,11 @@ SocketWrapper::WriteV(const struct iovec *v, std::size_t n) noexcept
 {
 	assert(IsValid());
 
+#ifdef HAVE_URING
+	if (uring != nullptr)
+		return uring->SendV(v, n);
+#endif
+
 	auto m = MakeMsgHdr({v, n});
 
 	return sendmsg(GetSocket().Get(), &m, MSG_DONTWAIT|MSG_NOSIGNAL);
@@ -159,6 +270,15 @@ ssize_t
 SocketWrapper::WriteFrom(int other_fd, FdType other_fd_type,
 			 std::size_t length) noexcept
 {
+#ifdef HAVE_URING
+	if (uring != nullptr && !uring->IsReadyForWriting()) {
+		/* don't overtake data which is still in the send
+		   buffer */
+		errno = EAGAIN;
+		return -1;
+	}
+#endif
+
 	return SpliceToSocket(other_fd_type, other_fd,
 			      GetSocket().Get(), length);
 }
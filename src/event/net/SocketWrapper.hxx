@@ -33,10 +33,15 @@
 #pragma once
 
 #include "io/FdType.hxx"
+#include "io/uring/config.h"
 #include "event/SocketEvent.hxx"
 #include "event/CoarseTimerEvent.hxx"
 #include "net/SocketDescriptor.hxx"
 
+#ifdef HAVE_URING
+#include "UringSocket.hxx"
+#endif
+
 #include <cstddef>
 
 #include <sys/types.h>
@@ -75,7 +80,11 @@ public:
 	virtual bool OnSocketError(int error) noexcept = 0;
 };
 
-class SocketWrapper {
+class SocketWrapper
+#ifdef HAVE_URING
+	: UringSocketHandler
+#endif
+{
 	FdType fd_type;
 
 	SocketEvent socket_event;
@@ -83,6 +92,19 @@ class SocketWrapper {
 
 	SocketHandler &handler;
 
+#ifdef HAVE_URING
+	/**
+	 * If not nullptr, then I/O is done with io_uring instead of
+	 * #socket_event.  See EnableUring().
+	 */
+	UringSocket *uring = nullptr;
+
+	/**
+	 * The emulated "scheduled" flags for io_uring mode.
+	 */
+	bool uring_read_scheduled, uring_write_scheduled;
+#endif
+
 public:
 	SocketWrapper(EventLoop &event_loop, SocketHandler &_handler) noexcept
 		:socket_event(event_loop, BIND_THIS_METHOD(SocketEventCallback)),
@@ -98,6 +120,25 @@ public:
 
 	void Init(SocketDescriptor _fd, FdType _fd_type) noexcept;
 
+#ifdef HAVE_URING
+	/**
+	 * Switch to io_uring mode: receive with a multishot
+	 * `IORING_OP_RECV` into buffers from the given
+	 * #Uring::BufferRing and send with `IORING_OP_SEND` (see
+	 * #UringSocket).  This must be called right after Init(),
+	 * before any I/O is done.  The mode ends with Close() or
+	 * Abandon().
+	 *
+	 * @param zerocopy use `IORING_OP_SEND_ZC`
+	 */
+	void EnableUring(Uring::Queue &queue, Uring::BufferRing &buffers,
+			 bool zerocopy=false) noexcept;
+
+	bool IsUring() const noexcept {
+		return uring != nullptr;
+	}
+#endif
+
 	/**
 	 * Shut down the socket gracefully, allowing the TCP stack to
 	 * complete all pending transfers.  If you call Close() without
@@ -139,7 +180,13 @@ public:
 	void ScheduleRead(Event::Duration timeout) noexcept {
 		assert(IsValid());
 
-		socket_event.ScheduleRead();
+#ifdef HAVE_URING
+		if (uring != nullptr) {
+			uring_read_scheduled = true;
+			uring->StartReceive();
+		} else
+#endif
+			socket_event.ScheduleRead();
 
 		if (timeout < timeout.zero())
 			read_timeout_event.Cancel();
@@ -148,7 +195,14 @@ public:
 	}
 
 	void UnscheduleRead() noexcept {
-		socket_event.CancelRead();
+#ifdef HAVE_URING
+		if (uring != nullptr) {
+			uring_read_scheduled = false;
+			uring->StopReceive();
+		} else
+#endif
+			socket_event.CancelRead();
+
 		read_timeout_event.Cancel();
 	}
 
@@ -159,7 +213,13 @@ public:
 	void ScheduleWrite(Event::Duration timeout) noexcept {
 		assert(IsValid());
 
-		socket_event.ScheduleWrite();
+#ifdef HAVE_URING
+		if (uring != nullptr) {
+			uring_write_scheduled = true;
+			uring->ScheduleReady();
+		} else
+#endif
+			socket_event.ScheduleWrite();
 
 		if (timeout < timeout.zero())
 			write_timeout_event.Cancel();
@@ -168,17 +228,34 @@ public:
 	}
 
 	void UnscheduleWrite() noexcept {
-		socket_event.CancelWrite();
+#ifdef HAVE_URING
+		if (uring != nullptr) {
+			uring_write_scheduled = false;
+			uring->CancelReady();
+		} else
+#endif
+			socket_event.CancelWrite();
+
 		write_timeout_event.Cancel();
 	}
 
 	[[gnu::pure]]
 	bool IsReadPending() const noexcept {
+#ifdef HAVE_URING
+		if (uring != nullptr)
+			return uring_read_scheduled;
+#endif
+
 		return socket_event.IsReadPending();
 	}
 
 	[[gnu::pure]]
 	bool IsWritePending() const noexcept {
+#ifdef HAVE_URING
+		if (uring != nullptr)
+			return uring_write_scheduled;
+#endif
+
 		return socket_event.IsWritePending();
 	}
 
@@ -195,6 +272,17 @@ public:
 			  std::size_t length) noexcept;
 
 private:
+#ifdef HAVE_URING
+	void CloseUring() noexcept;
+#endif
+
 	void SocketEventCallback(unsigned events) noexcept;
 	void TimeoutCallback() noexcept;
+
+#ifdef HAVE_URING
+	/* virtual methods from class UringSocketHandler */
+	void OnUringSocketReceive() noexcept override;
+	void OnUringSocketReady() noexcept override;
+	void OnUringSocketError(int error) noexcept override;
+#endif
 };
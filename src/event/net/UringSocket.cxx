@@ -0,0 +1,418 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "UringSocket.hxx"
+#include "io/uring/Queue.hxx"
+#include "io/uring/BufferRing.hxx"
+#include "util/ForeignFifoBuffer.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/**
+ * How long to wait before retrying after a temporary failure (full
+ * submission queue, exhausted #BufferRing)?
+ */
+static constexpr Event::Duration URING_SOCKET_RETRY_DELAY =
+	std::chrono::milliseconds(10);
+
+UringSocket::UringSocket(EventLoop &event_loop,
+			 Uring::Queue &_queue, Uring::BufferRing &_buffers,
+			 SocketDescriptor _fd, UringSocketHandler &_handler,
+			 std::size_t _send_buffer_size,
+			 bool _zerocopy) noexcept
+	:queue(_queue), buffers(_buffers), fd(_fd), handler(&_handler),
+	 defer_receive(event_loop, BIND_THIS_METHOD(OnDeferredReceive)),
+	 defer_ready(event_loop, BIND_THIS_METHOD(OnDeferredReady)),
+	 retry_timer(event_loop, BIND_THIS_METHOD(OnRetryTimer)),
+	 send_buffer_size(_send_buffer_size),
+	 zerocopy(_zerocopy)
+{
+}
+
+void
+UringSocket::Close() noexcept
+{
+	assert(handler != nullptr);
+
+	handler = nullptr;
+	want_receive = false;
+	defer_receive.Cancel();
+	defer_ready.Cancel();
+	retry_timer.Cancel();
+
+	for (const auto &i : received)
+		buffers.Recycle(i.id);
+	received.clear();
+
+	if (IsIdle()) {
+		delete this;
+		return;
+	}
+
+	/* the remaining completions will be handled by
+	   OnReceiveCompletion() and OnSendCompletion(), which free
+	   this object after the final one (without
+	   IORING_CQE_F_MORE); if no submission queue entry is
+	   available, the #Queue postpones the cancel requests, but
+	   it doesn't drop them */
+	queue.RequestCancel(receive_operation);
+	queue.RequestCancel(send_operation);
+}
+
+inline void
+UringSocket::Arm() noexcept
+{
+	if (receive_operation.IsUringPending() ||
+	    receive_end || receive_error != 0)
+		return;
+
+	auto *s = queue.GetSubmitEntry();
+	if (s == nullptr) {
+		/* the submission queue is full; this is only a
+		   temporary condition */
+		retry_timer.ScheduleEarlier(URING_SOCKET_RETRY_DELAY);
+		return;
+	}
+
+	receive_stalled = false;
+
+	io_uring_prep_recv_multishot(s, fd.Get(), nullptr, 0, 0);
+	s->flags |= IOSQE_BUFFER_SELECT;
+	s->buf_group = buffers.GetGroup();
+	queue.Push(*s, receive_operation);
+}
+
+void
+UringSocket::StartReceive() noexcept
+{
+	want_receive = true;
+
+	if (HasReceived())
+		defer_receive.Schedule();
+	else
+		Arm();
+}
+
+void
+UringSocket::StopReceive() noexcept
+{
+	want_receive = false;
+	defer_receive.Cancel();
+
+	/* canceling the multishot operation stops the kernel from
+	   filling more provided buffers for this socket */
+	queue.RequestCancel(receive_operation);
+}
+
+ssize_t
+UringSocket::ReadToBuffer(ForeignFifoBuffer<uint8_t> &buffer) noexcept
+{
+	auto w = buffer.Write();
+	if (w.empty())
+		return -2;
+
+	std::size_t nbytes = 0;
+	bool recycled = false;
+	while (!received.empty() && nbytes < w.size) {
+		auto &chunk = received.front();
+		const std::size_t n = std::min<std::size_t>(chunk.end - chunk.position,
+							    w.size - nbytes);
+		memcpy(w.data + nbytes,
+		       buffers.GetBuffer(chunk.id) + chunk.position, n);
+		nbytes += n;
+		chunk.position += n;
+
+		if (chunk.position == chunk.end) {
+			buffers.Recycle(chunk.id);
+			received.pop_front();
+			recycled = true;
+		}
+	}
+
+	/* resubmit the receive operation if it was stopped by the
+	   kernel; after ENOBUFS, wait until we have given buffers
+	   back to the ring, or else the kernel would fail again
+	   immediately */
+	if (want_receive && (!receive_stalled || recycled))
+		Arm();
+
+	if (nbytes > 0) {
+		buffer.Append(nbytes);
+		return nbytes;
+	}
+
+	if (receive_error != 0) {
+		errno = receive_error;
+		return -1;
+	}
+
+	if (receive_end)
+		return 0;
+
+	errno = EAGAIN;
+	return -1;
+}
+
+void
+UringSocket::ScheduleReady() noexcept
+{
+	if (IsReadyForWriting())
+		defer_ready.Schedule();
+
+	/* else OnSendCompletion() will invoke the handler */
+}
+
+inline std::byte *
+UringSocket::PrepareSend() noexcept
+{
+	if (send_error != 0) {
+		errno = send_error;
+		return nullptr;
+	}
+
+	if (!IsReadyForWriting()) {
+		errno = EAGAIN;
+		return nullptr;
+	}
+
+	if (send_buffer == nullptr) {
+		send_buffer.reset(new (std::nothrow) std::byte[send_buffer_size]);
+		if (send_buffer == nullptr) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+	}
+
+	return send_buffer.get();
+}
+
+bool
+UringSocket::SubmitSend() noexcept
+{
+	assert(send_position < send_end);
+	assert(!send_operation.IsUringPending());
+
+	auto *s = queue.GetSubmitEntry();
+	if (s == nullptr)
+		return false;
+
+	const auto *data = send_buffer.get() + send_position;
+	const std::size_t size = send_end - send_position;
+
+	if (zerocopy)
+		io_uring_prep_send_zc(s, fd.Get(), data, size,
+				      MSG_NOSIGNAL, 0);
+	else
+		io_uring_prep_send(s, fd.Get(), data, size, MSG_NOSIGNAL);
+
+	queue.Push(*s, send_operation);
+	return true;
+}
+
+inline ssize_t
+UringSocket::SubmitSend(std::size_t size) noexcept
+{
+	send_position = 0;
+	send_end = size;
+
+	if (!SubmitSend()) {
+		send_end = 0;
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return size;
+}
+
+ssize_t
+UringSocket::Send(const void *data, std::size_t size) noexcept
+{
+	auto *p = PrepareSend();
+	if (p == nullptr)
+		return -1;
+
+	size = std::min(size, send_buffer_size);
+	memcpy(p, data, size);
+	return SubmitSend(size);
+}
+
+ssize_t
+UringSocket::SendV(const struct iovec *v, std::size_t n) noexcept
+{
+	auto *p = PrepareSend();
+	if (p == nullptr)
+		return -1;
+
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < n && size < send_buffer_size; ++i) {
+		const std::size_t chunk = std::min(v[i].iov_len,
+						   send_buffer_size - size);
+		memcpy(p + size, v[i].iov_base, chunk);
+		size += chunk;
+	}
+
+	return SubmitSend(size);
+}
+
+inline void
+UringSocket::OnReceiveCompletion(int res, unsigned flags) noexcept
+{
+	if (flags & IORING_CQE_F_BUFFER) {
+		const unsigned id = Uring::BufferRing::GetBufferId(flags);
+		if (res > 0 && handler != nullptr)
+			received.push_back({uint_least16_t(id), 0,
+					    uint_least32_t(res)});
+		else
+			buffers.Recycle(id);
+	}
+
+	const bool more = flags & IORING_CQE_F_MORE;
+
+	if (handler == nullptr) {
+		/* Close() has been called */
+		if (more)
+			/* the multishot operation is still armed;
+			   make sure it gets canceled (this is a no-op
+			   if the cancel request is still postponed) */
+			queue.RequestCancel(receive_operation);
+		else if (IsIdle())
+			delete this;
+		return;
+	}
+
+	if (res == 0)
+		receive_end = true;
+	else if (res == -ECANCELED) {
+		/* canceled by StopReceive(); resubmit if
+		   StartReceive() was called meanwhile */
+		if (!more && want_receive)
+			Arm();
+		return;
+	} else if (res == -ENOBUFS) {
+		/* the ring has run out of buffers, which ends the
+		   multishot operation */
+		receive_stalled = true;
+
+		if (received.empty()) {
+			/* all buffers are owned by other sockets
+			   sharing the ring; we can't free any, so try
+			   again later */
+			retry_timer.ScheduleEarlier(URING_SOCKET_RETRY_DELAY);
+			return;
+		}
+
+		/* else the handler's ReadToBuffer() call recycles
+		   our buffers and resubmits the receive
+		   operation */
+	} else if (res < 0)
+		receive_error = -res;
+
+	if (want_receive)
+		handler->OnUringSocketReceive();
+}
+
+inline void
+UringSocket::OnSendCompletion(int res, unsigned flags) noexcept
+{
+	if (flags & IORING_CQE_F_NOTIF) {
+		/* the kernel doesn't need the zero-copy buffer
+		   anymore; now evaluate the result */
+		res = send_result;
+	} else if (flags & IORING_CQE_F_MORE) {
+		/* a zero-copy notification will follow */
+		send_result = res;
+		return;
+	}
+
+	if (handler == nullptr) {
+		if (IsIdle())
+			delete this;
+		return;
+	}
+
+	if (res < 0) {
+		send_error = -res;
+		send_position = send_end = 0;
+		handler->OnUringSocketError(send_error);
+		return;
+	}
+
+	send_position += res;
+	if (send_position < send_end) {
+		/* partial send: submit the rest; if the submission
+		   queue is full, OnRetryTimer() does it */
+		if (!SubmitSend())
+			retry_timer.ScheduleEarlier(URING_SOCKET_RETRY_DELAY);
+		return;
+	}
+
+	send_position = send_end = 0;
+	handler->OnUringSocketReady();
+}
+
+void
+UringSocket::OnDeferredReceive() noexcept
+{
+	assert(handler != nullptr);
+
+	if (want_receive)
+		handler->OnUringSocketReceive();
+}
+
+void
+UringSocket::OnDeferredReady() noexcept
+{
+	assert(handler != nullptr);
+
+	if (IsReadyForWriting())
+		handler->OnUringSocketReady();
+}
+
+void
+UringSocket::OnRetryTimer() noexcept
+{
+	assert(handler != nullptr);
+
+	if (want_receive)
+		Arm();
+
+	if (send_position < send_end && !send_operation.IsUringPending() &&
+	    !SubmitSend())
+		retry_timer.Schedule(URING_SOCKET_RETRY_DELAY);
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "io/uring/Operation.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+#include <sys/types.h>
+
+struct iovec;
+template<typename T> class ForeignFifoBuffer;
+
+namespace Uring {
+class Queue;
+class BufferRing;
+}
+
+class UringSocketHandler {
+public:
+	/**
+	 * Data, the end of the stream or an error has been received.
+	 * Call UringSocket::ReadToBuffer() to obtain it.
+	 */
+	virtual void OnUringSocketReceive() noexcept = 0;
+
+	/**
+	 * All data passed to UringSocket::Send() has been sent, and
+	 * the send buffer can be filled again.
+	 */
+	virtual void OnUringSocketReady() noexcept = 0;
+
+	/**
+	 * Sending has failed.
+	 *
+	 * @param error an errno value
+	 */
+	virtual void OnUringSocketError(int error) noexcept = 0;
+};
+
+/**
+ * Socket I/O using io_uring instead of readiness notifications: a
+ * multishot `IORING_OP_RECV` receives into buffers picked by the
+ * kernel from a #Uring::BufferRing, and `IORING_OP_SEND` (or
+ * `IORING_OP_SEND_ZC`) sends from an internal send buffer.  The
+ * methods mimic the non-blocking system calls (including `errno`),
+ * so #SocketWrapper can use this class as a drop-in replacement.
+ *
+ * Instances must be created with `new`.  They are freed by Close(),
+ * which may have to wait for pending operations to be finished by
+ * the kernel, because those still own provided buffers and the send
+ * buffer.
+ */
+class UringSocket final {
+	Uring::Queue &queue;
+	Uring::BufferRing &buffers;
+
+	const SocketDescriptor fd;
+
+	/**
+	 * The handler; nullptr after Close() was called.
+	 */
+	UringSocketHandler *handler;
+
+	class ReceiveOperation final : public Uring::Operation {
+		UringSocket &parent;
+
+	public:
+		explicit ReceiveOperation(UringSocket &_parent) noexcept
+			:parent(_parent) {}
+
+	private:
+		/* virtual methods from class Uring::Operation */
+		void OnUringCompletion(int res) noexcept override {
+			OnUringCompletionFlags(res, 0);
+		}
+
+		void OnUringCompletionFlags(int res, unsigned flags) noexcept override {
+			parent.OnReceiveCompletion(res, flags);
+		}
+	};
+
+	class SendOperation final : public Uring::Operation {
+		UringSocket &parent;
+
+	public:
+		explicit SendOperation(UringSocket &_parent) noexcept
+			:parent(_parent) {}
+
+	private:
+		/* virtual methods from class Uring::Operation */
+		void OnUringCompletion(int res) noexcept override {
+			OnUringCompletionFlags(res, 0);
+		}
+
+		void OnUringCompletionFlags(int res, unsigned flags) noexcept override {
+			parent.OnSendCompletion(res, flags);
+		}
+	};
+
+	ReceiveOperation receive_operation{*this};
+	SendOperation send_operation{*this};
+
+	/**
+	 * Invokes UringSocketHandler::OnUringSocketReceive() for
+	 * data which has been received already.
+	 */
+	DeferEvent defer_receive;
+
+	/**
+	 * Invokes UringSocketHandler::OnUringSocketReady() if the
+	 * send buffer is already empty.
+	 */
+	DeferEvent defer_ready;
+
+	/**
+	 * Retries submitting an operation after a temporary failure,
+	 * i.e. a full submission queue or (for the receive
+	 * operation) an exhausted #BufferRing.
+	 */
+	FineTimerEvent retry_timer;
+
+	/**
+	 * A portion of a provided buffer which contains received data
+	 * not yet consumed by ReadToBuffer().
+	 */
+	struct Chunk {
+		uint_least16_t id;
+		uint_least32_t position, end;
+	};
+
+	std::deque<Chunk> received;
+
+	/**
+	 * The errno value of a failed receive operation (or 0).
+	 */
+	int receive_error = 0;
+
+	/**
+	 * The send buffer, allocated on the first Send() call.  It
+	 * must not be modified while #send_operation is pending.
+	 */
+	std::unique_ptr<std::byte[]> send_buffer;
+
+	const std::size_t send_buffer_size;
+
+	/**
+	 * The range of #send_buffer which has not yet been sent.
+	 */
+	std::size_t send_position = 0, send_end = 0;
+
+	/**
+	 * The result of a zero-copy send; it gets evaluated after the
+	 * kernel's notification has been received.
+	 */
+	int send_result;
+
+	/**
+	 * The errno value of a failed send operation (or 0).
+	 */
+	int send_error = 0;
+
+	/**
+	 * Has the peer closed the socket?
+	 */
+	bool receive_end = false;
+
+	/**
+	 * Does the handler want to receive data?
+	 */
+	bool want_receive = false;
+
+	/**
+	 * Was the multishot receive operation stopped by the kernel
+	 * because the #BufferRing had run out of buffers (ENOBUFS)?
+	 * It is resubmitted only after buffers have been recycled or
+	 * after #retry_timer has expired.
+	 */
+	bool receive_stalled = false;
+
+	const bool zerocopy;
+
+public:
+	/**
+	 * @param send_buffer_size the maximum number of bytes per
+	 * send operation
+	 * @param zerocopy use `IORING_OP_SEND_ZC`, which avoids
+	 * copying the send buffer to the kernel (worthwhile only for
+	 * large buffers)
+	 */
+	UringSocket(EventLoop &event_loop,
+		    Uring::Queue &_queue, Uring::BufferRing &_buffers,
+		    SocketDescriptor _fd, UringSocketHandler &_handler,
+		    std::size_t _send_buffer_size=16384,
+		    bool _zerocopy=false) noexcept;
+
+	UringSocket(const UringSocket &) = delete;
+	UringSocket &operator=(const UringSocket &) = delete;
+
+	/**
+	 * Stop all I/O and free this object as soon as the kernel
+	 * has delivered the final completion of each pending
+	 * operation.  The caller may close the socket right after
+	 * this call.
+	 */
+	void Close() noexcept;
+
+	/**
+	 * Start receiving (if not already doing so).  The handler
+	 * will be invoked as soon as data is available.
+	 */
+	void StartReceive() noexcept;
+
+	/**
+	 * Stop receiving.  Data which arrives while the receive
+	 * operation is being canceled is kept for the next
+	 * ReadToBuffer() call.
+	 */
+	void StopReceive() noexcept;
+
+	/**
+	 * Move received data to the given buffer.  The return value
+	 * is the same as ReceiveToBuffer().
+	 *
+	 * @return the number of bytes, 0 if the peer has closed the
+	 * socket, -1 on error (with `errno`, `EAGAIN` if no data is
+	 * available), -2 if the buffer is full
+	 */
+	ssize_t ReadToBuffer(ForeignFifoBuffer<uint8_t> &buffer) noexcept;
+
+	/**
+	 * Is there received data (or end-of-stream or an error)
+	 * which can be obtained with ReadToBuffer()?
+	 */
+	bool HasReceived() const noexcept {
+		return !received.empty() || receive_end || receive_error != 0;
+	}
+
+	/**
+	 * Can Send() accept more data now?
+	 */
+	bool IsReadyForWriting() const noexcept {
+		return !send_operation.IsUringPending() &&
+			send_position == send_end;
+	}
+
+	/**
+	 * Invoke UringSocketHandler::OnUringSocketReady() as soon as
+	 * the send buffer is empty.
+	 */
+	void ScheduleReady() noexcept;
+
+	void CancelReady() noexcept {
+		defer_ready.Cancel();
+	}
+
+	/**
+	 * Copy data to the send buffer and submit a send operation.
+	 *
+	 * @return the number of bytes accepted or -1 on error (with
+	 * `errno`; `EAGAIN` if a send operation is still pending)
+	 */
+	ssize_t Send(const void *data, std::size_t size) noexcept;
+
+	ssize_t SendV(const struct iovec *v, std::size_t n) noexcept;
+
+private:
+	~UringSocket() noexcept = default;
+
+	bool IsIdle() const noexcept {
+		return !receive_operation.IsUringPending() &&
+			!send_operation.IsUringPending();
+	}
+
+	/**
+	 * Submit the multishot receive operation if it is not
+	 * already pending.  If the submission queue is full, this is
+	 * retried by #retry_timer.
+	 */
+	void Arm() noexcept;
+
+	std::byte *PrepareSend() noexcept;
+	ssize_t SubmitSend(std::size_t size) noexcept;
+	bool SubmitSend() noexcept;
+
+	void OnReceiveCompletion(int res, unsigned flags) noexcept;
+	void OnSendCompletion(int res, unsigned flags) noexcept;
+
+	void OnDeferredReceive() noexcept;
+	void OnDeferredReady() noexcept;
+	void OnRetryTimer() noexcept;
+};
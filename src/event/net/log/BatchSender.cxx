@@ -0,0 +1,162 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BatchSender.hxx"
+#include "net/log/Serializer.hxx"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <errno.h>
+#include <sys/socket.h>
+
+namespace Net {
+namespace Log {
+
+BatchSender::BatchSender(EventLoop &event_loop, SocketDescriptor _socket,
+			 std::size_t _n_slots, std::size_t _slot_size)
+	:socket_event(event_loop, BIND_THIS_METHOD(OnSocketReady), _socket),
+	 flush_event(event_loop, BIND_THIS_METHOD(Flush)),
+	 n_slots(_n_slots), slot_size(_slot_size),
+	 buffer(new std::byte[n_slots * slot_size]),
+	 iovecs(new struct iovec[n_slots]),
+	 messages(new struct mmsghdr[n_slots])
+{
+	if (n_slots == 0)
+		throw std::invalid_argument("No slots");
+
+	for (std::size_t i = 0; i < n_slots; ++i) {
+		iovecs[i] = {GetSlot(i), 0};
+
+		auto &m = messages[i];
+		m = {};
+		m.msg_hdr.msg_iov = &iovecs[i];
+		m.msg_hdr.msg_iovlen = 1;
+	}
+}
+
+BatchSender::~BatchSender() noexcept
+{
+	/* last chance to deliver queued datagrams; whatever does
+	   not fit into the socket buffer is lost */
+	Flush();
+}
+
+bool
+BatchSender::Send(const Datagram &d) noexcept
+{
+	if (IsFull()) {
+		++stats.dropped;
+		return false;
+	}
+
+	const std::size_t i = (head + n_queued) % n_slots;
+
+	try {
+		iovecs[i].iov_len = Serialize(GetSlot(i), slot_size, d);
+	} catch (const BufferTooSmall &) {
+		++stats.too_large;
+		return false;
+	}
+
+	++n_queued;
+
+	if (IsCongested())
+		/* OnSocketReady() will flush */
+		return true;
+
+	if (IsFull())
+		Flush();
+	else
+		flush_event.Schedule();
+
+	return true;
+}
+
+inline void
+BatchSender::Consume(std::size_t n) noexcept
+{
+	head = (head + n) % n_slots;
+	n_queued -= n;
+}
+
+void
+BatchSender::Flush() noexcept
+{
+	flush_event.Cancel();
+
+	while (n_queued > 0) {
+		/* the queue may wrap around; send the first part
+		   now, and the rest in the next iteration */
+		const std::size_t n = std::min(n_queued, n_slots - head);
+
+		++stats.syscalls;
+		int result = sendmmsg(socket_event.GetSocket().Get(),
+				      &messages[head], n,
+				      MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EINTR)
+				/* interrupted by a signal: try again
+				   right away */
+				continue;
+
+			if (errno == EAGAIN) {
+				/* the socket buffer is full: try again
+				   as soon as it is writable */
+				socket_event.ScheduleWrite();
+				return;
+			}
+
+			/* discard the failed datagram (e.g. no
+			   receiver listening) and continue with the
+			   next one */
+			++stats.errors;
+			Consume(1);
+			continue;
+		}
+
+		stats.sent += result;
+		Consume(result);
+	}
+
+	socket_event.CancelWrite();
+}
+
+void
+BatchSender::OnSocketReady(unsigned) noexcept
+{
+	/* this also cancels the event if all datagrams have been
+	   sent; a socket error will be reported by sendmmsg() */
+	Flush();
+}
+
+}}
@@ -0,0 +1,206 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/DeferEvent.hxx"
+#include "event/SocketEvent.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <cstddef>
+#include <memory>
+
+struct mmsghdr;
+struct iovec;
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+struct BatchSenderStats {
+	/**
+	 * The number of datagrams which were sent successfully.
+	 */
+	std::size_t sent = 0;
+
+	/**
+	 * The number of datagrams which were discarded because the
+	 * queue was full.
+	 */
+	std::size_t dropped = 0;
+
+	/**
+	 * The number of datagrams which were discarded because they
+	 * did not fit into a slot.
+	 */
+	std::size_t too_large = 0;
+
+	/**
+	 * The number of datagrams which were discarded because
+	 * sendmmsg() has failed.
+	 */
+	std::size_t errors = 0;
+
+	/**
+	 * The number of sendmmsg() system calls.
+	 */
+	std::size_t syscalls = 0;
+
+	template<typename V>
+	void Visit(V &&v) const {
+		v("sent", sent);
+		v("dropped", dropped);
+		v("too_large", too_large);
+		v("errors", errors);
+		v("syscalls", syscalls);
+	}
+};
+
+/**
+ * Sends log datagrams in batches: Send() serializes the #Datagram
+ * into a preallocated slot, and all queued datagrams are sent with
+ * one sendmmsg() call at the end of the current #EventLoop iteration
+ * (or as soon as all slots are occupied).  After construction, no
+ * memory is allocated.
+ *
+ * If the socket buffer is full, the datagrams remain queued until
+ * the socket becomes writable again; meanwhile, new datagrams are
+ * discarded when the queue is full.
+ *
+ * The destructor attempts to flush all queued datagrams, but it
+ * cannot wait for the socket to become writable; datagrams which do
+ * not fit into the socket buffer at that point are discarded.
+ */
+class BatchSender final {
+	SocketEvent socket_event;
+
+	DeferEvent flush_event;
+
+	const std::size_t n_slots, slot_size;
+
+	const std::unique_ptr<std::byte[]> buffer;
+	const std::unique_ptr<struct iovec[]> iovecs;
+	const std::unique_ptr<struct mmsghdr[]> messages;
+
+	/**
+	 * The index of the oldest queued datagram.
+	 */
+	std::size_t head = 0;
+
+	/**
+	 * The number of queued datagrams.
+	 */
+	std::size_t n_queued = 0;
+
+	BatchSenderStats stats;
+
+public:
+	/**
+	 * Throws std::bad_alloc on error, and std::invalid_argument
+	 * if #_n_slots is zero.
+	 *
+	 * @param _socket a connected datagram socket (owned by
+	 * caller; must remain open until this object is destroyed)
+	 * @param _n_slots the maximum number of queued datagrams
+	 * (must not be zero)
+	 * @param _slot_size the maximum size of a serialized
+	 * datagram
+	 */
+	BatchSender(EventLoop &event_loop, SocketDescriptor _socket,
+		    std::size_t _n_slots=64, std::size_t _slot_size=4096);
+
+	/**
+	 * Calls Flush() one last time; see class documentation.
+	 */
+	~BatchSender() noexcept;
+
+	BatchSender(const BatchSender &) = delete;
+	BatchSender &operator=(const BatchSender &) = delete;
+
+	EventLoop &GetEventLoop() const noexcept {
+		return flush_event.GetEventLoop();
+	}
+
+	const BatchSenderStats &GetStats() const noexcept {
+		return stats;
+	}
+
+	std::size_t GetQueueLength() const noexcept {
+		return n_queued;
+	}
+
+	/**
+	 * Is the queue full?  Until it gets flushed, Send() will
+	 * discard all datagrams.
+	 */
+	[[gnu::pure]]
+	bool IsFull() const noexcept {
+		return n_queued == n_slots;
+	}
+
+	/**
+	 * Is the receiver too slow, i.e. are we waiting for the
+	 * socket to become writable?  Callers may use this to
+	 * throttle log output.
+	 */
+	[[gnu::pure]]
+	bool IsCongested() const noexcept {
+		return socket_event.IsWritePending();
+	}
+
+	/**
+	 * Queue a datagram for sending.  All pointed-to data is
+	 * copied, so it may be freed after returning.
+	 *
+	 * @return false if the datagram was discarded (because the
+	 * queue is full or the datagram is too large)
+	 */
+	bool Send(const Datagram &d) noexcept;
+
+	/**
+	 * Send all queued datagrams now (as far as the socket buffer
+	 * allows).
+	 */
+	void Flush() noexcept;
+
+private:
+	std::byte *GetSlot(std::size_t i) noexcept {
+		return buffer.get() + i * slot_size;
+	}
+
+	void Consume(std::size_t n) noexcept;
+
+	void OnSocketReady(unsigned events) noexcept;
+};
+
+}}
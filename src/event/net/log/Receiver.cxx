@@ -0,0 +1,125 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Receiver.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/Parser.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "system/Error.hxx"
+#include "util/ConstBuffer.hxx"
+
+namespace Net {
+namespace Log {
+
+Receiver::Receiver(EventLoop &event_loop, UniqueSocketDescriptor _socket,
+		   ReceiverHandler &_handler,
+		   std::size_t max_datagrams,
+		   std::size_t _max_payload_size)
+	:event(event_loop, BIND_THIS_METHOD(EventCallback), _socket.Release()),
+	 max_payload_size(_max_payload_size),
+	 /* one extra byte to detect truncated datagrams and to
+	    null-terminate the payload */
+	 multi(max_datagrams, max_payload_size + 1),
+	 datagrams(new Datagram[max_datagrams]),
+	 handler(_handler)
+{
+	event.ScheduleRead();
+}
+
+Receiver::~Receiver() noexcept
+{
+	event.Close();
+}
+
+std::size_t
+Receiver::ReceiveBatch()
+{
+	if (!multi.Receive(GetSocket()))
+		/* a datagram socket can't hang up */
+		return 0;
+
+	std::size_t n_received = 0, n_valid = 0;
+
+	for (auto &i : multi) {
+		++n_received;
+
+		if (i.payload.size > max_payload_size) {
+			++stats.truncated;
+			continue;
+		}
+
+		/* the parser relies on null-terminated strings; the
+		   buffer has room for one more byte, so this
+		   guarantees that a malformed datagram can't make it
+		   read past the payload */
+		auto *payload = (char *)const_cast<void *>(i.payload.data);
+		payload[i.payload.size] = 0;
+
+		try {
+			datagrams[n_valid] = ParseDatagram(i.payload);
+			++n_valid;
+		} catch (const ProtocolError &) {
+			++stats.malformed;
+		}
+	}
+
+	if (n_received == 0)
+		return 0;
+
+	++stats.batches;
+	stats.received += n_valid;
+
+	if (n_valid > 0 &&
+	    !handler.OnLogDatagrams({datagrams.get(), n_valid}))
+		return n_received;
+
+	multi.Clear();
+	return n_received;
+}
+
+void
+Receiver::EventCallback(unsigned events) noexcept
+try {
+	if (events & event.ERROR)
+		throw MakeErrno(event.GetSocket().GetError(),
+				"Socket error");
+
+	ReceiveBatch();
+} catch (...) {
+	/* unregister the SocketEvent, just in case the handler does
+	   not destroy us */
+	event.Cancel();
+
+	handler.OnLogReceiverError(std::current_exception());
+}
+
+}}
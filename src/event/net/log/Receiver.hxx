@@ -0,0 +1,185 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/SocketEvent.hxx"
+#include "net/MultiReceiveMessage.hxx"
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+
+template<typename T> struct ConstBuffer;
+class UniqueSocketDescriptor;
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+struct ReceiverStats {
+	/**
+	 * The number of datagrams which were parsed successfully.
+	 */
+	std::size_t received = 0;
+
+	/**
+	 * The number of datagrams which were discarded because they
+	 * were malformed (or had a bad CRC).
+	 */
+	std::size_t malformed = 0;
+
+	/**
+	 * The number of datagrams which were discarded because they
+	 * were larger than the configured maximum payload size.
+	 */
+	std::size_t truncated = 0;
+
+	/**
+	 * The number of recvmmsg() system calls which returned at
+	 * least one datagram.
+	 */
+	std::size_t batches = 0;
+
+	template<typename V>
+	void Visit(V &&v) const {
+		v("received", received);
+		v("malformed", malformed);
+		v("truncated", truncated);
+		v("batches", batches);
+	}
+};
+
+class ReceiverHandler {
+public:
+	/**
+	 * A batch of datagrams has been received and parsed.  All
+	 * pointers in the #Datagram objects refer to the receive
+	 * buffer and are only valid until this method returns.
+	 *
+	 * @return false if the #Receiver was destroyed inside this
+	 * method
+	 */
+	virtual bool OnLogDatagrams(ConstBuffer<Datagram> datagrams) noexcept = 0;
+
+	/**
+	 * An I/O error has occurred, and the socket is defunct.
+	 * After returning, it is assumed that the #Receiver has been
+	 * destroyed.
+	 */
+	virtual void OnLogReceiverError(std::exception_ptr ep) noexcept = 0;
+};
+
+/**
+ * Receives log datagrams in batches with recvmmsg(), parses them
+ * (verifying their CRC) and passes all valid datagrams of one batch
+ * to the #ReceiverHandler with one call.  Malformed datagrams are
+ * discarded and counted.  After construction, no memory is
+ * allocated.
+ */
+class Receiver final {
+	SocketEvent event;
+
+	const std::size_t max_payload_size;
+
+	MultiReceiveMessage multi;
+
+	const std::unique_ptr<Datagram[]> datagrams;
+
+	ReceiverHandler &handler;
+
+	ReceiverStats stats;
+
+public:
+	/**
+	 * Throws std::bad_alloc on error.
+	 *
+	 * @param _socket a non-blocking datagram socket
+	 * @param max_datagrams the maximum number of datagrams
+	 * received with one system call
+	 * @param _max_payload_size the maximum size of a datagram;
+	 * larger ones are discarded
+	 */
+	Receiver(EventLoop &event_loop, UniqueSocketDescriptor _socket,
+		 ReceiverHandler &_handler,
+		 std::size_t max_datagrams=256,
+		 std::size_t _max_payload_size=4096);
+
+	~Receiver() noexcept;
+
+	Receiver(const Receiver &) = delete;
+	Receiver &operator=(const Receiver &) = delete;
+
+	auto &GetEventLoop() const noexcept {
+		return event.GetEventLoop();
+	}
+
+	SocketDescriptor GetSocket() const noexcept {
+		return event.GetSocket();
+	}
+
+	const ReceiverStats &GetStats() const noexcept {
+		return stats;
+	}
+
+	/**
+	 * Enable the object after it has been disabled by Disable().  A
+	 * new object is enabled by default.
+	 */
+	void Enable() noexcept {
+		event.ScheduleRead();
+	}
+
+	/**
+	 * Disable the object temporarily.  To undo this, call Enable().
+	 */
+	void Disable() noexcept {
+		event.Cancel();
+	}
+
+	/**
+	 * Receive and handle one batch of datagrams now (without
+	 * waiting for the socket to become readable).
+	 *
+	 * Throws on I/O error.
+	 *
+	 * @return the number of datagrams received (including
+	 * discarded ones), or 0 if none are pending
+	 */
+	std::size_t ReceiveBatch();
+
+private:
+	void EventCallback(unsigned events) noexcept;
+};
+
+}}
@@ -38,12 +38,7 @@ namespace Uring {
 void
 Manager::OnReady(unsigned) noexcept
 {
-	try {
-		DispatchCompletions();
-	} catch (...) {
-		PrintException(std::current_exception());
-	}
-
+	DispatchCompletions();
 	CheckVolatileEvent();
 }
 
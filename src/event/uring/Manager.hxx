@@ -39,6 +39,8 @@
 namespace Uring {
 
 class Manager final : public Queue {
+	static constexpr unsigned DEFAULT_ENTRIES = 1024;
+
 	PipeEvent event;
 
 	/**
@@ -50,8 +52,32 @@ class Manager final : public Queue {
 	bool volatile_event = false;
 
 public:
-	explicit Manager(EventLoop &event_loop)
-		:Queue(1024, 0),
+	/**
+	 * Throws on error.
+	 *
+	 * @param entries the size of the submission queue
+	 * @param flags a bit mask of IORING_SETUP_* flags; see
+	 * Queue::Queue()
+	 */
+	explicit Manager(EventLoop &event_loop,
+			 unsigned entries=DEFAULT_ENTRIES,
+			 unsigned flags=0)
+		:Queue(entries, flags),
+		 event(event_loop, BIND_THIS_METHOD(OnReady),
+		       GetFileDescriptor()),
+		 defer_submit_event(event_loop,
+				    BIND_THIS_METHOD(DeferredSubmit))
+	{
+		event.ScheduleRead();
+	}
+
+	/**
+	 * This overload allows specifying more setup parameters,
+	 * e.g. `sq_thread_idle` for IORING_SETUP_SQPOLL.
+	 */
+	Manager(EventLoop &event_loop, unsigned entries,
+		struct io_uring_params &params)
+		:Queue(entries, params),
 		 event(event_loop, BIND_THIS_METHOD(OnReady),
 		       GetFileDescriptor()),
 		 defer_submit_event(event_loop,
@@ -65,10 +91,9 @@ public:
 		CheckVolatileEvent();
 	}
 
-	void Push(struct io_uring_sqe &sqe,
-		  Operation &operation) noexcept override {
-		AddPending(sqe, operation);
-
+protected:
+	/* virtual methods from class Queue */
+	void ScheduleSubmit() noexcept override {
 		/* defer in "idle" mode to allow accumulation of more
 		   events */
 		defer_submit_event.ScheduleIdle();
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "BufferPool.hxx"
+#include "Queue.hxx"
+
+#include <new>
+
+#include <sys/uio.h>
+
+namespace Uring {
+
+/**
+ * Align the slab to page boundaries so the kernel pins as few pages
+ * as possible.
+ */
+static constexpr std::align_val_t SLAB_ALIGNMENT{4096};
+
+BufferPool::BufferPool(Queue &_queue, unsigned n_buffers,
+		       std::size_t _buffer_size)
+	:queue(_queue),
+	 slab(static_cast<std::byte *>(::operator new(n_buffers * _buffer_size,
+						       SLAB_ALIGNMENT))),
+	 buffer_size(_buffer_size)
+{
+	try {
+		std::vector<struct iovec> iovecs;
+		iovecs.reserve(n_buffers);
+		free_list.reserve(n_buffers);
+
+		for (unsigned i = 0; i < n_buffers; ++i) {
+			iovecs.push_back({GetBuffer(i), buffer_size});
+
+			/* reverse order, so Allocate() returns the
+			   lowest index first */
+			free_list.push_back(n_buffers - 1 - i);
+		}
+
+		queue.RegisterBuffers(iovecs.data(), n_buffers);
+	} catch (...) {
+		::operator delete(slab, SLAB_ALIGNMENT);
+		throw;
+	}
+}
+
+BufferPool::~BufferPool() noexcept
+{
+	queue.UnregisterBuffers();
+	::operator delete(slab, SLAB_ALIGNMENT);
+}
+
+} // namespace Uring
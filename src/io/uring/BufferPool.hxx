@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Uring {
+
+class Queue;
+
+/**
+ * A slab of equally-sized buffers which are registered with the
+ * kernel (io_uring_register_buffers()), to be used with
+ * CoReadFixed() and CoWriteFixed().  The kernel pins those pages
+ * only once instead of on every operation.
+ *
+ * Only one #BufferPool can be registered with a #Queue at a time.
+ */
+class BufferPool {
+	Queue &queue;
+
+	std::byte *const slab;
+
+	const std::size_t buffer_size;
+
+	/**
+	 * The indices of all buffers which are not currently in use.
+	 */
+	std::vector<unsigned> free_list;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param n_buffers the number of buffers (the kernel's limit
+	 * is 16384)
+	 * @param buffer_size the size of each buffer in bytes
+	 */
+	BufferPool(Queue &_queue, unsigned n_buffers, std::size_t buffer_size);
+	~BufferPool() noexcept;
+
+	BufferPool(const BufferPool &) = delete;
+	BufferPool &operator=(const BufferPool &) = delete;
+
+	std::size_t GetBufferSize() const noexcept {
+		return buffer_size;
+	}
+
+	/**
+	 * Obtain a buffer.  Return it with Free() when it is not
+	 * needed anymore.
+	 *
+	 * @return the index of the buffer (to be passed to
+	 * GetBuffer() and to CoReadFixed()/CoWriteFixed()) or -1 if
+	 * all buffers are in use
+	 */
+	int Allocate() noexcept {
+		if (free_list.empty())
+			return -1;
+
+		unsigned index = free_list.back();
+		free_list.pop_back();
+		return index;
+	}
+
+	void Free(unsigned index) noexcept {
+		free_list.push_back(index);
+	}
+
+	std::byte *GetBuffer(unsigned index) const noexcept {
+		return slab + index * buffer_size;
+	}
+};
+
+} // namespace Uring
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "BufferRing.hxx"
+#include "Queue.hxx"
+
+#include <new>
+
+namespace Uring {
+
+static constexpr std::align_val_t SLAB_ALIGNMENT{4096};
+
+BufferRing::BufferRing(Queue &_queue, uint_least16_t _group,
+		       unsigned _n_buffers, std::size_t _buffer_size)
+	:queue(_queue),
+	 slab(static_cast<std::byte *>(::operator new(_n_buffers * _buffer_size,
+						       SLAB_ALIGNMENT))),
+	 buffer_size(_buffer_size), n_buffers(_n_buffers),
+	 group(_group)
+{
+	try {
+		ring = queue.SetupBufferRing(n_buffers, group);
+	} catch (...) {
+		::operator delete(slab, SLAB_ALIGNMENT);
+		throw;
+	}
+
+	const int mask = io_uring_buf_ring_mask(n_buffers);
+	for (unsigned i = 0; i < n_buffers; ++i)
+		io_uring_buf_ring_add(ring, GetBuffer(i), buffer_size,
+				      i, mask, i);
+	io_uring_buf_ring_advance(ring, n_buffers);
+}
+
+BufferRing::~BufferRing() noexcept
+{
+	queue.FreeBufferRing(ring, n_buffers, group);
+	::operator delete(slab, SLAB_ALIGNMENT);
+}
+
+void
+BufferRing::Recycle(unsigned id) noexcept
+{
+	io_uring_buf_ring_add(ring, GetBuffer(id), buffer_size, id,
+			      io_uring_buf_ring_mask(n_buffers), 0);
+	io_uring_buf_ring_advance(ring, 1);
+}
+
+} // namespace Uring
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_buf_ring;
+
+namespace Uring {
+
+class Queue;
+
+/**
+ * A ring of "provided buffers" (`IORING_REGISTER_PBUF_RING`) from
+ * which the kernel picks a buffer when a receive operation
+ * (submitted with `IOSQE_BUFFER_SELECT`) completes.  After the
+ * data has been consumed, the buffer must be returned with
+ * Recycle().
+ *
+ * A #BufferRing can be shared by many sockets, so a socket only
+ * occupies buffer memory while it has received data which has not
+ * yet been consumed.
+ */
+class BufferRing {
+	Queue &queue;
+
+	std::byte *const slab;
+
+	struct io_uring_buf_ring *ring;
+
+	const std::size_t buffer_size;
+
+	const unsigned n_buffers;
+
+	const uint_least16_t group;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param group the buffer group id which is passed to
+	 * receive operations; it must be unique within the #Queue
+	 * @param n_buffers the number of buffers (a power of two, at
+	 * most 32768)
+	 * @param buffer_size the size of each buffer in bytes
+	 */
+	BufferRing(Queue &_queue, uint_least16_t group,
+		   unsigned n_buffers, std::size_t buffer_size);
+	~BufferRing() noexcept;
+
+	BufferRing(const BufferRing &) = delete;
+	BufferRing &operator=(const BufferRing &) = delete;
+
+	uint_least16_t GetGroup() const noexcept {
+		return group;
+	}
+
+	std::size_t GetBufferSize() const noexcept {
+		return buffer_size;
+	}
+
+	/**
+	 * Obtain the buffer which was selected by the kernel.
+	 *
+	 * @param id the buffer id from the completion flags (see
+	 * GetBufferId())
+	 */
+	std::byte *GetBuffer(unsigned id) const noexcept {
+		return slab + id * buffer_size;
+	}
+
+	/**
+	 * Extract the buffer id from `io_uring_cqe::flags`.  Only
+	 * valid if `IORING_CQE_F_BUFFER` is set.
+	 */
+	static constexpr unsigned GetBufferId(unsigned flags) noexcept {
+		return flags >> 16; // IORING_CQE_BUFFER_SHIFT
+	}
+
+	/**
+	 * Give a buffer back to the kernel after its data has been
+	 * consumed.
+	 */
+	void Recycle(unsigned id) noexcept;
+};
+
+} // namespace Uring
@@ -35,6 +35,8 @@
 #include "Operation.hxx"
 #include "util/IntrusiveList.hxx"
 
+#include <liburing.h>
+
 #include <cassert>
 #include <utility>
 
@@ -45,6 +47,13 @@ class CancellableOperation : public IntrusiveListHook
 	Operation *operation;
 
 public:
+	/**
+	 * Has Queue::RequestCancel() postponed the
+	 * `IORING_OP_ASYNC_CANCEL` for this operation, because no
+	 * submission queue entry was available?
+	 */
+	bool cancel_postponed = false;
+
 	CancellableOperation(Operation &_operation) noexcept
 		:operation(&_operation)
 	{
@@ -75,14 +84,22 @@ public:
 		new_operation.cancellable = this;
 	}
 
-	void OnUringCompletion(int res) noexcept {
+	void OnUringCompletion(int res, unsigned flags) noexcept {
 		if (operation == nullptr)
 			return;
 
 		assert(operation->cancellable == this);
+
+		if (flags & IORING_CQE_F_MORE) {
+			/* more completions will follow; the operation
+			   remains pending */
+			operation->OnUringCompletionFlags(res, flags);
+			return;
+		}
+
 		operation->cancellable = nullptr;
 
-		std::exchange(operation, nullptr)->OnUringCompletion(res);
+		std::exchange(operation, nullptr)->OnUringCompletionFlags(res, flags);
 	}
 };
 
@@ -32,13 +32,38 @@
 
 #include "CoOperation.hxx"
 #include "Queue.hxx"
+#include "FileTable.hxx"
 #include "system/Error.hxx"
 #include "io/UniqueFileDescriptor.hxx"
+#include "net/SocketDescriptor.hxx"
+
+#include <cerrno>
 
 #include <fcntl.h>
+#include <sys/socket.h>
 
 namespace Uring {
 
+CoOperationBase::~CoOperationBase() noexcept
+{
+	if (IsUringPending())
+		queue->CancelOperation(*this);
+}
+
+void
+CoOperationBase::Submit(Queue &_queue, struct io_uring_sqe &s) noexcept
+{
+	queue = &_queue;
+	queue->Push(s, *this);
+}
+
+void
+CoOperationBase::Cancel() noexcept
+{
+	if (IsUringPending())
+		queue->RequestCancel(*this);
+}
+
 void
 CoOperationBase::OnUringCompletion(int res) noexcept
 {
@@ -50,6 +75,22 @@ CoOperationBase::OnUringCompletion(int res) noexcept
 		continuation.resume();
 }
 
+void
+CoVoidOperation::GetValue() const
+{
+	if (value < 0)
+		throw MakeErrno(-value, error_message);
+}
+
+std::size_t
+CoSizeOperation::GetValue() const
+{
+	if (value < 0)
+		throw MakeErrno(-value, error_message);
+
+	return value;
+}
+
 UniqueFileDescriptor
 CoOpenOperation::GetValue()
 {
@@ -67,15 +108,27 @@ CoCloseOperation::GetValue()
 }
 
 CoCloseOperation
-CoClose(Queue &queue, FileDescriptor fd) noexcept
+CoClose(Queue &queue, FileDescriptor fd)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_close(&s, fd.Get());
+
+	CoCloseOperation op;
+	op.Submit(queue, s);
+	return op;
+}
+
+CoCloseOperation
+CoClose(Queue &queue, FixedFile file, int sqe_flags)
 {
-	auto *s = queue.GetSubmitEntry();
-	assert(s != nullptr); // TODO: what if the submit queue is full?
+	auto &s = queue.RequireSubmitEntry();
 
-	io_uring_prep_close(s, fd.Get());
+	io_uring_prep_close_direct(&s, file.index);
+	s.flags = sqe_flags;
 
 	CoCloseOperation op;
-	queue.Push(*s, op);
+	op.Submit(queue, s);
 	return op;
 }
 
@@ -101,43 +154,104 @@ CoStatxOperation::CoStatxOperation(struct io_uring_sqe *s,
 CoStatxOperation
 CoStatx(Queue &queue,
 	FileDescriptor directory_fd, const char *path,
-	int flags, unsigned mask) noexcept
+	int flags, unsigned mask)
 {
-	auto *s = queue.GetSubmitEntry();
-	assert(s != nullptr); // TODO: what if the submit queue is full?
+	auto &s = queue.RequireSubmitEntry();
 
-	CoStatxOperation op(s, directory_fd, path, flags, mask);
-	queue.Push(*s, op);
+	CoStatxOperation op(&s, directory_fd, path, flags, mask);
+	op.Submit(queue, s);
 	return op;
 }
 
-static CoOpenOperation
+CoOpenOperation
 CoOpen(Queue &queue, FileDescriptor directory_fd, const char *path,
-       int flags, mode_t mode) noexcept
+       int flags, mode_t mode, int sqe_flags)
 {
-	auto *s = queue.GetSubmitEntry();
-	assert(s != nullptr); // TODO: what if the submit queue is full?
+	auto &s = queue.RequireSubmitEntry();
 
-	io_uring_prep_openat(s, directory_fd.Get(), path,
+	io_uring_prep_openat(&s, directory_fd.Get(), path,
 			     flags|O_NOCTTY|O_CLOEXEC, mode);
+	s.flags = sqe_flags;
 
 	CoOpenOperation op;
-	queue.Push(*s, op);
+	op.Submit(queue, s);
 	return op;
 }
 
 CoOpenOperation
-CoOpenReadOnly(Queue &queue, FileDescriptor directory_fd, const char *path) noexcept
+CoOpenReadOnly(Queue &queue, FileDescriptor directory_fd, const char *path)
 {
 	return CoOpen(queue, directory_fd, path, O_RDONLY, 0);
 }
 
 CoOpenOperation
-CoOpenReadOnly(Queue &queue, const char *path) noexcept
+CoOpenReadOnly(Queue &queue, const char *path)
 {
 	return CoOpenReadOnly(queue, FileDescriptor(AT_FDCWD), path);
 }
 
+inline
+CoOpenHowOperation::CoOpenHowOperation(struct io_uring_sqe *s,
+				       FileDescriptor directory_fd,
+				       const char *path,
+				       const struct open_how &_how) noexcept
+	:how(_how)
+{
+	io_uring_prep_openat2(s, directory_fd.Get(), path, &how);
+}
+
+UniqueFileDescriptor
+CoOpenHowOperation::GetValue()
+{
+	if (value < 0)
+		throw MakeErrno(-value, "Failed to open file");
+
+	return UniqueFileDescriptor(std::exchange(value, -1));
+}
+
+CoOpenHowOperation
+CoOpenat2(Queue &queue, FileDescriptor directory_fd, const char *path,
+	  const struct open_how &how, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	CoOpenHowOperation op(&s, directory_fd, path, how);
+	s.flags = sqe_flags;
+	op.Submit(queue, s);
+	return op;
+}
+
+CoOpenHowOperation
+CoOpenBeneath(Queue &queue, FileDescriptor directory_fd, const char *path,
+	      int flags, mode_t mode, int sqe_flags)
+{
+	struct open_how how{};
+	how.flags = flags|O_NOCTTY|O_CLOEXEC;
+	/* openat2() rejects a non-zero mode without O_CREAT */
+	if (flags & (O_CREAT|O_TMPFILE))
+		how.mode = mode;
+	how.resolve = RESOLVE_BENEATH;
+
+	return CoOpenat2(queue, directory_fd, path, how, sqe_flags);
+}
+
+CoVoidOperation
+CoOpenDirect(Queue &queue, FileDescriptor directory_fd, const char *path,
+	     int flags, FixedFile file, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	/* no O_CLOEXEC: direct descriptors are not installed in
+	   the process file table */
+	io_uring_prep_openat_direct(&s, directory_fd.Get(), path,
+				    flags|O_NOCTTY, 0, file.index);
+	s.flags = sqe_flags;
+
+	CoVoidOperation op("Failed to open file");
+	op.Submit(queue, s);
+	return op;
+}
+
 std::size_t
 CoReadOperation::GetValue() const
 {
@@ -147,21 +261,65 @@ CoReadOperation::GetValue() const
 	return value;
 }
 
+static CoReadOperation
+CoRead(Queue &queue, int fd, void *buffer, std::size_t size,
+       off_t offset, int flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_read(&s, fd, buffer, size, offset);
+	s.flags = flags;
+
+	CoReadOperation op;
+	op.Submit(queue, s);
+	return op;
+}
+
 CoReadOperation
 CoRead(Queue &queue, FileDescriptor fd, void *buffer, std::size_t size,
-       off_t offset, int flags) noexcept
+       off_t offset, int flags)
+{
+	return CoRead(queue, fd.Get(), buffer, size, offset, flags);
+}
+
+CoReadOperation
+CoRead(Queue &queue, FixedFile file, void *buffer, std::size_t size,
+       off_t offset, int flags)
+{
+	return CoRead(queue, file.index, buffer, size, offset,
+		      flags|IOSQE_FIXED_FILE);
+}
+
+static CoReadOperation
+CoReadFixed(Queue &queue, int fd, void *buffer, std::size_t size,
+	    off_t offset, unsigned buffer_index, int flags)
 {
-	auto *s = queue.GetSubmitEntry();
-	assert(s != nullptr); // TODO: what if the submit queue is full?
+	auto &s = queue.RequireSubmitEntry();
 
-	io_uring_prep_read(s, fd.Get(), buffer, size, offset);
-	s->flags = flags;
+	io_uring_prep_read_fixed(&s, fd, buffer, size, offset, buffer_index);
+	s.flags = flags;
 
 	CoReadOperation op;
-	queue.Push(*s, op);
+	op.Submit(queue, s);
 	return op;
 }
 
+CoReadOperation
+CoReadFixed(Queue &queue, FileDescriptor fd, void *buffer, std::size_t size,
+	    off_t offset, unsigned buffer_index, int flags)
+{
+	return CoReadFixed(queue, fd.Get(), buffer, size, offset,
+			   buffer_index, flags);
+}
+
+CoReadOperation
+CoReadFixed(Queue &queue, FixedFile file, void *buffer, std::size_t size,
+	    off_t offset, unsigned buffer_index, int flags)
+{
+	return CoReadFixed(queue, file.index, buffer, size, offset,
+			   buffer_index, flags|IOSQE_FIXED_FILE);
+}
+
 std::size_t
 CoWriteOperation::GetValue() const
 {
@@ -173,16 +331,261 @@ CoWriteOperation::GetValue() const
 
 CoWriteOperation
 CoWrite(Queue &queue, FileDescriptor fd, const void *buffer, std::size_t size,
-	off_t offset, int flags) noexcept
+	off_t offset, int flags)
 {
-	auto *s = queue.GetSubmitEntry();
-	assert(s != nullptr); // TODO: what if the submit queue is full?
+	auto &s = queue.RequireSubmitEntry();
 
-	io_uring_prep_write(s, fd.Get(), buffer, size, offset);
-	s->flags = flags;
+	io_uring_prep_write(&s, fd.Get(), buffer, size, offset);
+	s.flags = flags;
 
 	CoWriteOperation op;
-	queue.Push(*s, op);
+	op.Submit(queue, s);
+	return op;
+}
+
+static CoWriteOperation
+CoWriteFixed(Queue &queue, int fd, const void *buffer, std::size_t size,
+	     off_t offset, unsigned buffer_index, int flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_write_fixed(&s, fd, buffer, size, offset, buffer_index);
+	s.flags = flags;
+
+	CoWriteOperation op;
+	op.Submit(queue, s);
+	return op;
+}
+
+CoWriteOperation
+CoWriteFixed(Queue &queue, FileDescriptor fd,
+	     const void *buffer, std::size_t size,
+	     off_t offset, unsigned buffer_index, int flags)
+{
+	return CoWriteFixed(queue, fd.Get(), buffer, size, offset,
+			    buffer_index, flags);
+}
+
+CoWriteOperation
+CoWriteFixed(Queue &queue, FixedFile file,
+	     const void *buffer, std::size_t size,
+	     off_t offset, unsigned buffer_index, int flags)
+{
+	return CoWriteFixed(queue, file.index, buffer, size, offset,
+			    buffer_index, flags|IOSQE_FIXED_FILE);
+}
+
+CoSizeOperation
+CoSplice(Queue &queue, FileDescriptor in, off_t offset_in,
+	 FileDescriptor out, off_t offset_out,
+	 std::size_t size, unsigned splice_flags,
+	 int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_splice(&s, in.Get(), offset_in, out.Get(), offset_out,
+			     size, splice_flags);
+	s.flags = sqe_flags;
+
+	CoSizeOperation op("Failed to splice");
+	op.Submit(queue, s);
+	return op;
+}
+
+CoSizeOperation
+CoSend(Queue &queue, SocketDescriptor socket,
+       const void *buffer, std::size_t size,
+       int msg_flags, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_send(&s, socket.Get(), buffer, size,
+			   msg_flags|MSG_NOSIGNAL);
+	s.flags = sqe_flags;
+
+	CoSizeOperation op("Failed to send");
+	op.Submit(queue, s);
+	return op;
+}
+
+CoSizeOperation
+CoRecv(Queue &queue, SocketDescriptor socket, void *buffer, std::size_t size,
+       int msg_flags, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_recv(&s, socket.Get(), buffer, size, msg_flags);
+	s.flags = sqe_flags;
+
+	CoSizeOperation op("Failed to receive");
+	op.Submit(queue, s);
+	return op;
+}
+
+static CoVoidOperation
+CoFsync(Queue &queue, FileDescriptor fd, unsigned fsync_flags,
+	int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_fsync(&s, fd.Get(), fsync_flags);
+	s.flags = sqe_flags;
+
+	CoVoidOperation op("Failed to sync file");
+	op.Submit(queue, s);
+	return op;
+}
+
+CoVoidOperation
+CoFsync(Queue &queue, FileDescriptor fd, int sqe_flags)
+{
+	return CoFsync(queue, fd, 0, sqe_flags);
+}
+
+CoVoidOperation
+CoFdatasync(Queue &queue, FileDescriptor fd, int sqe_flags)
+{
+	return CoFsync(queue, fd, IORING_FSYNC_DATASYNC, sqe_flags);
+}
+
+CoVoidOperation
+CoFallocate(Queue &queue, FileDescriptor fd, int mode,
+	    off_t offset, off_t length, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_fallocate(&s, fd.Get(), mode, offset, length);
+	s.flags = sqe_flags;
+
+	CoVoidOperation op("Failed to allocate file space");
+	op.Submit(queue, s);
+	return op;
+}
+
+CoVoidOperation
+CoRename(Queue &queue, FileDescriptor old_directory_fd, const char *old_path,
+	 FileDescriptor new_directory_fd, const char *new_path,
+	 unsigned flags, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_renameat(&s, old_directory_fd.Get(), old_path,
+			       new_directory_fd.Get(), new_path, flags);
+	s.flags = sqe_flags;
+
+	CoVoidOperation op("Failed to rename file");
+	op.Submit(queue, s);
+	return op;
+}
+
+CoVoidOperation
+CoUnlink(Queue &queue, FileDescriptor directory_fd, const char *path,
+	 int flags, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_unlinkat(&s, directory_fd.Get(), path, flags);
+	s.flags = sqe_flags;
+
+	CoVoidOperation op("Failed to delete file");
+	op.Submit(queue, s);
+	return op;
+}
+
+CoVoidOperation
+CoMkdir(Queue &queue, FileDescriptor directory_fd, const char *path,
+	mode_t mode, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_mkdirat(&s, directory_fd.Get(), path, mode);
+	s.flags = sqe_flags;
+
+	CoVoidOperation op("Failed to create directory");
+	op.Submit(queue, s);
+	return op;
+}
+
+CoVoidOperation
+CoLink(Queue &queue, FileDescriptor old_directory_fd, const char *old_path,
+       FileDescriptor new_directory_fd, const char *new_path,
+       int flags, int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_linkat(&s, old_directory_fd.Get(), old_path,
+			     new_directory_fd.Get(), new_path, flags);
+	s.flags = sqe_flags;
+
+	CoVoidOperation op("Failed to create link");
+	op.Submit(queue, s);
+	return op;
+}
+
+unsigned
+CoPollOperation::GetValue() const
+{
+	if (value < 0)
+		throw MakeErrno(-value, "Failed to poll");
+
+	return value;
+}
+
+CoPollOperation
+CoPoll(Queue &queue, FileDescriptor fd, unsigned events,
+       int sqe_flags)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	io_uring_prep_poll_add(&s, fd.Get(), events);
+	s.flags = sqe_flags;
+
+	CoPollOperation op;
+	op.Submit(queue, s);
+	return op;
+}
+
+inline
+CoLinkTimeoutOperation::CoLinkTimeoutOperation(struct io_uring_sqe *s,
+					       std::chrono::steady_clock::duration timeout) noexcept
+{
+	const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+
+	io_uring_prep_link_timeout(s, &ts, 0);
+}
+
+bool
+CoLinkTimeoutOperation::GetValue() const
+{
+	switch (-value) {
+	case ETIME:
+	case EALREADY:
+		/* expired (EALREADY: the linked operation was
+		   already running and could not be canceled) */
+		return true;
+
+	case ECANCELED:
+	case ENOENT:
+		/* the linked operation has completed in time */
+		return false;
+	}
+
+	if (value < 0)
+		throw MakeErrno(-value, "Linked timeout failed");
+
+	return false;
+}
+
+CoLinkTimeoutOperation
+CoLinkTimeout(Queue &queue,
+	      std::chrono::steady_clock::duration timeout)
+{
+	auto &s = queue.RequireSubmitEntry();
+
+	CoLinkTimeoutOperation op(&s, timeout);
+	op.Submit(queue, s);
 	return op;
 }
 
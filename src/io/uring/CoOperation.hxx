@@ -35,29 +35,72 @@
 #include "Operation.hxx"
 #include "co/Compat.hxx"
 
+#include <chrono>
 #include <cstddef>
 
+#include <linux/openat2.h> // for struct open_how
+#include <linux/time_types.h> // for struct __kernel_timespec
 #include <sys/stat.h>
 #include <sys/types.h>
 
 struct io_uring_sqe;
 class FileDescriptor;
 class UniqueFileDescriptor;
+class SocketDescriptor;
+
+/*
+ * All functions in this header accept an optional "sqe_flags"
+ * parameter (`IOSQE_*`) which is copied to the submission queue
+ * entry.  Pass `IOSQE_IO_LINK` to chain the operation with the next
+ * one, e.g. open/read/close on a #FixedFile slot or an operation
+ * followed by CoLinkTimeout().  If a linked operation fails (this
+ * includes short reads and writes), the rest of the chain completes
+ * with `ECANCELED`.  Call Queue::ReserveSubmitEntries() with the
+ * length of the chain before submitting its first operation.
+ *
+ * If no submission queue entry is available, these functions throw
+ * std::system_error with `EBUSY`.
+ */
 
 namespace Uring {
 
 class Queue;
+struct FixedFile;
 
 /**
  * Coroutine integration for an io_uring #Operation.
+ *
+ * If this object is destroyed while the operation is still pending
+ * (e.g. because the awaiting coroutine was destroyed), the kernel
+ * is asked to cancel the operation.
  */
 class CoOperationBase : public Operation {
+	Queue *queue = nullptr;
+
 public:
 	std::coroutine_handle<> continuation;
 
 protected:
 	int value;
 
+public:
+	~CoOperationBase() noexcept;
+
+	/**
+	 * Push the given submission queue entry, with this object as
+	 * its completion handler.
+	 */
+	void Submit(Queue &_queue, struct io_uring_sqe &s) noexcept;
+
+	/**
+	 * Ask the kernel to cancel this operation.  Unlike
+	 * CancelUring(), the awaiting coroutine will still be
+	 * resumed, usually with `ECANCELED` (or with the real result
+	 * if the operation has already completed).  This is a no-op
+	 * if the operation is not pending.
+	 */
+	void Cancel() noexcept;
+
 private:
 	/* virtual methods from class Uring::Operation */
 	void OnUringCompletion(int res) noexcept override;
@@ -99,7 +142,7 @@ public:
 CoStatxOperation
 CoStatx(Queue &queue,
 	FileDescriptor directory_fd, const char *path,
-	int flags, unsigned mask) noexcept;
+	int flags, unsigned mask);
 
 class CoOpenOperation final : public CoOperationBase {
 public:
@@ -112,10 +155,81 @@ public:
 
 CoOpenOperation
 CoOpenReadOnly(Queue &queue,
-	       FileDescriptor directory_fd, const char *path) noexcept;
+	       FileDescriptor directory_fd, const char *path);
 
 CoOpenOperation
-CoOpenReadOnly(Queue &queue, const char *path) noexcept;
+CoOpenReadOnly(Queue &queue, const char *path);
+
+/**
+ * Open a file (`IORING_OP_OPENAT`).  `O_NOCTTY` and `O_CLOEXEC` are
+ * added implicitly.
+ */
+CoOpenOperation
+CoOpen(Queue &queue, FileDescriptor directory_fd, const char *path,
+       int flags, mode_t mode=0, int sqe_flags=0);
+
+/**
+ * An openat2() operation; the #open_how structure is owned by this
+ * object so the caller doesn't need to keep it alive.
+ */
+class CoOpenHowOperation final : public CoOperationBase {
+	struct open_how how;
+
+public:
+	CoOpenHowOperation(struct io_uring_sqe *s,
+			   FileDescriptor directory_fd, const char *path,
+			   const struct open_how &_how) noexcept;
+
+	auto operator co_await() noexcept {
+		return CoAwaitable<CoOpenHowOperation>{*this};
+	}
+
+	UniqueFileDescriptor GetValue();
+};
+
+/**
+ * Open a file with openat2() (`IORING_OP_OPENAT2`).
+ */
+CoOpenHowOperation
+CoOpenat2(Queue &queue, FileDescriptor directory_fd, const char *path,
+	  const struct open_how &how, int sqe_flags=0);
+
+/**
+ * Open a file which must be beneath the given directory
+ * (`RESOLVE_BENEATH`), i.e. absolute paths and ".." escaping the
+ * directory are rejected with `EXDEV`.
+ */
+CoOpenHowOperation
+CoOpenBeneath(Queue &queue, FileDescriptor directory_fd, const char *path,
+	      int flags, mode_t mode=0, int sqe_flags=0);
+
+/**
+ * Common class for operations which return no value other than an
+ * error code.
+ */
+class CoVoidOperation final : public CoOperationBase {
+	const char *error_message;
+
+public:
+	explicit CoVoidOperation(const char *_error_message) noexcept
+		:error_message(_error_message) {}
+
+	auto operator co_await() noexcept {
+		return CoAwaitable<CoVoidOperation>{*this};
+	}
+
+	void GetValue() const;
+};
+
+/**
+ * Open a file into a slot of the #FileTable
+ * (`IORING_OP_OPENAT` with a direct descriptor).  Because the slot
+ * is known in advance, this can be linked with subsequent
+ * operations on the #FixedFile.
+ */
+CoVoidOperation
+CoOpenDirect(Queue &queue, FileDescriptor directory_fd, const char *path,
+	     int flags, FixedFile file, int sqe_flags=0);
 
 class CoCloseOperation final : public CoOperationBase {
 public:
@@ -127,7 +241,14 @@ public:
 };
 
 CoCloseOperation
-CoClose(Queue &queue, FileDescriptor fd) noexcept;
+CoClose(Queue &queue, FileDescriptor fd);
+
+/**
+ * Close a direct descriptor opened by CoOpenDirect().  The
+ * #FileTable slot is empty afterwards, but it is still allocated.
+ */
+CoCloseOperation
+CoClose(Queue &queue, FixedFile file, int sqe_flags=0);
 
 class CoReadOperation final : public CoOperationBase {
 public:
@@ -140,7 +261,33 @@ public:
 
 CoReadOperation
 CoRead(Queue &queue, FileDescriptor fd, void *buffer, std::size_t size,
-       off_t offset, int flags=0) noexcept;
+       off_t offset, int flags=0);
+
+/**
+ * Like above, but read from a file registered in a #FileTable.
+ */
+CoReadOperation
+CoRead(Queue &queue, FixedFile file, void *buffer, std::size_t size,
+       off_t offset, int flags=0);
+
+/**
+ * Read into a buffer registered with the kernel
+ * (`IORING_OP_READ_FIXED`).
+ *
+ * @param buffer a pointer into the registered buffer
+ * @param buffer_index the index of the registered buffer (see
+ * BufferPool::Allocate())
+ */
+CoReadOperation
+CoReadFixed(Queue &queue, FileDescriptor fd, void *buffer, std::size_t size,
+	    off_t offset, unsigned buffer_index, int flags=0);
+
+/**
+ * Like above, but read from a file registered in a #FileTable.
+ */
+CoReadOperation
+CoReadFixed(Queue &queue, FixedFile file, void *buffer, std::size_t size,
+	    off_t offset, unsigned buffer_index, int flags=0);
 
 class CoWriteOperation final : public CoOperationBase {
 public:
@@ -153,6 +300,173 @@ public:
 
 CoWriteOperation
 CoWrite(Queue &queue, FileDescriptor fd, const void *buffer, std::size_t size,
-	off_t offset, int flags=0) noexcept;
+	off_t offset, int flags=0);
+
+/**
+ * Write from a buffer registered with the kernel
+ * (`IORING_OP_WRITE_FIXED`).
+ *
+ * @param buffer a pointer into the registered buffer
+ * @param buffer_index the index of the registered buffer (see
+ * BufferPool::Allocate())
+ */
+CoWriteOperation
+CoWriteFixed(Queue &queue, FileDescriptor fd,
+	     const void *buffer, std::size_t size,
+	     off_t offset, unsigned buffer_index, int flags=0);
+
+/**
+ * Like above, but write to a file registered in a #FileTable.
+ */
+CoWriteOperation
+CoWriteFixed(Queue &queue, FixedFile file,
+	     const void *buffer, std::size_t size,
+	     off_t offset, unsigned buffer_index, int flags=0);
+
+/**
+ * Common class for operations which transfer data and return the
+ * number of bytes.
+ */
+class CoSizeOperation final : public CoOperationBase {
+	const char *error_message;
+
+public:
+	explicit CoSizeOperation(const char *_error_message) noexcept
+		:error_message(_error_message) {}
+
+	auto operator co_await() noexcept {
+		return CoAwaitable<CoSizeOperation>{*this};
+	}
+
+	std::size_t GetValue() const;
+};
+
+/**
+ * Move data between two file descriptors, one of which must be a
+ * pipe (`IORING_OP_SPLICE`).
+ *
+ * @param offset_in the offset to read from or -1 to use (and
+ * update) the file position
+ * @param offset_out the offset to write to or -1
+ * @param splice_flags `SPLICE_F_*`
+ */
+CoSizeOperation
+CoSplice(Queue &queue, FileDescriptor in, off_t offset_in,
+	 FileDescriptor out, off_t offset_out,
+	 std::size_t size, unsigned splice_flags=0,
+	 int sqe_flags=0);
+
+/**
+ * @param msg_flags `MSG_*`
+ */
+CoSizeOperation
+CoSend(Queue &queue, SocketDescriptor s, const void *buffer, std::size_t size,
+       int msg_flags=0, int sqe_flags=0);
+
+/**
+ * @param msg_flags `MSG_*`
+ */
+CoSizeOperation
+CoRecv(Queue &queue, SocketDescriptor s, void *buffer, std::size_t size,
+       int msg_flags=0, int sqe_flags=0);
+
+CoVoidOperation
+CoFsync(Queue &queue, FileDescriptor fd, int sqe_flags=0);
+
+/**
+ * Like CoFsync(), but skip metadata which is not necessary for
+ * reading the data back (`IORING_FSYNC_DATASYNC`).
+ */
+CoVoidOperation
+CoFdatasync(Queue &queue, FileDescriptor fd, int sqe_flags=0);
+
+/**
+ * @param mode `FALLOC_FL_*`
+ */
+CoVoidOperation
+CoFallocate(Queue &queue, FileDescriptor fd, int mode,
+	    off_t offset, off_t length, int sqe_flags=0);
+
+/**
+ * @param flags `RENAME_*`
+ */
+CoVoidOperation
+CoRename(Queue &queue, FileDescriptor old_directory_fd, const char *old_path,
+	 FileDescriptor new_directory_fd, const char *new_path,
+	 unsigned flags=0, int sqe_flags=0);
+
+/**
+ * @param flags 0 or `AT_REMOVEDIR`
+ */
+CoVoidOperation
+CoUnlink(Queue &queue, FileDescriptor directory_fd, const char *path,
+	 int flags=0, int sqe_flags=0);
+
+CoVoidOperation
+CoMkdir(Queue &queue, FileDescriptor directory_fd, const char *path,
+	mode_t mode=0777, int sqe_flags=0);
+
+/**
+ * Create a hard link.
+ *
+ * @param flags 0 or `AT_SYMLINK_FOLLOW`
+ */
+CoVoidOperation
+CoLink(Queue &queue, FileDescriptor old_directory_fd, const char *old_path,
+       FileDescriptor new_directory_fd, const char *new_path,
+       int flags=0, int sqe_flags=0);
+
+class CoPollOperation final : public CoOperationBase {
+public:
+	auto operator co_await() noexcept {
+		return CoAwaitable<CoPollOperation>{*this};
+	}
+
+	/**
+	 * @return the events which are ready
+	 */
+	unsigned GetValue() const;
+};
+
+/**
+ * Wait until the file descriptor is ready (`IORING_OP_POLL_ADD`).
+ *
+ * @param events `POLLIN`, `POLLOUT` etc.
+ */
+CoPollOperation
+CoPoll(Queue &queue, FileDescriptor fd, unsigned events,
+       int sqe_flags=0);
+
+/**
+ * A timeout for the previous operation.  The #__kernel_timespec is
+ * owned by this object.
+ */
+class CoLinkTimeoutOperation final : public CoOperationBase {
+	struct __kernel_timespec ts;
+
+public:
+	CoLinkTimeoutOperation(struct io_uring_sqe *s,
+			       std::chrono::steady_clock::duration timeout) noexcept;
+
+	auto operator co_await() noexcept {
+		return CoAwaitable<CoLinkTimeoutOperation>{*this};
+	}
+
+	/**
+	 * @return true if the timeout has expired (and the linked
+	 * operation was canceled with `ECANCELED`), false if the
+	 * linked operation has completed in time
+	 */
+	bool GetValue() const;
+};
+
+/**
+ * Submit a timeout for the previous operation, which must have been
+ * submitted with `IOSQE_IO_LINK` right before this call.  If the
+ * timeout expires, the linked operation fails with `ECANCELED`.
+ */
+CoLinkTimeoutOperation
+CoLinkTimeout(Queue &queue,
+	      std::chrono::steady_clock::duration timeout);
 
 } // namespace Uring
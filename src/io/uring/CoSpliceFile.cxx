@@ -0,0 +1,204 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CoSpliceFile.hxx"
+#include "CoOperation.hxx"
+#include "Queue.hxx"
+#include "system/Error.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <liburing.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+
+namespace Uring {
+
+/**
+ * The pipe buffer size we ask for; this is the maximum amount of
+ * data in flight.  The kernel may give us less (see
+ * /proc/sys/fs/pipe-max-size).
+ */
+static constexpr std::size_t PIPE_SIZE = 256 * 1024;
+
+/**
+ * The maximum size of one splice directly into a pipe.
+ */
+static constexpr std::size_t MAX_DIRECT_SIZE = 1024 * 1024;
+
+/**
+ * Splice up to #size bytes.  If #out is non-blocking and full, wait
+ * until it becomes writable.
+ *
+ * @return the number of bytes transferred (0 means end of file)
+ */
+static Co::Task<std::size_t>
+SpliceOnce(Queue &queue, FileDescriptor in, off_t in_offset,
+	   FileDescriptor out, std::size_t size)
+{
+	while (true) {
+		bool again = false;
+
+		try {
+			co_return co_await CoSplice(queue, in, in_offset,
+						    out, -1, size,
+						    SPLICE_F_MOVE);
+		} catch (const std::system_error &e) {
+			if (!IsErrno(e, EAGAIN))
+				throw;
+
+			again = true;
+		}
+
+		if (again)
+			co_await CoPoll(queue, out, POLLOUT);
+	}
+}
+
+/**
+ * Move exactly #size bytes from the pipe to #out.
+ */
+static Co::Task<void>
+DrainPipe(Queue &queue, FileDescriptor pipe_r, FileDescriptor out,
+	  std::size_t size)
+{
+	while (size > 0) {
+		const std::size_t nbytes =
+			co_await SpliceOnce(queue, pipe_r, -1, out, size);
+		if (nbytes == 0)
+			/* cannot happen: we still own the write end
+			   and there is data in the pipe */
+			throw std::runtime_error("Pipe ended unexpectedly");
+
+		size -= nbytes;
+	}
+}
+
+static Co::Task<uint_least64_t>
+SpliceToPipe(Queue &queue, FileDescriptor in, off_t offset,
+	     uint_least64_t length, FileDescriptor out)
+{
+	uint_least64_t total = 0;
+
+	while (total < length) {
+		const std::size_t size =
+			std::min<uint_least64_t>(length - total,
+						 MAX_DIRECT_SIZE);
+		const std::size_t nbytes =
+			co_await SpliceOnce(queue, in, offset + total,
+					    out, size);
+		if (nbytes == 0)
+			break;
+
+		total += nbytes;
+	}
+
+	co_return total;
+}
+
+/**
+ * Try to resize the pipe buffer.
+ *
+ * @return the actual size of the pipe buffer
+ */
+static std::size_t
+SetPipeSize(FileDescriptor fd, std::size_t size) noexcept
+{
+	fcntl(fd.Get(), F_SETPIPE_SZ, (int)size);
+
+	const int result = fcntl(fd.Get(), F_GETPIPE_SZ);
+	return result > 0
+		? std::size_t(result)
+		/* the Linux default */
+		: 65536;
+}
+
+Co::Task<uint_least64_t>
+CoSpliceFile(Queue &queue, FileDescriptor in, off_t offset,
+	     uint_least64_t length, FileDescriptor out)
+{
+	if (out.IsPipe())
+		co_return co_await SpliceToPipe(queue, in, offset,
+						length, out);
+
+	UniqueFileDescriptor pipe_r, pipe_w;
+	if (!UniqueFileDescriptor::CreatePipe(pipe_r, pipe_w))
+		throw MakeErrno("Failed to create pipe");
+
+	const std::size_t pipe_size = SetPipeSize(pipe_w, PIPE_SIZE);
+
+	uint_least64_t total = 0;
+
+	while (total < length) {
+		const std::size_t size =
+			std::min<uint_least64_t>(length - total, pipe_size);
+
+		/* submit both halves at once; the second one starts
+		   only after the first one has filled the pipe
+		   completely */
+		queue.ReserveSubmitEntries(2);
+		auto fill = CoSplice(queue, in, offset + total,
+				     pipe_w, -1, size, SPLICE_F_MOVE,
+				     IOSQE_IO_LINK);
+		auto drain = CoSplice(queue, pipe_r, -1, out, -1, size,
+				      SPLICE_F_MOVE);
+
+		const std::size_t filled = co_await fill;
+
+		std::size_t drained = 0;
+		try {
+			drained = co_await drain;
+		} catch (const std::system_error &e) {
+			/* ECANCELED: the pipe was not filled completely
+			   (end of file or an unaligned file offset),
+			   which broke the chain; EAGAIN: the destination
+			   is full; DrainPipe() handles both */
+			if (!IsErrno(e, ECANCELED) && !IsErrno(e, EAGAIN))
+				throw;
+		}
+
+		if (filled == 0)
+			break;
+
+		co_await DrainPipe(queue, pipe_r, out, filled - drained);
+
+		total += filled;
+	}
+
+	co_return total;
+}
+
+} // namespace Uring
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "co/Task.hxx"
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+class FileDescriptor;
+
+namespace Uring {
+
+class Queue;
+
+/**
+ * Copy a range of a regular file to a socket or a pipe without
+ * copying the data through userspace, similar to sendfile().
+ *
+ * If the destination is not a pipe, the data is moved with a pair
+ * of linked `IORING_OP_SPLICE` operations through an internal pipe.
+ * Only one pipe buffer is in flight at a time; a non-blocking
+ * destination which is full is waited for with `IORING_OP_POLL_ADD`,
+ * so slow peers throttle the file reads.
+ *
+ * Destroying the task cancels the pending operations.
+ *
+ * Throws on error.
+ *
+ * @param in a regular file
+ * @param offset the file position to start at; the file's own
+ * position is not used or modified
+ * @param length the number of bytes to transfer
+ * @param out a socket or a pipe
+ * @return the number of bytes transferred; this is less than
+ * #length only if the end of the file was reached
+ */
+Co::Task<uint_least64_t>
+CoSpliceFile(Queue &queue, FileDescriptor in, off_t offset,
+	     uint_least64_t length, FileDescriptor out);
+
+} // namespace Uring
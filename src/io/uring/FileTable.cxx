@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "FileTable.hxx"
+#include "Queue.hxx"
+#include "system/Error.hxx"
+#include "io/FileDescriptor.hxx"
+
+namespace Uring {
+
+FileTable::FileTable(Queue &_queue, unsigned n_slots)
+	:queue(_queue)
+{
+	/* start with a sparse table */
+	const std::vector<int> fds(n_slots, -1);
+	queue.RegisterFiles(fds.data(), n_slots);
+
+	free_list.reserve(n_slots);
+	for (unsigned i = n_slots; i > 0; --i)
+		free_list.push_back(i - 1);
+}
+
+FileTable::~FileTable() noexcept
+{
+	queue.UnregisterFiles();
+}
+
+FixedFile
+FileTable::Add(FileDescriptor fd)
+{
+	if (free_list.empty())
+		throw MakeErrno(ENFILE, "Fixed file table is full");
+
+	const unsigned index = free_list.back();
+	const int value = fd.Get();
+	queue.UpdateFiles(index, &value, 1);
+
+	free_list.pop_back();
+	return {index};
+}
+
+FixedFile
+FileTable::Allocate()
+{
+	if (free_list.empty())
+		throw MakeErrno(ENFILE, "Fixed file table is full");
+
+	const unsigned index = free_list.back();
+	free_list.pop_back();
+	return {index};
+}
+
+void
+FileTable::Remove(FixedFile file) noexcept
+{
+	const int value = -1;
+
+	try {
+		queue.UpdateFiles(file.index, &value, 1);
+	} catch (...) {
+		/* the slot keeps referencing the file until it gets
+		   overwritten by the next Add() call */
+	}
+
+	free_list.push_back(file.index);
+}
+
+} // namespace Uring
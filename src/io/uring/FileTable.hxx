@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+class FileDescriptor;
+
+namespace Uring {
+
+class Queue;
+
+/**
+ * A file which is referenced by its index in a #FileTable.  Passing
+ * it to an operation (e.g. CoReadFixed()) sets IOSQE_FIXED_FILE,
+ * which saves the kernel the file descriptor lookup.
+ */
+struct FixedFile {
+	unsigned index;
+};
+
+/**
+ * A table of file descriptors registered with the kernel
+ * (io_uring_register_files()).  It has a fixed number of slots
+ * which are filled with Add() and released with Remove().
+ *
+ * Only one #FileTable can be registered with a #Queue at a time.
+ */
+class FileTable {
+	Queue &queue;
+
+	/**
+	 * The indices of all slots which are not currently in use.
+	 */
+	std::vector<unsigned> free_list;
+
+public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param n_slots the number of slots
+	 */
+	FileTable(Queue &_queue, unsigned n_slots);
+	~FileTable() noexcept;
+
+	FileTable(const FileTable &) = delete;
+	FileTable &operator=(const FileTable &) = delete;
+
+	/**
+	 * Register a file descriptor in a free slot.  The kernel
+	 * holds its own reference to the file, so the caller may
+	 * close the file descriptor afterwards.
+	 *
+	 * Throws on error (e.g. if all slots are in use).
+	 */
+	FixedFile Add(FileDescriptor fd);
+
+	/**
+	 * Reserve an empty slot, e.g. as the target of
+	 * CoOpenDirect().
+	 *
+	 * Throws if all slots are in use.
+	 */
+	FixedFile Allocate();
+
+	/**
+	 * Release a slot previously returned by Add() or
+	 * Allocate().  Operations
+	 * which are still in flight keep their reference to the file.
+	 */
+	void Remove(FixedFile file) noexcept;
+};
+
+} // namespace Uring
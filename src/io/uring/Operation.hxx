@@ -35,12 +35,14 @@
 namespace Uring {
 
 class CancellableOperation;
+class Queue;
 
 /**
  * An asynchronous I/O operation to be queued in a #Queue instance.
  */
 class Operation {
 	friend class CancellableOperation;
+	friend class Queue;
 
 	CancellableOperation *cancellable = nullptr;
 
@@ -76,6 +78,22 @@ public:
 	 * occurred
 	 */
 	virtual void OnUringCompletion(int res) noexcept = 0;
+
+	/**
+	 * Like OnUringCompletion(), but also receives the
+	 * completion's `IORING_CQE_F_*` flags.  Override this for
+	 * operations which need them, e.g. to find out which
+	 * provided buffer was selected by the kernel
+	 * (`IORING_CQE_F_BUFFER`).
+	 *
+	 * If `IORING_CQE_F_MORE` is set (multishot operations and
+	 * zero-copy sends), the operation remains pending, and this
+	 * method will be called again.
+	 */
+	virtual void OnUringCompletionFlags(int res, unsigned flags) noexcept {
+		(void)flags;
+		OnUringCompletion(res);
+	}
 };
 
 } // namespace Uring
@@ -32,41 +32,267 @@
 
 #include "Queue.hxx"
 #include "CancellableOperation.hxx"
+#include "system/Error.hxx"
 #include "util/DeleteDisposer.hxx"
 
+#include <cassert>
+
 namespace Uring {
 
+/**
+ * The maximum number of completion queue entries harvested by
+ * DispatchCompletions() at a time.
+ */
+static constexpr unsigned COMPLETION_BATCH = 64;
+
 Queue::Queue(unsigned entries, unsigned flags)
 	:ring(entries, flags)
 {
 }
 
+Queue::Queue(unsigned entries, struct io_uring_params &params)
+	:ring(entries, params)
+{
+}
+
 Queue::~Queue() noexcept
 {
 	operations.clear_and_dispose(DeleteDisposer{});
 }
 
+struct io_uring_sqe *
+Queue::GetSubmitEntry() noexcept
+{
+	auto *sqe = ring.GetSubmitEntry();
+	if (sqe != nullptr)
+		return sqe;
+
+	if (link_open)
+		/* flushing now would split the chain; the caller
+		   should have used ReserveSubmitEntries() */
+		return nullptr;
+
+	/* the submit queue is full: flush it to the kernel and try
+	   again */
+	try {
+		ring.Submit();
+	} catch (...) {
+		return nullptr;
+	}
+
+	return ring.GetSubmitEntry();
+}
+
+struct io_uring_sqe &
+Queue::RequireSubmitEntry()
+{
+	auto *sqe = GetSubmitEntry();
+	if (sqe == nullptr)
+		throw MakeErrno(EBUSY, "io_uring submission queue is full");
+
+	return *sqe;
+}
+
+void
+Queue::ReserveSubmitEntries(unsigned n)
+{
+	if (ring.GetSubmitSpace() >= n)
+		return;
+
+	assert(!link_open);
+
+	ring.Submit();
+
+	if (ring.GetSubmitSpace() < n)
+		throw MakeErrno(EBUSY, "io_uring submission queue is full");
+}
+
 void
 Queue::AddPending(struct io_uring_sqe &sqe,
 		  Operation &operation) noexcept
 {
 	auto *c = new CancellableOperation(operation);
 	operations.push_back(*c);
+	++n_pending;
 	io_uring_sqe_set_data(&sqe, c);
+
+	link_open = sqe.flags & (IOSQE_IO_LINK|IOSQE_IO_HARDLINK);
 }
 
 void
-Queue::DispatchOneCompletion(struct io_uring_cqe &cqe) noexcept
+Queue::ScheduleSubmit() noexcept
+{
+	if (link_open)
+		/* the chain is submitted after its last member has
+		   been pushed */
+		return;
+
+	try {
+		Submit();
+	} catch (...) {
+		/* the entries remain in the submission queue and
+		   will be submitted by the next Submit() call */
+	}
+}
+
+void
+Queue::Submit()
+{
+	/* a chain whose last member has never been pushed ends
+	   here */
+	link_open = false;
+
+	FlushCancels();
+	ring.Submit();
+}
+
+bool
+Queue::SubmitAndWaitCompletion(struct __kernel_timespec *timeout)
 {
-	void *data = io_uring_cqe_get_data(&cqe);
-	if (data != nullptr) {
-		auto *c = (CancellableOperation *)data;
-		c->OnUringCompletion(cqe.res);
+	link_open = false;
+
+	FlushCancels();
+	return ring.SubmitAndWaitCompletion(timeout);
+}
+
+bool
+Queue::PrepareCancel(CancellableOperation &c) noexcept
+{
+	auto *sqe = GetSubmitEntry();
+	if (sqe == nullptr)
+		return false;
+
+	/* this request has no "user_data", so its own completion
+	   will be ignored */
+	io_uring_prep_cancel(sqe, &c, 0);
+	io_uring_sqe_set_data(sqe, nullptr);
+	return true;
+}
+
+void
+Queue::FlushCancels() noexcept
+{
+	if (n_postponed_cancels == 0 || link_open)
+		return;
+
+	for (auto &c : operations) {
+		if (!c.cancel_postponed)
+			continue;
+
+		if (!PrepareCancel(c))
+			break;
+
+		c.cancel_postponed = false;
+		if (--n_postponed_cancels == 0)
+			break;
+	}
+}
+
+void
+Queue::RequestCancel(Operation &operation) noexcept
+{
+	if (!operation.IsUringPending())
+		return;
+
+	auto &c = *operation.cancellable;
+	if (c.cancel_postponed)
+		return;
+
+	/* a cancel request must not be inserted into an incomplete
+	   chain, because it would become a member of that chain */
+	if (link_open || !PrepareCancel(c)) {
+		c.cancel_postponed = true;
+		++n_postponed_cancels;
+	}
+
+	ScheduleSubmit();
+}
+
+void
+Queue::CancelOperation(Operation &operation) noexcept
+{
+	/* the cancel request may be postponed, but the operation
+	   remains in #operations until its final completion
+	   arrives */
+	RequestCancel(operation);
+	operation.CancelUring();
+}
+
+inline void
+Queue::Dispatch(void *user_data, int res, unsigned flags) noexcept
+{
+	if (user_data != nullptr) {
+		auto *c = (CancellableOperation *)user_data;
+		c->OnUringCompletion(res, flags);
+
+		if (flags & IORING_CQE_F_MORE)
+			/* this is not the last completion for this
+			   operation */
+			return;
+
+		if (c->cancel_postponed)
+			/* too late, the operation has finished
+			   already */
+			--n_postponed_cancels;
+
 		c->unlink();
+		--n_pending;
 		delete c;
 	}
+}
 
+void
+Queue::DispatchOneCompletion(struct io_uring_cqe &cqe) noexcept
+{
+	/* copy the entry and give it back to the kernel before
+	   invoking the handler, which may dispatch more
+	   completions */
+	void *user_data = io_uring_cqe_get_data(&cqe);
+	const int res = cqe.res;
+	const unsigned flags = cqe.flags;
 	ring.SeenCompletion(cqe);
+
+	Dispatch(user_data, res, flags);
+
+	if (n_postponed_cancels > 0)
+		ScheduleSubmit();
+}
+
+void
+Queue::DispatchCompletions() noexcept
+{
+	struct io_uring_cqe *cqes[COMPLETION_BATCH];
+
+	struct {
+		void *user_data;
+		int res;
+		unsigned flags;
+	} completions[COMPLETION_BATCH];
+
+	unsigned n;
+	while ((n = ring.PeekCompletions(cqes, COMPLETION_BATCH)) > 0) {
+		/* copy the batch and advance the completion queue
+		   before invoking the handlers; else a handler which
+		   dispatches completions itself would dispatch the
+		   same entries again */
+		for (unsigned i = 0; i < n; ++i)
+			completions[i] = {io_uring_cqe_get_data(cqes[i]),
+					  cqes[i]->res, cqes[i]->flags};
+
+		ring.AdvanceCompletionQueue(n);
+
+		/* since the completion queue has room now, handlers
+		   which cancel other operations can submit their
+		   cancel requests right away */
+		for (unsigned i = 0; i < n; ++i)
+			Dispatch(completions[i].user_data,
+				 completions[i].res, completions[i].flags);
+	}
+
+	if (n_postponed_cancels > 0)
+		/* a handler has requested a cancel, but no entry was
+		   available (or a chain was incomplete) */
+		ScheduleSubmit();
 }
 
 bool
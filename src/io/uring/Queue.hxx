@@ -37,6 +37,8 @@
 
 #include <liburing.h>
 
+#include <cstddef>
+
 namespace Uring {
 
 class Operation;
@@ -51,42 +53,204 @@ class Queue {
 
 	IntrusiveList<CancellableOperation> operations;
 
+	/**
+	 * The number of items in #operations.  This includes
+	 * canceled operations whose completion has not yet been
+	 * received.
+	 */
+	std::size_t n_pending = 0;
+
+	/**
+	 * Was the most recent entry pushed with `IOSQE_IO_LINK`,
+	 * i.e. is a chain waiting for its next member?  While this
+	 * is set, the submission queue must not be flushed, because
+	 * that would split the chain.
+	 */
+	bool link_open = false;
+
+	/**
+	 * The number of items in #operations whose cancel request
+	 * has been postponed, see FlushCancels().
+	 */
+	std::size_t n_postponed_cancels = 0;
+
 public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param entries the size of the submission queue; a larger
+	 * ring allows more operations to be submitted with one
+	 * system call
+	 * @param flags a bit mask of IORING_SETUP_* flags, e.g.
+	 * IORING_SETUP_SQPOLL, IORING_SETUP_COOP_TASKRUN or
+	 * IORING_SETUP_SINGLE_ISSUER (the kernel rejects flags it
+	 * does not support)
+	 */
 	Queue(unsigned entries, unsigned flags);
+
+	/**
+	 * @see Ring::Ring(unsigned, struct io_uring_params &)
+	 */
+	Queue(unsigned entries, struct io_uring_params &params);
+
 	~Queue() noexcept;
 
 	FileDescriptor GetFileDescriptor() const noexcept {
 		return ring.GetFileDescriptor();
 	}
 
-	struct io_uring_sqe *GetSubmitEntry() noexcept {
-		return ring.GetSubmitEntry();
-	}
+	/**
+	 * Obtain a free submission queue entry.  If the submission
+	 * queue is full, all pending entries are submitted to make
+	 * room (unless a chain of linked entries is incomplete; see
+	 * ReserveSubmitEntries()).
+	 *
+	 * @return the entry or nullptr if the submission queue is
+	 * full and submitting failed
+	 */
+	struct io_uring_sqe *GetSubmitEntry() noexcept;
+
+	/**
+	 * Like GetSubmitEntry(), but throw std::system_error
+	 * (`EBUSY`) instead of returning nullptr.
+	 */
+	struct io_uring_sqe &RequireSubmitEntry();
+
+	/**
+	 * Make sure the submission queue has room for the given
+	 * number of entries, submitting pending entries if
+	 * necessary.  Call this before pushing a chain of linked
+	 * entries (`IOSQE_IO_LINK`), because the chain must not be
+	 * split by flushing the submission queue in the middle.
+	 *
+	 * Throws on error (e.g. if the submission queue is smaller
+	 * than the chain).
+	 */
+	void ReserveSubmitEntries(unsigned n);
 
 	bool HasPending() const noexcept {
 		return !operations.empty();
 	}
 
+	std::size_t GetPendingCount() const noexcept {
+		return n_pending;
+	}
+
+	/**
+	 * Cancel the given operation (if it is pending) and ask the
+	 * kernel to abort it with `IORING_OP_ASYNC_CANCEL`.  Unlike
+	 * Operation::CancelUring(), this releases all kernel
+	 * resources held by the operation (e.g. file references)
+	 * soon.  The cancel request is submitted with
+	 * ScheduleSubmit().
+	 */
+	void CancelOperation(Operation &operation) noexcept;
+
+	/**
+	 * Ask the kernel to abort the given operation with
+	 * `IORING_OP_ASYNC_CANCEL`, but unlike CancelOperation(),
+	 * keep listening for its completions.  This is useful for
+	 * multishot operations whose remaining completions carry
+	 * resources (e.g. provided buffers) which must be returned.
+	 *
+	 * If no submission queue entry is available (or a chain of
+	 * linked entries is incomplete), the cancel request is
+	 * postponed until the next Submit() call; it is never
+	 * dropped.
+	 */
+	void RequestCancel(Operation &operation) noexcept;
+
+	/**
+	 * @see Ring::RegisterBuffers()
+	 */
+	void RegisterBuffers(const struct iovec *iovecs, unsigned n) {
+		ring.RegisterBuffers(iovecs, n);
+	}
+
+	void UnregisterBuffers() noexcept {
+		ring.UnregisterBuffers();
+	}
+
+	/**
+	 * @see Ring::RegisterFiles()
+	 */
+	void RegisterFiles(const int *fds, unsigned n) {
+		ring.RegisterFiles(fds, n);
+	}
+
+	/**
+	 * @see Ring::UpdateFiles()
+	 */
+	void UpdateFiles(unsigned offset, const int *fds, unsigned n) {
+		ring.UpdateFiles(offset, fds, n);
+	}
+
+	void UnregisterFiles() noexcept {
+		ring.UnregisterFiles();
+	}
+
+	/**
+	 * @see Ring::SetupBufferRing()
+	 */
+	struct io_uring_buf_ring *SetupBufferRing(unsigned n, unsigned group) {
+		return ring.SetupBufferRing(n, group);
+	}
+
+	void FreeBufferRing(struct io_uring_buf_ring *br,
+			    unsigned n, unsigned group) noexcept {
+		ring.FreeBufferRing(br, n, group);
+	}
+
 protected:
 	void AddPending(struct io_uring_sqe &sqe,
 			Operation &operation) noexcept;
 
+	/**
+	 * Arrange for Submit() to be called soon.  This is used for
+	 * entries which are not added with Push(), e.g. cancel
+	 * requests.  The default implementation submits right away.
+	 */
+	virtual void ScheduleSubmit() noexcept;
+
 public:
+	/**
+	 * Add the given entry to #operations and submit it.  A chain
+	 * is submitted after its last member has been pushed.
+	 *
+	 * If submitting fails, the entries remain in the submission
+	 * queue and are submitted by the next Submit() call.
+	 */
 	virtual void Push(struct io_uring_sqe &sqe,
 			  Operation &operation) noexcept {
 		AddPending(sqe, operation);
-		Submit();
+		ScheduleSubmit();
 	}
 
-	void Submit() {
-		ring.Submit();
-	}
+	/**
+	 * Submit all pending entries, including postponed cancel
+	 * requests.  This terminates a chain of linked entries
+	 * whose last member has never been pushed.
+	 *
+	 * Throws on error.
+	 */
+	void Submit();
+
+	/**
+	 * @see Ring::SubmitAndWaitCompletion()
+	 */
+	bool SubmitAndWaitCompletion(struct __kernel_timespec *timeout);
 
 	bool DispatchOneCompletion();
 
-	void DispatchCompletions() {
-		while (DispatchOneCompletion()) {}
-	}
+	/**
+	 * Dispatch all completions which are currently in the
+	 * completion queue.  They are harvested in batches, and the
+	 * completion queue head is advanced only once per batch
+	 * (before the handlers are invoked, so they may re-enter
+	 * this method).  Cancel requests which handlers could not
+	 * submit are scheduled with ScheduleSubmit().
+	 */
+	void DispatchCompletions() noexcept;
 
 	bool WaitDispatchOneCompletion();
 
@@ -95,6 +259,27 @@ public:
 	}
 
 private:
+	/**
+	 * Prepare an `IORING_OP_ASYNC_CANCEL` entry for the given
+	 * operation.
+	 *
+	 * @return false if no submission queue entry is available
+	 */
+	bool PrepareCancel(CancellableOperation &c) noexcept;
+
+	/**
+	 * Prepare the cancel requests which have been postponed by
+	 * RequestCancel().
+	 */
+	void FlushCancels() noexcept;
+
+	/**
+	 * Invoke the operation's completion handler.  The parameters
+	 * are copies of the completion queue entry's fields, which
+	 * must have been marked as seen already.
+	 */
+	void Dispatch(void *user_data, int res, unsigned flags) noexcept;
+
 	void DispatchOneCompletion(struct io_uring_cqe &cqe) noexcept;
 };
 
@@ -42,6 +42,13 @@ Ring::Ring(unsigned entries, unsigned flags)
 		throw MakeErrno(-error, "io_uring_queue_init() failed");
 }
 
+Ring::Ring(unsigned entries, struct io_uring_params &params)
+{
+	int error = io_uring_queue_init_params(entries, &ring, &params);
+	if (error < 0)
+		throw MakeErrno(-error, "io_uring_queue_init_params() failed");
+}
+
 void
 Ring::Submit()
 {
@@ -50,6 +57,63 @@ Ring::Submit()
 		throw MakeErrno(-error, "io_uring_submit() failed");
 }
 
+bool
+Ring::SubmitAndWaitCompletion(struct __kernel_timespec *timeout)
+{
+	int error;
+	if (timeout == nullptr) {
+		error = io_uring_submit_and_wait(&ring, 1);
+	} else {
+		struct io_uring_cqe *cqe;
+		error = io_uring_submit_and_wait_timeout(&ring, &cqe, 1,
+							 timeout, nullptr);
+	}
+
+	if (error < 0) {
+		if (error == -ETIME || error == -EINTR)
+			return false;
+
+		throw MakeErrno(-error, "io_uring_submit_and_wait() failed");
+	}
+
+	return true;
+}
+
+void
+Ring::RegisterBuffers(const struct iovec *iovecs, unsigned n)
+{
+	int error = io_uring_register_buffers(&ring, iovecs, n);
+	if (error < 0)
+		throw MakeErrno(-error, "io_uring_register_buffers() failed");
+}
+
+void
+Ring::RegisterFiles(const int *fds, unsigned n)
+{
+	int error = io_uring_register_files(&ring, fds, n);
+	if (error < 0)
+		throw MakeErrno(-error, "io_uring_register_files() failed");
+}
+
+void
+Ring::UpdateFiles(unsigned offset, const int *fds, unsigned n)
+{
+	int error = io_uring_register_files_update(&ring, offset, fds, n);
+	if (error < 0)
+		throw MakeErrno(-error, "io_uring_register_files_update() failed");
+}
+
+struct io_uring_buf_ring *
+Ring::SetupBufferRing(unsigned n, unsigned group)
+{
+	int error;
+	auto *br = io_uring_setup_buf_ring(&ring, n, group, 0, &error);
+	if (br == nullptr)
+		throw MakeErrno(-error, "io_uring_setup_buf_ring() failed");
+
+	return br;
+}
+
 struct io_uring_cqe *
 Ring::WaitCompletion()
 {
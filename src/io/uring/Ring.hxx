@@ -47,8 +47,20 @@ class Ring {
 	struct io_uring ring;
 
 public:
+	/**
+	 * Throws on error.
+	 *
+	 * @param entries the number of submission queue entries
+	 * @param flags a bit mask of IORING_SETUP_* flags
+	 */
 	Ring(unsigned entries, unsigned flags);
 
+	/**
+	 * This overload allows specifying more setup parameters,
+	 * e.g. `sq_thread_idle` for IORING_SETUP_SQPOLL.
+	 */
+	Ring(unsigned entries, struct io_uring_params &params);
+
 	~Ring() noexcept {
 		io_uring_queue_exit(&ring);
 	}
@@ -64,8 +76,26 @@ public:
 		return io_uring_get_sqe(&ring);
 	}
 
+	/**
+	 * @return the number of free submission queue entries
+	 */
+	unsigned GetSubmitSpace() const noexcept {
+		return io_uring_sq_space_left(&ring);
+	}
+
 	void Submit();
 
+	/**
+	 * Submit all pending entries and wait for at least one
+	 * completion, all in one io_uring_enter() system call.
+	 *
+	 * @param timeout the maximum time to wait; nullptr means wait
+	 * forever, and a zero timeout means don't wait at all
+	 * @return false if the timeout has expired or if the wait was
+	 * interrupted by a signal
+	 */
+	bool SubmitAndWaitCompletion(struct __kernel_timespec *timeout);
+
 	struct io_uring_cqe *WaitCompletion();
 
 	/**
@@ -76,6 +106,69 @@ public:
 	void SeenCompletion(struct io_uring_cqe &cqe) noexcept {
 		io_uring_cqe_seen(&ring, &cqe);
 	}
+
+	/**
+	 * Obtain up to the given number of completion queue entries
+	 * without consuming them.  After handling them, call
+	 * AdvanceCompletionQueue().
+	 *
+	 * @return the number of entries stored in the array (0 if
+	 * the completion queue is empty)
+	 */
+	unsigned PeekCompletions(struct io_uring_cqe **cqes,
+				 unsigned count) noexcept {
+		return io_uring_peek_batch_cqe(&ring, cqes, count);
+	}
+
+	/**
+	 * Mark the given number of completion queue entries as
+	 * consumed, i.e. advance the completion queue head only
+	 * once for a batch of entries.
+	 */
+	void AdvanceCompletionQueue(unsigned n) noexcept {
+		io_uring_cq_advance(&ring, n);
+	}
+
+	/**
+	 * Register buffers for IORING_OP_READ_FIXED and
+	 * IORING_OP_WRITE_FIXED.  Throws on error.
+	 */
+	void RegisterBuffers(const struct iovec *iovecs, unsigned n);
+
+	void UnregisterBuffers() noexcept {
+		io_uring_unregister_buffers(&ring);
+	}
+
+	/**
+	 * Register a table of file descriptors to be used with
+	 * IOSQE_FIXED_FILE.  Entries may be -1 to be filled later by
+	 * UpdateFiles().  Throws on error.
+	 */
+	void RegisterFiles(const int *fds, unsigned n);
+
+	/**
+	 * Replace entries in the table registered by
+	 * RegisterFiles().  Throws on error.
+	 */
+	void UpdateFiles(unsigned offset, const int *fds, unsigned n);
+
+	void UnregisterFiles() noexcept {
+		io_uring_unregister_files(&ring);
+	}
+
+	/**
+	 * Set up and register a ring of provided buffers
+	 * (`IORING_REGISTER_PBUF_RING`).  Throws on error.
+	 *
+	 * @param n the number of entries (a power of two)
+	 * @param group the buffer group id
+	 */
+	struct io_uring_buf_ring *SetupBufferRing(unsigned n, unsigned group);
+
+	void FreeBufferRing(struct io_uring_buf_ring *br,
+			    unsigned n, unsigned group) noexcept {
+		io_uring_free_buf_ring(&ring, br, n, group);
+	}
 };
 
 } // namespace Uring
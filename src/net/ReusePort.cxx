@@ -0,0 +1,81 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ReusePort.hxx"
+#include "SocketDescriptor.hxx"
+#include "SocketError.hxx"
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+void
+AttachReusePortCpuSteering(SocketDescriptor s, ConstBuffer<int> cpus)
+{
+	if (cpus.size * 2 + 2 > BPF_MAXINSNS)
+		throw std::invalid_argument("Too many CPUs");
+
+	std::vector<struct sock_filter> code;
+	code.reserve(cpus.size * 2 + 2);
+
+	/* A = current CPU */
+	code.push_back(BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+				(uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+
+	/* a lookup table: if (A == cpu) return index; */
+	for (std::size_t i = 0; i < cpus.size; ++i) {
+		code.push_back(BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,
+					(uint32_t)cpus[i], 0, 1));
+		code.push_back(BPF_STMT(BPF_RET|BPF_K, (uint32_t)i));
+	}
+
+	/* unknown CPU: return an invalid index, which makes the
+	   kernel fall back to the hash */
+	code.push_back(BPF_STMT(BPF_RET|BPF_K, 0xffffffff));
+
+	const struct sock_fprog prog{
+		.len = (unsigned short)code.size(),
+		.filter = code.data(),
+	};
+
+	if (!s.SetOption(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+			 &prog, sizeof(prog)))
+		throw MakeSocketError("Failed to attach SO_REUSEPORT program");
+}
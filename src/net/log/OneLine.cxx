@@ -34,24 +34,43 @@
 #include "Datagram.hxx"
 #include "net/Anonymize.hxx"
 #include "io/FileDescriptor.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/DecimalFormat.h"
 #include "util/StringBuffer.hxx"
 #include "util/StringBuilder.hxx"
 
+#include <new>
+
+#include <errno.h>
 #include <stdio.h>
-#include <time.h>
+#include <string.h>
 
+/**
+ * @param cache an optional cache for the rendered timestamp
+ */
 static void
-AppendTimestamp(StringBuilder &b, Net::Log::TimePoint value)
+AppendTimestamp(StringBuilder &b, Net::Log::TimePoint value,
+		Net::Log::TimestampCache *cache)
 {
 	using namespace std::chrono;
-	time_t t = duration_cast<seconds>(value.time_since_epoch()).count();
-	struct tm tm;
-	size_t n = strftime(b.GetTail(), b.GetRemainingSize(),
-			    "%d/%b/%Y:%H:%M:%S %z", localtime_r(&t, &tm));
-	if (n == 0)
-		throw StringBuilder::Overflow();
+	const time_t t = duration_cast<seconds>(value.time_since_epoch()).count();
 
-	b.Extend(n);
+	b.CheckAppend(Net::Log::TIMESTAMP_LENGTH);
+
+	if (cache != nullptr)
+		memcpy(b.GetTail(), cache->Format(t),
+		       Net::Log::TIMESTAMP_LENGTH);
+	else
+		Net::Log::FormatTimestamp(b.GetTail(), t);
+
+	b.Extend(Net::Log::TIMESTAMP_LENGTH);
+}
+
+static void
+AppendDecimal(StringBuilder &b, uint64_t value)
+{
+	char buffer[32];
+	b.Append(buffer, format_uint64(buffer, value));
 }
 
 [[gnu::const]]
@@ -97,21 +116,11 @@ AppendAnonymize(StringBuilder &b, const char *value)
 	b.Append(result.second);
 }
 
-template<typename... Args>
-static inline void
-AppendFormat(StringBuilder &b, const char *fmt, Args&&... args)
-{
-	size_t size = b.GetRemainingSize();
-	size_t n = snprintf(b.GetTail(), size, fmt, args...);
-	if (n >= size - 1)
-		throw StringBuilder::Overflow();
-	b.Extend(n);
-}
-
 static char *
 FormatOneLineHttp(char *buffer, size_t buffer_size,
 		  const Net::Log::Datagram &d,
-		  bool site, bool anonymize) noexcept
+		  bool site, bool anonymize,
+		  Net::Log::TimestampCache *cache) noexcept
 try {
 	StringBuilder b(buffer, buffer_size);
 
@@ -130,7 +139,7 @@ try {
 	b.Append(" - - [");
 
 	if (d.HasTimestamp())
-		AppendTimestamp(b, d.timestamp);
+		AppendTimestamp(b, d.timestamp, cache);
 	else
 		b.Append('-');
 
@@ -139,14 +148,18 @@ try {
 		? http_method_to_string(d.http_method)
 		: "?";
 
-	AppendFormat(b, "] \"%s ", method);
+	b.Append("] \"");
+	b.Append(method);
+	b.Append(' ');
 
 	AppendEscape(b, d.http_uri);
 
-	AppendFormat(b, " HTTP/1.1\" %u ", d.http_status);
+	b.Append(" HTTP/1.1\" ");
+	AppendDecimal(b, d.http_status);
+	b.Append(' ');
 
 	if (d.valid_length)
-		AppendFormat(b, "%llu", (unsigned long long)d.length);
+		AppendDecimal(b, d.length);
 	else
 		b.Append('-');
 
@@ -157,7 +170,7 @@ try {
 	b.Append("\" ");
 
 	if (d.valid_duration)
-		AppendFormat(b, "%llu", (unsigned long long)d.duration.count());
+		AppendDecimal(b, d.duration.count());
 	else
 		b.Append('-');
 
@@ -169,7 +182,7 @@ try {
 static char *
 FormatOneLineMessage(char *buffer, size_t buffer_size,
 		     const Net::Log::Datagram &d,
-		     bool site) noexcept
+		     bool site, Net::Log::TimestampCache *cache) noexcept
 try {
 	StringBuilder b(buffer, buffer_size);
 
@@ -180,7 +193,7 @@ try {
 
 	b.Append('[');
 	if (d.HasTimestamp())
-		AppendTimestamp(b, d.timestamp);
+		AppendTimestamp(b, d.timestamp, cache);
 	else
 		b.Append('-');
 
@@ -192,23 +205,58 @@ try {
 	return buffer;
 }
 
-char *
+static char *
 FormatOneLine(char *buffer, size_t buffer_size,
-	      const Net::Log::Datagram &d, bool site, bool anonymize) noexcept
+	      const Net::Log::Datagram &d, bool site, bool anonymize,
+	      Net::Log::TimestampCache *cache) noexcept
 {
 	if (d.GuessIsHttpAccess())
 		return FormatOneLineHttp(buffer, buffer_size, d,
-					 site, anonymize);
+					 site, anonymize, cache);
 	else if (d.message != nullptr)
-		return FormatOneLineMessage(buffer, buffer_size, d, site);
+		return FormatOneLineMessage(buffer, buffer_size, d,
+					    site, cache);
 	else
 		return buffer;
 }
 
+char *
+FormatOneLine(char *buffer, size_t buffer_size,
+	      const Net::Log::Datagram &d, bool site, bool anonymize) noexcept
+{
+	return FormatOneLine(buffer, buffer_size, d, site, anonymize,
+			     nullptr);
+}
+
+static bool
+WriteAll(FileDescriptor fd, const char *p, size_t size) noexcept
+{
+	while (size > 0) {
+		ssize_t nbytes = fd.Write(p, size);
+		if (nbytes < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		p += nbytes;
+		size -= nbytes;
+	}
+
+	return true;
+}
+
+/**
+ * The maximum length of one line (including the newline
+ * character).
+ */
+static constexpr size_t MAX_LINE_LENGTH = 16384;
+
 bool
 LogOneLine(FileDescriptor fd, const Net::Log::Datagram &d, bool site) noexcept
 {
-	char buffer[16384];
+	char buffer[MAX_LINE_LENGTH];
 	char *end = FormatOneLine(buffer, sizeof(buffer) - 1, d, site);
 	if (end == buffer)
 		return true;
@@ -216,3 +264,49 @@ LogOneLine(FileDescriptor fd, const Net::Log::Datagram &d, bool site) noexcept
 	*end++ = '\n';
 	return fd.Write(buffer, end - buffer) >= 0;
 }
+
+char *
+OneLineFormatter::Format(char *buffer, std::size_t buffer_size,
+			 const Net::Log::Datagram &d) noexcept
+{
+	return FormatOneLine(buffer, buffer_size, d, site, anonymize,
+			     &timestamp_cache);
+}
+
+bool
+OneLineFormatter::Write(FileDescriptor fd,
+			ConstBuffer<Net::Log::Datagram> datagrams) noexcept
+{
+	static_assert(WRITE_BUFFER_SIZE >= MAX_LINE_LENGTH);
+
+	if (write_buffer == nullptr) {
+		write_buffer.reset(new (std::nothrow) char[WRITE_BUFFER_SIZE]);
+		if (write_buffer == nullptr) {
+			errno = ENOMEM;
+			return false;
+		}
+	}
+
+	char *const buffer = write_buffer.get();
+	char *p = buffer;
+	char *const end = buffer + WRITE_BUFFER_SIZE;
+
+	for (const auto &d : datagrams) {
+		if (size_t(end - p) < MAX_LINE_LENGTH) {
+			/* not enough room for another line */
+			if (!WriteAll(fd, buffer, p - buffer))
+				return false;
+
+			p = buffer;
+		}
+
+		char *line_end = Format(p, MAX_LINE_LENGTH - 1, d);
+		if (line_end == p)
+			continue;
+
+		*line_end++ = '\n';
+		p = line_end;
+	}
+
+	return WriteAll(fd, buffer, p - buffer);
+}
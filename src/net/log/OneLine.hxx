@@ -32,9 +32,13 @@
 
 #pragma once
 
+#include "Timestamp.hxx"
+
 #include <cstddef>
+#include <memory>
 
 namespace Net { namespace Log { struct Datagram; }}
+template<typename T> struct ConstBuffer;
 class FileDescriptor;
 
 /**
@@ -61,3 +65,52 @@ FormatOneLine(char *buffer, std::size_t buffer_size,
 bool
 LogOneLine(FileDescriptor fd, const Net::Log::Datagram &d,
 	   bool site=true) noexcept;
+
+/**
+ * Formats #Net::Log::Datagram instances like FormatOneLine(), but
+ * caches the rendered timestamp, which makes it much cheaper to
+ * format many datagrams (with similar timestamps) in a row.
+ */
+class OneLineFormatter {
+	Net::Log::TimestampCache timestamp_cache;
+
+	/**
+	 * The output buffer for Write(), allocated on the first
+	 * call.
+	 */
+	std::unique_ptr<char[]> write_buffer;
+
+	static constexpr std::size_t WRITE_BUFFER_SIZE = 65536;
+
+	const bool site, anonymize;
+
+public:
+	/**
+	 * @param _site log the site name?
+	 * @param _anonymize anonymize IP addresses by zeroing a
+	 * portion at the end?
+	 */
+	explicit OneLineFormatter(bool _site=true,
+				  bool _anonymize=false) noexcept
+		:site(_site), anonymize(_anonymize) {}
+
+	/**
+	 * Convert the given datagram to a text line (without a
+	 * trailing newline character and without a null
+	 * terminator).
+	 *
+	 * @return a pointer to the end of the line
+	 */
+	char *Format(char *buffer, std::size_t buffer_size,
+		     const Net::Log::Datagram &d) noexcept;
+
+	/**
+	 * Print all datagrams, one line each.  The lines are
+	 * collected in one buffer, which is written with a single
+	 * write() call (unless it overflows).
+	 *
+	 * @return true on success, false on error (errno set)
+	 */
+	bool Write(FileDescriptor fd,
+		   ConstBuffer<Net::Log::Datagram> datagrams) noexcept;
+};
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Timestamp.hxx"
+#include "time/gmtime.hxx"
+#include "util/DecimalFormat.h"
+
+#include <string.h>
+
+namespace Net {
+namespace Log {
+
+static constexpr char month_names[13][4] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+	"???",
+};
+
+static void
+FormatTimestamp(char *p, const struct tm &tm, long gmtoff) noexcept
+{
+	format_2digit(p, tm.tm_mday);
+	p[2] = '/';
+	memcpy(p + 3, month_names[gcc_likely(tm.tm_mon >= 0 && tm.tm_mon < 12)
+				  ? tm.tm_mon : 12], 3);
+	p[6] = '/';
+	format_4digit(p + 7, tm.tm_year + 1900);
+	p[11] = ':';
+	format_2digit(p + 12, tm.tm_hour);
+	p[14] = ':';
+	format_2digit(p + 15, tm.tm_min);
+	p[17] = ':';
+	format_2digit(p + 18, tm.tm_sec);
+	p[20] = ' ';
+
+	p[21] = gmtoff < 0 ? '-' : '+';
+	const unsigned minutes = (gmtoff < 0 ? -gmtoff : gmtoff) / 60;
+	format_2digit(p + 22, minutes / 60);
+	format_2digit(p + 24, minutes % 60);
+}
+
+void
+FormatTimestamp(char *buffer, time_t t) noexcept
+{
+	struct tm tm;
+	localtime_r(&t, &tm);
+	FormatTimestamp(buffer, tm, tm.tm_gmtoff);
+}
+
+const char *
+TimestampCache::Format(time_t t) noexcept
+{
+	if (t == current)
+		return buffer;
+
+	if (gcc_unlikely(t < 0)) {
+		FormatTimestamp(buffer, t);
+		current = -1;
+		return buffer;
+	}
+
+	const time_t t_hour = t - t % 3600;
+	if (t_hour != hour) {
+		/* determine the UTC offset at the beginning and at
+		   the end of this hour; if both are equal, it is
+		   valid for the whole hour */
+		hour = t_hour;
+
+		struct tm a, b;
+		const time_t end = t_hour + 3599;
+		localtime_r(&t_hour, &a);
+		localtime_r(&end, &b);
+
+		gmtoff = a.tm_gmtoff;
+		hour_valid = a.tm_gmtoff == b.tm_gmtoff;
+	} else if (hour_valid && current >= 0 &&
+		   (t + gmtoff) / 60 == (current + gmtoff) / 60) {
+		/* same minute: only the seconds have changed */
+		format_2digit(buffer + 18, (t + gmtoff) % 60);
+		current = t;
+		return buffer;
+	}
+
+	if (hour_valid)
+		FormatTimestamp(buffer, sysx_time_gmtime(t + gmtoff), gmtoff);
+	else
+		FormatTimestamp(buffer, t);
+
+	current = t;
+	return buffer;
+}
+
+}}
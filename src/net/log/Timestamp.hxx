@@ -0,0 +1,100 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include <time.h>
+
+namespace Net {
+namespace Log {
+
+/**
+ * The length of a timestamp rendered by FormatTimestamp(),
+ * e.g. "16/Oct/2021:12:34:56 +0200".
+ */
+static constexpr std::size_t TIMESTAMP_LENGTH = 26;
+
+/**
+ * Render a timestamp in the local time zone, like strftime() with
+ * "%d/%b/%Y:%H:%M:%S %z" in the "C" locale (the Apache log format).
+ * Exactly #TIMESTAMP_LENGTH characters are written, without a null
+ * terminator.
+ */
+void
+FormatTimestamp(char *buffer, time_t t) noexcept;
+
+/**
+ * Like FormatTimestamp(), but remembers the last rendered timestamp
+ * and the time zone offset of the current hour, so consecutive
+ * calls within the same second cost nearly nothing, and calls
+ * within the same hour need no localtime_r() call.
+ *
+ * This assumes the time zone does not change while this object
+ * exists, and that the UTC offset changes at most once per hour.
+ */
+class TimestampCache {
+	/**
+	 * The time which is currently rendered in #buffer; -1 if
+	 * nothing has been rendered yet.
+	 */
+	time_t current = -1;
+
+	/**
+	 * The beginning of the hour for which #gmtoff was
+	 * determined; -1 if unknown.
+	 */
+	time_t hour = -1;
+
+	/**
+	 * The UTC offset [seconds] which is valid throughout #hour;
+	 * only valid if #hour_valid is true.
+	 */
+	long gmtoff;
+
+	/**
+	 * False if the UTC offset changes during #hour.
+	 */
+	bool hour_valid;
+
+	char buffer[TIMESTAMP_LENGTH];
+
+public:
+	/**
+	 * @return a pointer to #TIMESTAMP_LENGTH characters (not
+	 * null-terminated), valid until the next call
+	 */
+	const char *Format(time_t t) noexcept;
+};
+
+}}
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/*
+ * Definitions for the columnar archive file format for
+ * #Net::Log::Datagram records.
+ */
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+namespace Archive {
+
+/*
+
+  All integers in headers are little-endian.  A file starts with
+  #FILE_MAGIC and #VERSION (4 bytes each), followed by any number of
+  self-contained blocks.
+
+  Each block starts with a header of #BLOCK_HEADER_SIZE bytes:
+
+  - #BLOCK_MAGIC
+  - the number of records
+  - the number of columns
+  - the size of the rest of the block (column directory and data)
+
+  After that, there is a column directory entry for each column
+  (#COLUMN_HEADER_SIZE bytes each):
+
+  - the #Column (1 byte)
+  - the #Encoding (1 byte)
+  - the #Compression (1 byte)
+  - padding (1 byte)
+  - the stored size of the column data
+  - the decompressed size of the column data
+  - the CRC32 of the stored column data
+
+  The column data follows the directory in the same order.  A reader
+  can therefore locate and decode one column without touching the
+  others.  Columns without any values in this block are omitted;
+  their values are all absent.
+
+  Column data uses LEB128 variable-length integers ("varint").
+  Integer columns start with a presence bitmap (one bit per record,
+  least significant bit first), followed by one varint for each
+  present value.  Strings include a null terminator, so they can be
+  used directly as C strings.  See #Encoding for details.
+
+ */
+
+static constexpr uint32_t FILE_MAGIC = 0x3141'4c4e; // "NLA1"
+static constexpr uint32_t VERSION = 1;
+static constexpr std::size_t FILE_HEADER_SIZE = 8;
+
+static constexpr uint32_t BLOCK_MAGIC = 0x4b42'4c4e; // "NLBK"
+static constexpr std::size_t BLOCK_HEADER_SIZE = 16;
+static constexpr std::size_t COLUMN_HEADER_SIZE = 16;
+
+/**
+ * The maximum number of records in one block.  Readers refuse
+ * larger blocks, which protects them against huge allocations.
+ */
+static constexpr std::size_t MAX_BLOCK_RECORDS = 1 << 20;
+
+enum class Column : uint8_t {
+	TIMESTAMP,
+	REMOTE_HOST,
+	HOST,
+	SITE,
+	FORWARDED_TO,
+	HTTP_METHOD,
+	HTTP_URI,
+	HTTP_REFERER,
+	USER_AGENT,
+	MESSAGE,
+	HTTP_STATUS,
+	LENGTH,
+	TRAFFIC_RECEIVED,
+	TRAFFIC_SENT,
+	DURATION,
+	TYPE,
+};
+
+static constexpr std::size_t N_COLUMNS = std::size_t(Column::TYPE) + 1;
+
+enum class Encoding : uint8_t {
+	/**
+	 * Integers: each present value is a varint.
+	 */
+	INTEGER = 1,
+
+	/**
+	 * Integers: each present value is the difference to the
+	 * previous present value (or to zero), zigzag-encoded as
+	 * varint.  Used for timestamps and durations.
+	 */
+	INTEGER_DELTA = 2,
+
+	/**
+	 * Strings: for each record, a varint with the length plus
+	 * one (zero means absent), followed by the string and a null
+	 * terminator.
+	 */
+	STRING = 3,
+
+	/**
+	 * Strings: a varint with the number of dictionary entries,
+	 * each entry being a varint length followed by the string and
+	 * a null terminator; then for each record a varint with the
+	 * dictionary index plus one (zero means absent).
+	 */
+	STRING_DICTIONARY = 4,
+};
+
+enum class Compression : uint8_t {
+	NONE = 0,
+
+	/**
+	 * zlib (RFC 1950) stream.
+	 */
+	ZLIB = 1,
+};
+
+}}}
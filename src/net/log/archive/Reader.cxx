@@ -0,0 +1,383 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Reader.hxx"
+#include "Varint.hxx"
+#include "net/log/Datagram.hxx"
+#include "util/CRC32.hxx"
+
+#include <zlib.h>
+
+namespace Net {
+namespace Log {
+namespace Archive {
+
+/**
+ * The maximum compression ratio of zlib's "deflate" algorithm.  A
+ * column whose declared decompressed size exceeds its stored size
+ * times this factor is malformed; checking this before allocating
+ * the buffer protects against huge allocations.
+ */
+static constexpr std::size_t MAX_ZLIB_RATIO = 1032;
+
+static const std::byte *
+ReadVarintChecked(const std::byte *p, const std::byte *end,
+		  uint64_t &value_r)
+{
+	p = ReadVarint(p, end, value_r);
+	if (p == nullptr)
+		throw FormatError("Malformed varint");
+
+	return p;
+}
+
+/**
+ * Read a string of the given length followed by a null terminator.
+ */
+static const std::byte *
+ReadString(const std::byte *p, const std::byte *end, uint64_t length,
+	   StringView &value_r)
+{
+	if (length >= std::size_t(end - p) || p[length] != std::byte{0})
+		throw FormatError("Malformed string");
+
+	value_r = {(const char *)p, std::size_t(length)};
+	return p + length + 1;
+}
+
+IntegerColumnReader::IntegerColumnReader(Encoding encoding,
+					 ConstBuffer<std::byte> data,
+					 std::size_t _n_records)
+	:bitmap(data.data), end(data.data + data.size),
+	 n_records(_n_records),
+	 delta(encoding == Encoding::INTEGER_DELTA)
+{
+	if (encoding != Encoding::INTEGER &&
+	    encoding != Encoding::INTEGER_DELTA)
+		throw FormatError("Not an integer column");
+
+	const std::size_t bitmap_size = (n_records + 7) / 8;
+	if (data.size < bitmap_size)
+		throw FormatError("Truncated integer column");
+
+	p = bitmap + bitmap_size;
+}
+
+bool
+IntegerColumnReader::Next(uint64_t &value_r)
+{
+	const std::size_t index = i++;
+	if (index >= n_records ||
+	    (bitmap[index / 8] & std::byte(1U << (index % 8))) == std::byte{0})
+		return false;
+
+	uint64_t value;
+	p = ReadVarintChecked(p, end, value);
+
+	if (delta) {
+		previous += uint64_t(ZigZagDecode(value));
+		value = previous;
+	}
+
+	value_r = value;
+	return true;
+}
+
+StringColumnReader::StringColumnReader(Encoding encoding,
+				       ConstBuffer<std::byte> data)
+	:p(data.data), end(data.data + data.size),
+	 use_dictionary(encoding == Encoding::STRING_DICTIONARY)
+{
+	if (encoding != Encoding::STRING &&
+	    encoding != Encoding::STRING_DICTIONARY)
+		throw FormatError("Not a string column");
+
+	if (!use_dictionary)
+		return;
+
+	uint64_t n;
+	p = ReadVarintChecked(p, end, n);
+
+	/* each entry needs at least two bytes; this check protects
+	   against huge allocations */
+	if (n > std::size_t(end - p) / 2)
+		throw FormatError("Malformed dictionary");
+
+	dictionary.reserve(n);
+
+	for (uint64_t j = 0; j < n; ++j) {
+		uint64_t length;
+		p = ReadVarintChecked(p, end, length);
+
+		StringView value;
+		p = ReadString(p, end, length, value);
+		dictionary.push_back(value);
+	}
+}
+
+StringView
+StringColumnReader::Next()
+{
+	if (p == end)
+		/* column not present, or truncated; if the latter,
+		   treat missing values as absent */
+		return nullptr;
+
+	uint64_t value;
+	p = ReadVarintChecked(p, end, value);
+	if (value == 0)
+		return nullptr;
+
+	if (use_dictionary) {
+		if (value > dictionary.size())
+			throw FormatError("Bad dictionary index");
+
+		return dictionary[value - 1];
+	}
+
+	StringView s;
+	p = ReadString(p, end, value - 1, s);
+	return s;
+}
+
+ConstBuffer<std::byte>
+Block::GetColumnData(Column column)
+{
+	auto &c = columns[std::size_t(column)];
+	if (c.stored.IsNull())
+		return nullptr;
+
+	auto &buffer = decompressed[std::size_t(column)];
+
+	if (!c.loaded) {
+		CRC32 crc;
+		crc.Update(c.stored.ToVoid());
+		if (crc.Finish() != c.crc)
+			throw FormatError("Column CRC mismatch");
+
+		switch (c.compression) {
+		case Compression::NONE:
+			if (c.stored.size != c.raw_size)
+				throw FormatError("Column size mismatch");
+			break;
+
+		case Compression::ZLIB:
+			{
+				if (c.raw_size / MAX_ZLIB_RATIO > c.stored.size)
+					throw FormatError("Column size mismatch");
+
+				buffer.resize(c.raw_size);
+				uLongf size = c.raw_size;
+				int result = uncompress((Bytef *)buffer.data(),
+							&size,
+							(const Bytef *)c.stored.data,
+							c.stored.size);
+				if (result != Z_OK || size != c.raw_size)
+					throw FormatError("Failed to decompress column");
+			}
+			break;
+
+		default:
+			throw FormatError("Unsupported compression");
+		}
+
+		c.loaded = true;
+	}
+
+	if (c.compression == Compression::NONE)
+		return c.stored;
+
+	return {buffer.data(), buffer.size()};
+}
+
+IntegerColumnReader
+Block::ReadIntegers(Column column)
+{
+	const auto data = GetColumnData(column);
+	if (data.IsNull())
+		return {};
+
+	return {columns[std::size_t(column)].encoding, data, n_records};
+}
+
+StringColumnReader
+Block::ReadStrings(Column column)
+{
+	const auto data = GetColumnData(column);
+	if (data.IsNull())
+		return {};
+
+	return {columns[std::size_t(column)].encoding, data};
+}
+
+void
+Block::ToDatagrams(std::vector<Datagram> &dest)
+{
+	dest.clear();
+	dest.resize(n_records);
+
+	auto timestamp = ReadIntegers(Column::TIMESTAMP);
+	auto remote_host = ReadStrings(Column::REMOTE_HOST);
+	auto host = ReadStrings(Column::HOST);
+	auto site = ReadStrings(Column::SITE);
+	auto forwarded_to = ReadStrings(Column::FORWARDED_TO);
+	auto http_method = ReadIntegers(Column::HTTP_METHOD);
+	auto http_uri = ReadStrings(Column::HTTP_URI);
+	auto http_referer = ReadStrings(Column::HTTP_REFERER);
+	auto user_agent = ReadStrings(Column::USER_AGENT);
+	auto message = ReadStrings(Column::MESSAGE);
+	auto http_status = ReadIntegers(Column::HTTP_STATUS);
+	auto length = ReadIntegers(Column::LENGTH);
+	auto traffic_received = ReadIntegers(Column::TRAFFIC_RECEIVED);
+	auto traffic_sent = ReadIntegers(Column::TRAFFIC_SENT);
+	auto duration = ReadIntegers(Column::DURATION);
+	auto type = ReadIntegers(Column::TYPE);
+
+	for (auto &d : dest) {
+		uint64_t value;
+
+		if (timestamp.Next(value))
+			d.timestamp = TimePoint(Duration(value));
+
+		d.remote_host = remote_host.Next().data;
+		d.host = host.Next().data;
+		d.site = site.Next().data;
+		d.forwarded_to = forwarded_to.Next().data;
+
+		if (http_method.Next(value))
+			d.http_method = http_method_t(value);
+
+		d.http_uri = http_uri.Next().data;
+		d.http_referer = http_referer.Next().data;
+		d.user_agent = user_agent.Next().data;
+		d.message = message.Next();
+
+		if (http_status.Next(value))
+			d.http_status = http_status_t(value);
+
+		d.valid_length = length.Next(d.length);
+
+		d.valid_traffic = traffic_received.Next(d.traffic_received);
+		if (!traffic_sent.Next(d.traffic_sent))
+			d.valid_traffic = false;
+
+		if (duration.Next(value)) {
+			d.duration = Duration(value);
+			d.valid_duration = true;
+		}
+
+		if (type.Next(value))
+			d.type = Type(value);
+	}
+}
+
+inline void
+Block::Clear() noexcept
+{
+	for (auto &c : columns)
+		c.stored = nullptr;
+
+	n_records = 0;
+}
+
+Reader::Reader(ConstBuffer<void> file)
+	:remaining(ConstBuffer<std::byte>::FromVoid(file))
+{
+	if (remaining.size < FILE_HEADER_SIZE ||
+	    LoadLE32(remaining.data) != FILE_MAGIC)
+		throw FormatError("Not an archive file");
+
+	if (LoadLE32(remaining.data + 4) != VERSION)
+		throw FormatError("Unsupported archive version");
+
+	remaining.skip_front(FILE_HEADER_SIZE);
+}
+
+bool
+Reader::ReadBlock(Block &block)
+{
+	block.Clear();
+
+	if (remaining.empty())
+		return false;
+
+	if (remaining.size < BLOCK_HEADER_SIZE ||
+	    LoadLE32(remaining.data) != BLOCK_MAGIC)
+		throw FormatError("Malformed block header");
+
+	const std::size_t n_records = LoadLE32(remaining.data + 4);
+	const std::size_t n_columns = LoadLE32(remaining.data + 8);
+	const std::size_t size = LoadLE32(remaining.data + 12);
+	remaining.skip_front(BLOCK_HEADER_SIZE);
+
+	if (size > remaining.size || n_columns > N_COLUMNS ||
+	    n_columns * COLUMN_HEADER_SIZE > size)
+		throw FormatError("Malformed block header");
+
+	if (n_records > MAX_BLOCK_RECORDS)
+		throw FormatError("Too many records in block");
+
+	const std::byte *directory = remaining.data;
+	const std::byte *data = directory + n_columns * COLUMN_HEADER_SIZE;
+	const std::byte *const end = remaining.data + size;
+
+	for (std::size_t i = 0; i < n_columns; ++i) {
+		const std::byte *h = directory + i * COLUMN_HEADER_SIZE;
+
+		const std::size_t column = std::size_t(h[0]);
+		if (column >= N_COLUMNS)
+			throw FormatError("Unknown column");
+
+		auto &c = block.columns[column];
+		if (!c.stored.IsNull())
+			throw FormatError("Duplicate column");
+
+		const std::size_t stored_size = LoadLE32(h + 4);
+		if (stored_size > std::size_t(end - data))
+			throw FormatError("Truncated column");
+
+		c.encoding = Encoding(h[1]);
+		c.compression = Compression(h[2]);
+		c.stored = {data, stored_size};
+		c.raw_size = LoadLE32(h + 8);
+		c.crc = LoadLE32(h + 12);
+		c.loaded = false;
+
+		data += stored_size;
+	}
+
+	block.n_records = n_records;
+	remaining.skip_front(size);
+	return true;
+}
+
+}}}
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Format.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/StringView.hxx"
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+namespace Archive {
+
+class FormatError : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+/**
+ * Decodes the values of an integer column one record at a time.
+ */
+class IntegerColumnReader {
+	const std::byte *bitmap = nullptr;
+	const std::byte *p = nullptr, *end = nullptr;
+
+	std::size_t i = 0, n_records = 0;
+
+	uint64_t previous = 0;
+
+	bool delta = false;
+
+public:
+	/**
+	 * Construct a reader for a column which is not present in
+	 * the block; all values are absent.
+	 */
+	IntegerColumnReader() noexcept = default;
+
+	/**
+	 * Throws #FormatError on error.
+	 */
+	IntegerColumnReader(Encoding encoding, ConstBuffer<std::byte> data,
+			    std::size_t _n_records);
+
+	/**
+	 * Decode the value of the next record.
+	 *
+	 * Throws #FormatError on error.
+	 *
+	 * @return false if the value is absent
+	 */
+	bool Next(uint64_t &value_r);
+};
+
+/**
+ * Decodes the values of a string column one record at a time.  The
+ * returned strings are null-terminated and point into the column
+ * data.
+ */
+class StringColumnReader {
+	std::vector<StringView> dictionary;
+
+	const std::byte *p = nullptr, *end = nullptr;
+
+	bool use_dictionary = false;
+
+public:
+	/**
+	 * Construct a reader for a column which is not present in
+	 * the block; all values are absent.
+	 */
+	StringColumnReader() noexcept = default;
+
+	/**
+	 * Throws #FormatError on error.
+	 */
+	StringColumnReader(Encoding encoding, ConstBuffer<std::byte> data);
+
+	/**
+	 * Decode the value of the next record.
+	 *
+	 * Throws #FormatError on error.
+	 *
+	 * @return the string or nullptr if the value is absent
+	 */
+	StringView Next();
+};
+
+/**
+ * One block of an archive file.  Column data is verified and
+ * decompressed only when it is accessed.
+ */
+class Block {
+	friend class Reader;
+
+	struct ColumnInfo {
+		ConstBuffer<std::byte> stored = nullptr;
+
+		uint32_t raw_size, crc;
+
+		Encoding encoding;
+
+		Compression compression;
+
+		/**
+		 * Has the CRC been verified and the data been
+		 * decompressed?
+		 */
+		bool loaded;
+	};
+
+	std::array<ColumnInfo, N_COLUMNS> columns;
+
+	/**
+	 * Buffers for decompressed column data.  They are kept
+	 * across blocks to reuse their allocations.
+	 */
+	std::array<std::vector<std::byte>, N_COLUMNS> decompressed;
+
+	std::size_t n_records = 0;
+
+public:
+	std::size_t size() const noexcept {
+		return n_records;
+	}
+
+	[[gnu::pure]]
+	bool HasColumn(Column column) const noexcept {
+		return !columns[std::size_t(column)].stored.IsNull();
+	}
+
+	/**
+	 * Obtain the (decompressed) data of the given column.  The
+	 * returned buffer points either into the archive or into
+	 * this object, and is valid until the next block is read.
+	 *
+	 * Throws #FormatError on error.
+	 *
+	 * @return the column data or nullptr if the column is not
+	 * present
+	 */
+	ConstBuffer<std::byte> GetColumnData(Column column);
+
+	/**
+	 * Throws #FormatError on error.
+	 */
+	IntegerColumnReader ReadIntegers(Column column);
+
+	/**
+	 * Throws #FormatError on error.
+	 */
+	StringColumnReader ReadStrings(Column column);
+
+	/**
+	 * Decode all columns of this block into #Datagram instances
+	 * (replacing the contents of the given vector).  Their
+	 * pointers are valid until the next block is read.
+	 *
+	 * Throws #FormatError on error.
+	 */
+	void ToDatagrams(std::vector<Datagram> &dest);
+
+private:
+	void Clear() noexcept;
+};
+
+/**
+ * Reads an archive file from memory, e.g. a file mapped with
+ * mmap().  Only the columns which are accessed are decoded.
+ */
+class Reader {
+	ConstBuffer<std::byte> remaining;
+
+public:
+	/**
+	 * Throws #FormatError if the file header is malformed.
+	 */
+	explicit Reader(ConstBuffer<void> file);
+
+	/**
+	 * Read the next block.
+	 *
+	 * Throws #FormatError on error.
+	 *
+	 * @return false if the end of the file has been reached
+	 */
+	bool ReadBlock(Block &block);
+};
+
+}}}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/*
+ * Low-level encoding helpers for the archive format.
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace Net {
+namespace Log {
+namespace Archive {
+
+/**
+ * The maximum size of an encoded 64 bit varint.
+ */
+static constexpr std::size_t MAX_VARINT_SIZE = 10;
+
+static constexpr uint64_t
+ZigZagEncode(int64_t value) noexcept
+{
+	return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static constexpr int64_t
+ZigZagDecode(uint64_t value) noexcept
+{
+	return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+/**
+ * Write a LEB128 varint to the buffer, which must have room for
+ * #MAX_VARINT_SIZE bytes.
+ *
+ * @return the end of the encoded value
+ */
+static inline std::byte *
+WriteVarint(std::byte *p, uint64_t value) noexcept
+{
+	while (value >= 0x80) {
+		*p++ = std::byte(value | 0x80);
+		value >>= 7;
+	}
+
+	*p++ = std::byte(value);
+	return p;
+}
+
+/**
+ * Decode a LEB128 varint.
+ *
+ * @return the end of the encoded value or nullptr if the input is
+ * truncated or malformed
+ */
+static inline const std::byte *
+ReadVarint(const std::byte *p, const std::byte *end,
+	   uint64_t &value_r) noexcept
+{
+	uint64_t value = 0;
+	for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+		const auto b = uint8_t(*p++);
+		value |= uint64_t(b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			value_r = value;
+			return p;
+		}
+	}
+
+	return nullptr;
+}
+
+static inline void
+StoreLE32(std::byte *p, uint32_t value) noexcept
+{
+	const uint8_t b[4] = {
+		uint8_t(value), uint8_t(value >> 8),
+		uint8_t(value >> 16), uint8_t(value >> 24),
+	};
+
+	memcpy(p, b, sizeof(b));
+}
+
+static inline uint32_t
+LoadLE32(const std::byte *p) noexcept
+{
+	uint8_t b[4];
+	memcpy(b, p, sizeof(b));
+	return b[0] | (b[1] << 8) | (b[2] << 16) | (uint32_t(b[3]) << 24);
+}
+
+}}}
@@ -0,0 +1,356 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Writer.hxx"
+#include "Varint.hxx"
+#include "net/log/Datagram.hxx"
+#include "io/OutputStream.hxx"
+#include "zlib/Error.hxx"
+#include "util/CRC32.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <cassert>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace Net {
+namespace Log {
+namespace Archive {
+
+static void
+AppendBytes(std::vector<std::byte> &dest, const void *p, std::size_t size)
+{
+	const auto *b = (const std::byte *)p;
+	dest.insert(dest.end(), b, b + size);
+}
+
+static void
+AppendVarint(std::vector<std::byte> &dest, uint64_t value)
+{
+	std::byte buffer[MAX_VARINT_SIZE];
+	AppendBytes(dest, buffer, WriteVarint(buffer, value) - buffer);
+}
+
+static void
+AppendLE32(std::vector<std::byte> &dest, uint32_t value)
+{
+	std::byte buffer[4];
+	StoreLE32(buffer, value);
+	AppendBytes(dest, buffer, sizeof(buffer));
+}
+
+/**
+ * Append a string with its length prefix and a null terminator.
+ */
+static void
+AppendString(std::vector<std::byte> &dest, uint64_t prefix, StringView s)
+{
+	AppendVarint(dest, prefix);
+	AppendBytes(dest, s.data, s.size);
+	dest.push_back(std::byte{0});
+}
+
+void
+IntegerColumnWriter::Append(uint64_t value)
+{
+	if (n_records % 8 == 0)
+		bitmap.push_back(std::byte{0});
+	bitmap.back() |= std::byte(1U << (n_records % 8));
+	++n_records;
+	empty = false;
+
+	if (delta) {
+		AppendVarint(values, ZigZagEncode(int64_t(value - previous)));
+		previous = value;
+	} else
+		AppendVarint(values, value);
+}
+
+void
+IntegerColumnWriter::AppendNull()
+{
+	if (n_records % 8 == 0)
+		bitmap.push_back(std::byte{0});
+	++n_records;
+}
+
+void
+IntegerColumnWriter::Finish(std::vector<std::byte> &dest) const
+{
+	AppendBytes(dest, bitmap.data(), bitmap.size());
+	AppendBytes(dest, values.data(), values.size());
+}
+
+void
+IntegerColumnWriter::Clear() noexcept
+{
+	bitmap.clear();
+	values.clear();
+	previous = 0;
+	n_records = 0;
+	empty = true;
+}
+
+void
+StringColumnWriter::Append(StringView value)
+{
+	if (value.IsNull()) {
+		AppendVarint(values, 0);
+		return;
+	}
+
+	empty = false;
+
+	if (!use_dictionary) {
+		AppendString(values, value.size + 1, value);
+		return;
+	}
+
+	auto i = dictionary.find(std::string_view(value));
+	if (i == dictionary.end()) {
+		i = dictionary.emplace(std::string(value.data, value.size),
+				       dictionary.size()).first;
+		AppendString(entries, value.size, value);
+	}
+
+	AppendVarint(values, i->second + 1);
+}
+
+void
+StringColumnWriter::Finish(std::vector<std::byte> &dest) const
+{
+	if (use_dictionary) {
+		AppendVarint(dest, dictionary.size());
+		AppendBytes(dest, entries.data(), entries.size());
+	}
+
+	AppendBytes(dest, values.data(), values.size());
+}
+
+void
+StringColumnWriter::Clear() noexcept
+{
+	dictionary.clear();
+	entries.clear();
+	values.clear();
+	empty = true;
+}
+
+Writer::Writer(OutputStream &_os, const WriterOptions &_options)
+	:os(_os), options(_options)
+{
+	if (options.records_per_block == 0 ||
+	    options.records_per_block > MAX_BLOCK_RECORDS)
+		/* the Reader would reject such blocks */
+		throw std::invalid_argument("Invalid records_per_block");
+
+	std::byte header[FILE_HEADER_SIZE];
+	StoreLE32(header, FILE_MAGIC);
+	StoreLE32(header + 4, VERSION);
+	os.Write(header, sizeof(header));
+}
+
+void
+Writer::Append(const Datagram &d)
+{
+	if (d.HasTimestamp())
+		timestamp.Append(d.timestamp.time_since_epoch().count());
+	else
+		timestamp.AppendNull();
+
+	remote_host.Append(d.remote_host);
+	host.Append(d.host);
+	site.Append(d.site);
+	forwarded_to.Append(d.forwarded_to);
+
+	if (d.HasHttpMethod())
+		http_method.Append(d.http_method);
+	else
+		http_method.AppendNull();
+
+	http_uri.Append(d.http_uri);
+	http_referer.Append(d.http_referer);
+	user_agent.Append(d.user_agent);
+	message.Append(d.message);
+
+	if (d.HasHttpStatus())
+		http_status.Append(d.http_status);
+	else
+		http_status.AppendNull();
+
+	if (d.valid_length)
+		length.Append(d.length);
+	else
+		length.AppendNull();
+
+	if (d.valid_traffic) {
+		traffic_received.Append(d.traffic_received);
+		traffic_sent.Append(d.traffic_sent);
+	} else {
+		traffic_received.AppendNull();
+		traffic_sent.AppendNull();
+	}
+
+	if (d.valid_duration)
+		duration.Append(d.duration.count());
+	else
+		duration.AppendNull();
+
+	if (d.type != Type::UNSPECIFIED)
+		type.Append(uint8_t(d.type));
+	else
+		type.AppendNull();
+
+	if (++n_records >= options.records_per_block)
+		Flush();
+}
+
+/**
+ * Compress the column data in #raw (if enabled and worthwhile) and
+ * append it to #block, and its directory entry to #directory.
+ */
+void
+Writer::AddColumn(Column column, Encoding encoding)
+{
+	ConstBuffer<std::byte> stored{raw.data(), raw.size()};
+	auto compression = Compression::NONE;
+
+	if (options.compression_level > 0 && !raw.empty()) {
+		uLongf compressed_size = compressBound(raw.size());
+		compressed.resize(compressed_size);
+
+		int result = compress2((Bytef *)compressed.data(),
+				       &compressed_size,
+				       (const Bytef *)raw.data(), raw.size(),
+				       options.compression_level);
+		if (result != Z_OK)
+			throw ZlibError(result);
+
+		if (compressed_size < raw.size()) {
+			stored = {compressed.data(), compressed_size};
+			compression = Compression::ZLIB;
+		}
+	}
+
+	CRC32 crc;
+	crc.Update(stored.ToVoid());
+
+	directory.push_back(std::byte(column));
+	directory.push_back(std::byte(encoding));
+	directory.push_back(std::byte(compression));
+	directory.push_back(std::byte{0});
+	AppendLE32(directory, stored.size);
+	AppendLE32(directory, raw.size());
+	AppendLE32(directory, crc.Finish());
+
+	AppendBytes(block, stored.data, stored.size);
+}
+
+void
+Writer::AddColumn(Column column, const IntegerColumnWriter &c)
+{
+	if (c.IsEmpty())
+		return;
+
+	raw.clear();
+	c.Finish(raw);
+	AddColumn(column, c.GetEncoding());
+}
+
+void
+Writer::AddColumn(Column column, const StringColumnWriter &c)
+{
+	if (c.IsEmpty())
+		return;
+
+	raw.clear();
+	c.Finish(raw);
+	AddColumn(column, c.GetEncoding());
+}
+
+void
+Writer::Flush()
+{
+	if (n_records == 0)
+		return;
+
+	directory.clear();
+	block.clear();
+
+	AddColumn(Column::TIMESTAMP, timestamp);
+	AddColumn(Column::REMOTE_HOST, remote_host);
+	AddColumn(Column::HOST, host);
+	AddColumn(Column::SITE, site);
+	AddColumn(Column::FORWARDED_TO, forwarded_to);
+	AddColumn(Column::HTTP_METHOD, http_method);
+	AddColumn(Column::HTTP_URI, http_uri);
+	AddColumn(Column::HTTP_REFERER, http_referer);
+	AddColumn(Column::USER_AGENT, user_agent);
+	AddColumn(Column::MESSAGE, message);
+	AddColumn(Column::HTTP_STATUS, http_status);
+	AddColumn(Column::LENGTH, length);
+	AddColumn(Column::TRAFFIC_RECEIVED, traffic_received);
+	AddColumn(Column::TRAFFIC_SENT, traffic_sent);
+	AddColumn(Column::DURATION, duration);
+	AddColumn(Column::TYPE, type);
+
+	std::byte header[BLOCK_HEADER_SIZE];
+	StoreLE32(header, BLOCK_MAGIC);
+	StoreLE32(header + 4, n_records);
+	StoreLE32(header + 8, directory.size() / COLUMN_HEADER_SIZE);
+	StoreLE32(header + 12, directory.size() + block.size());
+
+	os.Write(header, sizeof(header));
+	os.Write(directory.data(), directory.size());
+	os.Write(block.data(), block.size());
+
+	timestamp.Clear();
+	remote_host.Clear();
+	host.Clear();
+	site.Clear();
+	forwarded_to.Clear();
+	http_method.Clear();
+	http_uri.Clear();
+	http_referer.Clear();
+	user_agent.Clear();
+	message.Clear();
+	http_status.Clear();
+	length.Clear();
+	traffic_received.Clear();
+	traffic_sent.Clear();
+	duration.Clear();
+	type.Clear();
+	n_records = 0;
+}
+
+}}}
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Format.hxx"
+#include "util/StringView.hxx"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+class OutputStream;
+
+namespace Net {
+namespace Log {
+
+struct Datagram;
+
+namespace Archive {
+
+struct WriterOptions {
+	/**
+	 * The maximum number of records in one block.  Larger blocks
+	 * compress better, but need more memory in the writer and
+	 * the reader.  Must be positive and must not exceed
+	 * #MAX_BLOCK_RECORDS.
+	 */
+	std::size_t records_per_block = 4096;
+
+	/**
+	 * The zlib compression level (1-9) for column data; 0
+	 * disables compression.  Higher levels gain little, because
+	 * the column encodings already remove most redundancy.
+	 */
+	int compression_level = 1;
+};
+
+/**
+ * Collects the values of one integer column of the current block.
+ */
+class IntegerColumnWriter {
+	std::vector<std::byte> bitmap, values;
+
+	uint64_t previous = 0;
+
+	std::size_t n_records = 0;
+
+	const bool delta;
+
+	bool empty = true;
+
+public:
+	explicit IntegerColumnWriter(bool _delta=false) noexcept
+		:delta(_delta) {}
+
+	bool IsEmpty() const noexcept {
+		return empty;
+	}
+
+	Encoding GetEncoding() const noexcept {
+		return delta ? Encoding::INTEGER_DELTA : Encoding::INTEGER;
+	}
+
+	void Append(uint64_t value);
+	void AppendNull();
+
+	/**
+	 * Append the encoded column data to the given buffer.
+	 */
+	void Finish(std::vector<std::byte> &dest) const;
+
+	void Clear() noexcept;
+};
+
+/**
+ * Collects the values of one string column of the current block.
+ */
+class StringColumnWriter {
+	/**
+	 * The dictionary which maps strings to their index.  Only
+	 * used if this column is dictionary-encoded.
+	 */
+	std::map<std::string, std::size_t, std::less<>> dictionary;
+
+	/**
+	 * The encoded dictionary entries.
+	 */
+	std::vector<std::byte> entries;
+
+	std::vector<std::byte> values;
+
+	const bool use_dictionary;
+
+	bool empty = true;
+
+public:
+	explicit StringColumnWriter(bool _use_dictionary=false) noexcept
+		:use_dictionary(_use_dictionary) {}
+
+	bool IsEmpty() const noexcept {
+		return empty;
+	}
+
+	Encoding GetEncoding() const noexcept {
+		return use_dictionary
+			? Encoding::STRING_DICTIONARY
+			: Encoding::STRING;
+	}
+
+	void Append(StringView value);
+
+	void Finish(std::vector<std::byte> &dest) const;
+
+	void Clear() noexcept;
+};
+
+/**
+ * Writes #Datagram records to an #OutputStream in the columnar
+ * archive format (see Format.hxx).  Records are collected in memory
+ * and written one block at a time.
+ */
+class Writer {
+	OutputStream &os;
+
+	const WriterOptions options;
+
+	std::size_t n_records = 0;
+
+	IntegerColumnWriter timestamp{true};
+	StringColumnWriter remote_host, host{true}, site{true};
+	StringColumnWriter forwarded_to{true};
+	IntegerColumnWriter http_method;
+	StringColumnWriter http_uri, http_referer, user_agent{true};
+	StringColumnWriter message;
+	IntegerColumnWriter http_status, length;
+	IntegerColumnWriter traffic_received, traffic_sent;
+	IntegerColumnWriter duration{true};
+	IntegerColumnWriter type;
+
+	/**
+	 * Buffers for Flush(), kept here to reuse their allocations.
+	 */
+	std::vector<std::byte> raw, compressed, directory, block;
+
+public:
+	/**
+	 * Writes the file header.
+	 *
+	 * Throws std::invalid_argument if the options are invalid,
+	 * or another exception if writing fails.
+	 */
+	Writer(OutputStream &_os, const WriterOptions &_options={});
+
+	Writer(const Writer &) = delete;
+	Writer &operator=(const Writer &) = delete;
+
+	std::size_t GetPendingRecords() const noexcept {
+		return n_records;
+	}
+
+	/**
+	 * Add a record to the current block; all values are copied.
+	 * If the block is full, it gets flushed.
+	 *
+	 * Throws on error.
+	 */
+	void Append(const Datagram &d);
+
+	/**
+	 * Write the current block (if it is not empty).  This must
+	 * be called before the #Writer is destroyed, or else pending
+	 * records are lost.
+	 *
+	 * Throws on error.
+	 */
+	void Flush();
+
+private:
+	void AddColumn(Column column, Encoding encoding);
+
+	void AddColumn(Column column, const IntegerColumnWriter &c);
+	void AddColumn(Column column, const StringColumnWriter &c);
+};
+
+}}}
@@ -36,6 +36,7 @@
 
 class CancellablePointer;
 struct CreateStockItem;
+struct StockItem;
 
 class StockClass {
 public:
@@ -45,4 +46,17 @@ public:
 	virtual void Create(CreateStockItem c,
 			    StockRequest request,
 			    CancellablePointer &cancel_ptr) = 0;
+
+	/**
+	 * Check whether the given idle item is still usable, e.g. by
+	 * peeking whether the peer has closed the connection.  This
+	 * is called periodically for a batch of idle items (see
+	 * Stock::SetHealthCheck()), not on the request path, and it
+	 * must not block.
+	 *
+	 * @return false if the item is defunct and shall be destroyed
+	 */
+	virtual bool CheckIdle([[maybe_unused]] StockItem &item) noexcept {
+		return true;
+	}
 };
@@ -32,55 +32,31 @@
 
 #pragma once
 
-#include "Chrono.hxx"
-#include "event/Features.h"
-#include "util/IntrusiveList.hxx"
-
-#ifndef NO_BOOST
-#include <boost/intrusive/set.hpp>
-#endif
-
-class FineTimerEvent;
+#include <stdexcept>
 
 /**
- * A list of #FineTimerEvent instances sorted by due time point.
+ * A #Stock request has failed without even attempting to create an
+ * item, because the stock is overloaded.
  */
-class TimerList final {
-	struct Compare {
-		constexpr bool operator()(const FineTimerEvent &a,
-					  const FineTimerEvent &b) const noexcept;
-	};
-
-#ifdef NO_BOOST
-	/* when building without Boost, then this is just a sorted
-	   doubly-linked list - this doesn't scale well, but is good
-	   enough for most programs */
-	IntrusiveList<FineTimerEvent> timers;
-#else
-	boost::intrusive::multiset<FineTimerEvent,
-				   boost::intrusive::base_hook<boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>>,
-				   boost::intrusive::compare<Compare>,
-				   boost::intrusive::constant_time_size<false>> timers;
-#endif
-
+class StockWaitError : public std::runtime_error {
 public:
-	TimerList();
-	~TimerList() noexcept;
-
-	TimerList(const TimerList &other) = delete;
-	TimerList &operator=(const TimerList &other) = delete;
-
-	bool IsEmpty() const noexcept {
-		return timers.empty();
-	}
+	explicit StockWaitError(const char *msg):std::runtime_error(msg) {}
+};
 
-	void Insert(FineTimerEvent &t) noexcept;
+/**
+ * The request has waited for an item longer than its deadline.
+ */
+class StockTimeoutError : public StockWaitError {
+public:
+	StockTimeoutError()
+		:StockWaitError("Timeout waiting for a stock item") {}
+};
 
-	/**
-	 * Invoke all expired #FineTimerEvent instances and return the
-	 * duration until the next timer expires.  Returns a negative
-	 * duration if there is no timeout.
-	 */
-	Event::Duration Run(Event::TimePoint now,
-			    bool &invoked) noexcept;
+/**
+ * The request was rejected because the waiting queue was full.
+ */
+class StockQueueFullError : public StockWaitError {
+public:
+	StockQueueFullError()
+		:StockWaitError("Too many requests waiting for a stock item") {}
 };
@@ -32,10 +32,12 @@
 
 #pragma once
 
+#include "event/Chrono.hxx"
 #include "util/LeakDetector.hxx"
 
 #include <boost/intrusive/list_hook.hpp>
 
+#include <cstddef>
 #include <exception>
 
 class AbstractStock;
@@ -84,6 +86,18 @@ struct StockItem
 	 */
 	bool unclean = false;
 
+	/**
+	 * The number of times this item has been handed out to a
+	 * client.  Used by Stock::SetMaxUses().
+	 */
+	std::size_t uses = 0;
+
+	/**
+	 * When was this item created?  Used by
+	 * Stock::SetMaxLifetime().
+	 */
+	Event::TimePoint created;
+
 #ifndef NDEBUG
 	bool is_idle = false;
 #endif
@@ -60,6 +60,8 @@ StockMap::~StockMap() noexcept
 void
 StockMap::Erase(Item &item) noexcept
 {
+	erased_counters += item.stock.GetCounters();
+
 	auto i = map.iterator_to(item);
 	map.erase_and_dispose(i, DeleteDisposer());
 }
@@ -83,14 +85,18 @@ StockMap::GetStock(const char *uri, void *request) noexcept
 	Map::insert_commit_data hint;
 	auto i = map.insert_check(uri, Item::KeyHasher, Item::KeyValueEqual, hint);
 	if (i.second) {
+		++stock_misses;
+
 		auto *item = new Item(event_loop, cls,
 				      uri, limit, max_idle,
 				      GetClearInterval(request),
 				      this);
 		map.insert_commit(*item, hint);
 		return item->stock;
-	} else
+	} else {
+		++stock_hits;
 		return i.first->stock;
+	}
 }
 
 void
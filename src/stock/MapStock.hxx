@@ -123,6 +123,18 @@ class StockMap : StockHandler {
 	static constexpr size_t N_BUCKETS = 251;
 	Map::bucket_type buckets[N_BUCKETS];
 
+	/**
+	 * The counters of all #Stock instances which have already
+	 * been deleted.
+	 */
+	StockCounters erased_counters;
+
+	/**
+	 * The number of GetStock() calls which have found an
+	 * existing #Stock / which had to create a new one.
+	 */
+	std::size_t stock_hits = 0, stock_misses = 0;
+
 public:
 	StockMap(EventLoop &_event_loop, StockClass &_cls,
 		 std::size_t _limit, std::size_t _max_idle,
@@ -167,14 +179,41 @@ public:
 	}
 
 	/**
-	 * Obtain statistics.
+	 * Obtain statistics.  The counters include those of #Stock
+	 * instances which have been deleted already.
 	 */
 	void AddStats(StockStats &data) const noexcept {
 		for (const auto &i : map)
 			i.stock.AddStats(data);
+
+		data.counters += erased_counters;
+	}
+
+	/**
+	 * Pass all statistics to the given visitor, which gets called
+	 * with the name and the value of each counter (as
+	 * std::size_t) or histogram (as #Log2Histogram).
+	 */
+	template<typename V>
+	void VisitStats(V &&v) const {
+		StockStats data;
+		AddStats(data);
+		data.Visit(v);
+
+		std::size_t n_stocks = 0;
+		Log2Histogram<6> chain_lengths;
+		for (std::size_t i = 0; i < map.bucket_count(); ++i) {
+			const std::size_t n = map.bucket_size(i);
+			n_stocks += n;
+			chain_lengths.Add(n);
+		}
+
+		v("stocks", n_stocks);
+		v("stock_hits", stock_hits);
+		v("stock_misses", stock_misses);
+		v("chain_lengths", chain_lengths);
 	}
 
-	[[gnu::pure]]
 	Stock &GetStock(const char *uri, void *request) noexcept;
 
 	/**
@@ -0,0 +1,516 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MultiStock.hxx"
+#include "Class.hxx"
+#include "GetHandler.hxx"
+#include "Item.hxx"
+#include "event/Loop.hxx"
+#include "util/Cancellable.hxx"
+#include "util/DeleteDisposer.hxx"
+
+#include <algorithm>
+#include <cassert>
+
+struct MultiStock::OuterItem final
+	: boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>
+{
+	StockItem &item;
+
+	/**
+	 * The number of leases currently held on this item.
+	 */
+	std::size_t leases = 0;
+
+	/**
+	 * The number of leases granted on this item so far.
+	 */
+	std::size_t total_leases = 0;
+
+	explicit OuterItem(StockItem &_item) noexcept
+		:item(_item) {}
+
+	~OuterItem() noexcept {
+		delete &item;
+	}
+
+	OuterItem(const OuterItem &) = delete;
+	OuterItem &operator=(const OuterItem &) = delete;
+
+	/**
+	 * May another lease be granted on this item?
+	 */
+	[[gnu::pure]]
+	bool IsAvailable(std::size_t concurrency) const noexcept {
+		return !item.fade && leases < concurrency &&
+			(leases > 0 || !item.unclean);
+	}
+};
+
+inline const StockItem *
+MultiStock::ItemKey::operator()(const OuterItem &outer) const noexcept
+{
+	return &outer.item;
+}
+
+struct MultiStock::Waiting final
+	: boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+	  Cancellable
+{
+	MultiStock &stock;
+
+	StockRequest request;
+
+	StockGetHandler &handler;
+
+	/**
+	 * The creation which has been started with #request, or
+	 * nullptr if #request has not been passed to
+	 * StockClass::Create() yet.  Such a request is only served
+	 * by its own creation, because the #StockRequest may refer to
+	 * memory owned by the caller.
+	 */
+	CreateRequest *create = nullptr;
+
+	Waiting(MultiStock &_stock, StockRequest &&_request,
+		StockGetHandler &_handler,
+		CancellablePointer &cancel_ptr) noexcept
+		:stock(_stock), request(std::move(_request)),
+		 handler(_handler)
+	{
+		cancel_ptr = *this;
+	}
+
+	/* virtual methods from class Cancellable */
+	void Cancel() noexcept override;
+};
+
+/**
+ * The creation of a new item, see CreateForWaiting().
+ */
+struct MultiStock::CreateRequest final
+	: boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+	  StockGetHandler
+{
+	MultiStock &stock;
+
+	/**
+	 * The waiting request whose #StockRequest has been passed to
+	 * StockClass::Create().
+	 */
+	Waiting &waiting;
+
+	CancellablePointer cancel_ptr;
+
+	CreateRequest(MultiStock &_stock, Waiting &_waiting) noexcept
+		:stock(_stock), waiting(_waiting) {}
+
+	/* virtual methods from class StockGetHandler */
+	void OnStockItemReady(StockItem &item) noexcept override {
+		stock.OnCreateReady(*this, item);
+	}
+
+	void OnStockItemError(std::exception_ptr ep) noexcept override {
+		stock.OnCreateError(*this, std::move(ep));
+	}
+};
+
+void
+MultiStock::Waiting::Cancel() noexcept
+{
+	++stock.counters.canceled_waits;
+
+	if (create != nullptr) {
+		/* the creation uses our #StockRequest, which the
+		   caller may free after canceling: cancel it as
+		   well */
+		create->cancel_ptr.Cancel();
+		stock.creating.erase_and_dispose(stock.creating.iterator_to(*create),
+						 DeleteDisposer());
+
+		/* other waiting requests may need another
+		   creation */
+		stock.ScheduleRetryWaiting();
+	}
+
+	stock.waiting.erase_and_dispose(stock.waiting.iterator_to(*this),
+					DeleteDisposer());
+}
+
+MultiStock::MultiStock(EventLoop &event_loop, StockClass &_cls,
+		       const char *_name, std::size_t _limit,
+		       std::size_t _concurrency,
+		       std::size_t _max_leases) noexcept
+	:cls(_cls), name(_name),
+	 limit(_limit), concurrency(_concurrency),
+	 max_leases(_max_leases),
+	 logger(name),
+	 retry_event(event_loop, BIND_THIS_METHOD(RetryWaiting))
+{
+	assert(concurrency > 0);
+}
+
+MultiStock::~MultiStock() noexcept
+{
+	/* must not delete the MultiStock when there are waiting
+	   requests left; their callers must cancel them first */
+	assert(waiting.empty());
+
+	creating.clear_and_dispose([](CreateRequest *request){
+		request->cancel_ptr.Cancel();
+		delete request;
+	});
+
+	/* must not delete the MultiStock when there are leases
+	   left */
+	assert(num_idle == items.size());
+
+	items.clear_and_dispose(DeleteDisposer());
+}
+
+void
+MultiStock::FadeAll() noexcept
+{
+	for (auto i = items.begin(); i != items.end();) {
+		auto &outer = *i++;
+		outer.item.fade = true;
+
+		if (outer.leases == 0) {
+			--num_idle;
+			DeleteItem(outer);
+		}
+	}
+}
+
+MultiStock::OuterItem *
+MultiStock::FindLeastLoaded() noexcept
+{
+	/* a linear search is good enough: thanks to the
+	   concurrency, there are only few items */
+
+	OuterItem *best = nullptr;
+
+	for (auto &outer : items) {
+		if (!outer.IsAvailable(concurrency))
+			continue;
+
+		if (best == nullptr || outer.leases < best->leases) {
+			best = &outer;
+			if (best->leases == 0)
+				break;
+		}
+	}
+
+	return best;
+}
+
+StockItem *
+MultiStock::Lease() noexcept
+{
+	OuterItem *outer;
+	while ((outer = FindLeastLoaded()) != nullptr) {
+		if (outer->leases == 0) {
+			--num_idle;
+
+			if (!outer->item.Borrow()) {
+				DeleteItem(*outer);
+				continue;
+			}
+
+#ifndef NDEBUG
+			outer->item.is_idle = false;
+#endif
+		}
+
+		return &AddLease(*outer);
+	}
+
+	return nullptr;
+}
+
+StockItem &
+MultiStock::AddLease(OuterItem &outer) noexcept
+{
+	if (outer.total_leases > 0)
+		++counters.reused;
+
+	++outer.leases;
+	++outer.total_leases;
+
+	if (max_leases > 0 && outer.total_leases >= max_leases)
+		/* retire this item as soon as it becomes idle */
+		outer.item.fade = true;
+
+	return outer.item;
+}
+
+inline void
+MultiStock::DeleteItem(OuterItem &outer) noexcept
+{
+	items.erase_and_dispose(items.iterator_to(outer), DeleteDisposer());
+}
+
+void
+MultiStock::Get(StockRequest request,
+		StockGetHandler &get_handler,
+		CancellablePointer &cancel_ptr) noexcept
+{
+	if (waiting.empty()) {
+		if (auto *item = Lease()) {
+			/* destroy the request before invoking the
+			   handler (see Stock::GetIdle()) */
+			request.reset();
+
+			get_handler.OnStockItemReady(*item);
+			return;
+		}
+	}
+
+	if (IsFull()) {
+		/* no new item can be created: wait for a lease to be
+		   returned */
+		++counters.waits;
+		counters.waiting_length.Add(waiting.size());
+	}
+
+	auto *w = new Waiting(*this, std::move(request),
+			      get_handler, cancel_ptr);
+	waiting.push_back(*w);
+
+	CreateForWaiting();
+}
+
+void
+MultiStock::CreateForWaiting() noexcept
+{
+	while (!waiting.empty() &&
+	       creating.size() * concurrency < waiting.size() &&
+	       !IsFull()) {
+		/* each #StockRequest can be passed to
+		   StockClass::Create() only once: use the one of the
+		   oldest waiting request which hasn't started a
+		   creation yet */
+		auto w = FindWaitingWithoutCreate();
+		if (w == waiting.end())
+			break;
+
+		auto *request = new CreateRequest(*this, *w);
+		creating.push_back(*request);
+		w->create = request;
+
+		const auto old_create_errors = counters.create_errors;
+
+		/* this may serve waiting requests synchronously, which
+		   is why the loop condition is checked again each
+		   time */
+		try {
+			cls.Create({*this, *request},
+				   std::move(w->request),
+				   request->cancel_ptr);
+		} catch (...) {
+			ItemCreateError(*request, std::current_exception());
+		}
+
+		if (counters.create_errors != old_create_errors)
+			/* the creation has failed synchronously; don't
+			   try again right now, because the next attempt
+			   would most likely fail as well; the remaining
+			   requests wait for an existing item */
+			break;
+	}
+}
+
+void
+MultiStock::OnCreateReady(CreateRequest &request, StockItem &item) noexcept
+{
+	auto &w = request.waiting;
+	assert(w.create == &request);
+
+	creating.erase_and_dispose(creating.iterator_to(request),
+				   DeleteDisposer());
+
+	auto *outer = new OuterItem(item);
+	items.insert(*outer);
+
+	/* hand the new item directly to the request which started
+	   the creation, just like Stock does, without releasing and
+	   borrowing it */
+	waiting.erase(waiting.iterator_to(w));
+
+	auto &get_handler = w.handler;
+	delete &w;
+
+	get_handler.OnStockItemReady(AddLease(*outer));
+
+	/* other waiting requests may share the new item */
+	RetryWaiting();
+}
+
+void
+MultiStock::OnCreateError(CreateRequest &request,
+			  std::exception_ptr ep) noexcept
+{
+	auto &w = request.waiting;
+	assert(w.create == &request);
+
+	creating.erase_and_dispose(creating.iterator_to(request),
+				   DeleteDisposer());
+
+	logger(2, "Failed to create item: ", ep);
+
+	/* the #StockRequest has been consumed by the failed
+	   creation: report the error to the request which started
+	   it */
+	waiting.erase(waiting.iterator_to(w));
+
+	auto &get_handler = w.handler;
+	delete &w;
+
+	get_handler.OnStockItemError(ep);
+
+	if (!items.empty() || !creating.empty())
+		/* the other waiting requests may still be served by
+		   another item */
+		return;
+
+	/* nothing left which could serve the waiting requests: fail
+	   them all instead of trying again and again */
+	while (!waiting.empty()) {
+		auto &i = waiting.front();
+		assert(i.create == nullptr);
+		waiting.pop_front();
+
+		auto &h = i.handler;
+		delete &i;
+
+		h.OnStockItemError(ep);
+	}
+}
+
+MultiStock::WaitingList::iterator
+MultiStock::FindWaitingWithoutCreate() noexcept
+{
+	return std::find_if(waiting.begin(), waiting.end(),
+			    [](const Waiting &i){
+				    return i.create == nullptr;
+			    });
+}
+
+void
+MultiStock::RetryWaiting() noexcept
+{
+	/* requests which have started a creation are skipped; they
+	   will be served by their own creation */
+	for (auto w = FindWaitingWithoutCreate(); w != waiting.end();
+	     w = FindWaitingWithoutCreate()) {
+		auto *item = Lease();
+		if (item == nullptr)
+			break;
+
+		auto &get_handler = w->handler;
+		waiting.erase_and_dispose(w, DeleteDisposer());
+
+		get_handler.OnStockItemReady(*item);
+	}
+
+	/* more items may be needed, e.g. if some have been retired */
+	CreateForWaiting();
+}
+
+void
+MultiStock::Put(StockItem &item, bool destroy) noexcept
+{
+	assert(!item.is_idle);
+	assert(&item.stock == this);
+
+	auto i = items.find(&item);
+	assert(i != items.end());
+
+	auto &outer = *i;
+	assert(outer.leases > 0);
+
+	if (destroy)
+		/* the item is defunct, but other clients may still
+		   be using it */
+		item.fade = true;
+
+	if (--outer.leases == 0) {
+		if (item.fade || !item.Release()) {
+			DeleteItem(outer);
+		} else {
+#ifndef NDEBUG
+			item.is_idle = true;
+#endif
+			++num_idle;
+		}
+	}
+
+	ScheduleRetryWaiting();
+}
+
+void
+MultiStock::ItemIdleDisconnect(StockItem &item) noexcept
+{
+	assert(item.is_idle);
+
+	auto i = items.find(&item);
+	assert(i != items.end());
+	assert(i->leases == 0);
+
+	--num_idle;
+	DeleteItem(*i);
+}
+
+void
+MultiStock::ItemCreateSuccess(StockItem &item) noexcept
+{
+	++counters.created;
+
+	item.handler.OnStockItemReady(item);
+}
+
+void
+MultiStock::ItemCreateError(StockGetHandler &get_handler,
+			    std::exception_ptr ep) noexcept
+{
+	++counters.create_errors;
+
+	get_handler.OnStockItemError(ep);
+}
+
+void
+MultiStock::ItemCreateAborted() noexcept
+{
+	/* creations are only aborted by the destructor or by
+	   Waiting::Cancel(), which have already disposed the
+	   #CreateRequest */
+}
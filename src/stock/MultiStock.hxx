@@ -0,0 +1,272 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "AbstractStock.hxx"
+#include "Request.hxx"
+#include "Stats.hxx"
+#include "event/DeferEvent.hxx"
+#include "io/Logger.hxx"
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+
+#include <cstddef>
+#include <string>
+
+class CancellablePointer;
+class StockClass;
+class StockGetHandler;
+struct StockItem;
+
+/**
+ * A variant of #Stock whose items can be shared by several clients
+ * at the same time, e.g. connections to a server which supports
+ * pipelining or multiplexing.  Each client obtains a "lease" on an
+ * item with Get() and returns it with StockItem::Put().
+ *
+ * StockItem::Borrow() is called when an idle item gets its first
+ * lease, and StockItem::Release() when its last lease is returned.
+ * Calling StockItem::Put() with destroy=true marks the item as
+ * defunct; it will be destroyed as soon as all other leases have
+ * been returned.
+ */
+class MultiStock final : public AbstractStock {
+	struct OuterItem;
+	struct Waiting;
+	struct CreateRequest;
+
+	StockClass &cls;
+
+	const std::string name;
+
+	/**
+	 * The maximum number of items; zero means unlimited.  If no
+	 * more items can be created, requests are put into the
+	 * #waiting list.
+	 */
+	const std::size_t limit;
+
+	/**
+	 * The maximum number of concurrent leases per item.
+	 */
+	const std::size_t concurrency;
+
+	/**
+	 * The total number of leases after which an item is retired,
+	 * i.e. destroyed as soon as it becomes idle; zero means
+	 * unlimited.
+	 */
+	const std::size_t max_leases;
+
+	const Logger logger;
+
+	/**
+	 * This event is used to move the "retry waiting" code out of
+	 * the current stack.
+	 */
+	DeferEvent retry_event;
+
+	struct ItemKey {
+		using type = const StockItem *;
+
+		type operator()(const OuterItem &outer) const noexcept;
+	};
+
+	using ItemSet =
+		boost::intrusive::set<OuterItem,
+				      boost::intrusive::base_hook<boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>>,
+				      boost::intrusive::key_of_value<ItemKey>,
+				      boost::intrusive::constant_time_size<true>>;
+
+	/**
+	 * All items which are ready, indexed by their #StockItem
+	 * address.
+	 */
+	ItemSet items;
+
+	/**
+	 * The number of items which currently have no lease.
+	 */
+	std::size_t num_idle = 0;
+
+	using WaitingList =
+		boost::intrusive::list<Waiting,
+				       boost::intrusive::base_hook<boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>>,
+				       boost::intrusive::constant_time_size<true>>;
+
+	WaitingList waiting;
+
+	using CreateList =
+		boost::intrusive::list<CreateRequest,
+				       boost::intrusive::base_hook<boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>>,
+				       boost::intrusive::constant_time_size<true>>;
+
+	/**
+	 * Items which are currently being created.
+	 */
+	CreateList creating;
+
+	StockCounters counters;
+
+public:
+	/**
+	 * @param _concurrency the maximum number of concurrent leases
+	 * per item
+	 * @param _max_leases retire items after this number of
+	 * leases; zero means unlimited
+	 */
+	MultiStock(EventLoop &event_loop, StockClass &_cls,
+		   const char *_name, std::size_t _limit,
+		   std::size_t _concurrency,
+		   std::size_t _max_leases=0) noexcept;
+
+	~MultiStock() noexcept;
+
+	MultiStock(const MultiStock &) = delete;
+	MultiStock &operator=(const MultiStock &) = delete;
+
+	EventLoop &GetEventLoop() const noexcept override {
+		return retry_event.GetEventLoop();
+	}
+
+	const char *GetName() const noexcept override {
+		return name.c_str();
+	}
+
+	[[gnu::pure]]
+	bool IsEmpty() const noexcept {
+		return items.empty() && creating.empty();
+	}
+
+	/**
+	 * @return true if the configured limit has been reached and
+	 * no more items can be created
+	 */
+	[[gnu::pure]]
+	bool IsFull() const noexcept {
+		return limit > 0 && items.size() + creating.size() >= limit;
+	}
+
+	/**
+	 * Obtain statistics.  An item counts as "busy" if it has at
+	 * least one lease.  Leases on existing items are counted as
+	 * "reused".
+	 */
+	void AddStats(StockStats &data) const noexcept {
+		data.busy += items.size() - num_idle;
+		data.idle += num_idle;
+		data.creating += creating.size();
+		data.waiting += waiting.size();
+		data.counters += counters;
+	}
+
+	/**
+	 * Obtain a lease on the least-loaded item.  A new item is
+	 * only created if all existing items are at their
+	 * concurrency limit.
+	 *
+	 * The #StockRequest is passed to StockClass::Create() if
+	 * this request causes the creation of a new item; the request
+	 * is then served by that creation, and canceling it cancels
+	 * the creation.
+	 */
+	void Get(StockRequest request,
+		 StockGetHandler &get_handler,
+		 CancellablePointer &cancel_ptr) noexcept;
+
+	/**
+	 * Destroy all idle items and don't grant new leases on the
+	 * busy items.
+	 */
+	void FadeAll() noexcept;
+
+	/* virtual methods from class AbstractStock */
+	void Put(StockItem &item, bool destroy) noexcept override;
+	void ItemIdleDisconnect(StockItem &item) noexcept override;
+	void ItemCreateSuccess(StockItem &item) noexcept override;
+	void ItemCreateError(StockGetHandler &get_handler,
+			     std::exception_ptr ep) noexcept override;
+	void ItemCreateAborted() noexcept override;
+
+	void ItemUncleanFlagCleared() noexcept override {
+		ScheduleRetryWaiting();
+	}
+
+private:
+	/**
+	 * Find the usable item with the fewest leases.
+	 */
+	[[gnu::pure]]
+	OuterItem *FindLeastLoaded() noexcept;
+
+	/**
+	 * Try to obtain a lease on an existing item.
+	 *
+	 * @return the item or nullptr if all items are at their
+	 * concurrency limit
+	 */
+	StockItem *Lease() noexcept;
+
+	/**
+	 * Grant a lease on the given item, which must be available
+	 * (and borrowed if it was idle).
+	 */
+	StockItem &AddLease(OuterItem &outer) noexcept;
+
+	void DeleteItem(OuterItem &outer) noexcept;
+
+	/**
+	 * Find the oldest waiting request whose #StockRequest has
+	 * not yet been passed to StockClass::Create().
+	 */
+	[[gnu::pure]]
+	WaitingList::iterator FindWaitingWithoutCreate() noexcept;
+
+	/**
+	 * Create as many items as needed to serve all waiting
+	 * requests.
+	 */
+	void CreateForWaiting() noexcept;
+
+	void OnCreateReady(CreateRequest &request, StockItem &item) noexcept;
+	void OnCreateError(CreateRequest &request,
+			   std::exception_ptr ep) noexcept;
+
+	void RetryWaiting() noexcept;
+
+	void ScheduleRetryWaiting() noexcept {
+		if (!waiting.empty())
+			retry_event.Schedule();
+	}
+};
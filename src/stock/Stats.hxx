@@ -32,8 +32,131 @@
 
 #pragma once
 
+#include "util/Log2Histogram.hxx"
+
 #include <cstddef>
 
+/**
+ * Event counters of a #Stock.
+ */
+struct StockCounters {
+	/**
+	 * The number of requests which were served with an idle
+	 * item.
+	 */
+	std::size_t reused = 0;
+
+	/**
+	 * The number of items which were created successfully.
+	 */
+	std::size_t created = 0;
+
+	std::size_t create_errors = 0;
+
+	/**
+	 * The number of items which were destroyed because they
+	 * exceeded their maximum lifetime or number of uses.
+	 */
+	std::size_t expired = 0;
+
+	/**
+	 * The number of idle items which were destroyed because
+	 * StockClass::CheckIdle() has failed.
+	 */
+	std::size_t check_failures = 0;
+
+	/**
+	 * The number of requests which had to wait because the stock
+	 * was full.
+	 */
+	std::size_t waits = 0;
+
+	/**
+	 * The number of waiting requests which were canceled.
+	 */
+	std::size_t canceled_waits = 0;
+
+	/**
+	 * The number of waiting requests which have failed with
+	 * #StockTimeoutError.
+	 */
+	std::size_t wait_timeouts = 0;
+
+	/**
+	 * The number of requests which have failed with
+	 * #StockQueueFullError.
+	 */
+	std::size_t rejected = 0;
+
+	/**
+	 * The length of the waiting queue, sampled each time a
+	 * request gets enqueued.
+	 */
+	Log2Histogram<12> waiting_length;
+
+	/**
+	 * How long requests have waited (in milliseconds) until an
+	 * item became available.
+	 */
+	Log2Histogram<16> wait_time_ms;
+
+	StockCounters &operator+=(const StockCounters &other) noexcept {
+		reused += other.reused;
+		created += other.created;
+		create_errors += other.create_errors;
+		expired += other.expired;
+		check_failures += other.check_failures;
+		waits += other.waits;
+		canceled_waits += other.canceled_waits;
+		wait_timeouts += other.wait_timeouts;
+		rejected += other.rejected;
+		waiting_length += other.waiting_length;
+		wait_time_ms += other.wait_time_ms;
+		return *this;
+	}
+
+	template<typename V>
+	void Visit(V &&v) const {
+		v("reused", reused);
+		v("created", created);
+		v("create_errors", create_errors);
+		v("expired", expired);
+		v("check_failures", check_failures);
+		v("waits", waits);
+		v("canceled_waits", canceled_waits);
+		v("wait_timeouts", wait_timeouts);
+		v("rejected", rejected);
+		v("waiting_length", waiting_length);
+		v("wait_time_ms", wait_time_ms);
+	}
+};
+
 struct StockStats {
-	std::size_t busy, idle;
+	std::size_t busy = 0, idle = 0;
+
+	/**
+	 * The number of items currently being created.
+	 */
+	std::size_t creating = 0;
+
+	/**
+	 * The number of requests currently waiting for an item.
+	 */
+	std::size_t waiting = 0;
+
+	StockCounters counters;
+
+	/**
+	 * Pass all values to the given visitor, which gets called
+	 * with the name and the value of each counter (as
+	 * std::size_t) or histogram (as #Log2Histogram).
+	 */
+	template<typename V>
+	void Visit(V &&v) const {
+		v("busy", busy);
+		v("idle", idle);
+		v("creating", creating);
+		v("waiting", waiting);
+		counters.Visit(v);
+	}
 };
@@ -32,10 +32,14 @@
 
 #include "Stock.hxx"
 #include "Class.hxx"
+#include "Error.hxx"
 #include "GetHandler.hxx"
+#include "event/Loop.hxx"
+#include "time/Cast.hxx"
 #include "util/Cancellable.hxx"
 
 #include <cassert>
+#include <iterator>
 
 struct Stock::Waiting final
 	: boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
@@ -50,25 +54,80 @@ struct Stock::Waiting final
 
 	CancellablePointer &cancel_ptr;
 
+	/**
+	 * When was this request enqueued?  Used for the wait time
+	 * histogram.
+	 */
+	const Event::TimePoint since;
+
+	/**
+	 * Fails this request with #StockTimeoutError after
+	 * #StockGetOptions::timeout.
+	 */
+	FineTimerEvent timeout_event;
+
+	const int priority;
+
 	Waiting(Stock &_stock, StockRequest &&_request,
+		const StockGetOptions &options,
 		StockGetHandler &_handler,
 		CancellablePointer &_cancel_ptr) noexcept;
 
 	void Destroy() noexcept;
 
+	void OnTimeout() noexcept {
+		++stock.counters.wait_timeouts;
+		stock.AbortWaiting(*this,
+				   std::make_exception_ptr(StockTimeoutError()));
+	}
+
 	/* virtual methods from class Cancellable */
 	void Cancel() noexcept override;
 };
 
+/**
+ * A background creation for SetMinIdle() or Prewarm().
+ */
+struct Stock::PrewarmRequest final
+	: boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>,
+	  StockGetHandler
+{
+	Stock &stock;
+
+	CancellablePointer cancel_ptr;
+
+	explicit PrewarmRequest(Stock &_stock) noexcept
+		:stock(_stock) {}
+
+	/* virtual methods from class StockGetHandler */
+	void OnStockItemReady(StockItem &item) noexcept override {
+		stock.OnPrewarmReady(*this, item);
+	}
+
+	void OnStockItemError(std::exception_ptr ep) noexcept override {
+		stock.OnPrewarmError(*this, std::move(ep));
+	}
+};
+
 inline
 Stock::Waiting::Waiting(Stock &_stock, StockRequest &&_request,
+			const StockGetOptions &options,
 			StockGetHandler &_handler,
 			CancellablePointer &_cancel_ptr) noexcept
 	:stock(_stock), request(std::move(_request)),
 	 handler(_handler),
-	 cancel_ptr(_cancel_ptr)
+	 cancel_ptr(_cancel_ptr),
+	 since(_stock.GetEventLoop().SteadyNow()),
+	 timeout_event(_stock.GetEventLoop(), BIND_THIS_METHOD(OnTimeout)),
+	 priority(options.priority)
 {
 	cancel_ptr = *this;
+
+	const auto timeout = options.timeout > Event::Duration::zero()
+		? options.timeout
+		: _stock.wait_timeout;
+	if (timeout > Event::Duration::zero())
+		timeout_event.Schedule(timeout);
 }
 
 inline void
@@ -77,6 +136,13 @@ Stock::Waiting::Destroy() noexcept
 	delete this;
 }
 
+inline void
+Stock::RecordWaitTime(const Waiting &w) noexcept
+{
+	const auto duration = GetEventLoop().SteadyNow() - w.since;
+	counters.wait_time_ms.Add(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+}
+
 void
 Stock::DiscardUnused() noexcept
 {
@@ -88,6 +154,7 @@ Stock::DiscardUnused() noexcept
 	may_clear = true;
 	ScheduleClear();
 	ScheduleCheckEmpty();
+	SchedulePrewarm();
 }
 
 void
@@ -98,6 +165,7 @@ Stock::FadeAll() noexcept
 
 	ClearIdle();
 	ScheduleCheckEmpty();
+	SchedulePrewarm();
 
 	// TODO: restart the "num_create" list?
 }
@@ -105,10 +173,143 @@ Stock::FadeAll() noexcept
 void
 Stock::Shutdown() noexcept
 {
+	min_idle = prewarm_goal = 0;
+	CancelPrewarm();
+
 	FadeAll();
 
 	cleanup_event.Cancel();
 	clear_event.Cancel();
+	check_event.Cancel();
+}
+
+/*
+ * prewarm
+ *
+ */
+
+void
+Stock::SetMinIdle(std::size_t _min_idle) noexcept
+{
+	min_idle = _min_idle;
+	SchedulePrewarm();
+}
+
+void
+Stock::Prewarm(std::size_t n) noexcept
+{
+	prewarm_goal = std::max(prewarm_goal, n);
+	SchedulePrewarm();
+}
+
+void
+Stock::SchedulePrewarm() noexcept
+{
+	if (idle.size() >= prewarm_goal)
+		/* the Prewarm() goal has been reached */
+		prewarm_goal = 0;
+
+	if (idle.size() + prewarming.size() < GetPrewarmTarget() &&
+	    !prewarm_event.IsPending())
+		prewarm_event.Schedule(Event::Duration::zero());
+}
+
+void
+Stock::CancelPrewarm() noexcept
+{
+	prewarm_event.Cancel();
+
+	prewarming.clear_and_dispose([](PrewarmRequest *request){
+		request->cancel_ptr.Cancel();
+		delete request;
+	});
+}
+
+void
+Stock::PrewarmEventCallback() noexcept
+{
+	const auto now = ToFloatSeconds(GetEventLoop().SteadyNow().time_since_epoch());
+
+	while (idle.size() + prewarming.size() < GetPrewarmTarget()) {
+		if (prewarming.size() >= prewarm_burst || IsFull())
+			/* will be resumed by OnPrewarmReady() or
+			   Put() */
+			return;
+
+		if (!prewarm_bucket.Check(now, prewarm_rate,
+					  prewarm_burst, 1)) {
+			/* rate limit exceeded: try again later */
+			prewarm_event.Schedule(std::chrono::duration_cast<Event::Duration>(std::chrono::duration<double>(1. / prewarm_rate)));
+			return;
+		}
+
+		StartPrewarm();
+	}
+}
+
+inline void
+Stock::StartPrewarm() noexcept
+{
+	auto *request = new PrewarmRequest(*this);
+	prewarming.push_back(*request);
+
+	/* this may invoke OnPrewarmReady() or OnPrewarmError()
+	   synchronously, which deletes the request */
+	GetCreate(nullptr, *request, request->cancel_ptr);
+}
+
+void
+Stock::OnPrewarmReady(PrewarmRequest &request, StockItem &item) noexcept
+{
+	prewarming.erase_and_dispose(prewarming.iterator_to(request),
+				     DeleteDisposer());
+
+	/* move the new item (which ItemCreateSuccess() has added to
+	   the "busy" list) to the "idle" list; it has never been
+	   borrowed, but Release() prepares it for being idle */
+	busy.erase(busy.iterator_to(item));
+
+	if (!item.Release()) {
+		/* defunct already; treat this like a creation
+		   failure and don't retry immediately */
+		delete &item;
+		ScheduleCheckEmpty();
+		ScheduleRetryWaiting();
+
+		if (!prewarm_event.IsPending())
+			prewarm_event.Schedule(std::chrono::seconds(1));
+		return;
+	}
+
+	/* not handed out yet */
+	item.uses = 0;
+
+#ifndef NDEBUG
+	item.is_idle = true;
+#endif
+
+	if (idle.size() == max_idle)
+		ScheduleCleanup();
+
+	idle.push_front(item);
+
+	ScheduleRetryWaiting();
+	SchedulePrewarm();
+	ScheduleCheck();
+}
+
+void
+Stock::OnPrewarmError(PrewarmRequest &request,
+		      std::exception_ptr ep) noexcept
+{
+	prewarming.erase_and_dispose(prewarming.iterator_to(request),
+				     DeleteDisposer());
+
+	logger(2, "Background creation failed: ", ep);
+
+	/* don't retry immediately */
+	if (!prewarm_event.IsPending())
+		prewarm_event.Schedule(std::chrono::seconds(1));
 }
 
 /*
@@ -155,6 +356,47 @@ Stock::CleanupEventCallback() noexcept
 }
 
 
+/*
+ * health check
+ *
+ */
+
+void
+Stock::CheckEventCallback() noexcept
+{
+	const auto now = GetEventLoop().SteadyNow();
+
+	/* start with the item which has been idle for the longest
+	   time; this is the one most likely to have been closed by
+	   the peer */
+
+	std::size_t n_checks = 0;
+	for (auto i = idle.end(); i != idle.begin();) {
+		auto &item = *--i;
+
+		if (IsExpired(item, now)) {
+			++counters.expired;
+		} else if (n_checks < check_batch) {
+			++n_checks;
+			if (cls.CheckIdle(item))
+				continue;
+
+			++counters.check_failures;
+		} else
+			continue;
+
+		i = idle.erase_and_dispose(i, DeleteDisposer());
+	}
+
+	if (idle.size() <= max_idle)
+		UnscheduleCleanup();
+
+	ScheduleCheckEmpty();
+	SchedulePrewarm();
+	ScheduleCheck();
+}
+
+
 /*
  * wait operation
  *
@@ -163,11 +405,38 @@ Stock::CleanupEventCallback() noexcept
 void
 Stock::Waiting::Cancel() noexcept
 {
+	++stock.counters.canceled_waits;
+
 	auto &list = stock.waiting;
 	const auto i = list.iterator_to(*this);
 	list.erase_and_dispose(i, [](Stock::Waiting *w){ w->Destroy(); });
 }
 
+void
+Stock::Enqueue(Waiting &w) noexcept
+{
+	/* insert after the last request with the same or a higher
+	   priority; usually, this is the end of the list */
+	auto i = waiting.end();
+	while (i != waiting.begin() && std::prev(i)->priority < w.priority)
+		--i;
+
+	waiting.insert(i, w);
+}
+
+void
+Stock::AbortWaiting(Waiting &w, std::exception_ptr ep) noexcept
+{
+	waiting.erase(waiting.iterator_to(w));
+
+	/* destroy the request before invoking the handler (see
+	   GetIdle()) */
+	auto &get_handler = w.handler;
+	w.Destroy();
+
+	get_handler.OnStockItemError(std::move(ep));
+}
+
 void
 Stock::RetryWaiting() noexcept
 {
@@ -193,6 +462,7 @@ Stock::RetryWaiting() noexcept
 			break;
 		}
 
+		RecordWaitTime(w);
 		w.Destroy();
 	}
 
@@ -204,6 +474,7 @@ Stock::RetryWaiting() noexcept
 		auto &w = waiting.front();
 		waiting.pop_front();
 
+		RecordWaitTime(w);
 		GetCreate(std::move(w.request),
 			  w.handler,
 			  w.cancel_ptr);
@@ -246,6 +517,7 @@ Stock::ClearEventCallback() noexcept
 
 	may_clear = true;
 	ScheduleClear();
+	SchedulePrewarm();
 	CheckEmpty();
 }
 
@@ -268,7 +540,9 @@ Stock::Stock(EventLoop &event_loop, StockClass &_cls,
 	 retry_event(event_loop, BIND_THIS_METHOD(RetryWaiting)),
 	 empty_event(event_loop, BIND_THIS_METHOD(CheckEmpty)),
 	 cleanup_event(event_loop, BIND_THIS_METHOD(CleanupEventCallback)),
-	 clear_event(event_loop, BIND_THIS_METHOD(ClearEventCallback))
+	 clear_event(event_loop, BIND_THIS_METHOD(ClearEventCallback)),
+	 check_event(event_loop, BIND_THIS_METHOD(CheckEventCallback)),
+	 prewarm_event(event_loop, BIND_THIS_METHOD(PrewarmEventCallback))
 {
 	assert(max_idle > 0);
 
@@ -277,6 +551,8 @@ Stock::Stock(EventLoop &event_loop, StockClass &_cls,
 
 Stock::~Stock() noexcept
 {
+	CancelPrewarm();
+
 	assert(num_create == 0);
 
 	/* must not delete the Stock when there are busy items left */
@@ -286,6 +562,7 @@ Stock::~Stock() noexcept
 	empty_event.Cancel();
 	cleanup_event.Cancel();
 	clear_event.Cancel();
+	check_event.Cancel();
 
 	ClearIdle();
 }
@@ -293,6 +570,8 @@ Stock::~Stock() noexcept
 StockItem *
 Stock::GetIdle() noexcept
 {
+	const auto now = GetEventLoop().SteadyNow();
+
 	auto i = idle.begin();
 	const auto end = idle.end();
 	while (i != end) {
@@ -311,12 +590,17 @@ Stock::GetIdle() noexcept
 		if (idle.size() == max_idle)
 			UnscheduleCleanup();
 
-		if (item.Borrow()) {
+		if (IsExpired(item, now)) {
+			++counters.expired;
+		} else if (item.Borrow()) {
 #ifndef NDEBUG
 			item.is_idle = false;
 #endif
 
+			++item.uses;
+
 			busy.push_front(item);
+			SchedulePrewarm();
 			return &item;
 		}
 
@@ -336,6 +620,8 @@ Stock::GetIdle(StockRequest &request,
 		return false;
 
 
+	++counters.reused;
+
 	/* destroy the request before invoking the handler, because
 	   the handler may destroy the memory pool, which may
 	   invalidate the request's memory region */
@@ -361,7 +647,7 @@ Stock::GetCreate(StockRequest request,
 }
 
 void
-Stock::Get(StockRequest request,
+Stock::Get(StockRequest request, const StockGetOptions &options,
 	   StockGetHandler &get_handler,
 	   CancellablePointer &cancel_ptr) noexcept
 {
@@ -372,9 +658,27 @@ Stock::Get(StockRequest request,
 
 	if (IsFull()) {
 		/* item limit reached: wait for an item to return */
-		auto w = new Waiting(*this, std::move(request),
+
+		if (max_waiting > 0 && waiting.size() >= max_waiting) {
+			/* the queue is full: shed load by rejecting
+			   the request with the lowest priority */
+			++counters.rejected;
+
+			auto &last = waiting.back();
+			if (last.priority >= options.priority) {
+				request.reset();
+				get_handler.OnStockItemError(std::make_exception_ptr(StockQueueFullError()));
+				return;
+			}
+
+			AbortWaiting(last, std::make_exception_ptr(StockQueueFullError()));
+		}
+
+		auto w = new Waiting(*this, std::move(request), options,
 				     get_handler, cancel_ptr);
-		waiting.push_front(*w);
+		++counters.waits;
+		counters.waiting_length.Add(waiting.size());
+		Enqueue(*w);
 		return;
 	}
 
@@ -430,6 +734,9 @@ Stock::ItemCreateSuccess(StockItem &item) noexcept
 	assert(num_create > 0);
 	--num_create;
 
+	++counters.created;
+	item.created = GetEventLoop().SteadyNow();
+	item.uses = 1;
 	busy.push_front(item);
 
 	item.handler.OnStockItemReady(item);
@@ -442,6 +749,8 @@ Stock::ItemCreateError(StockGetHandler &get_handler,
 	assert(num_create > 0);
 	--num_create;
 
+	++counters.create_errors;
+
 	ScheduleCheckEmpty();
 	ScheduleRetryWaiting();
 
@@ -470,6 +779,12 @@ Stock::Put(StockItem &item, bool destroy) noexcept
 
 	busy.erase(busy.iterator_to(item));
 
+	if (!destroy && !item.fade &&
+	    IsExpired(item, GetEventLoop().SteadyNow())) {
+		++counters.expired;
+		destroy = true;
+	}
+
 	if (destroy || item.fade || !item.Release()) {
 		delete &item;
 		ScheduleCheckEmpty();
@@ -482,9 +797,11 @@ Stock::Put(StockItem &item, bool destroy) noexcept
 			ScheduleCleanup();
 
 		idle.push_front(item);
+		ScheduleCheck();
 	}
 
 	ScheduleRetryWaiting();
+	SchedulePrewarm();
 }
 
 void
@@ -501,4 +818,5 @@ Stock::ItemIdleDisconnect(StockItem &item) noexcept
 
 	delete &item;
 	ScheduleCheckEmpty();
+	SchedulePrewarm();
 }
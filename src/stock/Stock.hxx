@@ -38,11 +38,14 @@
 #include "Stats.hxx"
 #include "event/CoarseTimerEvent.hxx"
 #include "event/DeferEvent.hxx"
+#include "event/FineTimerEvent.hxx"
 #include "io/Logger.hxx"
 #include "util/DeleteDisposer.hxx"
+#include "util/TokenBucket.hxx"
 
 #include <boost/intrusive/list.hpp>
 
+#include <algorithm>
 #include <cstddef>
 #include <string>
 
@@ -51,6 +54,25 @@ class Stock;
 class StockClass;
 class StockGetHandler;
 
+/**
+ * Optional parameters for Stock::Get().
+ */
+struct StockGetOptions {
+	/**
+	 * If the stock is full, requests with a higher priority are
+	 * served first.  Requests with the same priority are served
+	 * in the order they arrived.
+	 */
+	int priority = 0;
+
+	/**
+	 * If the stock is full, wait at most this long for an item
+	 * and then fail with #StockTimeoutError.  Zero means use
+	 * the default (see Stock::SetWaitTimeout()).
+	 */
+	Event::Duration timeout = Event::Duration::zero();
+};
+
 class StockHandler {
 public:
 	/**
@@ -105,6 +127,17 @@ class Stock : public AbstractStock {
 	CoarseTimerEvent cleanup_event;
 	CoarseTimerEvent clear_event;
 
+	/**
+	 * Periodically checks idle items, see SetHealthCheck().
+	 */
+	FineTimerEvent check_event;
+
+	/**
+	 * Creates idle items in the background, see SetMinIdle() and
+	 * Prewarm().
+	 */
+	FineTimerEvent prewarm_event;
+
 	using ItemList =
 		boost::intrusive::list<StockItem,
 				       boost::intrusive::constant_time_size<true>>;
@@ -119,10 +152,82 @@ class Stock : public AbstractStock {
 	using WaitingList =
 		boost::intrusive::list<Waiting,
 				       boost::intrusive::base_hook<boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>>,
-				       boost::intrusive::constant_time_size<false>>;
+				       boost::intrusive::constant_time_size<true>>;
 
 	WaitingList waiting;
 
+	/**
+	 * The maximum number of waiting requests; zero means
+	 * unlimited.  See SetMaxWaiting().
+	 */
+	std::size_t max_waiting = 0;
+
+	/**
+	 * The default #StockGetOptions::timeout; zero means wait
+	 * forever.
+	 */
+	Event::Duration wait_timeout = Event::Duration::zero();
+
+	/**
+	 * Try to keep at least this number of idle items.
+	 */
+	std::size_t min_idle = 0;
+
+	/**
+	 * The number of idle items requested by Prewarm(); this is
+	 * reset to zero as soon as it has been reached.
+	 */
+	std::size_t prewarm_goal = 0;
+
+	/**
+	 * The maximum number of background creations per second.
+	 */
+	double prewarm_rate = 10;
+
+	/**
+	 * The maximum number of concurrent background creations.
+	 */
+	std::size_t prewarm_burst = 2;
+
+	TokenBucket prewarm_bucket;
+
+	struct PrewarmRequest;
+	using PrewarmList =
+		boost::intrusive::list<PrewarmRequest,
+				       boost::intrusive::base_hook<boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::normal_link>>>,
+				       boost::intrusive::constant_time_size<true>>;
+
+	/**
+	 * Background creations which are currently in progress.
+	 */
+	PrewarmList prewarming;
+
+	/**
+	 * Destroy items which are older than this; zero means no
+	 * limit.
+	 */
+	Event::Duration max_lifetime = Event::Duration::zero();
+
+	/**
+	 * Destroy items which have been handed out this many times;
+	 * zero means no limit.
+	 */
+	std::size_t max_uses = 0;
+
+	/**
+	 * How often shall idle items be checked?  Zero disables the
+	 * periodic check.
+	 */
+	Event::Duration check_interval = Event::Duration::zero();
+
+	/**
+	 * The maximum number of StockClass::CheckIdle() calls per
+	 * #check_interval.
+	 */
+	std::size_t check_batch = 16;
+
+	StockCounters counters;
+
 	bool may_clear = false;
 
 public:
@@ -179,6 +284,23 @@ public:
 	void AddStats(StockStats &data) const noexcept {
 		data.busy += busy.size();
 		data.idle += idle.size();
+		data.creating += num_create;
+		data.waiting += waiting.size();
+		data.counters += counters;
+	}
+
+	const StockCounters &GetCounters() const noexcept {
+		return counters;
+	}
+
+	/**
+	 * @see StockStats::Visit()
+	 */
+	template<typename V>
+	void VisitStats(V &&v) const {
+		StockStats data;
+		AddStats(data);
+		data.Visit(v);
 	}
 
 	/**
@@ -215,6 +337,94 @@ public:
 	 */
 	void Shutdown() noexcept;
 
+	/**
+	 * Destroy items which are older than the given duration
+	 * instead of reusing them.
+	 *
+	 * @param _max_lifetime the maximum lifetime; zero means no
+	 * limit (the default)
+	 */
+	void SetMaxLifetime(Event::Duration _max_lifetime) noexcept {
+		max_lifetime = _max_lifetime;
+	}
+
+	/**
+	 * Destroy items which have been handed out the given number
+	 * of times instead of reusing them.
+	 *
+	 * @param _max_uses the maximum number of uses; zero means no
+	 * limit (the default)
+	 */
+	void SetMaxUses(std::size_t _max_uses) noexcept {
+		max_uses = _max_uses;
+	}
+
+	/**
+	 * Periodically check idle items in the background: expired
+	 * items (see SetMaxLifetime() and SetMaxUses()) are
+	 * destroyed, and StockClass::CheckIdle() is called for up to
+	 * "batch" items, starting with the one which has been idle
+	 * for the longest time.
+	 *
+	 * @param interval the check interval; zero disables the
+	 * check (the default)
+	 */
+	void SetHealthCheck(Event::Duration interval,
+			    std::size_t batch) noexcept {
+		check_interval = interval;
+		check_batch = batch;
+		ScheduleCheck();
+	}
+
+	/**
+	 * Limit the number of requests waiting for an item while the
+	 * stock is full.  Excess requests fail immediately with
+	 * #StockQueueFullError; if the new request has a higher
+	 * priority than the last waiting one, that one is rejected
+	 * instead.
+	 *
+	 * @param _max_waiting the maximum queue length; zero means
+	 * unlimited (the default)
+	 */
+	void SetMaxWaiting(std::size_t _max_waiting) noexcept {
+		max_waiting = _max_waiting;
+	}
+
+	/**
+	 * Set the default #StockGetOptions::timeout.
+	 */
+	void SetWaitTimeout(Event::Duration _timeout) noexcept {
+		wait_timeout = _timeout;
+	}
+
+	/**
+	 * Try to keep at least this number of idle items (but not
+	 * more than "max_idle"); missing items are created in the
+	 * background.  This avoids the creation latency for the
+	 * first requests after a quiet period.
+	 *
+	 * Background creations use an empty #StockRequest, so this
+	 * requires a #StockClass which does not need one.
+	 */
+	void SetMinIdle(std::size_t _min_idle) noexcept;
+
+	/**
+	 * Limit background creations (see SetMinIdle() and
+	 * Prewarm()) to the given number of items per second and
+	 * the given number of concurrent creations.
+	 */
+	void SetPrewarmRate(double rate, std::size_t burst) noexcept {
+		prewarm_rate = rate;
+		prewarm_burst = burst;
+	}
+
+	/**
+	 * Create idle items in the background until there are at
+	 * least the given number of them, e.g. at startup.  Unlike
+	 * SetMinIdle(), this is a one-shot operation.
+	 */
+	void Prewarm(std::size_t n) noexcept;
+
 private:
 	/**
 	 * Determine the number of "active" items, i.e. the busy items
@@ -245,8 +455,26 @@ private:
 
 		if (idle.size() <= max_idle)
 			UnscheduleCleanup();
+
+		SchedulePrewarm();
 	}
 
+	/**
+	 * How many idle items shall be created in the background?
+	 */
+	[[gnu::pure]]
+	std::size_t GetPrewarmTarget() const noexcept {
+		return std::min(std::max(min_idle, prewarm_goal), max_idle);
+	}
+
+	void SchedulePrewarm() noexcept;
+	void CancelPrewarm() noexcept;
+	void PrewarmEventCallback() noexcept;
+	void StartPrewarm() noexcept;
+	void OnPrewarmReady(PrewarmRequest &request, StockItem &item) noexcept;
+	void OnPrewarmError(PrewarmRequest &request,
+			    std::exception_ptr ep) noexcept;
+
 public:
 	/**
 	 * Borrow an idle item.
@@ -268,6 +496,16 @@ public:
 		       CancellablePointer &cancel_ptr) noexcept;
 
 	void Get(StockRequest request,
+		 StockGetHandler &get_handler,
+		 CancellablePointer &cancel_ptr) noexcept {
+		Get(std::move(request), {}, get_handler, cancel_ptr);
+	}
+
+	/**
+	 * Like Get(), but with #StockGetOptions which control the
+	 * behavior while the stock is full.
+	 */
+	void Get(StockRequest request, const StockGetOptions &options,
 		 StockGetHandler &get_handler,
 		 CancellablePointer &cancel_ptr) noexcept;
 
@@ -298,6 +536,18 @@ private:
 	 * busy items was reduced.
 	 */
 	void RetryWaiting() noexcept;
+	void RecordWaitTime(const Waiting &w) noexcept;
+
+	/**
+	 * Insert a new #Waiting into the queue, ordered by priority.
+	 */
+	void Enqueue(Waiting &w) noexcept;
+
+	/**
+	 * Remove the given #Waiting from the queue and fail it with
+	 * the given error.
+	 */
+	void AbortWaiting(Waiting &w, std::exception_ptr ep) noexcept;
 	void ScheduleRetryWaiting() noexcept;
 
 	void ScheduleCleanup() noexcept {
@@ -310,4 +560,24 @@ private:
 
 	void CleanupEventCallback() noexcept;
 	void ClearEventCallback() noexcept;
+
+	/**
+	 * Has this item exceeded its maximum lifetime or number of
+	 * uses?
+	 */
+	[[gnu::pure]]
+	bool IsExpired(const StockItem &item,
+		       Event::TimePoint now) const noexcept {
+		return (max_uses > 0 && item.uses >= max_uses) ||
+			(max_lifetime > Event::Duration::zero() &&
+			 now - item.created >= max_lifetime);
+	}
+
+	void ScheduleCheck() noexcept {
+		if (check_interval > Event::Duration::zero() &&
+		    !idle.empty() && !check_event.IsPending())
+			check_event.Schedule(check_interval);
+	}
+
+	void CheckEventCallback() noexcept;
 };
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CRC32.hxx"
+#include "ByteOrder.hxx"
+
+#include <array>
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32_PCLMUL
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARM
+#include <arm_acle.h>
+#endif
+
+namespace CRC32Detail {
+
+using Table = std::array<std::array<uint32_t, 256>, 8>;
+
+static constexpr Table
+GenerateTable() noexcept
+{
+	Table t{};
+
+	for (unsigned i = 0; i < 256; ++i) {
+		const uint8_t octet = i;
+		t[0][i] = UpdateBitwise(0, &octet, 1);
+	}
+
+	/* t[k][i] is the CRC of byte i followed by k zero bytes */
+	for (unsigned k = 1; k < t.size(); ++k)
+		for (unsigned i = 0; i < 256; ++i)
+			t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+
+	return t;
+}
+
+static constexpr Table table = GenerateTable();
+
+static inline uint32_t
+LoadLE32(const uint8_t *p) noexcept
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return FromLE32(value);
+}
+
+uint32_t
+UpdateSlicing8(uint32_t crc, const uint8_t *p, std::size_t size) noexcept
+{
+	for (; size >= 8; size -= 8, p += 8) {
+		const uint32_t a = LoadLE32(p) ^ crc;
+		const uint32_t b = LoadLE32(p + 4);
+
+		crc = table[7][a & 0xff] ^ table[6][(a >> 8) & 0xff] ^
+			table[5][(a >> 16) & 0xff] ^ table[4][a >> 24] ^
+			table[3][b & 0xff] ^ table[2][(b >> 8) & 0xff] ^
+			table[1][(b >> 16) & 0xff] ^ table[0][b >> 24];
+	}
+
+	for (; size > 0; --size)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+
+	return crc;
+}
+
+#ifdef CRC32_PCLMUL
+
+[[gnu::target("sse2")]]
+static inline __m128i
+Load128(const uint8_t *p) noexcept
+{
+	return _mm_loadu_si128((const __m128i *)(const void *)p);
+}
+
+/**
+ * Multiply both halves of "x" with the constants "k" and add "next".
+ */
+[[gnu::target("pclmul")]]
+static inline __m128i
+Fold(__m128i x, __m128i k, __m128i next) noexcept
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+					   _mm_clmulepi64_si128(x, k, 0x00)),
+			     next);
+}
+
+/**
+ * CRC folding with carry-less multiplication, see "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ * (Intel, 2009).  The constants are the bit-reflected ones for the
+ * CRC-32/ISO-HDLC polynomial from that paper.
+ *
+ * @param size at least 64 and a multiple of 16
+ */
+[[gnu::target("pclmul,sse4.1")]]
+static uint32_t
+UpdatePCLMUL(uint32_t crc, const uint8_t *p, std::size_t size) noexcept
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_xor_si128(Load128(p), _mm_cvtsi32_si128(crc));
+	__m128i x2 = Load128(p + 16);
+	__m128i x3 = Load128(p + 32);
+	__m128i x4 = Load128(p + 48);
+	p += 64;
+	size -= 64;
+
+	/* fold 4x128 bits in parallel */
+	for (; size >= 64; size -= 64, p += 64) {
+		x1 = Fold(x1, k1k2, Load128(p));
+		x2 = Fold(x2, k1k2, Load128(p + 16));
+		x3 = Fold(x3, k1k2, Load128(p + 32));
+		x4 = Fold(x4, k1k2, Load128(p + 48));
+	}
+
+	/* fold into 128 bits */
+	x1 = Fold(x1, k3k4, x2);
+	x1 = Fold(x1, k3k4, x3);
+	x1 = Fold(x1, k3k4, x4);
+
+	for (; size >= 16; size -= 16, p += 16)
+		x1 = Fold(x1, k3k4, Load128(p));
+
+	/* fold 128 bits into 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static bool
+DetectPCLMUL() noexcept
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") &&
+		__builtin_cpu_supports("sse4.1");
+}
+
+static const bool have_pclmul = DetectPCLMUL();
+
+bool
+HaveHardware() noexcept
+{
+	return have_pclmul;
+}
+
+uint32_t
+UpdateFast(uint32_t crc, const uint8_t *p, std::size_t size) noexcept
+{
+	if (size >= 64 && have_pclmul) {
+		const std::size_t n = size & ~std::size_t(15);
+		crc = UpdatePCLMUL(crc, p, n);
+		p += n;
+		size -= n;
+	}
+
+	return UpdateSlicing8(crc, p, size);
+}
+
+#elif defined(CRC32_ARM)
+
+bool
+HaveHardware() noexcept
+{
+	return true;
+}
+
+uint32_t
+UpdateFast(uint32_t crc, const uint8_t *p, std::size_t size) noexcept
+{
+	for (; size >= 8; size -= 8, p += 8) {
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		crc = __crc32d(crc, FromLE64(value));
+	}
+
+	for (; size > 0; --size)
+		crc = __crc32b(crc, *p++);
+
+	return crc;
+}
+
+#else
+
+bool
+HaveHardware() noexcept
+{
+	return false;
+}
+
+uint32_t
+UpdateFast(uint32_t crc, const uint8_t *p, std::size_t size) noexcept
+{
+	return UpdateSlicing8(crc, p, size);
+}
+
+#endif
+
+} // namespace CRC32Detail
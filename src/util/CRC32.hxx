@@ -34,10 +34,67 @@
 
 #include "ConstBuffer.hxx"
 
+#include <cstddef>
 #include <cstdint>
+#include <type_traits>
+
+namespace CRC32Detail {
 
 /**
- * A naive (and slow) CRC-32/ISO-HDLC implementation.
+ * The bit-at-a-time implementation; slow, but usable at compile
+ * time.
+ */
+constexpr uint32_t
+UpdateBitwise(uint32_t crc, const uint8_t *p, std::size_t size) noexcept
+{
+	for (; size > 0; --size) {
+		uint8_t octet = *p++;
+
+		for (unsigned i = 0; i < 8; i++) {
+			uint32_t bit = (octet ^ crc) & 1;
+			crc >>= 1;
+			if (bit)
+				crc ^= 0xedb88320;
+
+			octet >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+/**
+ * The table-driven "slicing-by-8" implementation which processes
+ * 8 bytes per step.
+ */
+[[gnu::pure]]
+uint32_t
+UpdateSlicing8(uint32_t crc, const uint8_t *p, std::size_t size) noexcept;
+
+/**
+ * Is a hardware-accelerated implementation available on this
+ * CPU?  This is "pure", not "const", because it reads the result
+ * of the CPU feature detection from a global variable.
+ */
+[[gnu::pure]]
+bool
+HaveHardware() noexcept;
+
+/**
+ * The fastest implementation available on this CPU: PCLMULQDQ
+ * folding on x86_64, the CRC32 instructions on ARMv8 (if enabled at
+ * compile time), else UpdateSlicing8().
+ */
+[[gnu::pure]]
+uint32_t
+UpdateFast(uint32_t crc, const uint8_t *p, std::size_t size) noexcept;
+
+} // namespace CRC32Detail
+
+/**
+ * A CRC-32/ISO-HDLC implementation.  At compile time, a naive
+ * bitwise algorithm is used; at run time, the fastest one for this
+ * CPU.
  */
 class CRC32 {
 public:
@@ -48,8 +105,10 @@ private:
 
 public:
 	constexpr const auto &Update(ConstBuffer<uint8_t> b) noexcept {
-		for (auto i : b)
-			state = Update(state, i);
+		if (std::is_constant_evaluated())
+			state = CRC32Detail::UpdateBitwise(state, b.data, b.size);
+		else
+			state = CRC32Detail::UpdateFast(state, b.data, b.size);
 		return *this;
 	}
 
@@ -60,19 +119,4 @@ public:
 	constexpr value_type Finish() const noexcept {
 		return ~state;
 	}
-
-private:
-	static constexpr value_type Update(value_type crc,
-					   uint8_t octet) noexcept {
-		for (unsigned i = 0; i < 8; i++) {
-			uint32_t bit = (octet ^ crc) & 1;
-			crc >>= 1;
-			if (bit)
-				crc ^= 0xedb88320;
-
-			octet >>= 1;
-		}
-
-		return crc;
-	}
 };
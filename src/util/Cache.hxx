@@ -32,28 +32,173 @@
 
 #include "Manual.hxx"
 #include "Cast.hxx"
+#include "CountMinSketch.hxx"
+#include "Expiry.hxx"
+#include "Log2Histogram.hxx"
 
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/unordered_set.hpp>
 
 #include <array>
 #include <cassert>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+/**
+ * Eviction policy for #Cache: plain LRU.  This is the cheapest
+ * policy, but a burst of keys which are used only once flushes out
+ * all of the popular items.
+ */
+struct LRUCachePolicy {
+	static constexpr bool segmented = false;
+};
+
+/**
+ * Eviction policy for #Cache: W-TinyLFU.  New items enter a small LRU
+ * "window"; items falling out of the window compete with the least
+ * recently used item of the main area, and only the one which was
+ * accessed more frequently (according to a #CountMinSketch) stays.
+ * The main area is a segmented LRU: items hit while on "probation"
+ * are promoted to the "protected" segment.
+ *
+ * This is resistant against scans, at the cost of a few bytes per
+ * item for the frequency sketch.
+ *
+ * @param window_percent the size of the window relative to the
+ * cache size
+ * @param protected_percent the size of the protected segment
+ * relative to the main area
+ */
+template<unsigned window_percent=1, unsigned protected_percent=80>
+struct TinyLFUCachePolicy {
+	static_assert(window_percent <= 100);
+	static_assert(protected_percent <= 100);
+
+	static constexpr bool segmented = true;
+
+	static constexpr std::size_t WindowSize(std::size_t max_size) noexcept {
+		const std::size_t size = max_size * window_percent / 100;
+		return size > 0 ? size : 1;
+	}
+
+	static constexpr std::size_t ProtectedSize(std::size_t max_size) noexcept {
+		return (max_size - WindowSize(max_size)) * protected_percent / 100;
+	}
+};
+
+/**
+ * Counters describing how well a #Cache performs.
+ */
+struct CacheStats {
+	/**
+	 * The number of Get() calls which have found an item.
+	 */
+	std::size_t hits = 0;
+
+	/**
+	 * The number of Get() calls which have not found a (valid)
+	 * item.
+	 */
+	std::size_t misses = 0;
+
+	/**
+	 * The number of items which have been added.
+	 */
+	std::size_t insertions = 0;
+
+	/**
+	 * The number of items which have been deleted to make room
+	 * for new ones.
+	 */
+	std::size_t evictions = 0;
+
+	/**
+	 * The number of items which have been deleted because they
+	 * have expired.
+	 */
+	std::size_t expired = 0;
+
+	/**
+	 * The number of items which have not been added because
+	 * their weight exceeds the maximum total weight.
+	 */
+	std::size_t rejected = 0;
+
+	CacheStats &operator+=(const CacheStats &other) noexcept {
+		hits += other.hits;
+		misses += other.misses;
+		insertions += other.insertions;
+		evictions += other.evictions;
+		expired += other.expired;
+		rejected += other.rejected;
+		return *this;
+	}
+
+	/**
+	 * Pass all counters to the given visitor, which gets called
+	 * with the name and the value of each counter.
+	 */
+	template<typename V>
+	void Visit(V &&v) const {
+		v("hits", hits);
+		v("misses", misses);
+		v("insertions", insertions);
+		v("evictions", evictions);
+		v("expired", expired);
+		v("rejected", rejected);
+	}
+};
+
+/**
+ * A histogram of hash chain lengths, see Cache::GetChainLengths().
+ */
+using CacheChainLengths = Log2Histogram<6>;
 
 /**
  * A simple LRU cache.  Item lookup is done with a hash table.  No
  * dynamic allocation; all items are allocated statically inside this
  * class.
  *
+ * Each item may have an expiry time; expired items are never
+ * returned and get deleted lazily by Get() or in batches by
+ * PurgeExpired() (which may be called periodically, e.g. by a
+ * #CoarseTimerEvent).
+ *
+ * Each item also has a weight (e.g. its size in bytes); if a
+ * maximum total weight has been configured with SetMaxWeight(),
+ * items are evicted until the new one fits.  Items which are
+ * heavier than the maximum are refused.
+ *
  * @param max_size the maximum number of items in the cache
  * @param table_size the size of the internal hash table; rule of
  * thumb: should be prime
+ * @param Policy the eviction policy, either #LRUCachePolicy or
+ * #TinyLFUCachePolicy
  */
 template<typename Key, typename Data,
 	 std::size_t max_size,
 	 std::size_t table_size,
 	 typename Hash=std::hash<Key>,
-	 typename Equal=std::equal_to<Key>>
+	 typename Equal=std::equal_to<Key>,
+	 typename Policy=LRUCachePolicy>
 class Cache {
+	static_assert(max_size > 0);
+
+	/**
+	 * Which list is an #Item currently linked in?
+	 */
+	enum class Segment : uint_least8_t {
+		/**
+		 * In #chronological_list: the whole cache with
+		 * #LRUCachePolicy, only the admission window with
+		 * #TinyLFUCachePolicy.
+		 */
+		CHRONOLOGICAL,
+
+		PROBATION,
+		PROTECTED,
+	};
 
 	struct Pair {
 		Key key;
@@ -87,6 +232,12 @@ class Cache {
 		Manual<Pair> pair;
 
 	public:
+		Segment segment;
+
+		Expiry expires = Expiry::Never();
+
+		std::size_t weight = 0;
+
 		static constexpr Item &Cast(Data &data) {
 			return ContainerCast(Manual<Pair>::Cast(Pair::Cast(data)),
 					     &Item::pair);
@@ -160,6 +311,41 @@ class Cache {
 
 	ItemList chronological_list;
 
+	/**
+	 * The main area of a segmented cache (only used with
+	 * #TinyLFUCachePolicy): items which have survived the
+	 * admission window, but have not been hit since.
+	 */
+	ItemList probation_list;
+
+	/**
+	 * Items of the main area which have been hit while on
+	 * probation (only used with #TinyLFUCachePolicy).
+	 */
+	ItemList protected_list;
+
+	/**
+	 * The number of items in #chronological_list and in
+	 * #protected_list (only maintained with #TinyLFUCachePolicy).
+	 */
+	std::size_t chronological_size = 0, protected_size = 0;
+
+	/**
+	 * The sum of the weights of all items.
+	 */
+	std::size_t total_weight = 0;
+
+	std::size_t max_weight = std::numeric_limits<std::size_t>::max();
+
+	CacheStats stats;
+
+	static constexpr bool segmented = Policy::segmented;
+
+	struct NoSketch {};
+
+	[[no_unique_address]]
+	std::conditional_t<segmented, CountMinSketch<max_size>, NoSketch> sketch;
+
 	using KeyMap = boost::intrusive::unordered_set<Item,
 						       boost::intrusive::hash<ItemHash>,
 						       boost::intrusive::equal<ItemEqual>,
@@ -171,26 +357,150 @@ class Cache {
 
 	std::array<Item, max_size> buffer;
 
-	[[gnu::pure]]
-	Item &GetOldest() noexcept {
-		assert(!chronological_list.empty());
+	ItemList &GetList(Segment segment) noexcept {
+		switch (segment) {
+		case Segment::CHRONOLOGICAL:
+			break;
+
+		case Segment::PROBATION:
+			return probation_list;
+
+		case Segment::PROTECTED:
+			return protected_list;
+		}
 
-		return chronological_list.back();
+		return chronological_list;
 	}
 
 	/**
-	 * Remove the oldest item from the cache (both from the #map and
-	 * from #chronological_list), but do not destruct it.
+	 * Add the item to the front of the given segment.
 	 */
-	Item &RemoveOldest() noexcept {
-		Item &item = GetOldest();
+	void Link(Item &item, Segment segment) noexcept {
+		item.segment = segment;
+		GetList(segment).push_front(item);
+
+		if constexpr (segmented) {
+			if (segment == Segment::CHRONOLOGICAL)
+				++chronological_size;
+			else if (segment == Segment::PROTECTED)
+				++protected_size;
+		}
+	}
 
-		map.erase(map.iterator_to(item));
-		chronological_list.erase(chronological_list.iterator_to(item));
+	/**
+	 * Remove the item from the list it is linked in, but not from
+	 * the #map.
+	 */
+	void Unlink(Item &item) noexcept {
+		auto &list = GetList(item.segment);
+		list.erase(list.iterator_to(item));
+		Uncount(item);
+	}
 
+	/**
+	 * Update the segment counters after the item has been
+	 * removed from its list.
+	 */
+	void Uncount(const Item &item) noexcept {
+		if constexpr (segmented) {
+			if (item.segment == Segment::CHRONOLOGICAL)
+				--chronological_size;
+			else if (item.segment == Segment::PROTECTED)
+				--protected_size;
+		}
+	}
+
+	void MoveToFront(Item &item, Segment segment) noexcept {
+		Unlink(item);
+		Link(item, segment);
+	}
+
+	/**
+	 * Mark the item as "recently used".
+	 */
+	void Touch(Item &item) noexcept {
+		if constexpr (segmented) {
+			switch (item.segment) {
+			case Segment::CHRONOLOGICAL:
+			case Segment::PROTECTED:
+				break;
+
+			case Segment::PROBATION:
+				/* hit on probation: promote to the
+				   protected segment and demote the least
+				   recently used protected item if that
+				   segment is full now */
+				MoveToFront(item, Segment::PROTECTED);
+
+				if (protected_size > Policy::ProtectedSize(max_size))
+					MoveToFront(protected_list.back(),
+						    Segment::PROBATION);
+				return;
+			}
+		}
+
+		MoveToFront(item, item.segment);
+	}
+
+	template<typename K>
+	void RecordAccess(const K &key) noexcept {
+		if constexpr (segmented)
+			sketch.Increment(map.hash_function()(key));
+	}
+
+	[[gnu::pure]]
+	unsigned EstimateFrequency(const Item &item) const noexcept {
+		return sketch.Estimate(map.hash_function()(item.GetKey()));
+	}
+
+	/**
+	 * Remove the given item from the cache (both from the #map and
+	 * from its list), but do not destruct it.
+	 */
+	Item &Evict(Item &item) noexcept {
+		map.erase(map.iterator_to(item));
+		Unlink(item);
 		return item;
 	}
 
+	/**
+	 * Choose an item which shall be evicted to make room for a
+	 * new one, and remove it, but do not destruct it.
+	 */
+	Item &RemoveOldest() noexcept {
+		assert(!IsEmpty());
+
+		++stats.evictions;
+
+		if constexpr (segmented) {
+			ItemList &main = probation_list.empty()
+				? protected_list
+				: probation_list;
+
+			if (main.empty())
+				return Evict(chronological_list.back());
+
+			/* the window will still be within its limit
+			   after the new item has been added: make room
+			   in the main area */
+			if (chronological_size < Policy::WindowSize(max_size))
+				return Evict(main.back());
+
+			/* the oldest item of the window competes with
+			   the main area's victim; the one which is
+			   used less frequently gets evicted */
+			Item &candidate = chronological_list.back();
+			Item &victim = main.back();
+
+			if (EstimateFrequency(candidate) > EstimateFrequency(victim)) {
+				MoveToFront(candidate, Segment::PROBATION);
+				return Evict(victim);
+			} else
+				return Evict(candidate);
+		} else
+			return Evict(chronological_list.back());
+	}
+
 	/**
 	 * Allocate an item from #unallocated_list, but do not construct it.
 	 */
@@ -207,16 +517,99 @@ class Cache {
 		if (unallocated_list.empty()) {
 			/* cache is full: delete oldest */
 			Item &item = RemoveOldest();
+			total_weight -= item.weight;
 			item.Replace(std::forward<K>(key), std::forward<U>(data));
 			return item;
 		} else {
 			/* cache is not full: allocate new item */
 			Item &item = Allocate();
 			item.Construct(std::forward<K>(key), std::forward<U>(data));
+
+			if constexpr (segmented) {
+				/* there is room in the main area: move
+				   the oldest window item there */
+				if (chronological_size >= Policy::WindowSize(max_size))
+					MoveToFront(chronological_list.back(),
+						    Segment::PROBATION);
+			}
+
 			return item;
 		}
 	}
 
+	void Dispose(Item &item) noexcept {
+		total_weight -= item.weight;
+		item.Destruct();
+		unallocated_list.push_front(item);
+	}
+
+	/**
+	 * Evict items until another item with the given weight
+	 * fits.
+	 */
+	void ShrinkToWeight(std::size_t reserve) noexcept {
+		while ((total_weight > max_weight ||
+			reserve > max_weight - total_weight) &&
+		       !IsEmpty())
+			Dispose(RemoveOldest());
+	}
+
+	template<typename K, typename U>
+	Item &Insert(K &&key, U &&data, Expiry expires, std::size_t weight) {
+		ShrinkToWeight(weight);
+
+		Item &item = Make(std::forward<K>(key), std::forward<U>(data));
+		item.expires = expires;
+		item.weight = weight;
+		total_weight += weight;
+		++stats.insertions;
+		Link(item, Segment::CHRONOLOGICAL);
+		return item;
+	}
+
+	template<typename K>
+	Item *Find(K &&key) noexcept {
+		RecordAccess(key);
+
+		auto i = map.find(std::forward<K>(key),
+				  map.hash_function(), map.key_eq());
+		if (i == map.end())
+			return nullptr;
+
+		return &*i;
+	}
+
+	/**
+	 * Check whether the item has expired, and if so, delete it.
+	 *
+	 * @return true if the item is still valid
+	 */
+	bool Validate(Item &item, Expiry now) noexcept {
+		if (!item.expires.IsExpired(now))
+			return true;
+
+		++stats.expired;
+		Dispose(Evict(item));
+		return false;
+	}
+
+	template<typename P>
+	std::size_t RemoveItemsIf(P &&p) noexcept {
+		std::size_t n = 0;
+
+		const auto dispose = [this, &n](Item *item){
+			Uncount(*item);
+			map.erase(map.iterator_to(*item));
+			Dispose(*item);
+			++n;
+		};
+
+		chronological_list.remove_and_dispose_if(p, dispose);
+		probation_list.remove_and_dispose_if(p, dispose);
+		protected_list.remove_and_dispose_if(p, dispose);
+		return n;
+	}
+
 public:
 	using hasher = typename KeyMap::hasher;
 	using key_equal = typename KeyMap::key_equal;
@@ -243,41 +636,86 @@ public:
 	}
 
 	bool IsEmpty() const noexcept {
-		return chronological_list.empty();
+		return chronological_list.empty() && probation_list.empty() &&
+			protected_list.empty();
 	}
 
 	bool IsFull() const noexcept {
 		return unallocated_list.empty();
 	}
 
+	/**
+	 * Returns the sum of the weights of all items.
+	 */
+	std::size_t GetWeight() const noexcept {
+		return total_weight;
+	}
+
+	std::size_t GetMaxWeight() const noexcept {
+		return max_weight;
+	}
+
+	/**
+	 * Limit the sum of the weights of all items (in addition to
+	 * the #max_size limit).  If the cache is heavier than that
+	 * already, items are evicted immediately.
+	 */
+	void SetMaxWeight(std::size_t _max_weight) noexcept {
+		max_weight = _max_weight;
+		ShrinkToWeight(0);
+	}
+
 	void Clear() noexcept {
 		map.clear();
 
-		chronological_list.clear_and_dispose([this](Item *item){
-				item->Destruct();
-				unallocated_list.push_front(*item);
-			});
+		const auto dispose = [this](Item *item){
+			Dispose(*item);
+		};
+
+		chronological_list.clear_and_dispose(dispose);
+		probation_list.clear_and_dispose(dispose);
+		protected_list.clear_and_dispose(dispose);
+		chronological_size = protected_size = 0;
+		assert(total_weight == 0);
 	}
 
 	/**
 	 * Look up an item by its key.  Returns nullptr if no such
-	 * item exists.
+	 * item exists or if it has expired.
 	 */
 	template<typename K>
-	[[gnu::pure]]
 	Data *Get(K &&key) noexcept {
-		auto i = map.find(std::forward<K>(key),
-				  map.hash_function(), map.key_eq());
-		if (i == map.end())
+		Item *item = Find(std::forward<K>(key));
+
+		/* don't bother to read the clock for items which
+		   never expire */
+		if (item == nullptr ||
+		    (item->expires != Expiry::Never() &&
+		     !Validate(*item, Expiry::Now()))) {
+			++stats.misses;
 			return nullptr;
+		}
 
-		Item &item = *i;
+		++stats.hits;
+		Touch(*item);
+		return &item->GetData();
+	}
 
-		/* move to the front of the chronological list */
-		chronological_list.erase(chronological_list.iterator_to(item));
-		chronological_list.push_front(item);
+	/**
+	 * Same as Get(), but use the given time stamp for the expiry
+	 * check instead of reading the clock.
+	 */
+	template<typename K>
+	Data *Get(K &&key, Expiry now) noexcept {
+		Item *item = Find(std::forward<K>(key));
+		if (item == nullptr || !Validate(*item, now)) {
+			++stats.misses;
+			return nullptr;
+		}
 
-		return &item.GetData();
+		++stats.hits;
+		Touch(*item);
+		return &item->GetData();
 	}
 
 	/**
@@ -285,36 +723,80 @@ public:
 	 * already, i.e. Get() has returned nullptr; it is not
 	 * possible to replace an existing item.  If the cache is
 	 * full, then the least recently used item is deleted, making
-	 * room for this one.
+	 * room for this one (with #TinyLFUCachePolicy, the evicted
+	 * item may be another one which is rarely used).
+	 *
+	 * @param expires the time when this item expires
+	 * @param weight the weight of this item; see SetMaxWeight()
+	 * @return the new item or nullptr if the weight exceeds the
+	 * maximum total weight
 	 */
 	template<typename K, typename U>
-	Data &Put(K &&key, U &&data) {
-		Item &item = Make(std::forward<K>(key), std::forward<U>(data));
-		chronological_list.push_front(item);
+	Data *Put(K &&key, U &&data,
+		  Expiry expires=Expiry::Never(), std::size_t weight=1) {
+		RecordAccess(key);
+
+		if (weight > max_weight) {
+			++stats.rejected;
+			return nullptr;
+		}
+
+		Item &item = Insert(std::forward<K>(key), std::forward<U>(data),
+				    expires, weight);
 		auto i = map.insert(item);
 		(void)i;
 		assert(i.second && "Key must not exist already");
-		return item.GetData();
+		return &item.GetData();
 	}
 
 	/**
 	 * Insert a new item into the cache.  If the key exists
 	 * already, then the item is replaced.
+	 *
+	 * @param expires the time when this item expires
+	 * @param weight the weight of this item; see SetMaxWeight()
+	 * @return the new item or nullptr if the weight exceeds the
+	 * maximum total weight (the old item is removed in that
+	 * case, because it is stale)
 	 */
 	template<typename K, typename U>
-	Data &PutOrReplace(K &&key, U &&data) {
+	Data *PutOrReplace(K &&key, U &&data,
+			   Expiry expires=Expiry::Never(),
+			   std::size_t weight=1) {
+		RecordAccess(key);
+
+		if (weight > max_weight) {
+			++stats.rejected;
+			Remove(std::forward<K>(key));
+			return nullptr;
+		}
+
 		typename KeyMap::insert_commit_data icd;
 		auto i = map.insert_check(key,
 					  map.hash_function(), map.key_eq(),
 					  icd);
 		if (i.second) {
-			Item &item = Make(std::forward<K>(key), std::forward<U>(data));
-			chronological_list.push_front(item);
+			Item &item = Insert(std::forward<K>(key),
+					    std::forward<U>(data),
+					    expires, weight);
 			map.insert_commit(item, icd);
-			return item.GetData();
-		} else {
+			return &item.GetData();
+		} else if (i.first->weight == weight) {
 			i.first->ReplaceData(std::forward<U>(data));
-			return i.first->GetData();
+			i.first->expires = expires;
+			return &i.first->GetData();
+		} else {
+			/* the weight has changed, which may require
+			   evicting other items (or even this one);
+			   to keep this simple, delete the old item
+			   and insert a new one */
+			Dispose(Evict(*i.first));
+
+			Item &item = Insert(std::forward<K>(key),
+					    std::forward<U>(data),
+					    expires, weight);
+			map.insert(item);
+			return &item.GetData();
 		}
 	}
 
@@ -325,11 +807,7 @@ public:
 	void RemoveItem(Data &data) noexcept {
 		auto &item = Item::Cast(data);
 
-		map.erase(map.iterator_to(item));
-		chronological_list.erase(chronological_list.iterator_to(item));
-
-		item.Destruct();
-		unallocated_list.push_front(item);
+		Dispose(Evict(item));
 	}
 
 	/**
@@ -342,13 +820,7 @@ public:
 		if (i == map.end())
 			return;
 
-		Item &item = *i;
-
-		map.erase(i);
-		chronological_list.erase(chronological_list.iterator_to(item));
-
-		item.Destruct();
-		unallocated_list.push_front(item);
+		Dispose(Evict(*i));
 	}
 
 	/**
@@ -357,14 +829,56 @@ public:
 	 */
 	template<typename P>
 	void RemoveIf(P &&p) noexcept {
-		chronological_list.remove_and_dispose_if([&p](const Item &item){
-				return p(item.GetKey(), item.GetData());
-			},
-			[this](Item *item){
-				map.erase(map.iterator_to(*item));
-				item->Destruct();
-				unallocated_list.push_front(*item);
-			});
+		RemoveItemsIf([&p](const Item &item){
+			return p(item.GetKey(), item.GetData());
+		});
+	}
+
+	/**
+	 * Delete all items which have expired.
+	 *
+	 * @return the number of items which were deleted
+	 */
+	std::size_t PurgeExpired(Expiry now=Expiry::Now()) noexcept {
+		const std::size_t n = RemoveItemsIf([now](const Item &item){
+			return item.expires.IsExpired(now);
+		});
+
+		stats.expired += n;
+		return n;
+	}
+
+	const CacheStats &GetStats() const noexcept {
+		return stats;
+	}
+
+	/**
+	 * Count the number of items in each hash table bucket.  This
+	 * walks the whole table and is meant for occasional
+	 * diagnostics, e.g. to choose a better #table_size.
+	 */
+	[[gnu::pure]]
+	CacheChainLengths GetChainLengths() const noexcept {
+		CacheChainLengths result;
+		for (std::size_t i = 0; i < map.bucket_count(); ++i)
+			result.Add(map.bucket_size(i));
+		return result;
+	}
+
+	/**
+	 * Pass all statistics to the given visitor, which gets called
+	 * with the name and the value of each counter (as
+	 * std::size_t) or histogram (as #Log2Histogram).
+	 */
+	template<typename V>
+	void VisitStats(V &&v) const {
+		stats.Visit(v);
+
+		std::size_t size = 0;
+		ForEach([&size](const Key &, const Data &){ ++size; });
+		v("size", size);
+		v("weight", total_weight);
+		v("chain_lengths", GetChainLengths());
 	}
 
 	/**
@@ -376,6 +890,10 @@ public:
 	void ForEach(F &&f) const {
 		for (const auto &i : chronological_list)
 			f(i.GetKey(), i.GetData());
+		for (const auto &i : protected_list)
+			f(i.GetKey(), i.GetData());
+		for (const auto &i : probation_list)
+			f(i.GetKey(), i.GetData());
 	}
 };
 
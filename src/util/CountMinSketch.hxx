@@ -0,0 +1,156 @@
+/*
+ * Copyright 2021 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A count-min sketch with 4 bit counters which estimates how often
+ * a hash value has been seen recently.  After a number of
+ * increments (the "sample size"), all counters are halved, so old
+ * popularity fades away.
+ *
+ * No dynamic allocation; the whole table is inside this object.
+ *
+ * @param capacity the number of distinct items which are expected
+ * to be tracked (e.g. the capacity of a cache); this determines the
+ * table size and the sample size
+ */
+template<std::size_t capacity>
+class CountMinSketch {
+	static_assert(capacity > 0);
+
+	/**
+	 * The number of 64 bit words; each holds 16 counters.
+	 */
+	static constexpr std::size_t n_words =
+		std::max<std::size_t>(std::bit_ceil(capacity), 8);
+
+	/**
+	 * The number of counters which are looked up for each hash.
+	 */
+	static constexpr unsigned DEPTH = 4;
+
+	static constexpr std::size_t SAMPLE_SIZE = capacity * 10;
+
+	static constexpr uint_least64_t RESET_MASK = 0x7777777777777777ULL;
+
+	std::array<uint_least64_t, n_words> table{};
+
+	std::size_t n_increments = 0;
+
+public:
+	/**
+	 * Increment the counters of the given hash value.
+	 */
+	void Increment(std::size_t hash) noexcept {
+		bool incremented = false;
+
+		for (unsigned i = 0; i < DEPTH; ++i) {
+			const auto p = Locate(hash, i);
+			auto &word = table[p.word];
+			if (((word >> p.shift) & 0xf) < 0xf) {
+				word += uint_least64_t(1) << p.shift;
+				incremented = true;
+			}
+		}
+
+		if (incremented && ++n_increments >= SAMPLE_SIZE)
+			Reset();
+	}
+
+	/**
+	 * Estimate how often the given hash value has been seen
+	 * (since the counters were last halved).  The result may be
+	 * too large (because of collisions), but never too small,
+	 * and it saturates at 15.
+	 */
+	[[gnu::pure]]
+	unsigned Estimate(std::size_t hash) const noexcept {
+		unsigned result = 0xf;
+
+		for (unsigned i = 0; i < DEPTH; ++i) {
+			const auto p = Locate(hash, i);
+			result = std::min(result,
+					  unsigned(table[p.word] >> p.shift) & 0xf);
+		}
+
+		return result;
+	}
+
+	void Clear() noexcept {
+		table.fill(0);
+		n_increments = 0;
+	}
+
+private:
+	struct Position {
+		std::size_t word;
+		unsigned shift;
+	};
+
+	static constexpr uint_least64_t SEEDS[DEPTH] = {
+		0xc3a5c85c97cb3127ULL,
+		0xb492b66fbe98f273ULL,
+		0x9ae16a3b2f90404fULL,
+		0xcbf29ce484222325ULL,
+	};
+
+	/**
+	 * Determine the position of the counter number #i for the
+	 * given hash value.
+	 */
+	static constexpr Position Locate(std::size_t hash,
+					 unsigned i) noexcept {
+		/* spread the (possibly weak) hash with a
+		   multiply-xorshift step, differently for each row */
+		uint_least64_t h = (uint_least64_t(hash) + SEEDS[i]) * SEEDS[i];
+		h ^= h >> 32;
+
+		return {
+			std::size_t(h) & (n_words - 1),
+			unsigned(h >> 60) << 2,
+		};
+	}
+
+	/**
+	 * Halve all counters.
+	 */
+	void Reset() noexcept {
+		for (auto &word : table)
+			word = (word >> 1) & RESET_MASK;
+
+		n_increments /= 2;
+	}
+};
@@ -48,7 +48,7 @@ public:
 private:
 	void *ptr = nullptr;
 
-	DisposeFunction dispose;
+	DisposeFunction dispose = nullptr;
 
 public:
 	DisposablePointer() = default;
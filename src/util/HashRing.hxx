@@ -33,7 +33,11 @@
 #ifndef HASH_RING_HXX
 #define HASH_RING_HXX
 
+#include <algorithm>
 #include <array>
+#include <cassert>
+#include <cmath>
+#include <utility>
 
 #include <stddef.h>
 
@@ -48,12 +52,23 @@ class AllocatorPtr;
  * @param N_REPLICAS the number of replicas in the ring for each node
  *
  * @see https://en.wikipedia.org/wiki/Consistent_hashing
+ * @see MaglevHash
  */
 template<typename Node, typename hash_t,
 	 size_t N_BUCKETS, size_t N_REPLICAS>
 class HashRing {
 	std::array<Node *, N_BUCKETS> buckets;
 
+	/**
+	 * The number of nodes with a non-zero weight.
+	 */
+	size_t n_nodes = 0;
+
+	/**
+	 * The sum of all node weights.
+	 */
+	size_t total_weight = 0;
+
 public:
 	/**
 	 * Build the hash ring using nodes from the given container.
@@ -66,13 +81,37 @@ public:
 	 */
 	template<typename C, typename H>
 	void Build(C &&nodes, H &&hasher) noexcept {
+		Build(std::forward<C>(nodes), std::forward<H>(hasher),
+		      [](const auto &) -> size_t { return 1; });
+	}
+
+	/**
+	 * Like Build(), but each node gets N_REPLICAS times its weight
+	 * replicas, i.e. a share of the ring proportional to its
+	 * weight.
+	 *
+	 * @param weigher a functor object which returns the (integer)
+	 * weight of a node; a node with weight 0 is not added to the
+	 * ring, but at least one node must have a non-zero weight
+	 */
+	template<typename C, typename H, typename W>
+	void Build(C &&nodes, H &&hasher, W &&weigher) noexcept {
 		/* clear all buckets */
 		std::fill(buckets.begin(), buckets.end(), nullptr);
+		n_nodes = 0;
+		total_weight = 0;
 
 		/* inject nodes (and their replicas) at certain buckets */
-		for (auto &node : nodes)
-			for (size_t replica = 0; replica < N_REPLICAS; ++replica)
+		for (auto &node : nodes) {
+			const size_t weight = weigher(node);
+			const size_t n_replicas = N_REPLICAS * weight;
+			if (n_replicas > 0)
+				++n_nodes;
+			total_weight += weight;
+
+			for (size_t replica = 0; replica < n_replicas; ++replica)
 				buckets[hasher(node, replica) % N_BUCKETS] = &node;
+		}
 
 		/* fill follow-up buckets */
 		Node *node = nullptr;
@@ -103,6 +142,68 @@ public:
 		return *buckets[h % N_BUCKETS];
 	}
 
+	/**
+	 * Pick a node using the given hash, but skip nodes which are
+	 * overloaded ("Consistent Hashing with Bounded Loads",
+	 * Mirrokni et al. 2016): a node may only accept a new request
+	 * if its load is below (1+epsilon) times its share of the
+	 * total load, which is proportional to its weight; else the
+	 * next node on the ring is tried.  This prevents a hot key
+	 * from overloading a node, while most keys still stay on
+	 * "their" node.
+	 *
+	 * Before calling this, Build() must have been called.
+	 *
+	 * @param get_load a functor object which returns the current
+	 * load of a node (e.g. the number of pending requests)
+	 * @param total_load the sum of the loads of all nodes
+	 * @param epsilon the allowed imbalance; smaller values mean
+	 * more even loads, but more keys which are moved away from
+	 * their node
+	 * @param weigher the functor object which was passed to
+	 * Build()
+	 */
+	template<typename L, typename W>
+	Node &PickBounded(hash_t h, L &&get_load, size_t total_load,
+			  double epsilon, W &&weigher) const noexcept {
+		assert(total_weight > 0);
+
+		const double share =
+			(1 + epsilon) * (total_load + 1) / total_weight;
+
+		const Node *previous = nullptr;
+		for (size_t i = 0; i < N_BUCKETS; ++i) {
+			auto &node = Pick(h + i);
+			if (&node == previous)
+				continue;
+
+			const size_t capacity =
+				std::ceil(share * weigher(node));
+			if (get_load(node) < capacity)
+				return node;
+
+			previous = &node;
+		}
+
+		/* all nodes are overloaded; this cannot happen if
+		   "total_load" is correct */
+		return Pick(h);
+	}
+
+	/**
+	 * Like PickBounded() above, but for a ring which was built
+	 * without a weigher, i.e. all nodes have the same weight.
+	 */
+	template<typename L>
+	Node &PickBounded(hash_t h, L &&get_load, size_t total_load,
+			  double epsilon) const noexcept {
+		assert(total_weight == n_nodes);
+
+		return PickBounded(h, std::forward<L>(get_load),
+				   total_load, epsilon,
+				   [](const auto &) -> size_t { return 1; });
+	}
+
 	/**
 	 * Find the next node after the given one.  This is useful for
 	 * skipping known-bad nodes and turning to a failover node.
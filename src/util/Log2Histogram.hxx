@@ -0,0 +1,94 @@
+/*
+ * Copyright 2021 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+
+/**
+ * A histogram with power-of-two buckets: bucket 0 counts the value
+ * 0, bucket i counts values in the range [2^(i-1), 2^i), and the last
+ * bucket counts all values which are larger.
+ *
+ * This is cheap enough to be updated in hot paths: no dynamic
+ * allocation, no floating point and no locking.
+ */
+template<std::size_t N>
+class Log2Histogram {
+	static_assert(N >= 2);
+
+	std::array<std::size_t, N> buckets{};
+
+public:
+	static constexpr std::size_t size() noexcept {
+		return N;
+	}
+
+	/**
+	 * Returns the smallest value which is counted in the given
+	 * bucket.
+	 */
+	static constexpr std::size_t GetLowerBound(std::size_t i) noexcept {
+		return i == 0 ? 0 : std::size_t(1) << (i - 1);
+	}
+
+	static constexpr std::size_t IndexOf(std::size_t value) noexcept {
+		const std::size_t i = std::bit_width(value);
+		return i < N ? i : N - 1;
+	}
+
+	void Add(std::size_t value) noexcept {
+		++buckets[IndexOf(value)];
+	}
+
+	void Clear() noexcept {
+		buckets.fill(0);
+	}
+
+	constexpr std::size_t operator[](std::size_t i) const noexcept {
+		return buckets[i];
+	}
+
+	constexpr auto begin() const noexcept {
+		return buckets.begin();
+	}
+
+	constexpr auto end() const noexcept {
+		return buckets.end();
+	}
+
+	Log2Histogram &operator+=(const Log2Histogram &other) noexcept {
+		for (std::size_t i = 0; i < N; ++i)
+			buckets[i] += other.buckets[i];
+		return *this;
+	}
+};
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <utility>
+#include <vector>
+
+#include <stddef.h>
+
+/**
+ * Maglev consistent hashing: an alternative to #HashRing which
+ * distributes keys almost perfectly evenly among the nodes.  When a
+ * node is removed, only slightly more than that node's own keys are
+ * moved to other nodes.
+ *
+ * Build() fills a lookup table with each node's preference
+ * permutation.  Pick() is a single table lookup.
+ *
+ * @param Node the node type
+ * @param hash_t the type of a hash value
+ * @param TABLE_SIZE the size of the lookup table; must be a prime
+ * number which is much larger than the number of nodes (e.g. 100
+ * times)
+ *
+ * @see https://research.google/pubs/pub44824/
+ */
+template<typename Node, typename hash_t, size_t TABLE_SIZE>
+class MaglevHash {
+	static constexpr bool IsPrime(size_t n) noexcept {
+		if (n < 2)
+			return false;
+
+		for (size_t i = 2; i <= n / i; ++i)
+			if (n % i == 0)
+				return false;
+
+		return true;
+	}
+
+	/* the permutations cover all table entries only if the
+	   "skip" values are coprime to the table size */
+	static_assert(TABLE_SIZE > 2);
+	static_assert(IsPrime(TABLE_SIZE), "TABLE_SIZE must be prime");
+
+	std::array<Node *, TABLE_SIZE> table;
+
+public:
+	/**
+	 * Build the lookup table using nodes from the given
+	 * container.
+	 *
+	 * Throws std::bad_alloc on error.
+	 *
+	 * @param nodes a non-empty iterable container which contains
+	 * nodes; pointers to those nodes will be stored in this object
+	 * (i.e. they must be valid as long as this object is used)
+	 * @param hasher a functor object which generates a secure hash of
+	 * a node and a seed number (0 or 1); this is compatible with
+	 * the #HashRing hasher
+	 */
+	template<typename C, typename H>
+	void Build(C &&nodes, H &&hasher) {
+		Build(std::forward<C>(nodes), std::forward<H>(hasher),
+		      [](const auto &) -> size_t { return 1; });
+	}
+
+	/**
+	 * Like Build(), but each node gets a share of the table
+	 * proportional to its weight.
+	 *
+	 * @param weigher a functor object which returns the (integer)
+	 * weight of a node; a node with weight 0 is not added to the
+	 * table, but at least one node must have a non-zero weight
+	 */
+	template<typename C, typename H, typename W>
+	void Build(C &&nodes, H &&hasher, W &&weigher) {
+		struct Permutation {
+			Node *node;
+
+			/**
+			 * The next table position in this node's
+			 * permutation.
+			 */
+			size_t position;
+
+			size_t skip, weight;
+		};
+
+		std::vector<Permutation> permutations;
+
+		for (auto &node : nodes) {
+			const size_t weight = weigher(node);
+			if (weight == 0)
+				continue;
+
+			permutations.push_back({
+				&node,
+				size_t(hasher(node, 0) % TABLE_SIZE),
+				size_t(hasher(node, 1) % (TABLE_SIZE - 1) + 1),
+				weight,
+			});
+		}
+
+		assert(!permutations.empty());
+
+		std::fill(table.begin(), table.end(), nullptr);
+
+		/* the nodes take turns claiming their next preferred
+		   table entry which is still free; since TABLE_SIZE is
+		   prime, each permutation visits all entries */
+		for (size_t n = 0;;) {
+			for (auto &p : permutations) {
+				for (size_t i = 0; i < p.weight; ++i) {
+					while (table[p.position] != nullptr)
+						p.position = (p.position + p.skip) % TABLE_SIZE;
+
+					table[p.position] = p.node;
+					if (++n == TABLE_SIZE)
+						return;
+				}
+			}
+		}
+	}
+
+	/**
+	 * Pick a node using the given hash.
+	 *
+	 * Before calling this, Build() must have been called.
+	 */
+	[[gnu::pure]]
+	Node &Pick(hash_t h) const noexcept {
+		return *table[h % TABLE_SIZE];
+	}
+};
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2021 Max Kellermann <max.kellermann@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "Cache.hxx"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+/**
+ * A thread-safe variant of #Cache which can be shared by several
+ * threads (e.g. one #EventLoop per CPU core).  The key space is split
+ * into a number of shards, each with its own #Cache and its own
+ * mutex, so threads accessing different shards do not contend.  LRU
+ * order is maintained per shard only, i.e. the cache as a whole is
+ * only approximately LRU.
+ *
+ * Since another thread may modify the cache at any time, there are
+ * no methods returning pointers to cached values; instead, values
+ * are copied or passed to a callback while the shard is locked.
+ *
+ * No dynamic allocation; all items and all shards are allocated
+ * statically inside this class (which means that instances are
+ * usually too large for the stack).
+ *
+ * @param max_size the maximum number of items in the whole cache;
+ * each shard holds up to `max_size / n_shards` items
+ * @param table_size the size of each shard's hash table; rule of
+ * thumb: should be prime
+ * @param n_shards the number of shards; must be a power of two
+ */
+template<typename Key, typename Data,
+	 std::size_t max_size,
+	 std::size_t table_size,
+	 std::size_t n_shards=16,
+	 typename Hash=std::hash<Key>,
+	 typename Equal=std::equal_to<Key>,
+	 typename Policy=LRUCachePolicy>
+class ShardedCache {
+	static_assert(std::has_single_bit(n_shards),
+		      "Number of shards must be a power of two");
+	static_assert(max_size >= n_shards);
+
+	static constexpr std::size_t shard_size = max_size / n_shards;
+
+	using ShardCache = Cache<Key, Data, shard_size, table_size,
+				 Hash, Equal, Policy>;
+
+	/**
+	 * Each shard gets its own cache line to avoid false sharing
+	 * between the mutexes.
+	 */
+	struct alignas(64) Shard {
+		mutable std::mutex mutex;
+
+		ShardCache cache;
+	};
+
+	std::array<Shard, n_shards> shards;
+
+	[[no_unique_address]]
+	Hash hash;
+
+	/**
+	 * Choose the shard for the given key.  This uses the upper
+	 * bits of the (spread) hash, because the lower bits select
+	 * the bucket inside the shard's hash table.
+	 */
+	template<typename K>
+	[[gnu::pure]]
+	Shard &GetShard(const K &key) noexcept {
+		if constexpr (n_shards == 1) {
+			(void)key;
+			return shards.front();
+		} else {
+			constexpr unsigned shift = 64 - std::countr_zero(n_shards);
+			const uint_least64_t h = uint_least64_t(hash(key)) *
+				0x9e3779b97f4a7c15ULL;
+			return shards[h >> shift];
+		}
+	}
+
+public:
+	ShardedCache() = default;
+
+	ShardedCache(const ShardedCache &) = delete;
+	ShardedCache &operator=(const ShardedCache &) = delete;
+
+	static constexpr std::size_t GetShardCount() noexcept {
+		return n_shards;
+	}
+
+	/**
+	 * Look up an item by its key and return a copy of its value.
+	 */
+	template<typename K>
+	std::optional<Data> Get(const K &key) {
+		auto &shard = GetShard(key);
+		const std::scoped_lock lock{shard.mutex};
+
+		if (const Data *data = shard.cache.Get(key))
+			return *data;
+
+		return std::nullopt;
+	}
+
+	/**
+	 * Look up an item by its key and, if found, invoke the given
+	 * function with a reference to its value.  The shard remains
+	 * locked while the function runs, so it should be quick and
+	 * must not access this cache.
+	 *
+	 * @return true if the item was found
+	 */
+	template<typename K, typename F>
+	bool Visit(const K &key, F &&f) {
+		auto &shard = GetShard(key);
+		const std::scoped_lock lock{shard.mutex};
+
+		Data *data = shard.cache.Get(key);
+		if (data == nullptr)
+			return false;
+
+		f(*data);
+		return true;
+	}
+
+	/**
+	 * Insert a new item into the cache.  Unlike Cache::Put(),
+	 * this replaces an existing item with the same key, because
+	 * another thread may have added it in the meantime.
+	 */
+	template<typename K, typename U>
+	void Put(K &&key, U &&data,
+		 Expiry expires=Expiry::Never(), std::size_t weight=1) {
+		auto &shard = GetShard(key);
+		const std::scoped_lock lock{shard.mutex};
+
+		shard.cache.PutOrReplace(std::forward<K>(key),
+					 std::forward<U>(data),
+					 expires, weight);
+	}
+
+	template<typename K>
+	void Remove(const K &key) noexcept {
+		auto &shard = GetShard(key);
+		const std::scoped_lock lock{shard.mutex};
+
+		shard.cache.Remove(key);
+	}
+
+	/**
+	 * Remove all items which match the given predicate.  The
+	 * shards are locked one after another, so this is not
+	 * atomic.
+	 */
+	template<typename P>
+	void RemoveIf(P &&p) noexcept {
+		for (auto &shard : shards) {
+			const std::scoped_lock lock{shard.mutex};
+			shard.cache.RemoveIf(p);
+		}
+	}
+
+	void Clear() noexcept {
+		for (auto &shard : shards) {
+			const std::scoped_lock lock{shard.mutex};
+			shard.cache.Clear();
+		}
+	}
+
+	/**
+	 * @see Cache::PurgeExpired()
+	 */
+	std::size_t PurgeExpired(Expiry now=Expiry::Now()) noexcept {
+		std::size_t n = 0;
+		for (auto &shard : shards) {
+			const std::scoped_lock lock{shard.mutex};
+			n += shard.cache.PurgeExpired(now);
+		}
+
+		return n;
+	}
+
+	/**
+	 * Limit the sum of the weights of all items; each shard gets
+	 * an equal part of this budget.
+	 *
+	 * @see Cache::SetMaxWeight()
+	 */
+	void SetMaxWeight(std::size_t max_weight) noexcept {
+		for (auto &shard : shards) {
+			const std::scoped_lock lock{shard.mutex};
+			shard.cache.SetMaxWeight(max_weight / n_shards);
+		}
+	}
+
+	/**
+	 * Returns the sum of the statistics of all shards.
+	 */
+	CacheStats GetStats() const noexcept {
+		CacheStats result;
+
+		for (const auto &shard : shards) {
+			const std::scoped_lock lock{shard.mutex};
+			result += shard.cache.GetStats();
+		}
+
+		return result;
+	}
+};
@@ -62,6 +62,24 @@ struct IsCacheableFactory {
 	}
 };
 
+struct ExpiryWeightFactory {
+	Co::Task<int> operator()(int key) noexcept {
+		++n_started;
+		++n_finished;
+		co_return key;
+	}
+
+	Expiry GetExpiry(int value) const noexcept {
+		return value % 2 == 0
+			? Expiry::Never()
+			: Expiry::AlreadyExpired();
+	}
+
+	std::size_t GetWeight(int value) const noexcept {
+		return value;
+	}
+};
+
 struct SleepFactory {
 	EventLoop &event_loop;
 
@@ -76,6 +94,50 @@ struct SleepFactory {
 	}
 };
 
+/**
+ * Returns items which are stale already.
+ */
+struct StaleFactory {
+	EventLoop &event_loop;
+
+	explicit StaleFactory(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop) {}
+
+	Co::Task<int> operator()(int key) noexcept {
+		++n_started;
+		co_await Co::Sleep(event_loop, std::chrono::milliseconds(1));
+		++n_finished;
+		co_return key * 100 + n_finished;
+	}
+
+	Expiry GetExpiry(int) const noexcept {
+		return Expiry::Touched(-std::chrono::seconds(1));
+	}
+};
+
+/**
+ * Like #StaleFactory, but fails after the first call.
+ */
+struct StaleThrowFactory {
+	EventLoop &event_loop;
+
+	explicit StaleThrowFactory(EventLoop &_event_loop) noexcept
+		:event_loop(_event_loop) {}
+
+	Co::Task<int> operator()(int key) {
+		++n_started;
+		co_await Co::Sleep(event_loop, std::chrono::milliseconds(1));
+		++n_finished;
+		if (n_finished > 1)
+			throw std::runtime_error("Error");
+		co_return key * 100 + n_finished;
+	}
+
+	Expiry GetExpiry(int) const noexcept {
+		return Expiry::Touched(-std::chrono::seconds(1));
+	}
+};
+
 struct ThrowImmediateFactory {
 	Co::Task<int> operator()(int) {
 		++n_started;
@@ -189,6 +251,10 @@ TEST(CoCache, Sleep)
 	ASSERT_EQ(n_started, 2u);
 	ASSERT_EQ(n_finished, 2u);
 
+	ASSERT_EQ(cache.GetRequestStats().requests, 2u);
+	ASSERT_EQ(cache.GetRequestStats().coalesced, 1u);
+	ASSERT_EQ(cache.GetRequestStats().errors, 0u);
+
 	// test Clear()
 
 	{
@@ -463,3 +529,152 @@ TEST(CoCache, IsCacheable)
 	ASSERT_EQ(cache.GetIfCached(3), nullptr);
 	ASSERT_EQ(*cache.GetIfCached(4), 4);
 }
+
+TEST(CoCache, ExpiryWeight)
+{
+	using Factory = ExpiryWeightFactory;
+	using Cache = TestCache<Factory>;
+
+	Cache cache;
+	cache.SetMaxWeight(10);
+
+	n_started = n_finished = 0;
+
+	Work w1(cache), w2(cache), w3(cache);
+	w1.Start(1);
+	w2.Start(2);
+	w3.Start(4);
+
+	ASSERT_EQ(n_started, 3u);
+	ASSERT_EQ(w1.value, 1);
+	ASSERT_EQ(cache.GetIfCached(1), nullptr);
+	ASSERT_EQ(*cache.GetIfCached(2), 2);
+	ASSERT_EQ(*cache.GetIfCached(4), 4);
+	ASSERT_EQ(cache.GetWeight(), 6u);
+
+	/* this exceeds the maximum weight and evicts the least
+	   recently used item */
+	Work w4(cache);
+	w4.Start(6);
+
+	ASSERT_EQ(w4.value, 6);
+	ASSERT_EQ(cache.GetIfCached(2), nullptr);
+	ASSERT_EQ(*cache.GetIfCached(4), 4);
+	ASSERT_EQ(*cache.GetIfCached(6), 6);
+	ASSERT_EQ(cache.GetWeight(), 10u);
+	ASSERT_EQ(cache.PurgeExpired(), 0u);
+}
+
+TEST(CoCache, StaleWhileRevalidate)
+{
+	using Factory = StaleFactory;
+	using Cache = TestCache<Factory>;
+
+	EventLoop event_loop;
+	Cache cache(event_loop);
+	cache.SetStaleDuration(std::chrono::hours(1));
+
+	n_started = n_finished = 0;
+
+	Work w1(cache);
+	w1.Start(4);
+	event_loop.Dispatch();
+
+	ASSERT_EQ(w1.value, 401);
+	ASSERT_EQ(n_started, 1u);
+	ASSERT_EQ(*cache.GetIfCached(4), 401);
+
+	/* the item is stale: both get it immediately, and only one
+	   refresh is started */
+	Work w2(cache), w3(cache);
+	w2.Start(4);
+	w3.Start(4);
+
+	ASSERT_EQ(w2.value, 401);
+	ASSERT_EQ(w3.value, 401);
+	ASSERT_EQ(n_started, 2u);
+	ASSERT_EQ(n_finished, 1u);
+
+	event_loop.Dispatch();
+
+	ASSERT_EQ(n_finished, 2u);
+	ASSERT_EQ(*cache.GetIfCached(4), 402);
+	ASSERT_EQ(cache.GetRequestStats().stale, 2u);
+	ASSERT_EQ(cache.GetRequestStats().revalidations, 1u);
+
+	/* destroying the cache cancels pending refreshes */
+	Work w4(cache);
+	w4.Start(4);
+	ASSERT_EQ(w4.value, 402);
+	ASSERT_EQ(n_started, 3u);
+}
+
+TEST(CoCache, NegativeCache)
+{
+	using Factory = ThrowImmediateFactory;
+	using Cache = TestCache<Factory>;
+
+	Cache cache;
+	cache.SetNegativeDuration(std::chrono::hours(1));
+
+	n_started = n_finished = 0;
+
+	Work w1(cache), w2(cache), w3(cache);
+	w1.Start(1);
+	w2.Start(1);
+	w3.Start(2);
+
+	ASSERT_TRUE(w1.error);
+	ASSERT_TRUE(w2.error);
+	ASSERT_TRUE(w3.error);
+	ASSERT_EQ(n_started, 2u);
+	ASSERT_EQ(cache.GetIfCached(1), nullptr);
+	ASSERT_EQ(cache.GetRequestStats().negative_hits, 1u);
+
+	cache.Remove(1);
+
+	Work w4(cache);
+	w4.Start(1);
+	ASSERT_TRUE(w4.error);
+	ASSERT_EQ(n_started, 3u);
+}
+
+TEST(CoCache, StaleIfError)
+{
+	using Factory = StaleThrowFactory;
+	using Cache = TestCache<Factory>;
+
+	EventLoop event_loop;
+	Cache cache(event_loop);
+	cache.SetStaleDuration(std::chrono::hours(1));
+	cache.SetNegativeDuration(std::chrono::hours(1));
+
+	n_started = n_finished = 0;
+
+	Work w1(cache);
+	w1.Start(4);
+	event_loop.Dispatch();
+
+	ASSERT_EQ(w1.value, 401);
+	ASSERT_EQ(*cache.GetIfCached(4), 401);
+
+	/* the refresh fails, but the stale item is not replaced
+	   with a negative entry */
+	Work w2(cache);
+	w2.Start(4);
+	ASSERT_EQ(w2.value, 401);
+	ASSERT_EQ(n_started, 2u);
+
+	event_loop.Dispatch();
+
+	ASSERT_EQ(n_finished, 2u);
+	ASSERT_EQ(cache.GetRequestStats().errors, 1u);
+	ASSERT_NE(cache.GetIfCached(4), nullptr);
+	ASSERT_EQ(*cache.GetIfCached(4), 401);
+
+	Work w3(cache);
+	w3.Start(4);
+	ASSERT_FALSE(w3.error);
+	ASSERT_EQ(w3.value, 401);
+	ASSERT_EQ(cache.GetRequestStats().negative_hits, 0u);
+}
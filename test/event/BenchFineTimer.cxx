@@ -0,0 +1,234 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Micro-benchmark for #FineTimerWheel, compared with a
+ * boost::intrusive::multiset (the data structure previously used for
+ * #FineTimerEvent).
+ */
+
+#include "event/Loop.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "util/PrintException.hxx"
+
+#include <boost/intrusive/set.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <thread>
+
+using std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+struct Result {
+	double insert, reschedule, cancel, expire;
+};
+
+static double
+ToNanoseconds(steady_clock::duration d, std::size_t n) noexcept
+{
+	return double(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) / n;
+}
+
+template<typename F>
+static double
+Measure(std::size_t n, F &&f)
+{
+	const auto start = steady_clock::now();
+	f();
+	return ToNanoseconds(steady_clock::now() - start, n);
+}
+
+static auto
+RandomDuration(std::minstd_rand &r, Event::Duration max) noexcept
+{
+	return std::chrono::duration_cast<Event::Duration>(max * (double(r()) / r.max()));
+}
+
+namespace {
+
+struct WheelTimer {
+	FineTimerEvent event;
+	std::size_t &counter;
+
+	WheelTimer(EventLoop &loop, std::size_t &_counter) noexcept
+		:event(loop, BIND_THIS_METHOD(OnTimer)), counter(_counter) {}
+
+	void OnTimer() noexcept {
+		++counter;
+	}
+};
+
+struct SetTimer
+	: boost::intrusive::set_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>
+{
+	Event::TimePoint due;
+
+	struct Compare {
+		bool operator()(const SetTimer &a,
+				const SetTimer &b) const noexcept {
+			return a.due < b.due;
+		}
+	};
+};
+
+using TimerSet =
+	boost::intrusive::multiset<SetTimer,
+				   boost::intrusive::compare<SetTimer::Compare>,
+				   boost::intrusive::constant_time_size<false>>;
+
+} // anonymous namespace
+
+static Result
+BenchWheel(std::size_t n)
+{
+	EventLoop loop;
+	std::size_t counter = 0;
+
+	std::deque<WheelTimer> timers;
+	for (std::size_t i = 0; i < n; ++i)
+		timers.emplace_back(loop, counter);
+
+	std::minstd_rand r;
+	Result result;
+
+	result.insert = Measure(n, [&]{
+		for (auto &i : timers)
+			i.event.Schedule(RandomDuration(r, 60s));
+	});
+
+	result.reschedule = Measure(n, [&]{
+		for (auto &i : timers)
+			i.event.Schedule(RandomDuration(r, 60s));
+	});
+
+	result.cancel = Measure(n, [&]{
+		for (auto &i : timers)
+			i.event.Cancel();
+	});
+
+	for (auto &i : timers)
+		i.event.Schedule(RandomDuration(r, 50ms));
+	std::this_thread::sleep_for(100ms);
+
+	result.expire = Measure(n, [&]{
+		loop.LoopOnceNonBlock();
+	});
+
+	if (counter != n)
+		throw std::runtime_error("Not all timers have expired");
+
+	return result;
+}
+
+static Result
+BenchSet(std::size_t n)
+{
+	std::deque<SetTimer> timers(n);
+	TimerSet set;
+	std::size_t counter = 0;
+
+	std::minstd_rand r;
+	Result result;
+
+	result.insert = Measure(n, [&]{
+		const auto now = steady_clock::now();
+		for (auto &i : timers) {
+			i.due = now + RandomDuration(r, 60s);
+			set.insert(i);
+		}
+	});
+
+	result.reschedule = Measure(n, [&]{
+		const auto now = steady_clock::now();
+		for (auto &i : timers) {
+			i.unlink();
+			i.due = now + RandomDuration(r, 60s);
+			set.insert(i);
+		}
+	});
+
+	result.cancel = Measure(n, [&]{
+		for (auto &i : timers)
+			i.unlink();
+	});
+
+	const auto start = steady_clock::now();
+	for (auto &i : timers) {
+		i.due = start + RandomDuration(r, 50ms);
+		set.insert(i);
+	}
+	std::this_thread::sleep_for(100ms);
+
+	result.expire = Measure(n, [&]{
+		const auto now = steady_clock::now();
+		while (!set.empty() && set.begin()->due <= now) {
+			set.erase(set.begin());
+			++counter;
+		}
+	});
+
+	if (counter != n)
+		throw std::runtime_error("Not all timers have expired");
+
+	return result;
+}
+
+static void
+Print(const char *name, std::size_t n, const Result &r) noexcept
+{
+	printf("%-8s %8zu %10.1f %10.1f %10.1f %10.1f\n", name, n,
+	       r.insert, r.reschedule, r.cancel, r.expire);
+}
+
+int
+main(int argc, char **argv) noexcept
+try {
+	(void)argc;
+	(void)argv;
+
+	printf("%-8s %8s %10s %10s %10s %10s   (ns per timer)\n",
+	       "", "timers", "insert", "resched", "cancel", "expire");
+
+	for (std::size_t n : {10000, 100000, 1000000}) {
+		Print("wheel", n, BenchWheel(n));
+		Print("multiset", n, BenchSet(n));
+	}
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark for #Net::Log::Receiver (recvmmsg() in
+ * batches), compared with one recv() system call per datagram.
+ */
+
+#include "event/net/log/Receiver.hxx"
+#include "event/Loop.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/Parser.hxx"
+#include "net/log/Serializer.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <sys/socket.h>
+
+using std::chrono::steady_clock;
+
+/**
+ * The number of datagrams sent before the receiver drains the
+ * socket; must fit into the socket's receive buffer.
+ */
+static constexpr std::size_t ROUND_SIZE = 256;
+
+static constexpr std::size_t N_ROUNDS = 4000;
+
+static std::size_t sink;
+
+class BenchHandler final : public Net::Log::ReceiverHandler {
+public:
+	bool OnLogDatagrams(ConstBuffer<Net::Log::Datagram> datagrams) noexcept override {
+		for (const auto &d : datagrams)
+			sink += d.message.size;
+		return true;
+	}
+
+	void OnLogReceiverError(std::exception_ptr ep) noexcept override {
+		PrintException(ep);
+		exit(EXIT_FAILURE);
+	}
+};
+
+static std::pair<UniqueSocketDescriptor, UniqueSocketDescriptor>
+CreateUdpPair()
+{
+	UniqueSocketDescriptor r;
+	if (!r.CreateNonBlock(AF_INET, SOCK_DGRAM, 0) ||
+	    !r.Bind(IPv4Address(IPv4Address::Loopback(), 0)))
+		throw std::runtime_error("Failed to bind receiver");
+
+	const int rcvbuf = 4 * 1024 * 1024;
+	r.SetOption(SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	UniqueSocketDescriptor s;
+	if (!s.Create(AF_INET, SOCK_DGRAM, 0) ||
+	    !s.Connect(r.GetLocalAddress()))
+		throw std::runtime_error("Failed to connect sender");
+
+	return {std::move(r), std::move(s)};
+}
+
+/**
+ * Send one round of datagrams and measure how long the receiver
+ * needs to drain the socket.
+ *
+ * @return datagrams per second
+ */
+template<typename F>
+static double
+Run(SocketDescriptor sender, ConstBuffer<void> payload, F &&receive)
+{
+	steady_clock::duration duration{};
+
+	for (std::size_t round = 0; round < N_ROUNDS; ++round) {
+		for (std::size_t i = 0; i < ROUND_SIZE; ++i)
+			if (send(sender.Get(), payload.data, payload.size, 0) < 0)
+				throw std::runtime_error("send() failed");
+
+		const auto start = steady_clock::now();
+
+		std::size_t n = 0;
+		while (n < ROUND_SIZE) {
+			const std::size_t nbytes = receive();
+			if (nbytes == 0)
+				throw std::runtime_error("Datagrams lost");
+			n += nbytes;
+		}
+
+		duration += steady_clock::now() - start;
+	}
+
+	const std::chrono::duration<double> seconds = duration;
+	return N_ROUNDS * ROUND_SIZE / seconds.count();
+}
+
+int
+main(int, char **) noexcept
+try {
+	Net::Log::Datagram d{"GET /index.html HTTP/1.1"};
+	d.http_uri = "/index.html";
+	d.host = "www.example.com";
+	d.remote_host = "192.0.2.1";
+	d.user_agent = "Mozilla/5.0 (X11; Linux x86_64)";
+	d.http_status = HTTP_STATUS_OK;
+
+	std::byte payload[1024];
+	const std::size_t payload_size = Serialize(payload, sizeof(payload), d);
+
+	/* one recv() per datagram */
+
+	auto single = CreateUdpPair();
+	const double single_rate =
+		Run(single.second, {payload, payload_size}, [&single]{
+			char buffer[4096];
+			ssize_t nbytes = recv(single.first.Get(),
+					      buffer, sizeof(buffer),
+					      MSG_DONTWAIT);
+			if (nbytes <= 0)
+				return std::size_t(0);
+
+			try {
+				const auto r = Net::Log::ParseDatagram(buffer,
+								       buffer + nbytes);
+				sink += r.message.size;
+			} catch (Net::Log::ProtocolError) {
+			}
+
+			return std::size_t(1);
+		});
+
+	/* Net::Log::Receiver */
+
+	EventLoop event_loop;
+	BenchHandler handler;
+
+	auto batched = CreateUdpPair();
+	Net::Log::Receiver receiver(event_loop, std::move(batched.first),
+				    handler, 64);
+	const double batched_rate =
+		Run(batched.second, {payload, payload_size}, [&receiver]{
+			return receiver.ReceiveBatch();
+		});
+
+	printf("payload size: %zu bytes\n\n", payload_size);
+	printf("%-10s %12s\n", "", "datagrams/s");
+	printf("%-10s %12.0f\n", "recv()", single_rate);
+	printf("%-10s %12.0f\n", "recvmmsg()", batched_rate);
+
+	/* prevent the compiler from optimizing the parser away */
+	if (sink == 0)
+		abort();
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
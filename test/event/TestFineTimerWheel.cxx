@@ -0,0 +1,110 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/Loop.hxx"
+#include "event/FineTimerEvent.hxx"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct Timer {
+	FineTimerEvent event;
+	std::vector<unsigned> &log;
+	const unsigned id;
+
+	Timer(EventLoop &loop, std::vector<unsigned> &_log,
+	      unsigned _id) noexcept
+		:event(loop, BIND_THIS_METHOD(OnTimer)),
+		 log(_log), id(_id) {}
+
+	void OnTimer() noexcept {
+		log.push_back(id);
+	}
+};
+
+} // anonymous namespace
+
+TEST(FineTimerWheel, Order)
+{
+	EventLoop loop;
+	std::vector<unsigned> log;
+
+	/* these durations are spread over the first three levels */
+	Timer a(loop, log, 0), b(loop, log, 1), c(loop, log, 2),
+		d(loop, log, 3), e(loop, log, 4);
+	e.event.Schedule(300ms);
+	c.event.Schedule(70ms);
+	a.event.Schedule(0ms);
+	d.event.Schedule(130ms);
+	b.event.Schedule(5ms);
+
+	const auto start = std::chrono::steady_clock::now();
+	loop.Dispatch();
+	const auto duration = std::chrono::steady_clock::now() - start;
+
+	EXPECT_EQ(log, (std::vector<unsigned>{0, 1, 2, 3, 4}));
+	EXPECT_GE(duration, 300ms);
+	EXPECT_TRUE(loop.IsEmpty());
+}
+
+TEST(FineTimerWheel, Cancel)
+{
+	EventLoop loop;
+	std::vector<unsigned> log;
+
+	Timer a(loop, log, 0), b(loop, log, 1), c(loop, log, 2);
+	a.event.Schedule(10ms);
+	b.event.Schedule(24h);
+	c.event.Schedule(1000 * 24h);
+	EXPECT_FALSE(loop.IsEmpty());
+
+	b.event.Cancel();
+	c.event.Cancel();
+	EXPECT_FALSE(b.event.IsPending());
+
+	loop.Dispatch();
+	EXPECT_EQ(log, std::vector<unsigned>{0});
+	EXPECT_TRUE(loop.IsEmpty());
+
+	/* rescheduling replaces the previous due time */
+	a.event.Schedule(1h);
+	a.event.Schedule(20ms);
+	b.event.Schedule(10ms);
+	b.event.ScheduleEarlier(30ms);
+	loop.Dispatch();
+	EXPECT_EQ(log, (std::vector<unsigned>{0, 1, 0}));
+}
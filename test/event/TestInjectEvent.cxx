@@ -0,0 +1,161 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/InjectEvent.hxx"
+#include "event/Call.hxx"
+#include "event/Loop.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Counter {
+	EventLoop &loop;
+	InjectEvent event;
+
+	unsigned n = 0;
+
+	explicit Counter(EventLoop &_loop) noexcept
+		:loop(_loop), event(loop, BIND_THIS_METHOD(OnInject)) {}
+
+	void OnInject() noexcept {
+		++n;
+	}
+};
+
+} // anonymous namespace
+
+TEST(InjectEvent, SameThread)
+{
+	EventLoop loop;
+	Counter c(loop);
+
+	loop.LoopNonBlock();
+	EXPECT_EQ(c.n, 0U);
+
+	c.event.Schedule();
+	c.event.Schedule();
+	EXPECT_TRUE(c.event.IsPending());
+	loop.LoopNonBlock();
+	EXPECT_EQ(c.n, 1U);
+	EXPECT_FALSE(c.event.IsPending());
+
+	c.event.Schedule();
+	c.event.Cancel();
+	EXPECT_FALSE(c.event.IsPending());
+	loop.LoopNonBlock();
+	EXPECT_EQ(c.n, 1U);
+
+	/* revive a canceled event */
+	c.event.Schedule();
+	c.event.Cancel();
+	c.event.Schedule();
+	loop.LoopNonBlock();
+	EXPECT_EQ(c.n, 2U);
+}
+
+TEST(InjectEvent, DestroyPending)
+{
+	EventLoop loop;
+	Counter a(loop);
+
+	{
+		Counter b(loop);
+		a.event.Schedule();
+		b.event.Schedule();
+	}
+
+	loop.LoopNonBlock();
+	EXPECT_EQ(a.n, 1U);
+}
+
+TEST(InjectEvent, Threads)
+{
+	EventLoop loop;
+
+	constexpr unsigned N_THREADS = 4, N_CALLS = 1000;
+
+	unsigned n = 0;
+
+	/* this InjectEvent keeps the EventLoop alive until all
+	   threads are finished */
+	Counter keep_alive(loop);
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < N_THREADS; ++i)
+		threads.emplace_back([&]{
+			for (unsigned j = 0; j < N_CALLS; ++j)
+				BlockingCall(loop, [&]{ ++n; });
+		});
+
+	std::thread joiner([&]{
+		for (auto &t : threads)
+			t.join();
+		BlockingCall(loop, [&]{ loop.Break(); });
+	});
+
+	loop.Dispatch();
+	joiner.join();
+
+	EXPECT_EQ(n, N_THREADS * N_CALLS);
+}
+
+TEST(BlockingCall, Exception)
+{
+	EventLoop loop;
+
+	std::thread thread([&]{
+		EXPECT_THROW(BlockingCall(loop, []{
+			throw std::runtime_error("foo");
+		}), std::runtime_error);
+		BlockingCall(loop, [&]{ loop.Break(); });
+	});
+
+	Counter keep_alive(loop);
+	loop.Dispatch();
+	thread.join();
+}
+
+TEST(BlockingCall, Inside)
+{
+	EventLoop loop;
+	loop.LoopNonBlock();
+
+	unsigned n = 0;
+	BlockingCall(loop, [&]{ ++n; });
+	EXPECT_EQ(n, 1U);
+}
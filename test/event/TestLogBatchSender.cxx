@@ -0,0 +1,215 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/log/BatchSender.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/Parser.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <string.h>
+#include <sys/socket.h>
+
+using namespace Net::Log;
+
+/**
+ * Receive all pending datagrams and check their message.
+ *
+ * @return the number of datagrams
+ */
+static unsigned
+ReceiveAll(SocketDescriptor s, unsigned &next) noexcept
+{
+	unsigned n = 0;
+	char buffer[4096];
+	ssize_t nbytes;
+	while ((nbytes = recv(s.Get(), buffer, sizeof(buffer),
+			      MSG_DONTWAIT)) > 0) {
+		const auto d = ParseDatagram(ConstBuffer<void>{buffer, size_t(nbytes)});
+		EXPECT_EQ(std::string(d.message.data, d.message.size),
+			  std::to_string(next));
+		++next;
+		++n;
+	}
+
+	return n;
+}
+
+TEST(LogBatchSender, Basic)
+{
+	EventLoop event_loop;
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_DGRAM, 0,
+								       a, b));
+
+	BatchSender sender(event_loop, a, 4, 256);
+
+	/* three datagrams are sent at the end of the loop
+	   iteration */
+
+	unsigned sent = 0, received = 0;
+	for (unsigned i = 0; i < 3; ++i) {
+		const auto message = std::to_string(sent++);
+		Datagram d;
+		d.message = {message.data(), message.size()};
+		ASSERT_TRUE(sender.Send(d));
+	}
+
+	ASSERT_EQ(ReceiveAll(b, received), 0U);
+
+	event_loop.LoopNonBlock();
+	ASSERT_EQ(ReceiveAll(b, received), 3U);
+	ASSERT_EQ(sender.GetStats().sent, 3U);
+	ASSERT_EQ(sender.GetStats().syscalls, 1U);
+
+	/* a full queue is flushed immediately; the ring wraps
+	   around, so this needs two system calls */
+
+	for (unsigned i = 0; i < 4; ++i) {
+		const auto message = std::to_string(sent++);
+		Datagram d;
+		d.message = {message.data(), message.size()};
+		ASSERT_TRUE(sender.Send(d));
+	}
+
+	ASSERT_EQ(sender.GetQueueLength(), 0U);
+	ASSERT_EQ(ReceiveAll(b, received), 4U);
+	ASSERT_EQ(sender.GetStats().sent, 7U);
+	ASSERT_EQ(sender.GetStats().syscalls, 3U);
+
+	/* too large */
+
+	const std::string large(1000, 'x');
+	Datagram d;
+	d.message = {large.data(), large.size()};
+	ASSERT_FALSE(sender.Send(d));
+	ASSERT_EQ(sender.GetStats().too_large, 1U);
+}
+
+TEST(LogBatchSender, Congestion)
+{
+	EventLoop event_loop;
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_DGRAM, 0,
+								       a, b));
+
+	BatchSender sender(event_loop, a, 16, 256);
+
+	/* send until the receiver's queue is full */
+
+	unsigned sent = 0, received = 0;
+	while (!sender.IsCongested()) {
+		const auto message = std::to_string(sent++);
+		Datagram d;
+		d.message = {message.data(), message.size()};
+		ASSERT_TRUE(sender.Send(d));
+		event_loop.LoopNonBlock();
+		ASSERT_LT(sent, 100000U);
+	}
+
+	/* datagrams are still queued, but once the queue is full,
+	   new ones are discarded */
+
+	while (!sender.IsFull()) {
+		const auto message = std::to_string(sent++);
+		Datagram d;
+		d.message = {message.data(), message.size()};
+		ASSERT_TRUE(sender.Send(d));
+	}
+
+	Datagram d;
+	d.message = "dropped";
+	ASSERT_FALSE(sender.Send(d));
+	ASSERT_EQ(sender.GetStats().dropped, 1U);
+
+	/* the receiver catches up, and all queued datagrams are
+	   delivered in order */
+
+	while (received < sent) {
+		ReceiveAll(b, received);
+		event_loop.LoopOnceNonBlock();
+	}
+
+	ASSERT_EQ(received, sent);
+	ASSERT_FALSE(sender.IsCongested());
+	ASSERT_EQ(sender.GetQueueLength(), 0U);
+	ASSERT_EQ(sender.GetStats().sent, sent);
+	ASSERT_EQ(sender.GetStats().errors, 0U);
+}
+
+TEST(LogBatchSender, FlushOnDestruction)
+{
+	EventLoop event_loop;
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_DGRAM, 0,
+								       a, b));
+
+	unsigned sent = 0, received = 0;
+
+	{
+		BatchSender sender(event_loop, a, 4, 256);
+
+		for (unsigned i = 0; i < 3; ++i) {
+			const auto message = std::to_string(sent++);
+			Datagram d;
+			d.message = {message.data(), message.size()};
+			ASSERT_TRUE(sender.Send(d));
+		}
+
+		ASSERT_EQ(sender.GetQueueLength(), 3U);
+	}
+
+	/* the destructor has sent the queued datagrams without
+	   running the EventLoop */
+	ASSERT_EQ(ReceiveAll(b, received), 3U);
+}
+
+TEST(LogBatchSender, NoSlots)
+{
+	EventLoop event_loop;
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_DGRAM, 0,
+								       a, b));
+
+	ASSERT_THROW(BatchSender(event_loop, a, 0, 256),
+		     std::invalid_argument);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/net/log/Receiver.hxx"
+#include "event/Loop.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/Serializer.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+using namespace Net::Log;
+
+namespace {
+
+struct MyHandler final : ReceiverHandler {
+	std::vector<std::vector<std::string>> batches;
+
+	std::exception_ptr error;
+
+	bool OnLogDatagrams(ConstBuffer<Datagram> datagrams) noexcept override {
+		auto &batch = batches.emplace_back();
+		for (const auto &d : datagrams)
+			batch.emplace_back(d.message.data, d.message.size);
+		return true;
+	}
+
+	void OnLogReceiverError(std::exception_ptr ep) noexcept override {
+		error = std::move(ep);
+	}
+};
+
+}
+
+static void
+SendRaw(SocketDescriptor s, const void *data, std::size_t size) noexcept
+{
+	ASSERT_EQ(send(s.Get(), data, size, MSG_DONTWAIT), ssize_t(size));
+}
+
+static void
+SendMessage(SocketDescriptor s, const char *message) noexcept
+{
+	std::byte buffer[4096];
+	const std::size_t size = Serialize(buffer, sizeof(buffer),
+					   Datagram{message});
+	SendRaw(s, buffer, size);
+}
+
+TEST(LogReceiver, Batch)
+{
+	EventLoop event_loop;
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_DGRAM, 0,
+								       a, b));
+
+	MyHandler handler;
+	Receiver receiver(event_loop, std::move(b), handler, 4, 256);
+
+	SendMessage(a, "foo");
+	SendMessage(a, "bar");
+	SendMessage(a, "baz");
+
+	event_loop.LoopOnceNonBlock();
+
+	ASSERT_EQ(handler.batches.size(), 1U);
+	ASSERT_EQ(handler.batches[0],
+		  (std::vector<std::string>{"foo", "bar", "baz"}));
+	ASSERT_EQ(receiver.GetStats().received, 3U);
+	ASSERT_EQ(receiver.GetStats().batches, 1U);
+
+	/* more datagrams than fit into one batch */
+
+	for (unsigned i = 0; i < 6; ++i)
+		SendMessage(a, std::to_string(i).c_str());
+
+	ASSERT_EQ(receiver.ReceiveBatch(), 4U);
+	ASSERT_EQ(receiver.ReceiveBatch(), 2U);
+	ASSERT_EQ(receiver.ReceiveBatch(), 0U);
+
+	ASSERT_EQ(handler.batches.size(), 3U);
+	ASSERT_EQ(handler.batches[1].size(), 4U);
+	ASSERT_EQ(handler.batches[2],
+		  (std::vector<std::string>{"4", "5"}));
+	ASSERT_EQ(receiver.GetStats().received, 9U);
+	ASSERT_EQ(receiver.GetStats().batches, 3U);
+	ASSERT_FALSE(handler.error);
+}
+
+TEST(LogReceiver, Malformed)
+{
+	EventLoop event_loop;
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_DGRAM, 0,
+								       a, b));
+
+	MyHandler handler;
+	Receiver receiver(event_loop, std::move(b), handler, 8, 256);
+
+	SendMessage(a, "good");
+
+	/* bad CRC */
+	std::byte buffer[256];
+	std::size_t size = Serialize(buffer, sizeof(buffer),
+				     Datagram{"bad"});
+	buffer[size - 1] ^= std::byte{0xff};
+	SendRaw(a, buffer, size);
+
+	/* bad magic */
+	SendRaw(a, "garbage", 7);
+
+	/* too large */
+	const std::string large(1000, 'x');
+	SendMessage(a, large.c_str());
+
+	SendMessage(a, "also good");
+
+	ASSERT_EQ(receiver.ReceiveBatch(), 5U);
+
+	ASSERT_EQ(handler.batches.size(), 1U);
+	ASSERT_EQ(handler.batches[0],
+		  (std::vector<std::string>{"good", "also good"}));
+
+	ASSERT_EQ(receiver.GetStats().received, 2U);
+	ASSERT_EQ(receiver.GetStats().malformed, 2U);
+	ASSERT_EQ(receiver.GetStats().truncated, 1U);
+
+	/* a batch without valid datagrams does not invoke the
+	   handler */
+
+	SendRaw(a, "garbage", 7);
+	ASSERT_EQ(receiver.ReceiveBatch(), 1U);
+	ASSERT_EQ(handler.batches.size(), 1U);
+	ASSERT_EQ(receiver.GetStats().malformed, 3U);
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/LoopPool.hxx"
+#include "event/Call.hxx"
+#include "event/net/ShardedServerSocket.hxx"
+#include "event/net/ServerSocket.hxx"
+#include "net/IPv4Address.hxx"
+#include "net/SocketConfig.hxx"
+#include "net/StaticSocketAddress.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+
+TEST(EventLoopPool, Basic)
+{
+	EventLoopPool pool(3);
+	ASSERT_EQ(pool.size(), 3U);
+
+	pool.Start(false);
+
+	std::atomic_uint n{0};
+	for (std::size_t i = 0; i < pool.size(); ++i) {
+		auto &loop = pool.GetEventLoop(i);
+		BlockingCall(loop, [&]{
+			EXPECT_TRUE(loop.IsInside());
+			++n;
+		});
+	}
+
+	EXPECT_EQ(n, 3U);
+
+	/* the barrier returns only after all handlers have finished */
+	pool.Shutdown([&](EventLoop &loop){
+		EXPECT_TRUE(loop.IsInside());
+		++n;
+	});
+	EXPECT_EQ(n, 6U);
+
+	const auto stats = pool.GetStats();
+	ASSERT_EQ(stats.size(), 3U);
+	for (const auto &i : stats)
+		EXPECT_GE(i.inject_count, 2U);
+
+	pool.Stop();
+	EXPECT_FALSE(pool[0].IsRunning());
+}
+
+namespace {
+
+class CountingServerSocket final : public ServerSocket {
+	std::atomic_uint &n;
+
+	/**
+	 * If not nullptr, this counts destroyed instances.
+	 */
+	std::atomic_uint *const destroyed;
+
+public:
+	CountingServerSocket(EventLoop &event_loop,
+			     std::atomic_uint &_n,
+			     std::atomic_uint *_destroyed=nullptr) noexcept
+		:ServerSocket(event_loop), n(_n), destroyed(_destroyed) {}
+
+	~CountingServerSocket() noexcept override {
+		EXPECT_TRUE(GetEventLoop().IsInside());
+
+		if (destroyed != nullptr)
+			++*destroyed;
+	}
+
+protected:
+	void OnAccept(UniqueSocketDescriptor &&,
+		      SocketAddress) noexcept override {
+		++n;
+	}
+
+	void OnAcceptError(std::exception_ptr) noexcept override {
+	}
+};
+
+/**
+ * Create a #SocketConfig for a listener on a random loopback port.
+ */
+static SocketConfig
+MakeLoopbackConfig()
+{
+	SocketConfig config{IPv4Address(IPv4Address::Loopback(), 0)};
+	config.listen = 16;
+
+	/* bind all sockets to a random port: create the first one to
+	   find out which port the kernel has chosen */
+	UniqueSocketDescriptor probe = config.Create(SOCK_STREAM);
+	const auto port = probe.GetLocalAddress().GetPort();
+	probe.Close();
+
+	config.bind_address = IPv4Address(IPv4Address::Loopback(), port);
+	return config;
+}
+
+/**
+ * Connect to the given address several times and wait until all
+ * connections have been accepted.
+ */
+static void
+ConnectAndWait(SocketAddress address, const std::atomic_uint &n,
+	       unsigned n_connections)
+{
+	for (unsigned i = 0; i < n_connections; ++i) {
+		UniqueSocketDescriptor s;
+		ASSERT_TRUE(s.Create(AF_INET, SOCK_STREAM, 0));
+		ASSERT_TRUE(s.Connect(address));
+	}
+
+	for (unsigned i = 0; i < 1000 && n < n_connections; ++i)
+		usleep(1000);
+
+	EXPECT_EQ(n, n_connections);
+}
+
+} // anonymous namespace
+
+TEST(ShardedServerSocket, Basic)
+{
+	EventLoopPool pool(2);
+	pool.Start(false);
+
+	std::atomic_uint n{0};
+
+	ShardedServerSocket server(pool, [&n](EventLoop &loop){
+		return std::make_unique<CountingServerSocket>(loop, n);
+	});
+
+	const auto config = MakeLoopbackConfig();
+	server.Listen(config);
+
+	ConnectAndWait(config.bind_address, n, 16);
+
+	pool.Shutdown([&server](EventLoop &loop){
+		server.Close(loop);
+	});
+}
+
+TEST(ShardedServerSocket, CpuSteering)
+{
+	EventLoopPool pool(2);
+	pool.Start(true);
+
+	std::atomic_uint n{0};
+
+	ShardedServerSocket server(pool, [&n](EventLoop &loop){
+		return std::make_unique<CountingServerSocket>(loop, n);
+	});
+
+	/* the BPF program is attached to the SO_REUSEPORT group;
+	   connections are still accepted */
+	const auto config = MakeLoopbackConfig();
+	server.Listen(config, true);
+
+	ConnectAndWait(config.bind_address, n, 16);
+
+	pool.Shutdown([&server](EventLoop &loop){
+		server.Close(loop);
+	});
+}
+
+TEST(ShardedServerSocket, CpuSteeringUnpinned)
+{
+	EventLoopPool pool(2);
+	pool.Start(false);
+
+	std::atomic_uint n{0};
+
+	ShardedServerSocket server(pool, [&n](EventLoop &loop){
+		return std::make_unique<CountingServerSocket>(loop, n);
+	});
+
+	ASSERT_THROW(server.Listen(MakeLoopbackConfig(), true),
+		     std::runtime_error);
+}
+
+TEST(ShardedServerSocket, FactoryError)
+{
+	EventLoopPool pool(3);
+	pool.Start(false);
+
+	std::atomic_uint n{0}, created{0}, destroyed{0};
+
+	/* the second call fails; the first socket must be destroyed
+	   (inside its own thread, see ~CountingServerSocket()) */
+	const ShardedServerSocket::Factory factory = [&](EventLoop &loop){
+		if (++created == 2)
+			throw std::runtime_error("Factory failed");
+
+		return std::make_unique<CountingServerSocket>(loop, n,
+							      &destroyed);
+	};
+
+	ASSERT_THROW(ShardedServerSocket(pool, factory),
+		     std::runtime_error);
+
+	EXPECT_EQ(created, 2U);
+	EXPECT_EQ(destroyed, 1U);
+}
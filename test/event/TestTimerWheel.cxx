@@ -0,0 +1,145 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/TimerWheel.hxx"
+#include "event/CoarseTimerEvent.hxx"
+#include "event/Loop.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct Timer {
+	CoarseTimerEvent event;
+	const Event::TimePoint &now;
+	Event::TimePoint fired{};
+	unsigned n = 0;
+
+	Timer(EventLoop &loop, const Event::TimePoint &_now) noexcept
+		:event(loop, BIND_THIS_METHOD(OnTimer)), now(_now) {}
+
+	void OnTimer() noexcept {
+		fired = now;
+		++n;
+	}
+};
+
+} // anonymous namespace
+
+/**
+ * Simulate an #EventLoop which sleeps as long as the #TimerWheel
+ * asks it to.
+ */
+TEST(TimerWheel, Overflow)
+{
+	EventLoop loop;
+	TimerWheel wheel;
+
+	Event::TimePoint now = loop.SteadyNow();
+
+	static constexpr Event::Duration durations[] = {
+		5s, 90s, 5min, 30min, 3h, 23h, 30h,
+	};
+
+	std::vector<std::unique_ptr<Timer>> timers;
+	for (const auto d : durations) {
+		auto &t = *timers.emplace_back(std::make_unique<Timer>(loop, now));
+
+		/* calculate the due time with the EventLoop, but
+		   insert into our own TimerWheel */
+		t.event.Schedule(d);
+		t.event.Cancel();
+		wheel.Insert(t.event, now);
+	}
+
+	EXPECT_FALSE(wheel.IsEmpty());
+
+	unsigned n_wakeups = 0;
+	while (true) {
+		bool invoked = false;
+		const auto sleep = wheel.Run(now, invoked);
+		if (sleep.count() < 0)
+			break;
+
+		now += sleep;
+		++n_wakeups;
+	}
+
+	EXPECT_TRUE(wheel.IsEmpty());
+
+	for (const auto &i : timers) {
+		EXPECT_EQ(i->n, 1U);
+		EXPECT_GE(i->fired, i->event.GetDue());
+		EXPECT_LE(i->fired, i->event.GetDue() + 1s);
+	}
+
+	/* far timers are not re-checked every second or every
+	   bucket round, only when their overflow bucket gets
+	   cascaded */
+	EXPECT_LT(n_wakeups, 100U);
+}
+
+TEST(TimerWheel, Cancel)
+{
+	EventLoop loop;
+	TimerWheel wheel;
+
+	Event::TimePoint now = loop.SteadyNow();
+
+	Timer a(loop, now), b(loop, now);
+	a.event.Schedule(10min);
+	a.event.Cancel();
+	wheel.Insert(a.event, now);
+	b.event.Schedule(10s);
+	b.event.Cancel();
+	wheel.Insert(b.event, now);
+
+	a.event.Cancel();
+	EXPECT_FALSE(wheel.IsEmpty());
+
+	/* the canceled far timer doesn't cause a wakeup */
+	bool invoked = false;
+	auto sleep = wheel.Run(now, invoked);
+	EXPECT_LE(sleep, 11s);
+
+	now += sleep;
+	sleep = wheel.Run(now, invoked);
+	EXPECT_TRUE(invoked);
+	EXPECT_EQ(b.n, 1U);
+	EXPECT_LT(sleep.count(), 0);
+	EXPECT_TRUE(wheel.IsEmpty());
+}
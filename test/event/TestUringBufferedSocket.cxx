@@ -0,0 +1,194 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/Loop.hxx"
+#include "event/net/BufferedSocket.hxx"
+#include "io/uring/BufferRing.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <sys/socket.h>
+
+namespace {
+
+struct Handler final : BufferedSocketHandler {
+	BufferedSocket socket;
+
+	std::string received;
+
+	std::exception_ptr error;
+
+	unsigned n_write = 0;
+
+	bool closed = false, ended = false;
+
+	explicit Handler(EventLoop &loop) noexcept
+		:socket(loop) {}
+
+	~Handler() noexcept {
+		if (socket.IsValid()) {
+			if (socket.IsConnected())
+				socket.Close();
+			socket.Destroy();
+		}
+	}
+
+	/* virtual methods from class BufferedSocketHandler */
+	BufferedResult OnBufferedData() override {
+		auto r = socket.ReadBuffer();
+		received.append((const char *)r.data, r.size);
+		socket.DisposeConsumed(r.size);
+		return BufferedResult::OK;
+	}
+
+	bool OnBufferedClosed() noexcept override {
+		closed = true;
+		socket.Close();
+		return true;
+	}
+
+	bool OnBufferedEnd() noexcept override {
+		ended = true;
+		return true;
+	}
+
+	bool OnBufferedWrite() override {
+		++n_write;
+		socket.UnscheduleWrite();
+		return true;
+	}
+
+	void OnBufferedError(std::exception_ptr e) noexcept override {
+		error = std::move(e);
+	}
+};
+
+} // anonymous namespace
+
+TEST(UringBufferedSocket, Basic)
+{
+	EventLoop loop;
+	try {
+		loop.EnableUring(64, 0);
+	} catch (...) {
+		GTEST_SKIP() << "io_uring not available";
+	}
+
+	auto &queue = *loop.GetUring();
+
+	std::unique_ptr<Uring::BufferRing> buffers;
+	try {
+		/* few small buffers, to exercise buffer recycling and
+		   ENOBUFS */
+		buffers = std::make_unique<Uring::BufferRing>(queue, 1, 4, 1024);
+	} catch (...) {
+		GTEST_SKIP() << "provided buffer rings not available";
+	}
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_STREAM, 0,
+								     a, b));
+
+	Handler handler(loop);
+	handler.socket.Init(a.Release(), FdType::FD_SOCKET,
+			    Event::Duration(-1), Event::Duration(-1),
+			    handler);
+	handler.socket.EnableUring(queue, *buffers);
+
+	/* direct transfers are not available in io_uring mode */
+	handler.socket.SetDirect(true);
+
+	handler.socket.ScheduleReadNoTimeout(false);
+
+	/* receive */
+	ASSERT_EQ(b.Write("hello", 5), 5);
+	while (handler.received.size() < 5 && !handler.error)
+		loop.LoopOnce();
+	EXPECT_FALSE(handler.error);
+	EXPECT_EQ(handler.received, "hello");
+
+	/* send */
+	EXPECT_EQ(handler.socket.Write("world", 5), 5);
+
+	/* the send buffer is occupied until the send operation
+	   completes */
+	EXPECT_FALSE(handler.socket.IsReadyForWriting());
+	EXPECT_EQ(handler.socket.Write("x", 1), WRITE_BLOCKING);
+
+	while (handler.n_write == 0)
+		loop.LoopOnce();
+	EXPECT_TRUE(handler.socket.IsReadyForWriting());
+
+	char buffer[64];
+	ASSERT_EQ(b.Read(buffer, sizeof(buffer)), 5);
+	EXPECT_EQ(std::string_view(buffer, 5), "world");
+
+	/* more data than fits into the buffer ring */
+	handler.received.clear();
+	std::string expected;
+	for (unsigned i = 0; i < 64; ++i) {
+		char line[64];
+		int length = snprintf(line, sizeof(line), "line %u\n", i);
+		expected.append(line, length);
+	}
+
+	for (std::size_t position = 0; position < expected.size();) {
+		auto nbytes = b.Write(expected.data() + position,
+				      std::min<std::size_t>(expected.size() - position, 700));
+		ASSERT_GT(nbytes, 0);
+		position += nbytes;
+		loop.LoopOnceNonBlock();
+	}
+
+	while (handler.received.size() < expected.size() && !handler.error)
+		loop.LoopOnce();
+	EXPECT_FALSE(handler.error);
+	EXPECT_EQ(handler.received, expected);
+
+	/* end of stream */
+	b.Close();
+	while (!handler.ended && !handler.error)
+		loop.LoopOnce();
+	EXPECT_TRUE(handler.closed);
+	EXPECT_TRUE(handler.ended);
+
+	handler.socket.Destroy();
+
+	/* the UringSocket has been freed after its last
+	   completion */
+	loop.Dispatch();
+	EXPECT_TRUE(loop.IsEmpty());
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event/Loop.hxx"
+#include "event/SocketEvent.hxx"
+#include "event/FineTimerEvent.hxx"
+#include "event/InjectEvent.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include <sys/socket.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct Reader {
+	SocketEvent event;
+
+	unsigned n = 0;
+	unsigned last_events = 0;
+
+	bool consume = true;
+
+	Reader(EventLoop &loop, SocketDescriptor fd) noexcept
+		:event(loop, BIND_THIS_METHOD(OnSocketReady), fd) {}
+
+	void OnSocketReady(unsigned events) noexcept {
+		++n;
+		last_events = events;
+
+		if (consume) {
+			char buffer[64];
+			[[maybe_unused]] auto nbytes =
+				event.GetSocket().Read(buffer, sizeof(buffer));
+		}
+
+		if (events & SocketEvent::HANGUP)
+			event.Cancel();
+	}
+};
+
+struct Counter {
+	FineTimerEvent timer;
+	InjectEvent inject;
+
+	unsigned n_timer = 0, n_inject = 0;
+
+	explicit Counter(EventLoop &loop) noexcept
+		:timer(loop, BIND_THIS_METHOD(OnTimer)),
+		 inject(loop, BIND_THIS_METHOD(OnInject)) {}
+
+	void OnTimer() noexcept {
+		++n_timer;
+	}
+
+	void OnInject() noexcept {
+		++n_inject;
+	}
+};
+
+static void
+EnableUringOrSkip(EventLoop &loop)
+{
+	try {
+		loop.EnableUring(64, 0);
+	} catch (...) {
+		/* the kernel does not support io_uring */
+	}
+}
+
+} // anonymous namespace
+
+TEST(UringLoop, Socket)
+{
+	EventLoop loop;
+	EnableUringOrSkip(loop);
+	if (loop.GetUring() == nullptr)
+		GTEST_SKIP();
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_STREAM, 0,
+								     a, b));
+
+	Reader reader(loop, a);
+	reader.event.ScheduleRead();
+
+	/* nothing to read yet */
+	loop.LoopNonBlock();
+	EXPECT_EQ(reader.n, 0U);
+
+	ASSERT_EQ(b.Write("x", 1), 1);
+	loop.LoopOnce();
+	EXPECT_EQ(reader.n, 1U);
+	EXPECT_EQ(reader.last_events, unsigned(SocketEvent::READ));
+
+	/* level-triggered: the unconsumed data is reported again */
+	reader.consume = false;
+	ASSERT_EQ(b.Write("y", 1), 1);
+	loop.LoopOnce();
+	EXPECT_EQ(reader.n, 2U);
+	loop.LoopOnce();
+	EXPECT_EQ(reader.n, 3U);
+
+	/* switch to WRITE while a poll is pending */
+	reader.consume = true;
+	loop.LoopOnce();
+	EXPECT_EQ(reader.n, 4U);
+	reader.event.Schedule(SocketEvent::WRITE);
+	loop.LoopOnce();
+	EXPECT_EQ(reader.n, 5U);
+	EXPECT_EQ(reader.last_events, unsigned(SocketEvent::WRITE));
+
+	reader.event.Schedule(SocketEvent::READ);
+	b.Close();
+	loop.Dispatch();
+	EXPECT_TRUE(reader.last_events & SocketEvent::HANGUP);
+	EXPECT_FALSE(reader.event.IsReadPending());
+	EXPECT_TRUE(loop.IsEmpty());
+}
+
+TEST(UringLoop, Cancel)
+{
+	EventLoop loop;
+	EnableUringOrSkip(loop);
+	if (loop.GetUring() == nullptr)
+		GTEST_SKIP();
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPairNonBlock(AF_LOCAL, SOCK_STREAM, 0,
+								     a, b));
+
+	{
+		Reader reader(loop, a);
+		reader.event.ScheduleRead();
+		loop.LoopNonBlock();
+		EXPECT_FALSE(loop.IsEmpty());
+
+		/* destroy while the poll is pending */
+	}
+
+	/* the ASYNC_CANCEL completes in the next iteration */
+	loop.Dispatch();
+	EXPECT_TRUE(loop.IsEmpty());
+}
+
+TEST(UringLoop, TimerAndInject)
+{
+	EventLoop loop;
+	EnableUringOrSkip(loop);
+	if (loop.GetUring() == nullptr)
+		GTEST_SKIP();
+
+	Counter c(loop);
+
+	/* blocks in io_uring_enter() until the timer expires */
+	c.timer.Schedule(10ms);
+	while (c.n_timer == 0)
+		loop.LoopOnce();
+
+	std::thread thread([&c]{
+		std::this_thread::sleep_for(10ms);
+		c.inject.Schedule();
+	});
+
+	/* blocks in io_uring_enter() until the InjectEvent wakes
+	   it up */
+	while (c.n_inject == 0)
+		loop.LoopOnce();
+
+	thread.join();
+	EXPECT_EQ(c.n_timer, 1U);
+	EXPECT_EQ(c.n_inject, 1U);
+}
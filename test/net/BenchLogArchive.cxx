@@ -0,0 +1,154 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares the columnar log archive format with one-line text logs
+ * (FormatOneLine()): file size, write speed and the speed of
+ * scanning a single column.
+ */
+
+#include "GenerateDatagrams.hxx"
+#include "net/log/archive/Writer.hxx"
+#include "net/log/archive/Reader.hxx"
+#include "net/log/Datagram.hxx"
+#include "net/log/OneLine.hxx"
+#include "io/StringOutputStream.hxx"
+#include "util/PrintException.hxx"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using std::chrono::steady_clock;
+
+static constexpr std::size_t N_RECORDS = 1000000;
+
+static double
+Seconds(steady_clock::time_point start) noexcept
+{
+	const std::chrono::duration<double> d = steady_clock::now() - start;
+	return d.count();
+}
+
+int
+main(int, char **) noexcept
+try {
+	std::vector<std::string> strings;
+	const auto v = GenerateDatagrams(N_RECORDS, strings);
+
+	/* text */
+
+	auto start = steady_clock::now();
+
+	std::string text;
+	for (const auto &d : v) {
+		char buffer[4096];
+		char *end = FormatOneLine(buffer, sizeof(buffer) - 1, d, true);
+		*end++ = '\n';
+		text.append(buffer, end);
+	}
+
+	const double text_write = Seconds(start);
+
+	start = steady_clock::now();
+
+	std::size_t text_404 = 0;
+	for (std::size_t i = 0; (i = text.find("\" 404 ", i)) != text.npos; ++i)
+		++text_404;
+
+	const double text_scan = Seconds(start);
+
+	/* archive */
+
+	start = steady_clock::now();
+
+	StringOutputStream os;
+	Net::Log::Archive::Writer writer(os);
+	for (const auto &d : v)
+		writer.Append(d);
+	writer.Flush();
+
+	const double archive_write = Seconds(start);
+	const auto &archive = os.GetValue();
+
+	start = steady_clock::now();
+
+	std::size_t archive_404 = 0;
+	{
+		Net::Log::Archive::Reader reader({archive.data(), archive.size()});
+		Net::Log::Archive::Block block;
+		while (reader.ReadBlock(block)) {
+			auto status = block.ReadIntegers(Net::Log::Archive::Column::HTTP_STATUS);
+			for (std::size_t i = 0; i < block.size(); ++i) {
+				uint64_t value;
+				if (status.Next(value) && value == HTTP_STATUS_NOT_FOUND)
+					++archive_404;
+			}
+		}
+	}
+
+	const double archive_scan = Seconds(start);
+
+	start = steady_clock::now();
+
+	std::size_t n_decoded = 0;
+	{
+		Net::Log::Archive::Reader reader({archive.data(), archive.size()});
+		Net::Log::Archive::Block block;
+		std::vector<Net::Log::Datagram> decoded;
+		while (reader.ReadBlock(block)) {
+			block.ToDatagrams(decoded);
+			n_decoded += decoded.size();
+		}
+	}
+
+	const double archive_decode = Seconds(start);
+
+	if (text_404 != archive_404 || n_decoded != v.size())
+		abort();
+
+	printf("%zu records\n\n", v.size());
+	printf("%-8s %12s %14s %14s %14s\n",
+	       "", "bytes", "write (rec/s)", "scan (rec/s)", "decode (rec/s)");
+	printf("%-8s %12zu %14.0f %14.0f %14s\n", "text",
+	       text.size(), v.size() / text_write, v.size() / text_scan, "-");
+	printf("%-8s %12zu %14.0f %14.0f %14.0f\n", "archive",
+	       archive.size(), v.size() / archive_write,
+	       v.size() / archive_scan, v.size() / archive_decode);
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
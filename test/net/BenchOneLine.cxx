@@ -0,0 +1,122 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark for one-line log formatting: LogOneLine()
+ * (one write() per line) compared with #OneLineFormatter (cached
+ * timestamps, one write() per batch).
+ */
+
+#include "GenerateDatagrams.hxx"
+#include "net/log/OneLine.hxx"
+#include "net/log/Datagram.hxx"
+#include "io/Open.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/ConstBuffer.hxx"
+#include "util/PrintException.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using std::chrono::steady_clock;
+
+static constexpr std::size_t N_RECORDS = 1000000;
+static constexpr std::size_t BATCH_SIZE = 256;
+
+/**
+ * @return lines per second
+ */
+template<typename F>
+static double
+Run(F &&f)
+{
+	const auto start = steady_clock::now();
+	f();
+	const std::chrono::duration<double> d = steady_clock::now() - start;
+	return N_RECORDS / d.count();
+}
+
+int
+main(int, char **) noexcept
+try {
+	std::vector<std::string> strings;
+	const auto v = GenerateDatagrams(N_RECORDS, strings);
+
+	const auto fd = OpenWriteOnly("/dev/null");
+
+	const double format_rate = Run([&v]{
+		for (const auto &d : v) {
+			char buffer[16384];
+			if (FormatOneLine(buffer, sizeof(buffer), d, true) == buffer)
+				abort();
+		}
+	});
+
+	const double formatter_rate = Run([&v]{
+		OneLineFormatter formatter;
+		for (const auto &d : v) {
+			char buffer[16384];
+			if (formatter.Format(buffer, sizeof(buffer), d) == buffer)
+				abort();
+		}
+	});
+
+	const double log_rate = Run([&v, &fd]{
+		for (const auto &d : v)
+			if (!LogOneLine(fd, d))
+				abort();
+	});
+
+	const double batch_rate = Run([&v, &fd]{
+		OneLineFormatter formatter;
+		for (std::size_t i = 0; i < v.size(); i += BATCH_SIZE) {
+			const std::size_t n = std::min(BATCH_SIZE, v.size() - i);
+			if (!formatter.Write(fd, {v.data() + i, n}))
+				abort();
+		}
+	});
+
+	printf("%-40s %12s\n", "", "lines/s");
+	printf("%-40s %12.0f\n", "FormatOneLine()", format_rate);
+	printf("%-40s %12.0f\n", "OneLineFormatter::Format()", formatter_rate);
+	printf("%-40s %12.0f\n", "LogOneLine() to /dev/null", log_rate);
+	printf("%-40s %12.0f\n", "OneLineFormatter::Write() to /dev/null", batch_rate);
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
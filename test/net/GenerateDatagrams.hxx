@@ -0,0 +1,101 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "net/log/Datagram.hxx"
+
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Generate records which look like a typical access log: few
+ * hosts, sites and user agents, many different URIs, and increasing
+ * timestamps (about 1000 records per second).  This is used by the
+ * log benchmarks.
+ *
+ * @param strings the storage for generated strings which are
+ * referenced by the returned records
+ */
+inline std::vector<Net::Log::Datagram>
+GenerateDatagrams(std::size_t n, std::vector<std::string> &strings)
+{
+	std::minstd_rand r;
+
+	static constexpr const char *hosts[] = {
+		"www.example.com", "example.com", "cdn.example.com",
+		"shop.example.org", "api.example.net",
+	};
+
+	static constexpr const char *user_agents[] = {
+		"Mozilla/5.0 (X11; Linux x86_64; rv:91.0) Gecko/20100101 Firefox/91.0",
+		"Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/94.0.4606.71 Safari/537.36",
+		"Mozilla/5.0 (iPhone; CPU iPhone OS 15_0 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/15.0 Mobile/15E148 Safari/604.1",
+		"curl/7.79.1",
+	};
+
+	/* all strings are allocated first, because the vector must
+	   not be reallocated after pointers have been taken */
+	strings.clear();
+	strings.reserve(n * 2);
+
+	std::vector<Net::Log::Datagram> v;
+	v.reserve(n);
+
+	auto timestamp = Net::Log::FromSystem(std::chrono::system_clock::now());
+
+	for (std::size_t i = 0; i < n; ++i) {
+		timestamp += Net::Log::Duration(r() % 2000);
+
+		strings.emplace_back("/articles/" + std::to_string(r() % 100000) + ".html");
+		const char *uri = strings.back().c_str();
+
+		strings.emplace_back("198.51.100." + std::to_string(r() % 256));
+		const char *remote_host = strings.back().c_str();
+
+		const char *host = hosts[r() % std::size(hosts)];
+
+		v.emplace_back(timestamp, HTTP_METHOD_GET, uri, remote_host,
+			       host, host, nullptr,
+			       user_agents[r() % std::size(user_agents)],
+			       r() % 20 == 0 ? HTTP_STATUS_NOT_FOUND : HTTP_STATUS_OK,
+			       int64_t(r() % 100000), 500, r() % 100000 + 300,
+			       Net::Log::Duration(r() % 100000));
+		v.back().type = Net::Log::Type::HTTP_ACCESS;
+	}
+
+	return v;
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/archive/Writer.hxx"
+#include "net/log/archive/Reader.hxx"
+#include "net/log/Datagram.hxx"
+#include "io/StringOutputStream.hxx"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+using namespace Net::Log;
+
+static bool
+StringAttributeEquals(const char *a, const char *b) noexcept
+{
+	return a == nullptr
+		? b == nullptr
+		: strcmp(a, b) == 0;
+}
+
+static bool
+StringAttributeEquals(StringView a, StringView b) noexcept
+{
+	return a == nullptr
+		? b == nullptr
+		: (a.size == b.size &&
+		   memcmp(a.data, b.data, a.size) == 0);
+}
+
+static bool
+operator==(const Datagram &a, const Datagram &b) noexcept
+{
+	return a.timestamp == b.timestamp &&
+		StringAttributeEquals(a.remote_host, b.remote_host) &&
+		StringAttributeEquals(a.host, b.host) &&
+		StringAttributeEquals(a.site, b.site) &&
+		StringAttributeEquals(a.forwarded_to, b.forwarded_to) &&
+		StringAttributeEquals(a.http_uri, b.http_uri) &&
+		StringAttributeEquals(a.http_referer, b.http_referer) &&
+		StringAttributeEquals(a.user_agent, b.user_agent) &&
+		StringAttributeEquals(a.message, b.message) &&
+		a.valid_length == b.valid_length &&
+		(!a.valid_length || a.length == b.length) &&
+		a.valid_traffic == b.valid_traffic &&
+		(!a.valid_traffic ||
+		 (a.traffic_received == b.traffic_received &&
+		  a.traffic_sent == b.traffic_sent)) &&
+		a.valid_duration == b.valid_duration &&
+		(!a.valid_duration || a.duration == b.duration) &&
+		a.http_method == b.http_method &&
+		a.http_status == b.http_status &&
+		a.type == b.type;
+}
+
+static std::vector<Datagram>
+MakeDatagrams(std::size_t n) noexcept
+{
+	static constexpr const char *hosts[] = {
+		"www.example.com", "example.org", "foo.example.net",
+	};
+
+	std::vector<Datagram> v;
+	v.reserve(n);
+
+	for (std::size_t i = 0; i < n; ++i) {
+		if (i % 7 == 3) {
+			/* an error log record without most attributes */
+			Datagram d{"something went wrong"};
+			d.type = Type::HTTP_ERROR;
+			v.push_back(d);
+			continue;
+		}
+
+		Datagram d(TimePoint(Duration(1600000000000000 + i * 1234)),
+			   i % 5 == 0 ? HTTP_METHOD_POST : HTTP_METHOD_GET,
+			   "/index.html",
+			   "192.0.2.1",
+			   hosts[i % std::size(hosts)], "site",
+			   i % 2 == 0 ? "http://example.com/" : nullptr,
+			   "Mozilla/5.0",
+			   i % 3 == 0 ? HTTP_STATUS_NOT_FOUND : HTTP_STATUS_OK,
+			   i % 11 == 0 ? -1 : int64_t(i * 100),
+			   i, i * 2,
+			   Duration(1000 - i % 500));
+		d.type = Type::HTTP_ACCESS;
+		v.push_back(d);
+	}
+
+	return v;
+}
+
+static std::string
+Write(const std::vector<Datagram> &v,
+      const Archive::WriterOptions &options)
+{
+	StringOutputStream os;
+	Archive::Writer writer(os, options);
+	for (const auto &d : v)
+		writer.Append(d);
+	writer.Flush();
+	return std::move(os).GetValue();
+}
+
+/**
+ * Read all blocks and compare them with the given records.
+ */
+static void
+Verify(const std::string &file, const std::vector<Datagram> &v)
+{
+	Archive::Reader reader({file.data(), file.size()});
+	Archive::Block block;
+
+	std::vector<Datagram> result;
+	std::size_t n = 0;
+
+	while (reader.ReadBlock(block)) {
+		/* the pointers are only valid until the next block
+		   is read, so compare now */
+		block.ToDatagrams(result);
+		for (const auto &d : result) {
+			ASSERT_LT(n, v.size());
+			ASSERT_TRUE(d == v[n]) << "record " << n;
+			++n;
+		}
+	}
+
+	ASSERT_EQ(n, v.size());
+}
+
+TEST(LogArchive, RoundTrip)
+{
+	const auto v = MakeDatagrams(1000);
+
+	for (int level : {0, 6}) {
+		Archive::WriterOptions options;
+		options.records_per_block = 128;
+		options.compression_level = level;
+
+		Verify(Write(v, options), v);
+	}
+}
+
+TEST(LogArchive, Empty)
+{
+	const auto file = Write({}, {});
+	ASSERT_EQ(file.size(), Archive::FILE_HEADER_SIZE);
+
+	Archive::Reader reader({file.data(), file.size()});
+	Archive::Block block;
+	ASSERT_FALSE(reader.ReadBlock(block));
+}
+
+TEST(LogArchive, SingleColumn)
+{
+	const auto v = MakeDatagrams(1000);
+	const auto file = Write(v, {});
+
+	Archive::Reader reader({file.data(), file.size()});
+	Archive::Block block;
+	ASSERT_TRUE(reader.ReadBlock(block));
+	ASSERT_EQ(block.size(), v.size());
+
+	/* the "message" column is only present in error records */
+	ASSERT_TRUE(block.HasColumn(Archive::Column::MESSAGE));
+	ASSERT_TRUE(block.HasColumn(Archive::Column::HOST));
+	ASSERT_FALSE(block.HasColumn(Archive::Column::FORWARDED_TO));
+
+	auto status = block.ReadIntegers(Archive::Column::HTTP_STATUS);
+	auto host = block.ReadStrings(Archive::Column::HOST);
+	for (const auto &d : v) {
+		uint64_t value;
+		ASSERT_EQ(status.Next(value), d.HasHttpStatus());
+		if (d.HasHttpStatus()) {
+			ASSERT_EQ(value, uint64_t(d.http_status));
+		}
+
+		ASSERT_TRUE(StringAttributeEquals(host.Next().data, d.host));
+	}
+
+	/* absent column */
+	auto forwarded_to = block.ReadStrings(Archive::Column::FORWARDED_TO);
+	ASSERT_TRUE(forwarded_to.Next().IsNull());
+
+	/* wrong column type */
+	ASSERT_THROW(block.ReadIntegers(Archive::Column::HOST),
+		     Archive::FormatError);
+
+	ASSERT_FALSE(reader.ReadBlock(block));
+}
+
+TEST(LogArchive, Compression)
+{
+	const auto v = MakeDatagrams(4096);
+
+	Archive::WriterOptions options;
+	options.compression_level = 0;
+	const auto uncompressed = Write(v, options);
+
+	options.compression_level = 6;
+	const auto compressed = Write(v, options);
+
+	/* dictionary and delta encoding are effective without
+	   compression */
+	ASSERT_LT(uncompressed.size(), v.size() * 64);
+	ASSERT_LT(compressed.size(), uncompressed.size() / 4);
+}
+
+TEST(LogArchive, InvalidOptions)
+{
+	StringOutputStream os;
+
+	Archive::WriterOptions options;
+	options.records_per_block = Archive::MAX_BLOCK_RECORDS + 1;
+	ASSERT_THROW(Archive::Writer(os, options), std::invalid_argument);
+
+	options.records_per_block = 0;
+	ASSERT_THROW(Archive::Writer(os, options), std::invalid_argument);
+}
+
+TEST(LogArchive, Corrupt)
+{
+	const auto v = MakeDatagrams(100);
+	auto file = Write(v, {});
+
+	/* flip a bit in the last column's data */
+	file.back() ^= 1;
+
+	Archive::Reader reader({file.data(), file.size()});
+	Archive::Block block;
+	ASSERT_TRUE(reader.ReadBlock(block));
+
+	/* other columns are still readable */
+	block.ReadStrings(Archive::Column::HOST);
+
+	ASSERT_THROW(block.ReadIntegers(Archive::Column::TYPE),
+		     Archive::FormatError);
+
+	/* truncated file */
+	file.resize(file.size() - 1);
+	Archive::Reader reader2({file.data(), file.size()});
+	ASSERT_THROW(reader2.ReadBlock(block), Archive::FormatError);
+
+	ASSERT_THROW(Archive::Reader({"garbage", 7}), Archive::FormatError);
+}
+
+TEST(LogArchive, HugeSizes)
+{
+	const auto v = MakeDatagrams(1000);
+	const auto original = Write(v, {});
+
+	constexpr std::size_t block_header = Archive::FILE_HEADER_SIZE;
+	constexpr std::size_t directory = block_header +
+		Archive::BLOCK_HEADER_SIZE;
+
+	Archive::Block block;
+	std::vector<Datagram> result;
+
+	/* a bogus number of records must not be allocated */
+	auto file = original;
+	memset(file.data() + block_header + 4, 0xff, 4);
+	Archive::Reader reader({file.data(), file.size()});
+	ASSERT_THROW(reader.ReadBlock(block), Archive::FormatError);
+
+	/* neither a bogus decompressed column size */
+	file = original;
+	const std::size_t n_columns = (uint8_t)file[block_header + 8];
+	char *h = file.data() + directory;
+	for (std::size_t i = 0;
+	     Archive::Compression(h[2]) != Archive::Compression::ZLIB;
+	     ++i, h += Archive::COLUMN_HEADER_SIZE)
+		ASSERT_LT(i + 1, n_columns);
+
+	memset(h + 8, 0xff, 4);
+
+	Archive::Reader reader2({file.data(), file.size()});
+	ASSERT_TRUE(reader2.ReadBlock(block));
+	ASSERT_THROW(block.ToDatagrams(result), Archive::FormatError);
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "net/log/OneLine.hxx"
+#include "net/log/Timestamp.hxx"
+#include "net/log/Datagram.hxx"
+#include "io/FileDescriptor.hxx"
+#include "util/ConstBuffer.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Temporarily switch to another time zone.
+ */
+class ScopeTimeZone {
+	std::string old;
+	bool had_old;
+
+public:
+	explicit ScopeTimeZone(const char *tz) noexcept {
+		const char *p = getenv("TZ");
+		had_old = p != nullptr;
+		if (had_old)
+			old = p;
+
+		setenv("TZ", tz, 1);
+		tzset();
+	}
+
+	~ScopeTimeZone() noexcept {
+		if (had_old)
+			setenv("TZ", old.c_str(), 1);
+		else
+			unsetenv("TZ");
+		tzset();
+	}
+};
+
+static std::string
+Strftime(time_t t) noexcept
+{
+	struct tm tm;
+	char buffer[64];
+	std::size_t n = strftime(buffer, sizeof(buffer),
+				 "%d/%b/%Y:%H:%M:%S %z",
+				 localtime_r(&t, &tm));
+	return {buffer, n};
+}
+
+/* POSIX TZ strings don't need the time zone database; the last one
+   has a DST transition at half past the (UTC) hour */
+static constexpr const char *time_zones[] = {
+	"UTC0",
+	"CET-1CEST,M3.5.0,M10.5.0/3",
+	"PST8PDT,M3.2.0,M11.1.0",
+	"NST3:30NDT,M3.2.0,M11.1.0",
+};
+
+TEST(OneLine, FormatTimestamp)
+{
+	for (const char *tz : time_zones) {
+		const ScopeTimeZone stz(tz);
+
+		for (time_t t = 1600000000; t < 1600000000 + 366 * 86400;
+		     t += 86400 / 3 + 7) {
+			char buffer[Net::Log::TIMESTAMP_LENGTH];
+			Net::Log::FormatTimestamp(buffer, t);
+			ASSERT_EQ(std::string(buffer, sizeof(buffer)),
+				  Strftime(t)) << tz;
+		}
+	}
+}
+
+TEST(OneLine, TimestampCache)
+{
+	for (const char *tz : time_zones) {
+		const ScopeTimeZone stz(tz);
+
+		Net::Log::TimestampCache cache;
+
+		/* a whole year in steps of 7 minutes and 13 seconds,
+		   plus a few seconds after each step (which hit the
+		   cache); this crosses all DST transitions */
+		for (time_t t = 1600000000; t < 1600000000 + 366 * 86400;
+		     t += 433) {
+			for (time_t i = t; i < t + 3; ++i) {
+				const char *s = cache.Format(i);
+				ASSERT_EQ(std::string(s, Net::Log::TIMESTAMP_LENGTH),
+					  Strftime(i)) << tz;
+			}
+		}
+	}
+}
+
+static Net::Log::Datagram
+MakeHttpDatagram(uint64_t i) noexcept
+{
+	Net::Log::Datagram d(Net::Log::TimePoint(std::chrono::seconds(1600000000 + i)),
+			     HTTP_METHOD_GET, "/foo\"bar",
+			     "192.0.2.42", "example.com", "site",
+			     "http://example.com/", "Mozilla/5.0",
+			     HTTP_STATUS_OK, i * 1000,
+			     100, 200,
+			     Net::Log::Duration(i * 12345));
+	d.type = Net::Log::Type::HTTP_ACCESS;
+	return d;
+}
+
+TEST(OneLine, Http)
+{
+	const ScopeTimeZone stz("CET-1CEST,M3.5.0,M10.5.0/3");
+
+	const auto d = MakeHttpDatagram(0);
+
+	char buffer[1024];
+	char *end = FormatOneLine(buffer, sizeof(buffer), d, true);
+	ASSERT_EQ(std::string(buffer, end),
+		  "site 192.0.2.42 - - [13/Sep/2020:14:26:40 +0200] "
+		  "\"GET /foo\\x22bar HTTP/1.1\" 200 0 "
+		  "\"http://example.com/\" \"Mozilla/5.0\" 0");
+
+	auto d2 = MakeHttpDatagram(1);
+	d2.valid_length = false;
+	d2.valid_duration = false;
+	d2.user_agent = nullptr;
+	end = FormatOneLine(buffer, sizeof(buffer), d2, false, true);
+	ASSERT_EQ(std::string(buffer, end),
+		  "192.0.2.0 - - [13/Sep/2020:14:26:41 +0200] "
+		  "\"GET /foo\\x22bar HTTP/1.1\" 200 - "
+		  "\"http://example.com/\" \"-\" -");
+
+	/* too small */
+	ASSERT_EQ(FormatOneLine(buffer, 32, d, true), buffer);
+}
+
+TEST(OneLine, Formatter)
+{
+	std::vector<Net::Log::Datagram> v;
+	for (unsigned i = 0; i < 1000; ++i)
+		v.push_back(MakeHttpDatagram(i / 3));
+
+	Net::Log::Datagram message{"hello world"};
+	message.timestamp = v.back().timestamp;
+	v.push_back(message);
+
+	/* this one is skipped */
+	v.emplace_back();
+
+	std::string expected;
+	for (const auto &d : v) {
+		char buffer[1024];
+		char *end = FormatOneLine(buffer, sizeof(buffer), d, true);
+		if (end != buffer) {
+			expected.append(buffer, end);
+			expected.push_back('\n');
+		}
+	}
+
+	FILE *file = tmpfile();
+	ASSERT_NE(file, nullptr);
+	const FileDescriptor fd(fileno(file));
+
+	OneLineFormatter formatter;
+	ASSERT_TRUE(formatter.Write(fd, {v.data(), v.size()}));
+
+	std::string actual;
+	char buffer[4096];
+	ssize_t nbytes;
+	while ((nbytes = pread(fd.Get(), buffer, sizeof(buffer),
+			       actual.size())) > 0)
+		actual.append(buffer, nbytes);
+
+	fclose(file);
+
+	ASSERT_EQ(actual, expected);
+}
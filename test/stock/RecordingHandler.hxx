@@ -30,65 +30,37 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "Loop.hxx"
-#include "FineTimerEvent.hxx"
+#pragma once
 
-#ifdef NO_BOOST
-#include <algorithm>
-#endif
+#include "stock/GetHandler.hxx"
+#include "util/Cancellable.hxx"
 
-constexpr bool
-TimerList::Compare::operator()(const FineTimerEvent &a,
-			       const FineTimerEvent &b) const noexcept
-{
-	return a.due < b.due;
-}
+#include <cassert>
+#include <exception>
 
-TimerList::TimerList() = default;
+struct StockItem;
 
-TimerList::~TimerList() noexcept
-{
-	assert(timers.empty());
-}
-
-void
-TimerList::Insert(FineTimerEvent &t) noexcept
-{
-#ifdef NO_BOOST
-	auto i = std::find_if(timers.begin(), timers.end(), [due = t.GetDue()](const auto &other){
-		return other.GetDue() >= due;
-	});
-
-	timers.insert(i, t);
-#else
-	timers.insert(t);
-#endif
-}
-
-Event::Duration
-TimerList::Run(const Event::TimePoint now,
-	       bool &invoked) noexcept
-{
-	while (true) {
-		auto i = timers.begin();
-		if (i == timers.end())
-			break;
-
-		auto &t = *i;
-		const auto timeout = t.due - now;
-		if (timeout > timeout.zero())
-			return timeout;
-
-		invoked = true;
+/**
+ * A #StockGetHandler which records the result, to be checked by the
+ * test afterwards.
+ */
+struct RecordingHandler final : StockGetHandler {
+	CancellablePointer cancel_ptr;
+	StockItem *item = nullptr;
+	std::exception_ptr error;
 
-#ifdef NO_BOOST
-		t.Cancel();
-#else
-		timers.erase(i);
-#endif
+	bool IsDone() const noexcept {
+		return item != nullptr || error;
+	}
 
-		t.Run();
+	/* virtual methods from class StockGetHandler */
+	void OnStockItemReady(StockItem &_item) noexcept override {
+		assert(!IsDone());
+		item = &_item;
 	}
 
-	return Event::Duration(-1);
-}
+	void OnStockItemError(std::exception_ptr ep) noexcept override {
+		assert(!IsDone());
+		error = std::move(ep);
+	}
+};
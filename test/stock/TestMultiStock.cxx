@@ -0,0 +1,404 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RecordingHandler.hxx"
+#include "stock/MultiStock.hxx"
+#include "stock/Class.hxx"
+#include "stock/Item.hxx"
+#include "event/Loop.hxx"
+#include "util/Cancellable.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cassert>
+#include <list>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+struct Counters {
+	unsigned create = 0, borrow = 0, release = 0, destroy = 0;
+	bool fail = false;
+};
+
+struct MyItem final : StockItem {
+	Counters &counters;
+
+	MyItem(CreateStockItem c, Counters &_counters) noexcept
+		:StockItem(c), counters(_counters) {}
+
+	~MyItem() noexcept override {
+		++counters.destroy;
+	}
+
+	/* virtual methods from class StockItem */
+	bool Borrow() noexcept override {
+		++counters.borrow;
+		return true;
+	}
+
+	bool Release() noexcept override {
+		++counters.release;
+		return true;
+	}
+};
+
+/**
+ * A creation which has been postponed by MyClass::Create().
+ */
+struct PendingCreate final : Cancellable {
+	CreateStockItem c;
+	StockRequest request;
+	bool canceled = false;
+
+	PendingCreate(CreateStockItem _c, StockRequest &&_request) noexcept
+		:c(_c), request(std::move(_request)) {}
+
+	/* virtual methods from class Cancellable */
+	void Cancel() noexcept override {
+		canceled = true;
+		request.reset();
+	}
+};
+
+struct MyClass final : StockClass {
+	Counters counters;
+
+	/**
+	 * The requests passed to Create().
+	 */
+	std::vector<const void *> requests;
+
+	/**
+	 * If true, Create() postpones the creation and appends it to
+	 * #pending.
+	 */
+	bool async = false;
+
+	std::list<PendingCreate> pending;
+
+	void FinishCreate(PendingCreate &p) noexcept {
+		assert(!p.canceled);
+
+		++counters.create;
+		(new MyItem(p.c, counters))->InvokeCreateSuccess();
+	}
+
+	/* virtual methods from class StockClass */
+	void Create(CreateStockItem c, StockRequest request,
+		    CancellablePointer &cancel_ptr) override {
+		requests.push_back(request.get());
+
+		if (counters.fail)
+			throw std::runtime_error("Create failed");
+
+		if (async) {
+			auto &p = pending.emplace_back(c, std::move(request));
+			cancel_ptr = p;
+			return;
+		}
+
+		++counters.create;
+		(new MyItem(c, counters))->InvokeCreateSuccess();
+	}
+};
+
+} // anonymous namespace
+
+TEST(MultiStock, Concurrency)
+{
+	EventLoop event_loop;
+	MyClass cls;
+	MultiStock stock(event_loop, cls, "test", 2, 3);
+
+	/* the first three requests share one item */
+
+	RecordingHandler h[8];
+	for (unsigned i = 0; i < 3; ++i) {
+		stock.Get(nullptr, h[i], h[i].cancel_ptr);
+		ASSERT_NE(h[i].item, nullptr);
+		ASSERT_EQ(h[i].item, h[0].item);
+	}
+
+	/* the new item is handed to the first request without
+	   Release() and Borrow() */
+	ASSERT_EQ(cls.counters.create, 1U);
+	ASSERT_EQ(cls.counters.borrow, 0U);
+	ASSERT_EQ(cls.counters.release, 0U);
+
+	/* the fourth one gets a new item */
+
+	stock.Get(nullptr, h[3], h[3].cancel_ptr);
+	ASSERT_NE(h[3].item, nullptr);
+	ASSERT_NE(h[3].item, h[0].item);
+	ASSERT_EQ(cls.counters.create, 2U);
+
+	/* the fifth one picks the least-loaded item */
+
+	h[0].item->Put(false);
+	stock.Get(nullptr, h[4], h[4].cancel_ptr);
+	ASSERT_EQ(h[4].item, h[3].item);
+
+	stock.Get(nullptr, h[5], h[5].cancel_ptr);
+	stock.Get(nullptr, h[6], h[6].cancel_ptr);
+	ASSERT_NE(h[5].item, nullptr);
+	ASSERT_NE(h[6].item, nullptr);
+
+	/* both items are at their concurrency limit, and the stock
+	   limit has been reached: wait */
+
+	stock.Get(nullptr, h[7], h[7].cancel_ptr);
+	ASSERT_FALSE(h[7].IsDone());
+	ASSERT_EQ(cls.counters.create, 2U);
+
+	StockStats stats;
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.busy, 2U);
+	ASSERT_EQ(stats.idle, 0U);
+	ASSERT_EQ(stats.waiting, 1U);
+
+	h[5].item->Put(false);
+	event_loop.LoopNonBlock();
+	ASSERT_EQ(h[7].item, h[5].item);
+
+	/* return everything; the items become idle, but are not
+	   destroyed */
+
+	for (unsigned i : {1, 2, 3, 4, 6, 7})
+		h[i].item->Put(false);
+
+	ASSERT_EQ(cls.counters.release, 2U);
+	ASSERT_EQ(cls.counters.destroy, 0U);
+
+	stats = {};
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.busy, 0U);
+	ASSERT_EQ(stats.idle, 2U);
+	ASSERT_EQ(stats.counters.created, 2U);
+	ASSERT_EQ(stats.counters.reused, 6U);
+	ASSERT_EQ(stats.counters.waits, 1U);
+
+	stock.FadeAll();
+	ASSERT_EQ(cls.counters.destroy, 2U);
+	ASSERT_TRUE(stock.IsEmpty());
+}
+
+TEST(MultiStock, MaxLeases)
+{
+	EventLoop event_loop;
+	MyClass cls;
+	MultiStock stock(event_loop, cls, "test", 0, 2, 3);
+
+	RecordingHandler a, b, c, d;
+	stock.Get(nullptr, a, a.cancel_ptr);
+	stock.Get(nullptr, b, b.cancel_ptr);
+	a.item->Put(false);
+	stock.Get(nullptr, c, c.cancel_ptr);
+	ASSERT_EQ(c.item, a.item);
+
+	/* three leases have been granted: the item is retired */
+
+	stock.Get(nullptr, d, d.cancel_ptr);
+	ASSERT_NE(d.item, a.item);
+	ASSERT_EQ(cls.counters.create, 2U);
+
+	b.item->Put(false);
+	ASSERT_EQ(cls.counters.destroy, 0U);
+	c.item->Put(false);
+	ASSERT_EQ(cls.counters.destroy, 1U);
+
+	/* a destroyed lease marks the item as defunct */
+
+	d.item->Put(true);
+	ASSERT_EQ(cls.counters.destroy, 2U);
+	ASSERT_TRUE(stock.IsEmpty());
+}
+
+TEST(MultiStock, Requests)
+{
+	EventLoop event_loop;
+	MyClass cls;
+	MultiStock stock(event_loop, cls, "test", 2, 1);
+
+	RecordingHandler h[4];
+	for (auto &i : h)
+		stock.Get(ToNopPointer(&i), i, i.cancel_ptr);
+
+	ASSERT_EQ(cls.requests,
+		  (std::vector<const void *>{&h[0], &h[1]}));
+	ASSERT_TRUE(h[1].IsDone());
+	ASSERT_FALSE(h[2].IsDone());
+	ASSERT_FALSE(h[3].IsDone());
+
+	/* destroying both items creates two new ones, each with the
+	   request of a different waiting client */
+
+	h[0].item->Put(true);
+	h[1].item->Put(true);
+	event_loop.LoopNonBlock();
+
+	ASSERT_EQ(cls.requests,
+		  (std::vector<const void *>{&h[0], &h[1], &h[2], &h[3]}));
+	ASSERT_TRUE(h[2].IsDone());
+	ASSERT_TRUE(h[3].IsDone());
+	ASSERT_NE(h[2].item, h[3].item);
+
+	h[2].item->Put(false);
+	h[3].item->Put(false);
+}
+
+TEST(MultiStock, CreateError)
+{
+	EventLoop event_loop;
+	MyClass cls;
+	MultiStock stock(event_loop, cls, "test", 1, 2);
+
+	cls.counters.fail = true;
+
+	RecordingHandler a;
+	stock.Get(nullptr, a, a.cancel_ptr);
+	ASSERT_EQ(a.item, nullptr);
+	ASSERT_TRUE(a.error);
+	ASSERT_TRUE(stock.IsEmpty());
+
+	StockStats stats;
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.waiting, 0U);
+	ASSERT_EQ(stats.counters.create_errors, 1U);
+}
+
+TEST(MultiStock, CreateErrorWaiting)
+{
+	EventLoop event_loop;
+	MyClass cls;
+	MultiStock stock(event_loop, cls, "test", 2, 1);
+
+	RecordingHandler h[5];
+	for (auto &i : h)
+		stock.Get(ToNopPointer(&i), i, i.cancel_ptr);
+
+	ASSERT_TRUE(h[0].IsDone());
+	ASSERT_TRUE(h[1].IsDone());
+
+	/* the request whose creation has failed gets the error; a
+	   synchronous failure doesn't start another creation
+	   immediately, and the other waiting requests are not
+	   failed, because there is still an item which may serve
+	   them */
+
+	cls.counters.fail = true;
+	h[0].item->Put(true);
+	event_loop.LoopNonBlock();
+
+	ASSERT_EQ(cls.requests,
+		  (std::vector<const void *>{&h[0], &h[1], &h[2]}));
+	ASSERT_EQ(h[2].item, nullptr);
+	ASSERT_TRUE(h[2].error);
+	ASSERT_FALSE(h[3].IsDone());
+	ASSERT_FALSE(h[4].IsDone());
+
+	cls.counters.fail = false;
+	h[1].item->Put(false);
+	event_loop.LoopNonBlock();
+
+	ASSERT_EQ(h[3].item, h[1].item);
+	ASSERT_NE(h[4].item, nullptr);
+	ASSERT_NE(h[4].item, h[3].item);
+	ASSERT_EQ(cls.requests,
+		  (std::vector<const void *>{&h[0], &h[1], &h[2], &h[4]}));
+
+	h[3].item->Put(false);
+	h[4].item->Put(false);
+}
+
+/**
+ * A request whose creation fails while another item is busy must
+ * not wait forever after that item has been retired.
+ */
+TEST(MultiStock, CreateErrorRetired)
+{
+	EventLoop event_loop;
+	MyClass cls;
+	MultiStock stock(event_loop, cls, "test", 0, 1, 1);
+
+	RecordingHandler a, b;
+	stock.Get(nullptr, a, a.cancel_ptr);
+	ASSERT_NE(a.item, nullptr);
+
+	cls.counters.fail = true;
+	stock.Get(nullptr, b, b.cancel_ptr);
+
+	a.item->Put(false);
+	event_loop.LoopNonBlock();
+
+	ASSERT_EQ(b.item, nullptr);
+	ASSERT_TRUE(b.error);
+	ASSERT_TRUE(stock.IsEmpty());
+
+	StockStats stats;
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.waiting, 0U);
+}
+
+/**
+ * Canceling a waiting request cancels the creation which uses its
+ * #StockRequest, and another waiting request starts a new one.
+ */
+TEST(MultiStock, CancelCreate)
+{
+	EventLoop event_loop;
+	MyClass cls;
+	cls.async = true;
+	MultiStock stock(event_loop, cls, "test", 1, 1);
+
+	RecordingHandler a, b;
+	stock.Get(ToNopPointer(&a), a, a.cancel_ptr);
+	stock.Get(ToNopPointer(&b), b, b.cancel_ptr);
+	ASSERT_EQ(cls.requests, (std::vector<const void *>{&a}));
+	ASSERT_EQ(cls.pending.size(), 1U);
+
+	a.cancel_ptr.Cancel();
+	ASSERT_TRUE(cls.pending.front().canceled);
+	ASSERT_EQ(cls.pending.front().request.get(), nullptr);
+
+	event_loop.LoopNonBlock();
+	ASSERT_EQ(cls.requests, (std::vector<const void *>{&a, &b}));
+	ASSERT_EQ(cls.pending.size(), 2U);
+	ASSERT_FALSE(b.IsDone());
+
+	cls.FinishCreate(cls.pending.back());
+	ASSERT_FALSE(a.IsDone());
+	ASSERT_NE(b.item, nullptr);
+
+	b.item->Put(false);
+}
@@ -30,9 +30,10 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "RecordingHandler.hxx"
 #include "stock/Stock.hxx"
 #include "stock/Class.hxx"
-#include "stock/GetHandler.hxx"
+#include "stock/Error.hxx"
 #include "stock/Item.hxx"
 #include "event/Loop.hxx"
 #include "util/Cancellable.hxx"
@@ -41,6 +42,8 @@
 #include <gtest/gtest.h>
 
 #include <stdexcept>
+#include <string_view>
+#include <type_traits>
 
 #include <assert.h>
 
@@ -52,6 +55,11 @@ static StockItem *last_item;
 struct MyStockItem final : StockItem {
 	StockRequest request;
 
+	/**
+	 * Shall MyStockClass::CheckIdle() fail?
+	 */
+	bool dead = false;
+
 	explicit MyStockItem(CreateStockItem c)
 		:StockItem(c) {}
 
@@ -81,6 +89,10 @@ public:
 	/* virtual methods from class StockClass */
 	void Create(CreateStockItem c, StockRequest request,
 		    CancellablePointer &cancel_ptr) override;
+
+	bool CheckIdle(StockItem &item) noexcept override {
+		return !static_cast<MyStockItem &>(item).dead;
+	}
 };
 
 void
@@ -119,6 +131,23 @@ public:
 	}
 };
 
+/**
+ * A #StockGetHandler which remembers its own result, for tests with
+ * more than one pending request.
+ */
+template<typename E>
+static bool
+IsError(const std::exception_ptr &ep) noexcept
+{
+	try {
+		std::rethrow_exception(ep);
+	} catch (const E &) {
+		return true;
+	} catch (...) {
+		return false;
+	}
+}
+
 TEST(Stock, Basic)
 {
 	CancellablePointer cancel_ptr;
@@ -286,4 +315,289 @@ TEST(Stock, Basic)
 	ASSERT_EQ(num_borrow, 2);
 	ASSERT_EQ(num_release, 2);
 	ASSERT_EQ(num_destroy, 5);
+
+	/* check the statistics */
+
+	StockStats stats;
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.busy, 0U);
+	ASSERT_EQ(stats.idle, 0U);
+	ASSERT_EQ(stats.creating, 0U);
+	ASSERT_EQ(stats.waiting, 0U);
+	ASSERT_EQ(stats.counters.reused, 2U);
+	ASSERT_EQ(stats.counters.created, 4U);
+	ASSERT_EQ(stats.counters.create_errors, 1U);
+	ASSERT_EQ(stats.counters.waits, 2U);
+	ASSERT_EQ(stats.counters.canceled_waits, 0U);
+	ASSERT_EQ(stats.counters.waiting_length[0], 1U);
+	ASSERT_EQ(stats.counters.waiting_length[1], 1U);
+
+	std::size_t n_waited = 0, n_values = 0;
+	stock.VisitStats([&](const char *name, const auto &value){
+		++n_values;
+		if constexpr (!std::is_integral_v<std::decay_t<decltype(value)>>)
+			if (std::string_view{name} == "wait_time_ms")
+				for (const auto i : value)
+					n_waited += i;
+	});
+	ASSERT_EQ(n_waited, 2U);
+	ASSERT_EQ(n_values, 15U);
+}
+
+TEST(Stock, Prewarm)
+{
+	CancellablePointer cancel_ptr;
+
+	EventLoop event_loop;
+
+	MyStockClass cls;
+	Stock stock(event_loop, cls, "test", 3, 8,
+		    Event::Duration::zero());
+	stock.SetPrewarmRate(1000, 2);
+
+	MyStockGetHandler handler;
+
+	num_create = num_fail = num_borrow = num_release = num_destroy = 0;
+	next_fail = false;
+
+	/* prewarming happens in the background */
+
+	stock.Prewarm(4);
+	ASSERT_EQ(num_create, 0);
+
+	event_loop.Dispatch();
+	ASSERT_EQ(num_create, 4);
+	ASSERT_EQ(num_borrow, 0);
+	ASSERT_EQ(num_release, 4);
+
+	StockStats stats;
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.idle, 4U);
+	ASSERT_EQ(stats.busy, 0U);
+
+	/* a prewarmed item gets borrowed; Prewarm() was a one-shot
+	   operation, so no replacement is created */
+
+	got_item = false;
+	stock.Get(nullptr, handler, cancel_ptr);
+	ASSERT_TRUE(got_item);
+	ASSERT_NE(last_item, nullptr);
+	StockItem *item1 = last_item;
+	ASSERT_EQ(num_borrow, 1);
+
+	event_loop.Dispatch();
+	ASSERT_EQ(num_create, 4);
+
+	/* now keep at least 4 idle items */
+
+	stock.SetMinIdle(4);
+	event_loop.Dispatch();
+	ASSERT_EQ(num_create, 5);
+
+	got_item = false;
+	stock.Get(nullptr, handler, cancel_ptr);
+	ASSERT_TRUE(got_item);
+	StockItem *item2 = last_item;
+
+	got_item = false;
+	stock.Get(nullptr, handler, cancel_ptr);
+	ASSERT_TRUE(got_item);
+	StockItem *item3 = last_item;
+
+	ASSERT_EQ(num_create, 5);
+	ASSERT_EQ(num_borrow, 3);
+
+	/* the stock is full now (3 busy items), so no more items
+	   can be created */
+
+	event_loop.Dispatch();
+	ASSERT_EQ(num_create, 5);
+
+	stock.Put(*item3, false);
+	event_loop.Dispatch();
+
+	stats = {};
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.idle, 4U);
+	ASSERT_EQ(stats.busy, 2U);
+	ASSERT_EQ(num_create, 6);
+
+	stock.Put(*item1, true);
+	stock.Put(*item2, true);
+	stock.Shutdown();
+}
+
+TEST(Stock, WaitingOrder)
+{
+	EventLoop event_loop;
+
+	MyStockClass cls;
+	Stock stock(event_loop, cls, "test", 1, 8,
+		    Event::Duration::zero());
+
+	next_fail = false;
+
+	RecordingHandler first;
+	stock.Get(nullptr, first, first.cancel_ptr);
+	ASSERT_NE(first.item, nullptr);
+
+	/* the stock is full now; two low-priority requests and one
+	   high-priority request wait */
+
+	RecordingHandler a, b, c;
+	stock.Get(nullptr, a, a.cancel_ptr);
+	stock.Get(nullptr, b, b.cancel_ptr);
+	stock.Get(nullptr, StockGetOptions{.priority = 1},
+		  c, c.cancel_ptr);
+	ASSERT_FALSE(a.IsDone());
+	ASSERT_FALSE(b.IsDone());
+	ASSERT_FALSE(c.IsDone());
+
+	/* the high-priority request is served first */
+
+	stock.Put(*first.item, false);
+	event_loop.LoopNonBlock();
+	ASSERT_FALSE(a.IsDone());
+	ASSERT_FALSE(b.IsDone());
+	ASSERT_NE(c.item, nullptr);
+
+	/* the others in the order they arrived */
+
+	stock.Put(*c.item, false);
+	event_loop.LoopNonBlock();
+	ASSERT_NE(a.item, nullptr);
+	ASSERT_FALSE(b.IsDone());
+
+	stock.Put(*a.item, false);
+	event_loop.LoopNonBlock();
+	ASSERT_NE(b.item, nullptr);
+
+	stock.Put(*b.item, true);
+	stock.Shutdown();
+}
+
+TEST(Stock, WaitingLimits)
+{
+	EventLoop event_loop;
+
+	MyStockClass cls;
+	Stock stock(event_loop, cls, "test", 1, 8,
+		    Event::Duration::zero());
+	stock.SetMaxWaiting(2);
+
+	next_fail = false;
+
+	RecordingHandler first;
+	stock.Get(nullptr, first, first.cancel_ptr);
+	ASSERT_NE(first.item, nullptr);
+
+	/* the third waiting request is rejected immediately */
+
+	RecordingHandler a, b, c;
+	stock.Get(nullptr, a, a.cancel_ptr);
+	stock.Get(nullptr, b, b.cancel_ptr);
+	stock.Get(nullptr, c, c.cancel_ptr);
+	ASSERT_FALSE(a.IsDone());
+	ASSERT_FALSE(b.IsDone());
+	ASSERT_TRUE(IsError<StockQueueFullError>(c.error));
+
+	/* a high-priority request pushes out the last low-priority
+	   one */
+
+	RecordingHandler d;
+	stock.Get(nullptr, StockGetOptions{.priority = 1},
+		  d, d.cancel_ptr);
+	ASSERT_FALSE(a.IsDone());
+	ASSERT_TRUE(IsError<StockQueueFullError>(b.error));
+	ASSERT_FALSE(d.IsDone());
+
+	/* a request with a deadline fails with a distinct error */
+
+	d.cancel_ptr.Cancel();
+
+	RecordingHandler e;
+	stock.Get(nullptr,
+		  StockGetOptions{.timeout = std::chrono::milliseconds(10)},
+		  e, e.cancel_ptr);
+	ASSERT_FALSE(e.IsDone());
+
+	while (!e.IsDone())
+		event_loop.LoopOnce();
+	ASSERT_TRUE(IsError<StockTimeoutError>(e.error));
+	ASSERT_FALSE(a.IsDone());
+
+	StockStats stats;
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.waiting, 1U);
+	ASSERT_EQ(stats.counters.waits, 4U);
+	ASSERT_EQ(stats.counters.rejected, 2U);
+	ASSERT_EQ(stats.counters.canceled_waits, 1U);
+	ASSERT_EQ(stats.counters.wait_timeouts, 1U);
+
+	stock.Put(*first.item, false);
+	event_loop.LoopNonBlock();
+	ASSERT_NE(a.item, nullptr);
+
+	stock.Put(*a.item, true);
+	stock.Shutdown();
+}
+
+TEST(Stock, HealthCheck)
+{
+	EventLoop event_loop;
+
+	MyStockClass cls;
+	Stock stock(event_loop, cls, "test", 0, 8,
+		    Event::Duration::zero());
+	stock.SetMaxUses(2);
+
+	num_create = num_fail = num_borrow = num_release = num_destroy = 0;
+	next_fail = false;
+
+	/* the second use of an item is its last one */
+
+	RecordingHandler a;
+	stock.Get(nullptr, a, a.cancel_ptr);
+	ASSERT_NE(a.item, nullptr);
+	stock.Put(*a.item, false);
+
+	RecordingHandler b;
+	stock.Get(nullptr, b, b.cancel_ptr);
+	ASSERT_EQ(b.item, a.item);
+	stock.Put(*b.item, false);
+	ASSERT_EQ(num_create, 1);
+	ASSERT_EQ(num_destroy, 1);
+
+	/* the periodic check destroys defunct idle items */
+
+	stock.SetMaxUses(0);
+	stock.SetMaxLifetime(std::chrono::milliseconds(50));
+	stock.SetHealthCheck(std::chrono::milliseconds(5), 16);
+
+	RecordingHandler c, d;
+	stock.Get(nullptr, c, c.cancel_ptr);
+	stock.Get(nullptr, d, d.cancel_ptr);
+	ASSERT_EQ(num_create, 3);
+	static_cast<MyStockItem *>(c.item)->dead = true;
+	stock.Put(*c.item, false);
+	stock.Put(*d.item, false);
+
+	while (num_destroy < 2)
+		event_loop.LoopOnce();
+
+	StockStats stats;
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.idle, 1U);
+	ASSERT_EQ(stats.counters.check_failures, 1U);
+
+	/* the other one expires after its maximum lifetime */
+
+	while (num_destroy < 3)
+		event_loop.LoopOnce();
+
+	stats = {};
+	stock.AddStats(stats);
+	ASSERT_EQ(stats.idle, 0U);
+	ASSERT_EQ(stats.counters.expired, 2U);
+	ASSERT_EQ(stats.counters.check_failures, 1U);
 }
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "event/uring/Manager.hxx"
+#include "event/Loop.hxx"
+#include "co/InvokeTask.hxx"
+
+#include <memory>
+
+/**
+ * An #EventLoop with a #Uring::Manager which runs one coroutine at
+ * a time.
+ */
+struct Instance {
+	EventLoop event_loop;
+	std::unique_ptr<Uring::Manager> uring;
+
+	Co::InvokeTask task;
+	std::exception_ptr error;
+
+	bool done = false;
+
+	Instance()
+		:uring(std::make_unique<Uring::Manager>(event_loop)) {}
+
+	/**
+	 * Run the given coroutine until it finishes and rethrow its
+	 * exception (if any).
+	 */
+	void Run(Co::InvokeTask &&_task) {
+		task = std::move(_task);
+		task.Start(BIND_THIS_METHOD(OnCompletion));
+
+		if (!done)
+			event_loop.Dispatch();
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	void OnCompletion(std::exception_ptr _error) noexcept {
+		error = std::move(_error);
+		done = true;
+		event_loop.Break();
+	}
+};
+
+/**
+ * @return a new #Instance or nullptr if io_uring is not available
+ */
+inline std::unique_ptr<Instance>
+MakeInstance() noexcept
+try {
+	return std::make_unique<Instance>();
+} catch (...) {
+	return nullptr;
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Instance.hxx"
+#include "io/uring/FileTable.hxx"
+#include "io/uring/CoOperation.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+static int
+GetErrno(const std::system_error &e) noexcept
+{
+	return e.code().value();
+}
+
+} // anonymous namespace
+
+static Co::InvokeTask
+FileOperations(Uring::Queue &queue, FileDescriptor directory_fd)
+{
+	co_await Uring::CoMkdir(queue, directory_fd, "sub", 0700);
+
+	auto fd = co_await Uring::CoOpenBeneath(queue, directory_fd, "sub/a",
+						O_CREAT|O_EXCL|O_WRONLY,
+						0600);
+
+	std::size_t nbytes = co_await Uring::CoWrite(queue, fd,
+						     "hello", 5, 0);
+	EXPECT_EQ(nbytes, 5U);
+
+	co_await Uring::CoFallocate(queue, fd, 0, 0, 8192);
+	co_await Uring::CoFdatasync(queue, fd);
+	co_await Uring::CoFsync(queue, fd);
+	co_await Uring::CoClose(queue, fd.Release());
+
+	co_await Uring::CoRename(queue, directory_fd, "sub/a",
+				 directory_fd, "sub/b");
+	co_await Uring::CoLink(queue, directory_fd, "sub/b",
+			       directory_fd, "sub/c");
+
+	/* the old name is gone */
+	try {
+		co_await Uring::CoOpenReadOnly(queue, directory_fd, "sub/a");
+		ADD_FAILURE();
+	} catch (const std::system_error &e) {
+		EXPECT_EQ(GetErrno(e), ENOENT);
+	}
+
+	/* RESOLVE_BENEATH refuses to leave the directory */
+	try {
+		co_await Uring::CoOpenBeneath(queue, directory_fd,
+					      "../sub/c", O_RDONLY);
+		ADD_FAILURE();
+	} catch (const std::system_error &e) {
+		EXPECT_EQ(GetErrno(e), EXDEV);
+	}
+
+	auto stat = Uring::CoStatx(queue, directory_fd, "sub/c", 0,
+				   STATX_SIZE|STATX_NLINK);
+	const auto &stx = co_await stat;
+	EXPECT_EQ(stx.stx_size, 8192U);
+	EXPECT_EQ(stx.stx_nlink, 2U);
+
+	co_await Uring::CoUnlink(queue, directory_fd, "sub/b");
+	co_await Uring::CoUnlink(queue, directory_fd, "sub/c");
+	co_await Uring::CoUnlink(queue, directory_fd, "sub", AT_REMOVEDIR);
+}
+
+TEST(UringCoOperation, FileOperations)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	char path[] = "/tmp/TestCoOperation.XXXXXX";
+	ASSERT_NE(mkdtemp(path), nullptr);
+
+	UniqueFileDescriptor directory_fd;
+	ASSERT_TRUE(directory_fd.Open(path, O_DIRECTORY|O_PATH));
+
+	instance->Run(FileOperations(*instance->uring, directory_fd));
+	rmdir(path);
+}
+
+static Co::InvokeTask
+LinkedChain(Uring::Queue &queue, FileDescriptor directory_fd,
+	    Uring::FixedFile file)
+{
+	char buffer[64];
+
+	/* submit all three at once; each one starts only after the
+	   previous one has succeeded */
+	queue.ReserveSubmitEntries(3);
+	auto open = Uring::CoOpenDirect(queue, directory_fd, "data",
+					O_RDONLY, file, IOSQE_IO_LINK);
+	/* note: a short read would break the chain, therefore read
+	   exactly the file size */
+	auto read = Uring::CoRead(queue, file, buffer, 5, 0,
+				  IOSQE_IO_LINK);
+	auto close = Uring::CoClose(queue, file);
+
+	co_await open;
+	const std::size_t nbytes = co_await read;
+	co_await close;
+
+	EXPECT_EQ(nbytes, 5U);
+	EXPECT_EQ(memcmp(buffer, "hello", 5), 0);
+
+	/* if the first operation fails, the rest of the chain is
+	   canceled */
+	queue.ReserveSubmitEntries(2);
+	auto open2 = Uring::CoOpenDirect(queue, directory_fd, "nonexistent",
+					 O_RDONLY, file, IOSQE_IO_LINK);
+	auto read2 = Uring::CoRead(queue, file, buffer, sizeof(buffer), 0);
+
+	try {
+		co_await open2;
+		ADD_FAILURE();
+	} catch (const std::system_error &e) {
+		EXPECT_EQ(GetErrno(e), ENOENT);
+	}
+
+	try {
+		co_await read2;
+		ADD_FAILURE();
+	} catch (const std::system_error &e) {
+		EXPECT_EQ(GetErrno(e), ECANCELED);
+	}
+}
+
+TEST(UringCoOperation, LinkedChain)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	char path[] = "/tmp/TestCoOperation.XXXXXX";
+	ASSERT_NE(mkdtemp(path), nullptr);
+
+	UniqueFileDescriptor directory_fd;
+	ASSERT_TRUE(directory_fd.Open(path, O_DIRECTORY|O_PATH));
+
+	{
+		UniqueFileDescriptor fd;
+		ASSERT_TRUE(fd.Open(directory_fd, "data",
+				    O_CREAT|O_WRONLY, 0600));
+		ASSERT_EQ(fd.Write("hello", 5), 5);
+	}
+
+	Uring::FileTable files(*instance->uring, 1);
+	const auto file = files.Allocate();
+
+	instance->Run(LinkedChain(*instance->uring, directory_fd, file));
+
+	files.Remove(file);
+	unlinkat(directory_fd.Get(), "data", 0);
+	rmdir(path);
+}
+
+static Co::InvokeTask
+Socket(Uring::Queue &queue, SocketDescriptor a, SocketDescriptor b)
+{
+	std::size_t nbytes = co_await Uring::CoSend(queue, a, "hello", 5);
+	EXPECT_EQ(nbytes, 5U);
+
+	char buffer[64];
+	nbytes = co_await Uring::CoRecv(queue, b, buffer, sizeof(buffer));
+	EXPECT_EQ(nbytes, 5U);
+	EXPECT_EQ(memcmp(buffer, "hello", 5), 0);
+
+	/* no data: the linked timeout cancels the receive */
+	queue.ReserveSubmitEntries(2);
+	auto recv = Uring::CoRecv(queue, b, buffer, sizeof(buffer),
+				  0, IOSQE_IO_LINK);
+	auto timeout = Uring::CoLinkTimeout(queue, 10ms);
+
+	try {
+		co_await recv;
+		ADD_FAILURE();
+	} catch (const std::system_error &e) {
+		EXPECT_EQ(GetErrno(e), ECANCELED);
+	}
+
+	EXPECT_TRUE(co_await timeout);
+
+	/* data arrives in time: the timeout is canceled */
+	a.Write("world", 5);
+	queue.ReserveSubmitEntries(2);
+	auto recv2 = Uring::CoRecv(queue, b, buffer, sizeof(buffer),
+				   0, IOSQE_IO_LINK);
+	auto timeout2 = Uring::CoLinkTimeout(queue, 10s);
+
+	nbytes = co_await recv2;
+	EXPECT_EQ(nbytes, 5U);
+	EXPECT_FALSE(co_await timeout2);
+
+	/* explicit cancellation */
+	auto recv3 = Uring::CoRecv(queue, b, buffer, sizeof(buffer));
+	recv3.Cancel();
+
+	try {
+		co_await recv3;
+		ADD_FAILURE();
+	} catch (const std::system_error &e) {
+		EXPECT_EQ(GetErrno(e), ECANCELED);
+	}
+}
+
+TEST(UringCoOperation, Socket)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							     SOCK_STREAM, 0,
+							     a, b));
+
+	instance->Run(Socket(*instance->uring, a, b));
+}
+
+static Co::InvokeTask
+Splice(Uring::Queue &queue, FileDescriptor file, FileDescriptor pipe_w)
+{
+	std::size_t nbytes = co_await Uring::CoSplice(queue, file, 0,
+						      pipe_w, -1, 1024);
+	EXPECT_EQ(nbytes, 11U);
+}
+
+TEST(UringCoOperation, Splice)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	UniqueFileDescriptor file;
+	ASSERT_TRUE(file.Open("/tmp", O_TMPFILE|O_RDWR, 0600));
+	ASSERT_EQ(file.Write("hello world", 11), 11);
+
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	instance->Run(Splice(*instance->uring, file, w));
+
+	char buffer[64];
+	ASSERT_EQ(r.Read(buffer, sizeof(buffer)), 11);
+	EXPECT_EQ(memcmp(buffer, "hello world", 11), 0);
+}
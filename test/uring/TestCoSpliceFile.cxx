@@ -0,0 +1,180 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Instance.hxx"
+#include "io/uring/CoSpliceFile.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "net/UniqueSocketDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+namespace {
+
+/**
+ * A temporary file filled with a known pattern.
+ */
+struct PatternFile {
+	UniqueFileDescriptor fd;
+	std::vector<std::byte> data;
+
+	explicit PatternFile(std::size_t size)
+		:data(size)
+	{
+		for (std::size_t i = 0; i < size; ++i)
+			data[i] = std::byte(i * 7 + i / 251);
+
+		if (!fd.Open("/tmp", O_TMPFILE|O_RDWR, 0600))
+			throw std::runtime_error("Failed to create file");
+
+		fd.FullWrite(data.data(), data.size());
+	}
+};
+
+/**
+ * Read everything from the file descriptor (until end of file) in a
+ * separate thread.
+ */
+class Sink {
+	std::vector<std::byte> received;
+	std::thread thread;
+
+public:
+	explicit Sink(FileDescriptor fd)
+		:thread([this, fd]() mutable {
+			std::byte buffer[16384];
+			ssize_t nbytes;
+			while ((nbytes = fd.Read(buffer, sizeof(buffer))) > 0)
+				received.insert(received.end(),
+						buffer, buffer + nbytes);
+		}) {}
+
+	const auto &Join() noexcept {
+		thread.join();
+		return received;
+	}
+};
+
+} // anonymous namespace
+
+static Co::InvokeTask
+Splice(Uring::Queue &queue, FileDescriptor in, off_t offset,
+       uint_least64_t length, FileDescriptor out,
+       uint_least64_t expected)
+{
+	const auto nbytes = co_await Uring::CoSpliceFile(queue, in, offset,
+							 length, out);
+	EXPECT_EQ(nbytes, expected);
+}
+
+TEST(UringCoSpliceFile, Socket)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	/* larger than the internal pipe */
+	const PatternFile file(3 * 1024 * 1024 + 123);
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							     SOCK_STREAM, 0,
+							     a, b));
+
+	/* the sink reads slowly through a small buffer, so the
+	   non-blocking socket fills up and the pump needs to wait */
+	a.SetNonBlocking();
+	const int rcvbuf = 4096;
+	b.SetOption(SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	Sink sink(b.ToFileDescriptor());
+
+	const off_t offset = 1000;
+	const uint_least64_t length = file.data.size() - offset - 1000;
+	instance->Run(Splice(*instance->uring, file.fd, offset, length,
+			     a.ToFileDescriptor(), length));
+	a.Close();
+
+	const auto &received = sink.Join();
+	ASSERT_EQ(received.size(), length);
+	EXPECT_TRUE(std::equal(received.begin(), received.end(),
+			       file.data.begin() + offset));
+}
+
+TEST(UringCoSpliceFile, Pipe)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	const PatternFile file(1024 * 1024 + 17);
+
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	Sink sink(r);
+
+	instance->Run(Splice(*instance->uring, file.fd, 0, file.data.size(),
+			     w, file.data.size()));
+	w.Close();
+
+	EXPECT_EQ(sink.Join(), file.data);
+}
+
+TEST(UringCoSpliceFile, ShortFile)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	const PatternFile file(300 * 1024);
+
+	UniqueSocketDescriptor a, b;
+	ASSERT_TRUE(UniqueSocketDescriptor::CreateSocketPair(AF_LOCAL,
+							     SOCK_STREAM, 0,
+							     a, b));
+
+	Sink sink(b.ToFileDescriptor());
+
+	/* ask for more than there is */
+	instance->Run(Splice(*instance->uring, file.fd, 0, 1024 * 1024,
+			     a.ToFileDescriptor(), file.data.size()));
+	a.Close();
+
+	EXPECT_EQ(sink.Join(), file.data);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Instance.hxx"
+#include "io/uring/BufferPool.hxx"
+#include "io/uring/FileTable.hxx"
+#include "io/uring/CoOperation.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+
+static Co::InvokeTask
+ReadWrite(Uring::Queue &queue, FileDescriptor fd,
+	  Uring::BufferPool &buffers, Uring::FileTable &files)
+{
+	const auto file = files.Add(fd);
+
+	const int i = buffers.Allocate();
+	EXPECT_GE(i, 0);
+	auto *buffer = buffers.GetBuffer(i);
+
+	/* write with a plain file descriptor */
+	memcpy(buffer, "hello", 5);
+	std::size_t nbytes = co_await Uring::CoWriteFixed(queue, fd,
+							  buffer, 5, 0, i);
+	EXPECT_EQ(nbytes, 5U);
+
+	/* write with the fixed file, from the middle of the
+	   buffer */
+	memcpy(buffer + 8, " world", 6);
+	nbytes = co_await Uring::CoWriteFixed(queue, file,
+					      buffer + 8, 6, 5, i);
+	EXPECT_EQ(nbytes, 6U);
+
+	memset(buffer, 0, buffers.GetBufferSize());
+	nbytes = co_await Uring::CoReadFixed(queue, file, buffer,
+					     buffers.GetBufferSize(), 0, i);
+	EXPECT_EQ(nbytes, 11U);
+	EXPECT_EQ(memcmp(buffer, "hello world", 11), 0);
+
+	buffers.Free(i);
+	files.Remove(file);
+}
+
+TEST(UringFixed, ReadWrite)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	auto &queue = *instance->uring;
+
+	UniqueFileDescriptor fd;
+	ASSERT_TRUE(fd.Open("/tmp", O_TMPFILE|O_RDWR, 0600));
+
+	Uring::BufferPool buffers(queue, 4, 4096);
+	EXPECT_EQ(buffers.GetBufferSize(), 4096U);
+
+	Uring::FileTable files(queue, 2);
+
+	instance->Run(ReadWrite(queue, fd, buffers, files));
+	instance->uring->SetVolatile();
+}
+
+TEST(UringFixed, Allocate)
+{
+	auto instance = MakeInstance();
+	if (!instance)
+		GTEST_SKIP() << "io_uring not available";
+
+	Uring::BufferPool buffers(*instance->uring, 2, 1024);
+	EXPECT_EQ(buffers.Allocate(), 0);
+	EXPECT_EQ(buffers.Allocate(), 1);
+	EXPECT_EQ(buffers.Allocate(), -1);
+	EXPECT_EQ(buffers.GetBuffer(1), buffers.GetBuffer(0) + 1024);
+
+	buffers.Free(0);
+	EXPECT_EQ(buffers.Allocate(), 0);
+
+	Uring::FileTable files(*instance->uring, 1);
+	EXPECT_EQ(files.Add(FileDescriptor(STDIN_FILENO)).index, 0U);
+	EXPECT_THROW(files.Add(FileDescriptor(STDIN_FILENO)), std::system_error);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "event/uring/Manager.hxx"
+#include "event/Loop.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include <errno.h>
+
+namespace {
+
+struct NopOperation final : Uring::Operation {
+	EventLoop &loop;
+	unsigned &remaining;
+
+	int result = 1;
+
+	NopOperation(EventLoop &_loop, unsigned &_remaining) noexcept
+		:loop(_loop), remaining(_remaining) {}
+
+	void OnUringCompletion(int res) noexcept override {
+		result = res;
+
+		if (--remaining == 0)
+			loop.Break();
+	}
+};
+
+/**
+ * An operation whose completion handler asks the kernel to cancel
+ * another operation.
+ */
+struct CancelSiblingOperation final : Uring::Operation {
+	Uring::Queue &queue;
+	Uring::Operation &sibling;
+
+	CancelSiblingOperation(Uring::Queue &_queue,
+			       Uring::Operation &_sibling) noexcept
+		:queue(_queue), sibling(_sibling) {}
+
+	void OnUringCompletion(int) noexcept override {
+		queue.RequestCancel(sibling);
+	}
+};
+
+} // anonymous namespace
+
+/**
+ * Push many more operations than the submission queue can hold;
+ * GetSubmitEntry() must submit automatically, and
+ * DispatchCompletions() must harvest more than one batch.
+ */
+TEST(UringManager, Overflow)
+{
+	EventLoop loop;
+
+	std::unique_ptr<Uring::Manager> manager;
+	try {
+		manager = std::make_unique<Uring::Manager>(loop, 8);
+	} catch (...) {
+		GTEST_SKIP() << "io_uring not available";
+	}
+
+	constexpr unsigned N = 1000;
+	unsigned remaining = N;
+
+	std::vector<std::unique_ptr<NopOperation>> operations;
+	for (unsigned i = 0; i < N; ++i) {
+		auto *sqe = manager->GetSubmitEntry();
+		ASSERT_NE(sqe, nullptr);
+
+		io_uring_prep_nop(sqe);
+
+		auto &operation = *operations.emplace_back(std::make_unique<NopOperation>(loop, remaining));
+		manager->Push(*sqe, operation);
+	}
+
+	EXPECT_EQ(manager->GetPendingCount(), N);
+
+	loop.Dispatch();
+
+	EXPECT_EQ(remaining, 0U);
+	EXPECT_EQ(manager->GetPendingCount(), 0U);
+
+	for (const auto &i : operations) {
+		EXPECT_FALSE(i->IsUringPending());
+		EXPECT_EQ(i->result, 0);
+	}
+}
+
+/**
+ * A cancel request for an operation must not be inserted into an
+ * incomplete chain of linked entries; it is postponed until the
+ * chain is complete and then submitted by the deferred submit.
+ */
+TEST(UringManager, CancelDuringChain)
+{
+	EventLoop loop;
+
+	std::unique_ptr<Uring::Manager> manager;
+	try {
+		manager = std::make_unique<Uring::Manager>(loop, 8);
+	} catch (...) {
+		GTEST_SKIP() << "io_uring not available";
+	}
+
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	unsigned remaining = 3;
+
+	/* this read never completes, because nobody writes to the
+	   pipe */
+	NopOperation read_operation(loop, remaining);
+	char buffer[16];
+	auto *sqe = manager->GetSubmitEntry();
+	ASSERT_NE(sqe, nullptr);
+	io_uring_prep_read(sqe, r.Get(), buffer, sizeof(buffer), 0);
+	manager->Push(*sqe, read_operation);
+
+	NopOperation first(loop, remaining), second(loop, remaining);
+
+	sqe = manager->GetSubmitEntry();
+	ASSERT_NE(sqe, nullptr);
+	io_uring_prep_nop(sqe);
+	sqe->flags |= IOSQE_IO_LINK;
+	manager->Push(*sqe, first);
+
+	manager->RequestCancel(read_operation);
+
+	sqe = manager->GetSubmitEntry();
+	ASSERT_NE(sqe, nullptr);
+	io_uring_prep_nop(sqe);
+	manager->Push(*sqe, second);
+
+	loop.Dispatch();
+
+	EXPECT_EQ(remaining, 0U);
+	EXPECT_EQ(first.result, 0);
+	EXPECT_EQ(second.result, 0);
+	EXPECT_EQ(read_operation.result, -ECANCELED);
+	EXPECT_EQ(manager->GetPendingCount(), 0U);
+}
+
+/**
+ * A completion handler which cancels a sibling operation; its cancel
+ * request must be submitted even though nothing else is pushed.
+ */
+TEST(UringManager, CancelFromHandler)
+{
+	EventLoop loop;
+
+	std::unique_ptr<Uring::Manager> manager;
+	try {
+		manager = std::make_unique<Uring::Manager>(loop, 8);
+	} catch (...) {
+		GTEST_SKIP() << "io_uring not available";
+	}
+
+	UniqueFileDescriptor r, w;
+	ASSERT_TRUE(UniqueFileDescriptor::CreatePipe(r, w));
+
+	unsigned remaining = 1;
+
+	NopOperation read_operation(loop, remaining);
+	char buffer[16];
+	auto *sqe = manager->GetSubmitEntry();
+	ASSERT_NE(sqe, nullptr);
+	io_uring_prep_read(sqe, r.Get(), buffer, sizeof(buffer), 0);
+	manager->Push(*sqe, read_operation);
+
+	CancelSiblingOperation cancel_operation(*manager, read_operation);
+	sqe = manager->GetSubmitEntry();
+	ASSERT_NE(sqe, nullptr);
+	io_uring_prep_nop(sqe);
+	manager->Push(*sqe, cancel_operation);
+
+	loop.Dispatch();
+
+	EXPECT_EQ(remaining, 0U);
+	EXPECT_EQ(read_operation.result, -ECANCELED);
+	EXPECT_EQ(manager->GetPendingCount(), 0U);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark for the #CRC32 implementations.
+ */
+
+#include "util/CRC32.hxx"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using std::chrono::steady_clock;
+
+static constexpr std::size_t TOTAL_BYTES = 64 * 1024 * 1024;
+
+/**
+ * @return gigabytes per second
+ */
+template<typename F>
+static double
+Run(F &&f, const std::vector<uint8_t> &data, std::size_t size) noexcept
+{
+	const std::size_t n = TOTAL_BYTES / size;
+	uint32_t sink = 0;
+
+	const auto start = steady_clock::now();
+
+	for (std::size_t i = 0; i < n; ++i)
+		sink += f(0xffffffff, data.data() + (i & 15), size);
+
+	const std::chrono::duration<double> duration =
+		steady_clock::now() - start;
+
+	/* prevent the compiler from optimizing the loop away */
+	if (sink == 1)
+		abort();
+
+	return n * size / duration.count() / 1e9;
+}
+
+int
+main(int, char **) noexcept
+{
+	std::vector<uint8_t> data(64 * 1024 + 16);
+	std::minstd_rand r;
+	for (auto &i : data)
+		i = r();
+
+	printf("hardware acceleration: %s\n\n",
+	       CRC32Detail::HaveHardware() ? "yes" : "no");
+
+	printf("%8s %10s %10s %10s   (GB/s)\n",
+	       "size", "bitwise", "slicing8", "fast");
+
+	for (std::size_t size : {16, 64, 256, 1500, 65536})
+		printf("%8zu %10.2f %10.2f %10.2f\n", size,
+		       Run([](uint32_t crc, const uint8_t *p, std::size_t n){
+			       return CRC32Detail::UpdateBitwise(crc, p, n);
+		       }, data, size),
+		       Run(CRC32Detail::UpdateSlicing8, data, size),
+		       Run(CRC32Detail::UpdateFast, data, size));
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares #HashRing with #MaglevHash: lookup speed, balance and
+ * the ratio of keys which are remapped when a node is removed or
+ * added.
+ */
+
+#include "util/HashRing.hxx"
+#include "util/MaglevHash.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+using std::chrono::steady_clock;
+
+static constexpr std::size_t N_NODES = 16;
+static constexpr std::size_t N_KEYS = 1000000;
+static constexpr std::size_t N_LOOKUPS = 20000000;
+
+struct Node {
+	unsigned id;
+};
+
+struct NodeHasher {
+	/* splitmix64 */
+	static constexpr uint64_t Mix(uint64_t x) noexcept {
+		x += 0x9e3779b97f4a7c15;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+		return x ^ (x >> 31);
+	}
+
+	uint64_t operator()(const Node &node, std::size_t replica) const noexcept {
+		return Mix((uint64_t(node.id) << 32) | replica);
+	}
+};
+
+using Ring = HashRing<const Node, uint64_t, 64 * 1024, 64>;
+using Maglev = MaglevHash<const Node, uint64_t, 65537>;
+
+/**
+ * @return nanoseconds per lookup
+ */
+template<typename T>
+static double
+BenchLookup(const T &t) noexcept
+{
+	std::minstd_rand r;
+	uintptr_t sink = 0;
+
+	const auto start = steady_clock::now();
+
+	for (std::size_t i = 0; i < N_LOOKUPS; ++i)
+		sink += reinterpret_cast<uintptr_t>(&t.Pick(NodeHasher::Mix(r())));
+
+	const std::chrono::duration<double, std::nano> duration =
+		steady_clock::now() - start;
+
+	/* prevent the compiler from optimizing the loop away */
+	if (sink == 1)
+		abort();
+
+	return duration.count() / N_LOOKUPS;
+}
+
+/**
+ * @return the ratio between the largest and the average number of
+ * keys per node
+ */
+template<typename T>
+static double
+Imbalance(const T &t, const std::vector<Node> &nodes) noexcept
+{
+	std::vector<std::size_t> n(N_NODES + 1);
+	for (std::size_t i = 0; i < N_KEYS; ++i)
+		++n[t.Pick(NodeHasher::Mix(i)).id];
+
+	return double(*std::max_element(n.begin(), n.end())) * nodes.size() / N_KEYS;
+}
+
+/**
+ * @return the ratio of keys which are mapped to different nodes
+ */
+template<typename T>
+static double
+RemapRatio(const T &a, const T &b) noexcept
+{
+	std::size_t moved = 0;
+	for (std::size_t i = 0; i < N_KEYS; ++i) {
+		const uint64_t h = NodeHasher::Mix(i);
+		if (a.Pick(h).id != b.Pick(h).id)
+			++moved;
+	}
+
+	return double(moved) / N_KEYS;
+}
+
+template<typename T>
+static void
+Run(const char *name)
+{
+	std::vector<Node> nodes, fewer, more;
+	for (unsigned i = 0; i < N_NODES; ++i)
+		nodes.push_back({i});
+
+	fewer = nodes;
+	fewer.erase(fewer.begin() + N_NODES / 2);
+
+	more = nodes;
+	more.push_back({N_NODES});
+
+	/* too large for the stack */
+	auto t = std::make_unique<T>();
+	auto t_fewer = std::make_unique<T>();
+	auto t_more = std::make_unique<T>();
+
+	const auto start = steady_clock::now();
+	t->Build(nodes, NodeHasher());
+	const std::chrono::duration<double, std::micro> build_duration =
+		steady_clock::now() - start;
+
+	t_fewer->Build(fewer, NodeHasher());
+	t_more->Build(more, NodeHasher());
+
+	printf("%-10s %10.0f %10.2f %10.3f %10.3f %10.3f\n", name,
+	       build_duration.count(),
+	       BenchLookup(*t),
+	       Imbalance(*t, nodes),
+	       RemapRatio(*t, *t_fewer),
+	       RemapRatio(*t, *t_more));
+}
+
+int
+main(int, char **) noexcept
+{
+	printf("%-10s %10s %10s %10s %10s %10s\n", "",
+	       "build[us]", "pick[ns]", "max/avg", "remove", "add");
+	printf("%-10s %10s %10s %10s %10.3f %10.3f\n", "(ideal)",
+	       "", "", "1.000",
+	       1. / N_NODES, 1. / (N_NODES + 1));
+
+	Run<Ring>("HashRing");
+	Run<Maglev>("Maglev");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Multi-threaded throughput benchmark for #ShardedCache, compared
+ * with a single shard (i.e. one #Cache protected by one mutex).
+ */
+
+#include "util/ShardedCache.hxx"
+#include "util/PrintException.hxx"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using std::chrono::steady_clock;
+
+static constexpr std::size_t CACHE_SIZE = 64 * 1024;
+static constexpr std::size_t N_KEYS = 2 * CACHE_SIZE;
+static constexpr std::size_t OPS_PER_THREAD = 1000000;
+
+template<std::size_t n_shards>
+using BenchCache = ShardedCache<std::size_t, std::size_t, CACHE_SIZE,
+				(CACHE_SIZE / n_shards) | 1, n_shards>;
+
+/**
+ * @param write_percent the percentage of operations which are
+ * Put() calls; the rest are Get() calls
+ * @return million operations per second
+ */
+template<typename C>
+static double
+Run(C &cache, unsigned n_threads, unsigned write_percent)
+{
+	cache.Clear();
+
+	std::atomic_bool go{false};
+	std::atomic_size_t sink{0};
+
+	std::vector<std::thread> threads;
+	threads.reserve(n_threads);
+
+	for (unsigned t = 0; t < n_threads; ++t) {
+		threads.emplace_back([&, t]{
+			std::minstd_rand r(t + 1);
+			std::size_t found = 0;
+
+			while (!go.load(std::memory_order_acquire)) {}
+
+			for (std::size_t i = 0; i < OPS_PER_THREAD; ++i) {
+				const std::size_t key = r() % N_KEYS;
+				if (r() % 100 < write_percent)
+					cache.Put(key, key);
+				else if (cache.Get(key))
+					++found;
+			}
+
+			sink += found;
+		});
+	}
+
+	const auto start = steady_clock::now();
+	go.store(true, std::memory_order_release);
+
+	for (auto &i : threads)
+		i.join();
+
+	const std::chrono::duration<double> duration =
+		steady_clock::now() - start;
+	return n_threads * OPS_PER_THREAD / duration.count() / 1e6;
+}
+
+int
+main(int argc, char **argv) noexcept
+try {
+	(void)argc;
+	(void)argv;
+
+	/* too large for the stack */
+	auto single = std::make_unique<BenchCache<1>>();
+	auto sharded = std::make_unique<BenchCache<64>>();
+
+	printf("%8s %10s %10s %10s %10s   (million ops/s)\n", "",
+	       "1 shard", "64 shards", "1 shard", "64 shards");
+	printf("%8s %21s %21s\n", "threads", "95% read", "50% read");
+
+	for (unsigned n_threads : {1, 2, 4, 8, 16, 32, 64})
+		printf("%8u %10.2f %10.2f %10.2f %10.2f\n", n_threads,
+		       Run(*single, n_threads, 5),
+		       Run(*sharded, n_threads, 5),
+		       Run(*single, n_threads, 50),
+		       Run(*sharded, n_threads, 50));
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -34,7 +34,58 @@
 
 #include <gtest/gtest.h>
 
+#include <array>
+#include <random>
+
 TEST(CRC32, Basic)
 {
 	EXPECT_EQ(CRC32{}.Update({"123456789", 9}).Finish(), 0xcbf43926);
 }
+
+TEST(CRC32, Constexpr)
+{
+	static constexpr std::array<uint8_t, 9> data{
+		'1', '2', '3', '4', '5', '6', '7', '8', '9',
+	};
+
+	static_assert(CRC32{}.Update(ConstBuffer<uint8_t>{data.data(), data.size()}).Finish() == 0xcbf43926);
+}
+
+TEST(CRC32, Implementations)
+{
+	std::array<uint8_t, 4096 + 16> data;
+	std::minstd_rand r;
+	for (auto &i : data)
+		i = r();
+
+	for (std::size_t offset = 0; offset < 16; ++offset) {
+		for (std::size_t size = 0; size <= 4096;
+		     size = size < 300 ? size + 1 : size * 2) {
+			const uint8_t *p = data.data() + offset;
+			const uint32_t expected =
+				CRC32Detail::UpdateBitwise(0xffffffff, p, size);
+
+			EXPECT_EQ(CRC32Detail::UpdateSlicing8(0xffffffff, p, size),
+				  expected);
+			EXPECT_EQ(CRC32Detail::UpdateFast(0xffffffff, p, size),
+				  expected);
+		}
+	}
+}
+
+TEST(CRC32, Incremental)
+{
+	std::array<uint8_t, 1000> data;
+	std::minstd_rand r;
+	for (auto &i : data)
+		i = r();
+
+	using Buffer = ConstBuffer<uint8_t>;
+	const auto expected = CRC32{}.Update(Buffer{data.data(), data.size()}).Finish();
+
+	CRC32 crc;
+	crc.Update(Buffer{data.data(), 1});
+	crc.Update(Buffer{data.data() + 1, 99});
+	crc.Update(Buffer{data.data() + 100, 900});
+	EXPECT_EQ(crc.Finish(), expected);
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Cache.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+using LRU = Cache<unsigned, unsigned, 100, 61>;
+using TinyLFU = Cache<unsigned, unsigned, 100, 61,
+		      std::hash<unsigned>, std::equal_to<unsigned>,
+		      TinyLFUCachePolicy<>>;
+
+template<typename C>
+static std::size_t
+Count(const C &cache) noexcept
+{
+	std::size_t n = 0;
+	cache.ForEach([&n](unsigned, unsigned){ ++n; });
+	return n;
+}
+
+/**
+ * Look up the key and insert it on a miss.
+ *
+ * @return true on a hit
+ */
+template<typename C>
+static bool
+Access(C &cache, unsigned key)
+{
+	if (const auto *data = cache.Get(key)) {
+		EXPECT_EQ(*data, key);
+		return true;
+	}
+
+	cache.Put(key, key);
+	return false;
+}
+
+template<typename C>
+static void
+TestBasic()
+{
+	C cache;
+	ASSERT_TRUE(cache.IsEmpty());
+	ASSERT_EQ(cache.Get(1U), nullptr);
+
+	for (unsigned i = 0; i < 100; ++i)
+		cache.Put(i, i);
+
+	ASSERT_TRUE(cache.IsFull());
+	ASSERT_EQ(Count(cache), 100U);
+
+	for (unsigned i = 0; i < 100; ++i) {
+		ASSERT_NE(cache.Get(i), nullptr);
+		ASSERT_EQ(*cache.Get(i), i);
+	}
+
+	/* a full cache stays full */
+	for (unsigned i = 100; i < 200; ++i)
+		cache.PutOrReplace(i, i);
+
+	ASSERT_TRUE(cache.IsFull());
+	ASSERT_EQ(Count(cache), 100U);
+
+	cache.PutOrReplace(1000U, 1U);
+	cache.PutOrReplace(1000U, 2U);
+	ASSERT_EQ(*cache.Get(1000U), 2U);
+
+	cache.Remove(1000U);
+	ASSERT_EQ(cache.Get(1000U), nullptr);
+	ASSERT_FALSE(cache.IsFull());
+	ASSERT_EQ(Count(cache), 99U);
+
+	cache.RemoveIf([](unsigned key, unsigned){ return key % 2 == 0; });
+	cache.ForEach([](unsigned key, unsigned){
+		ASSERT_NE(key % 2, 0U);
+	});
+
+	/* refill */
+	for (unsigned i = 2000; i < 2200; ++i)
+		cache.Put(i, i);
+
+	ASSERT_TRUE(cache.IsFull());
+	ASSERT_EQ(Count(cache), 100U);
+
+	cache.Clear();
+	ASSERT_TRUE(cache.IsEmpty());
+	ASSERT_EQ(Count(cache), 0U);
+}
+
+TEST(Cache, LRU)
+{
+	TestBasic<LRU>();
+
+	LRU cache;
+	for (unsigned i = 0; i < 100; ++i)
+		cache.Put(i, i);
+
+	/* touch item 0, which makes item 1 the oldest */
+	ASSERT_NE(cache.Get(0U), nullptr);
+	cache.Put(100U, 100U);
+	ASSERT_NE(cache.Get(0U), nullptr);
+	ASSERT_EQ(cache.Get(1U), nullptr);
+}
+
+TEST(Cache, TinyLFU)
+{
+	TestBasic<TinyLFU>();
+}
+
+template<typename C>
+static void
+TestExpiry()
+{
+	using namespace std::chrono_literals;
+
+	C cache;
+
+	const auto now = Expiry::Now();
+	cache.Put(1U, 1U);
+	cache.Put(2U, 2U, Expiry::Touched(now, 1min));
+	cache.Put(3U, 3U, Expiry::Touched(now, 2min));
+	cache.Put(4U, 4U, Expiry::AlreadyExpired());
+
+	ASSERT_NE(cache.Get(1U), nullptr);
+	ASSERT_NE(cache.Get(2U), nullptr);
+	ASSERT_NE(cache.Get(3U), nullptr);
+	ASSERT_EQ(cache.Get(4U), nullptr);
+	ASSERT_EQ(Count(cache), 3U);
+
+	/* lazy expiry */
+	ASSERT_EQ(cache.Get(2U, Expiry::Touched(now, 90s)), nullptr);
+	ASSERT_EQ(Count(cache), 2U);
+
+	cache.PutOrReplace(1U, 10U, Expiry::Touched(now, 1min));
+	ASSERT_EQ(*cache.Get(1U, now), 10U);
+
+	/* batched purge */
+	ASSERT_EQ(cache.PurgeExpired(Expiry::Touched(now, 10min)), 2U);
+	ASSERT_TRUE(cache.IsEmpty());
+}
+
+TEST(Cache, Expiry)
+{
+	TestExpiry<LRU>();
+	TestExpiry<TinyLFU>();
+}
+
+template<typename C>
+static void
+TestWeight()
+{
+	C cache;
+	cache.SetMaxWeight(1000);
+
+	for (unsigned i = 0; i < 10; ++i)
+		cache.Put(i, i, Expiry::Never(), 100);
+
+	ASSERT_EQ(cache.GetWeight(), 1000U);
+	ASSERT_EQ(Count(cache), 10U);
+
+	/* a heavy item evicts several others */
+	cache.Put(100U, 100U, Expiry::Never(), 250);
+	ASSERT_LE(cache.GetWeight(), 1000U);
+	ASSERT_EQ(Count(cache), 8U);
+	ASSERT_NE(cache.Get(100U), nullptr);
+
+	/* changing the weight of an existing item */
+	cache.PutOrReplace(100U, 101U, Expiry::Never(), 50);
+	ASSERT_EQ(*cache.Get(100U), 101U);
+	ASSERT_EQ(cache.GetWeight(), 750U);
+
+	/* an item heavier than the limit is refused and doesn't
+	   evict anything */
+	ASSERT_EQ(cache.Put(200U, 200U, Expiry::Never(), 1001), nullptr);
+	ASSERT_EQ(cache.Get(200U), nullptr);
+	ASSERT_EQ(cache.GetWeight(), 750U);
+	ASSERT_EQ(cache.GetStats().rejected, 1U);
+
+	/* replacing an item with one which is too heavy removes
+	   the stale old one */
+	ASSERT_EQ(cache.PutOrReplace(100U, 102U, Expiry::Never(), 1001),
+		  nullptr);
+	ASSERT_EQ(cache.Get(100U), nullptr);
+	ASSERT_EQ(cache.GetWeight(), 700U);
+	ASSERT_EQ(cache.GetStats().rejected, 2U);
+	cache.Put(100U, 101U, Expiry::Never(), 50);
+
+	/* shrinking the limit evicts immediately */
+	cache.SetMaxWeight(300);
+	ASSERT_LE(cache.GetWeight(), 300U);
+
+	cache.Remove(100U);
+	cache.RemoveIf([](unsigned, unsigned){ return true; });
+	ASSERT_TRUE(cache.IsEmpty());
+	ASSERT_EQ(cache.GetWeight(), 0U);
+
+	/* the item count limit still applies */
+	cache.SetMaxWeight(1000000);
+	for (unsigned i = 0; i < 200; ++i)
+		cache.Put(i, i, Expiry::Never(), 10);
+	ASSERT_EQ(Count(cache), 100U);
+	ASSERT_EQ(cache.GetWeight(), 1000U);
+}
+
+TEST(Cache, Weight)
+{
+	TestWeight<LRU>();
+	TestWeight<TinyLFU>();
+}
+
+TEST(Cache, Stats)
+{
+	LRU cache;
+
+	for (unsigned i = 0; i < 150; ++i)
+		cache.Put(i, i);
+
+	ASSERT_EQ(cache.Get(0U), nullptr);
+	ASSERT_NE(cache.Get(149U), nullptr);
+	ASSERT_NE(cache.Get(100U), nullptr);
+
+	cache.Put(1000U, 0U, Expiry::AlreadyExpired());
+	ASSERT_EQ(cache.Get(1000U), nullptr);
+
+	const auto &stats = cache.GetStats();
+	ASSERT_EQ(stats.hits, 2U);
+	ASSERT_EQ(stats.misses, 2U);
+	ASSERT_EQ(stats.insertions, 151U);
+	ASSERT_EQ(stats.evictions, 51U);
+	ASSERT_EQ(stats.expired, 1U);
+
+	std::size_t n_chained = 0, size = 0;
+	cache.VisitStats([&](const char *name, const auto &value){
+		using T = std::decay_t<decltype(value)>;
+		if constexpr (std::is_same_v<T, CacheChainLengths>) {
+			for (std::size_t i = 1; i < value.size(); ++i)
+				n_chained += value[i];
+		} else if (std::string_view{name} == "size")
+			size = value;
+	});
+
+	ASSERT_EQ(size, 99U);
+
+	/* 99 items in 61 buckets: at least 38 buckets are used */
+	ASSERT_GE(n_chained, 38U);
+}
+
+/**
+ * Generate a trace of keys following a Zipf distribution.
+ */
+static std::vector<unsigned>
+MakeZipfTrace(unsigned n_keys, std::size_t length, double s)
+{
+	std::vector<double> weights;
+	weights.reserve(n_keys);
+	for (unsigned i = 1; i <= n_keys; ++i)
+		weights.push_back(1.0 / std::pow(i, s));
+
+	std::mt19937 rng(42);
+	std::discrete_distribution<unsigned> dist(weights.begin(),
+						  weights.end());
+
+	std::vector<unsigned> trace;
+	trace.reserve(length);
+	for (std::size_t i = 0; i < length; ++i)
+		trace.push_back(dist(rng));
+
+	return trace;
+}
+
+template<typename C>
+static std::size_t
+CountHits(C &cache, const std::vector<unsigned> &trace)
+{
+	std::size_t hits = 0;
+	for (const unsigned key : trace)
+		hits += Access(cache, key);
+	return hits;
+}
+
+TEST(Cache, ZipfHitRatio)
+{
+	const auto trace = MakeZipfTrace(10000, 200000, 0.9);
+
+	LRU lru;
+	TinyLFU tiny_lfu;
+
+	const auto lru_hits = CountHits(lru, trace);
+	const auto tiny_lfu_hits = CountHits(tiny_lfu, trace);
+
+	EXPECT_GT(tiny_lfu_hits, lru_hits + lru_hits / 10);
+}
+
+TEST(Cache, ScanResistance)
+{
+	/* a hot set which fits into the cache, interleaved with a
+	   long scan of keys which are used only once */
+	std::vector<unsigned> trace;
+	for (unsigned round = 0; round < 20; ++round)
+		for (unsigned key = 0; key < 50; ++key)
+			trace.push_back(key);
+
+	unsigned scan_key = 1000;
+	for (unsigned round = 0; round < 100; ++round) {
+		for (unsigned key = 0; key < 50; ++key)
+			trace.push_back(key);
+		for (unsigned i = 0; i < 200; ++i)
+			trace.push_back(scan_key++);
+	}
+
+	LRU lru;
+	TinyLFU tiny_lfu;
+
+	const auto lru_hits = CountHits(lru, trace);
+	const auto tiny_lfu_hits = CountHits(tiny_lfu, trace);
+
+	/* the hot set is flushed by each scan burst in the LRU
+	   cache, but survives with TinyLFU */
+	EXPECT_LE(lru_hits, 19U * 50U + 50U);
+	EXPECT_GE(tiny_lfu_hits, 19U * 50U + 99U * 50U);
+
+	for (unsigned key = 0; key < 50; ++key)
+		EXPECT_NE(tiny_lfu.Get(key), nullptr);
+}
@@ -34,6 +34,9 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdint>
+#include <memory>
+
 TEST(HashRingTest, NoReplicas)
 {
 	struct Node {
@@ -120,3 +123,116 @@ TEST(HashRingTest, OneReplica)
 	ASSERT_EQ(&hr.FindNext(14).second, &nodes[1]);
 	ASSERT_EQ(&hr.FindNext(15).second, &nodes[1]);
 }
+
+namespace {
+
+struct WeightedNode {
+	unsigned id, weight;
+	std::size_t load = 0;
+};
+
+struct MixHasher {
+	/* splitmix64 */
+	static constexpr uint64_t Mix(uint64_t x) noexcept {
+		x += 0x9e3779b97f4a7c15;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+		return x ^ (x >> 31);
+	}
+
+	uint64_t operator()(const WeightedNode &node, size_t replica) const {
+		return Mix((uint64_t(node.id) << 32) | replica);
+	}
+};
+
+} // anonymous namespace
+
+TEST(HashRingTest, Weighted)
+{
+	static constexpr size_t N_BUCKETS = 64 * 1024;
+	using Ring = HashRing<WeightedNode, uint64_t, N_BUCKETS, 64>;
+	auto hr = std::make_unique<Ring>();
+
+	std::array<WeightedNode, 4> nodes{{{1, 1}, {2, 3}, {3, 0}, {4, 1}}};
+	hr->Build(nodes, MixHasher(), [](const WeightedNode &node){
+		return node.weight;
+	});
+
+	std::array<size_t, 4> n{};
+	for (size_t i = 0; i < N_BUCKETS; ++i)
+		++n[&hr->Pick(i) - nodes.data()];
+
+	/* weight 0 gets nothing, weight 3 gets roughly 3/5 */
+	ASSERT_EQ(n[2], 0U);
+	ASSERT_GT(n[1], N_BUCKETS / 2);
+	ASSERT_LT(n[1], N_BUCKETS * 7 / 10);
+	ASSERT_GT(n[0], N_BUCKETS / 10);
+	ASSERT_GT(n[3], N_BUCKETS / 10);
+}
+
+TEST(HashRingTest, BoundedLoads)
+{
+	using Ring = HashRing<WeightedNode, uint64_t, 4096, 16>;
+	auto hr = std::make_unique<Ring>();
+
+	std::array<WeightedNode, 4> nodes{{{1, 1}, {2, 1}, {3, 1}, {4, 1}}};
+	hr->Build(nodes, MixHasher());
+
+	const auto get_load = [](const WeightedNode &node){
+		return node.load;
+	};
+
+	/* one hot key: without the bound, all requests would go to
+	   one node */
+
+	std::size_t total_load = 0;
+	auto &home = hr->Pick(42);
+	for (unsigned i = 0; i < 100; ++i) {
+		auto &node = hr->PickBounded(42, get_load, total_load, 0.25);
+		if (i == 0) {
+			ASSERT_EQ(&node, &home);
+		}
+
+		++node.load;
+		++total_load;
+	}
+
+	/* the home node takes as much as allowed, the excess
+	   spills over to the following nodes */
+	ASSERT_GE(home.load, 30U);
+
+	for (const auto &node : nodes)
+		ASSERT_LE(node.load, 32U);
+}
+
+TEST(HashRingTest, BoundedLoadsWeighted)
+{
+	using Ring = HashRing<WeightedNode, uint64_t, 4096, 16>;
+	auto hr = std::make_unique<Ring>();
+
+	std::array<WeightedNode, 3> nodes{{{1, 1}, {2, 3}, {3, 0}}};
+	const auto get_weight = [](const WeightedNode &node){
+		return node.weight;
+	};
+	hr->Build(nodes, MixHasher(), get_weight);
+
+	const auto get_load = [](const WeightedNode &node){
+		return node.load;
+	};
+
+	/* many different keys, but the capacity of each node is
+	   proportional to its weight */
+
+	std::size_t total_load = 0;
+	for (unsigned i = 0; i < 400; ++i) {
+		auto &node = hr->PickBounded(i % 4, get_load, total_load,
+					     0.25, get_weight);
+		++node.load;
+		++total_load;
+	}
+
+	ASSERT_EQ(nodes[2].load, 0U);
+	ASSERT_LE(nodes[0].load, 126U);
+	ASSERT_LE(nodes[1].load, 376U);
+	ASSERT_GT(nodes[1].load, nodes[0].load);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/MaglevHash.hxx"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace {
+
+struct Node {
+	unsigned id, weight = 1;
+};
+
+struct NodeHasher {
+	/* splitmix64 */
+	static constexpr uint64_t Mix(uint64_t x) noexcept {
+		x += 0x9e3779b97f4a7c15;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+		return x ^ (x >> 31);
+	}
+
+	uint64_t operator()(const Node &node, size_t seed) const {
+		return Mix((uint64_t(node.id) << 32) | seed);
+	}
+};
+
+static constexpr size_t TABLE_SIZE = 65537;
+using Table = MaglevHash<const Node, uint64_t, TABLE_SIZE>;
+
+} // anonymous namespace
+
+TEST(MaglevHash, Balanced)
+{
+	std::vector<Node> nodes;
+	for (unsigned i = 0; i < 10; ++i)
+		nodes.push_back({i});
+
+	auto t = std::make_unique<Table>();
+	t->Build(nodes, NodeHasher());
+
+	std::vector<size_t> n(nodes.size());
+	for (size_t i = 0; i < TABLE_SIZE; ++i)
+		++n[&t->Pick(i) - nodes.data()];
+
+	/* each node gets almost exactly its share */
+	for (const auto i : n) {
+		ASSERT_GE(i, TABLE_SIZE / 10 - 1);
+		ASSERT_LE(i, TABLE_SIZE / 10 + 1);
+	}
+}
+
+TEST(MaglevHash, Weighted)
+{
+	std::vector<Node> nodes{{1, 1}, {2, 2}, {3, 0}, {4, 1}};
+
+	auto t = std::make_unique<Table>();
+	t->Build(nodes, NodeHasher(), [](const Node &node){
+		return node.weight;
+	});
+
+	std::vector<size_t> n(nodes.size());
+	for (size_t i = 0; i < TABLE_SIZE; ++i)
+		++n[&t->Pick(i) - nodes.data()];
+
+	ASSERT_EQ(n[2], 0U);
+	ASSERT_NEAR(double(n[1]) / TABLE_SIZE, 0.5, 0.01);
+	ASSERT_NEAR(double(n[0]) / TABLE_SIZE, 0.25, 0.01);
+	ASSERT_NEAR(double(n[3]) / TABLE_SIZE, 0.25, 0.01);
+}
+
+TEST(MaglevHash, Remove)
+{
+	std::vector<Node> nodes;
+	for (unsigned i = 0; i < 10; ++i)
+		nodes.push_back({i});
+
+	auto a = std::make_unique<Table>();
+	a->Build(nodes, NodeHasher());
+
+	/* remove one node */
+	auto b = std::make_unique<Table>();
+	b->Build(nodes, NodeHasher(), [](const Node &node) -> size_t {
+		return node.id != 3;
+	});
+
+	size_t moved = 0;
+	for (size_t i = 0; i < TABLE_SIZE; ++i) {
+		const auto &x = a->Pick(i), &y = b->Pick(i);
+		if (x.id == 3)
+			ASSERT_NE(y.id, 3U);
+		else if (&x != &y)
+			++moved;
+	}
+
+	/* only few keys of the other nodes have moved */
+	ASSERT_LT(moved, TABLE_SIZE / 20);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2007-2021 CM4all GmbH
+ * All rights reserved.
+ *
+ * author: Max Kellermann <mk@cm4all.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * FOUNDATION OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/ShardedCache.hxx"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using TestCache = ShardedCache<unsigned, unsigned, 1024, 67, 8>;
+
+TEST(ShardedCache, Basic)
+{
+	auto cache = std::make_unique<TestCache>();
+
+	ASSERT_FALSE(cache->Get(1U));
+
+	for (unsigned i = 0; i < 100; ++i)
+		cache->Put(i, i * 2);
+
+	for (unsigned i = 0; i < 100; ++i)
+		ASSERT_EQ(cache->Get(i), i * 2);
+
+	/* Put() replaces existing items */
+	cache->Put(1U, 42U);
+	ASSERT_EQ(cache->Get(1U), 42U);
+
+	unsigned value = 0;
+	ASSERT_TRUE(cache->Visit(2U, [&value](unsigned &v){ value = v; }));
+	ASSERT_EQ(value, 4U);
+
+	cache->Remove(1U);
+	ASSERT_FALSE(cache->Get(1U));
+
+	cache->RemoveIf([](unsigned key, unsigned){ return key % 2 == 0; });
+	ASSERT_FALSE(cache->Get(2U));
+	ASSERT_EQ(cache->Get(3U), 6U);
+
+	cache->Put(1000U, 1U, Expiry::AlreadyExpired());
+	ASSERT_FALSE(cache->Get(1000U));
+
+	const auto stats = cache->GetStats();
+	ASSERT_EQ(stats.expired, 1U);
+	ASSERT_EQ(stats.insertions, 101U);
+
+	cache->Clear();
+	ASSERT_FALSE(cache->Get(3U));
+}
+
+TEST(ShardedCache, Threads)
+{
+	auto cache = std::make_unique<TestCache>();
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < 4; ++t) {
+		threads.emplace_back([&cache, t]{
+			for (unsigned i = 0; i < 10000; ++i) {
+				const unsigned key = (i * 7 + t) % 2000;
+				if (auto value = cache->Get(key))
+					ASSERT_EQ(*value, key);
+				else
+					cache->Put(key, key);
+			}
+		});
+	}
+
+	for (auto &i : threads)
+		i.join();
+
+	const auto stats = cache->GetStats();
+	ASSERT_EQ(stats.hits + stats.misses, 40000U);
+	ASSERT_GT(stats.hits, 0U);
+}